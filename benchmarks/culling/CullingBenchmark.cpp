@@ -0,0 +1,111 @@
+/*
+ * Proland: a procedural landscape rendering library.
+ * Website : http://proland.inrialpes.fr/
+ * Copyright (c) 2008-2015 INRIA - LJK (CNRS - Grenoble University)
+ * All rights reserved.
+ * Redistribution and use in source and binary forms, with or without 
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice, 
+ * this list of conditions and the following disclaimer.
+ * 
+ * 2. Redistributions in binary form must reproduce the above copyright notice, 
+ * this list of conditions and the following disclaimer in the documentation 
+ * and/or other materials provided with the distribution.
+ * 
+ * 3. Neither the name of the copyright holder nor the names of its contributors 
+ * may be used to endorse or promote products derived from this software without 
+ * specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND 
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED 
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. 
+ * IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, 
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, 
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, 
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF 
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE 
+ * OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED 
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+/*
+ * Proland is distributed under the Berkeley Software Distribution 3 Licence. 
+ * For any assistance, feedback and enquiries about training programs, you can check out the 
+ * contact page on our website : 
+ * http://proland.inrialpes.fr/
+ */
+/*
+ * Main authors: Eric Bruneton, Antoine Begault, Guillaume Piolat.
+ */
+
+/*
+ * A benchmark of the culling kernels used to update the terrain quadtree
+ * (see proland::getFrustumVisibility, proland::getSphericalVisibility,
+ * proland::isBelowHorizon and proland::raiseHorizon). For each instruction
+ * set available on this CPU, it measures the time needed to test a box (or
+ * to test and raise a horizon line), for random boxes around random
+ * viewers. The results are printed in CSV format. The results themselves
+ * are checked by culling-test.
+ *
+ * Usage: culling-bench [iterations]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <algorithm>
+#include <vector>
+
+#include "ork/core/Timer.h"
+#include "CullingScene.h"
+
+int main(int argc, char *argv[])
+{
+    int iterations = argc > 1 ? max(1, atoi(argv[1])) : 200;
+
+    srand(1234);
+    Scene scene(6360000.0);
+    scene.generate();
+    vector<SceneManager::visibility> result(BOXES);
+    vector<float> horizon(HORIZON_SIZE);
+    for (int i = 0; i < HORIZON_SIZE; ++i) {
+        horizon[i] = float(random(-1.0, 1.0));
+    }
+
+    printf("kernel,isa,time(ns),boxes/s,speedup\n");
+    for (int kernel = 0; kernel < 3; ++kernel) {
+        const char *name = kernel == 0 ? "flat" : (kernel == 1 ? "spherical" : "horizon");
+        double scalarTime = 0.0;
+        for (int isa = CULLING_SCALAR; isa <= CULLING_AVX; ++isa) {
+            if (!isCullingIsaAvailable(CullingIsa(isa))) {
+                continue;
+            }
+            Timer timer;
+            timer.start();
+            for (int i = 0; i < iterations; ++i) {
+                if (kernel == 0) {
+                    getFrustumVisibility(scene.planes, BOXES, scene.boxes, &result[0], CullingIsa(isa));
+                } else if (kernel == 1) {
+                    getSphericalVisibility(scene.R, scene.camera, scene.planes, BOXES, scene.boxes, &result[0], CullingIsa(isa));
+                } else {
+                    for (int j = 0; j < BOXES; ++j) {
+                        int imin = j % 64;
+                        int imax = imin + 32 + j % 128;
+                        float z = scene.coords[4][j] * 0.01f;
+                        if (!isBelowHorizon(&horizon[0], imin, imax, z, CullingIsa(isa))) {
+                            raiseHorizon(&horizon[0], imin, imax, z, CullingIsa(isa));
+                        }
+                    }
+                }
+            }
+            double time = timer.end() * 1000.0 / (double(iterations) * BOXES);
+            if (isa == CULLING_SCALAR) {
+                scalarTime = time;
+            }
+            printf("%s,%s,%.2f,%.0f,%.2f\n", name, getCullingIsaName(CullingIsa(isa)),
+                time, 1e9 / time, scalarTime / time);
+            fflush(stdout);
+        }
+    }
+    return 0;
+}
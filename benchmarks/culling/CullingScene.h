@@ -0,0 +1,119 @@
+/*
+ * Proland: a procedural landscape rendering library.
+ * Website : http://proland.inrialpes.fr/
+ * Copyright (c) 2008-2015 INRIA - LJK (CNRS - Grenoble University)
+ * All rights reserved.
+ * Redistribution and use in source and binary forms, with or without 
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice, 
+ * this list of conditions and the following disclaimer.
+ * 
+ * 2. Redistributions in binary form must reproduce the above copyright notice, 
+ * this list of conditions and the following disclaimer in the documentation 
+ * and/or other materials provided with the distribution.
+ * 
+ * 3. Neither the name of the copyright holder nor the names of its contributors 
+ * may be used to endorse or promote products derived from this software without 
+ * specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND 
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED 
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. 
+ * IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, 
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, 
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, 
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF 
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE 
+ * OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED 
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+/*
+ * Proland is distributed under the Berkeley Software Distribution 3 Licence. 
+ * For any assistance, feedback and enquiries about training programs, you can check out the 
+ * contact page on our website : 
+ * http://proland.inrialpes.fr/
+ */
+/*
+ * Main authors: Eric Bruneton, Antoine Begault, Guillaume Piolat.
+ */
+
+/*
+ * The random scenes used by culling-bench and culling-test.
+ */
+
+#ifndef _PROLAND_CULLING_SCENE_H_
+#define _PROLAND_CULLING_SCENE_H_
+
+#include <stdlib.h>
+#include <math.h>
+#include <vector>
+
+#include "proland/math/culling.h"
+
+using namespace std;
+using namespace ork;
+using namespace proland;
+
+#define BOXES 4096
+
+#define HORIZON_SIZE 256
+
+static inline double random(double a, double b)
+{
+    return a + (b - a) * (rand() / double(RAND_MAX));
+}
+
+/**
+ * A set of random boxes, in SoA layout, and of random view frustums.
+ */
+struct Scene
+{
+    double R;
+
+    vec3d camera;
+
+    vec4d planes[5];
+
+    vector<double> coords[6];
+
+    BoxBatch boxes;
+
+    Scene(double R) : R(R)
+    {
+        for (int i = 0; i < 6; ++i) {
+            coords[i].resize(BOXES);
+        }
+        BoxBatch b = { &coords[0][0], &coords[1][0], &coords[2][0], &coords[3][0], &coords[4][0], &coords[5][0] };
+        boxes = b;
+    }
+
+    /**
+     * Generates a viewer looking at the ground, and quadtree like boxes of
+     * various sizes around it, so that all the visibility cases occur.
+     */
+    void generate()
+    {
+        camera = vec3d(random(-1e5, 1e5), random(-1e5, 1e5), R + random(1.0, 2e4));
+        vec3d forward = vec3d(random(-1.0, 1.0), random(-1.0, 1.0), random(-1.0, 0.2));
+        for (int j = 0; j < 5; ++j) {
+            vec3d n = forward + vec3d(random(-1.0, 1.0), random(-1.0, 1.0), random(-1.0, 1.0));
+            planes[j] = vec4d(n.x, n.y, n.z, -(n.x * camera.x + n.y * camera.y + n.z * camera.z));
+        }
+        for (int i = 0; i < BOXES; ++i) {
+            double l = pow(2.0, -random(0.0, 16.0)) * 2.0 * R;
+            double x = camera.x + random(-4.0 * l, 4.0 * l);
+            double y = camera.y + random(-4.0 * l, 4.0 * l);
+            double z = random(-100.0, 100.0);
+            coords[0][i] = x;
+            coords[1][i] = x + l;
+            coords[2][i] = y;
+            coords[3][i] = y + l;
+            coords[4][i] = z;
+            coords[5][i] = z + random(0.0, 3000.0);
+        }
+    }
+};
+
+#endif
@@ -0,0 +1,114 @@
+/*
+ * Proland: a procedural landscape rendering library.
+ * Website : http://proland.inrialpes.fr/
+ * Copyright (c) 2008-2015 INRIA - LJK (CNRS - Grenoble University)
+ * All rights reserved.
+ * Redistribution and use in source and binary forms, with or without 
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice, 
+ * this list of conditions and the following disclaimer.
+ * 
+ * 2. Redistributions in binary form must reproduce the above copyright notice, 
+ * this list of conditions and the following disclaimer in the documentation 
+ * and/or other materials provided with the distribution.
+ * 
+ * 3. Neither the name of the copyright holder nor the names of its contributors 
+ * may be used to endorse or promote products derived from this software without 
+ * specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND 
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED 
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. 
+ * IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, 
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, 
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, 
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF 
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE 
+ * OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED 
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+/*
+ * Proland is distributed under the Berkeley Software Distribution 3 Licence. 
+ * For any assistance, feedback and enquiries about training programs, you can check out the 
+ * contact page on our website : 
+ * http://proland.inrialpes.fr/
+ */
+/*
+ * Main authors: Eric Bruneton, Antoine Begault, Guillaume Piolat.
+ */
+
+/*
+ * A test of the culling kernels used to update the terrain quadtree (see
+ * proland::getFrustumVisibility, proland::getSphericalVisibility,
+ * proland::isBelowHorizon and proland::raiseHorizon). For each instruction
+ * set available on this CPU, it checks that the results are identical to
+ * the results of the scalar reference kernels, for random boxes around
+ * random viewers. The exit code is 1 if some results differ from the
+ * reference.
+ *
+ * Usage: culling-test
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <vector>
+
+#include "CullingScene.h"
+
+int main()
+{
+    bool exact = true;
+
+    Scene scene(6360000.0);
+    vector<SceneManager::visibility> reference(BOXES);
+    vector<SceneManager::visibility> result(BOXES);
+    vector<float> referenceHorizon(HORIZON_SIZE);
+    vector<float> horizon(HORIZON_SIZE);
+
+    printf("kernel,isa,result\n");
+    for (int kernel = 0; kernel < 3; ++kernel) {
+        const char *name = kernel == 0 ? "flat" : (kernel == 1 ? "spherical" : "horizon");
+        for (int isa = CULLING_SCALAR; isa <= CULLING_AVX; ++isa) {
+            if (!isCullingIsaAvailable(CullingIsa(isa))) {
+                continue;
+            }
+            // checks the results for several scenes (and for several batch
+            // sizes, to check the remainders)
+            bool same = true;
+            srand(1234);
+            for (int s = 0; s < 16 && same; ++s) {
+                scene.generate();
+                int n = BOXES - s;
+                if (kernel == 0) {
+                    getFrustumVisibility(scene.planes, n, scene.boxes, &reference[0], CULLING_SCALAR);
+                    getFrustumVisibility(scene.planes, n, scene.boxes, &result[0], CullingIsa(isa));
+                } else if (kernel == 1) {
+                    getSphericalVisibility(scene.R, scene.camera, scene.planes, n, scene.boxes, &reference[0], CULLING_SCALAR);
+                    getSphericalVisibility(scene.R, scene.camera, scene.planes, n, scene.boxes, &result[0], CullingIsa(isa));
+                } else {
+                    for (int i = 0; i < HORIZON_SIZE; ++i) {
+                        referenceHorizon[i] = horizon[i] = float(random(-1.0, 1.0));
+                    }
+                    for (int i = 0; i < n; ++i) {
+                        int imin = max(rand() % (HORIZON_SIZE + 40) - 20, 0);
+                        int imax = min(rand() % (HORIZON_SIZE + 40) - 20, HORIZON_SIZE - 1);
+                        float z = float(random(-1.2, 1.2));
+                        reference[i] = isBelowHorizon(&referenceHorizon[0], imin, imax, z, CULLING_SCALAR) ? SceneManager::INVISIBLE : SceneManager::FULLY_VISIBLE;
+                        result[i] = isBelowHorizon(&horizon[0], imin, imax, z, CullingIsa(isa)) ? SceneManager::INVISIBLE : SceneManager::FULLY_VISIBLE;
+                        raiseHorizon(&referenceHorizon[0], imin, imax, z, CULLING_SCALAR);
+                        raiseHorizon(&horizon[0], imin, imax, z, CullingIsa(isa));
+                    }
+                    same = memcmp(&referenceHorizon[0], &horizon[0], HORIZON_SIZE * sizeof(float)) == 0;
+                }
+                same = same && memcmp(&reference[0], &result[0], n * sizeof(SceneManager::visibility)) == 0;
+            }
+            exact = exact && same;
+            printf("%s,%s,%s\n", name, getCullingIsaName(CullingIsa(isa)), same ? "ok" : "FAILED");
+        }
+    }
+    return exact ? 0 : 1;
+}
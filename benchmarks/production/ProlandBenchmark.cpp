@@ -0,0 +1,538 @@
+/*
+ * Proland: a procedural landscape rendering library.
+ * Website : http://proland.inrialpes.fr/
+ * Copyright (c) 2008-2015 INRIA - LJK (CNRS - Grenoble University)
+ * All rights reserved.
+ * Redistribution and use in source and binary forms, with or without 
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice, 
+ * this list of conditions and the following disclaimer.
+ * 
+ * 2. Redistributions in binary form must reproduce the above copyright notice, 
+ * this list of conditions and the following disclaimer in the documentation 
+ * and/or other materials provided with the distribution.
+ * 
+ * 3. Neither the name of the copyright holder nor the names of its contributors 
+ * may be used to endorse or promote products derived from this software without 
+ * specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND 
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED 
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. 
+ * IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, 
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, 
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, 
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF 
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE 
+ * OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED 
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+/*
+ * Proland is distributed under the Berkeley Software Distribution 3 Licence. 
+ * For any assistance, feedback and enquiries about training programs, you can check out the 
+ * contact page on our website : 
+ * http://proland.inrialpes.fr/
+ */
+/*
+ * Main authors: Eric Bruneton, Antoine Begault, Guillaume Piolat.
+ */
+
+/*
+ * A headless benchmark of the CPU tile producers. It builds a TerrainNode and
+ * its TerrainQuad hierarchy from a generated archive, and moves a camera along
+ * scripted paths (a flyover at low altitude, an orbit around the terrain
+ * center, and a descent from high altitude). At each frame the terrain
+ * quadtree is updated with TerrainNode#update (without any OpenGL context),
+ * and the tiles of all the visible quads are requested with
+ * TileProducer#getTile from a ResidualProducer, a CPUElevationProducer, an
+ * OrthoCPUProducer, and optionally a GraphProducer. The tiles of the previous
+ * frame are then released, as TileSampler would do. TileSampler itself is not
+ * used because it requires a GPUTileStorage.
+ *
+ * The input data is generated procedurally the first time the benchmark is
+ * run, and saved in the data directory (unless an archive is given with the
+ * -archive option, in which case it must define a "scheduler", a "terrain",
+ * and the "residuals", "elevations" and "ortho" producers, as well as a "graph"
+ * producer if the -graph option is used). Each cache is reported under the
+ * name of the first of these producers that uses it. For each camera path the benchmark prints a JSON object on a
+ * single line, containing the number of tiles produced per second, the p50
+ * and p99 tile creation times (see TileProducer#getCreateStats), the hit rate
+ * of each cache (see TileCache#getAccessStats), the p50 and p99 frame times,
+ * and the peak memory usage of the process. Detailed per frame statistics can
+ * also be written with the -stats option (see TileStatsWriter).
+ *
+ * Usage: proland-bench [-data dir] [-level n] [-path flyover|orbit|descent|all]
+ *     [-frames n] [-threads n] [-capacity n] [-archive file] [-graph file]
+ *     [-stats prefix] [-interval n] [-o file]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <sys/resource.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "ork/core/Timer.h"
+#include "ork/resource/ResourceManager.h"
+#include "ork/resource/XMLResourceLoader.h"
+#include "ork/taskgraph/TaskGraph.h"
+#include "proland/math/noise.h"
+#include "proland/preprocess/terrain/Preprocess.h"
+#include "proland/producer/TileStatsWriter.h"
+#include "proland/terrain/TerrainNode.h"
+
+using namespace std;
+using namespace ork;
+using namespace proland;
+
+/**
+ * The half size of the generated terrain, in meters.
+ */
+static const double TERRAIN_SIZE = 50000.0;
+
+/**
+ * The maximum height of the generated terrain, in meters.
+ */
+static const double TERRAIN_ZMAX = 3000.0;
+
+/**
+ * A procedural input map, made of several octaves of cnoise.
+ */
+class NoiseMap : public InputMap
+{
+public:
+    NoiseMap(int size, int channels, int tileSize) :
+        InputMap(size, size, channels, tileSize)
+    {
+        setCacheSize(128 * 1024 * 1024);
+    }
+
+    virtual vec4f getValue(int x, int y)
+    {
+        float u = x / 128.0f;
+        float v = y / 128.0f;
+        float h = fbm(u, v, 8);
+        if (channels == 1) {
+            return vec4f(max(1000.0f + 1000.0f * h, 0.0f), 0.0f, 0.0f, 0.0f);
+        }
+        float d = fbm(u + 17.3f, v - 5.1f, 4);
+        float r = min(max(96.0f + 64.0f * h + 32.0f * d, 0.0f), 255.0f);
+        float g = min(max(128.0f + 48.0f * h - 32.0f * d, 0.0f), 255.0f);
+        float b = min(max(64.0f + 32.0f * d, 0.0f), 255.0f);
+        return vec4f(r, g, b, 255.0f);
+    }
+
+private:
+    static float fbm(float u, float v, int octaves)
+    {
+        float h = 0.0f;
+        float a = 0.5f;
+        for (int i = 0; i < octaves; ++i) {
+            h += a * cnoise(u, v);
+            u *= 2.0f;
+            v *= 2.0f;
+            a *= 0.5f;
+        }
+        return h;
+    }
+};
+
+/**
+ * A camera position and orientation.
+ */
+struct Camera
+{
+    vec3d position;
+
+    vec3d forward;
+};
+
+/**
+ * Returns the camera of the given path at the given time.
+ *
+ * @param path the camera path (flyover, orbit or descent).
+ * @param t a time between 0 and 1.
+ */
+static Camera getCamera(const string &path, double t)
+{
+    Camera c;
+    double S = TERRAIN_SIZE;
+    if (path == "orbit") {
+        double a = 2.0 * M_PI * t;
+        c.position = vec3d(0.4 * S * cos(a), 0.4 * S * sin(a), 4000.0);
+        c.forward = (vec3d(0.0, 0.0, 0.0) - c.position).normalize();
+    } else if (path == "descent") {
+        double z = 30000.0 * pow(0.01, t);
+        c.position = vec3d(0.0, -0.5 * S + 0.4 * S * t, z);
+        c.forward = vec3d(0.0, 1.0, -1.0).normalize();
+    } else {
+        c.position = vec3d(-0.8 * S + 1.6 * S * t, -0.8 * S + 1.6 * S * t, 2500.0);
+        c.forward = vec3d(1.0, 1.0, -0.5).normalize();
+    }
+    return c;
+}
+
+/**
+ * Returns the local to camera transformation of the given camera.
+ */
+static mat4d getLocalToCamera(const Camera &c)
+{
+    vec3d r = c.forward.crossProduct(vec3d::UNIT_Z).normalize();
+    vec3d u = r.crossProduct(c.forward);
+    vec3d f = c.forward;
+    vec3d p = c.position;
+    return mat4d(r.x, r.y, r.z, -r.dotproduct(p),
+        u.x, u.y, u.z, -u.dotproduct(p),
+        -f.x, -f.y, -f.z, f.dotproduct(p),
+        0.0, 0.0, 0.0, 1.0);
+}
+
+/**
+ * Generates the input data and the archive describing the benchmark
+ * resources, if they do not already exist.
+ *
+ * @param dir the directory where the data must be generated.
+ * @param level the maximum quadtree level of the precomputed data.
+ * @param threads the number of threads of the scheduler.
+ * @param capacity the capacity of the tile caches.
+ * @param graph an optional graph file name, or the empty string.
+ * @return the archive file name.
+ */
+static string generateData(const string &dir, int level, int threads, int capacity, const string &graph)
+{
+    NoiseMap heights(1024, 1, 256);
+    NoiseMap colors(1024, 4, 256);
+    preprocessDem(&heights, 24, 192, level, dir, dir + "/tmpDem", 1.0f);
+    preprocessOrtho(&colors, 192, 4, level, dir, dir + "/tmpOrtho");
+
+    string archive = dir + "/bench.xml";
+    FILE *f = fopen(archive.c_str(), "w");
+    if (f == NULL) {
+        fprintf(stderr, "Cannot write %s\n", archive.c_str());
+        exit(1);
+    }
+    fprintf(f, "<?xml version=\"1.0\" ?>\n<archive>\n");
+    fprintf(f, "    <multithreadScheduler name=\"scheduler\" nthreads=\"%d\" fps=\"0\"/>\n", threads);
+    fprintf(f, "    <tileCache name=\"residualCache\" scheduler=\"scheduler\">\n");
+    fprintf(f, "        <cpuFloatTileStorage tileSize=\"197\" channels=\"1\" capacity=\"%d\"/>\n", capacity);
+    fprintf(f, "    </tileCache>\n");
+    fprintf(f, "    <residualProducer name=\"residuals\" cache=\"residualCache\" file=\"DEM.dat\" delta=\"2\"/>\n");
+    fprintf(f, "    <tileCache name=\"elevationCache\" scheduler=\"scheduler\">\n");
+    fprintf(f, "        <cpuFloatTileStorage tileSize=\"101\" channels=\"1\" capacity=\"%d\"/>\n", capacity);
+    fprintf(f, "    </tileCache>\n");
+    fprintf(f, "    <cpuElevationProducer name=\"elevations\" cache=\"elevationCache\" residuals=\"residuals\"/>\n");
+    fprintf(f, "    <tileCache name=\"orthoCache\" scheduler=\"scheduler\">\n");
+    fprintf(f, "        <cpuByteTileStorage tileSize=\"196\" channels=\"4\" capacity=\"%d\"/>\n", capacity);
+    fprintf(f, "    </tileCache>\n");
+    fprintf(f, "    <orthoCpuProducer name=\"ortho\" cache=\"orthoCache\" file=\"RGB.dat\"/>\n");
+    if (graph.size() > 0) {
+        fprintf(f, "    <tileCache name=\"graphCache\" scheduler=\"scheduler\">\n");
+        fprintf(f, "        <objectTileStorage capacity=\"%d\"/>\n", capacity);
+        fprintf(f, "    </tileCache>\n");
+        fprintf(f, "    <basicGraphFactory name=\"graphFactory\"/>\n");
+        fprintf(f, "    <graphProducer name=\"graph\" cache=\"graphCache\" factory=\"graphFactory\" file=\"%s\" doFlatten=\"true\"/>\n", graph.c_str());
+    }
+    fprintf(f, "    <terrainNode name=\"terrain\" size=\"%g\" zmin=\"0\" zmax=\"%g\" splitFactor=\"2\" maxLevel=\"%d\"/>\n",
+        TERRAIN_SIZE, TERRAIN_ZMAX, level + 4);
+    fprintf(f, "</archive>\n");
+    fclose(f);
+    return archive;
+}
+
+/**
+ * A tile requested during a frame, to be released at the next frame.
+ */
+struct UsedTile
+{
+    TileProducer *producer;
+
+    TileCache::Tile *tile;
+};
+
+/**
+ * Requests the tiles of the given quad and of its visible sub quads.
+ *
+ * @param q a terrain quad.
+ * @param producers the producers whose tiles must be requested.
+ * @param used where the requested tiles must be added.
+ * @param graph where the tasks to produce these tiles must be added.
+ */
+static void getTiles(ptr<TerrainQuad> q, const vector< ptr<TileProducer> > &producers,
+    vector<UsedTile> &used, ptr<TaskGraph> graph)
+{
+    if (q->visible == SceneManager::INVISIBLE) {
+        return;
+    }
+    for (unsigned int i = 0; i < producers.size(); ++i) {
+        TileProducer *p = producers[i].get();
+        if (!p->hasTile(q->level, q->tx, q->ty)) {
+            continue;
+        }
+        TileCache::Tile *t = p->getTile(q->level, q->tx, q->ty, 0);
+        if (t == NULL) {
+            continue;
+        }
+        UsedTile u;
+        u.producer = p;
+        u.tile = t;
+        used.push_back(u);
+        if (!t->task->isDone()) {
+            graph->addTask(t->task);
+        }
+    }
+    if (!q->isLeaf()) {
+        for (int i = 0; i < 4; ++i) {
+            getTiles(q->children[i], producers, used, graph);
+        }
+    }
+}
+
+/**
+ * Adds the given tile creation statistics to the given totals.
+ */
+static void addStats(TileProducer::CreateStats &total, const TileProducer::CreateStats &s)
+{
+    total.tiles += s.tiles;
+    total.totalTime += s.totalTime;
+    total.maxTime = max(total.maxTime, s.maxTime);
+    for (int i = 0; i < TileProducer::CreateStats::BINS; ++i) {
+        total.histogram[i] += s.histogram[i];
+    }
+}
+
+/**
+ * Adds the given cache access statistics to the given totals.
+ */
+static void addStats(TileCache::AccessStats &total, const TileCache::AccessStats &s)
+{
+    total.hits += s.hits;
+    total.misses += s.misses;
+    total.failures += s.failures;
+    total.evictions += s.evictions;
+}
+
+/**
+ * Returns the given percentile of the given sorted durations.
+ */
+static double getPercentile(const vector<double> &durations, float p)
+{
+    if (durations.empty()) {
+        return 0.0;
+    }
+    int i = min(int(p / 100.0f * durations.size()), int(durations.size()) - 1);
+    return durations[i];
+}
+
+/**
+ * Runs the benchmark along the given camera path, and prints its results.
+ *
+ * @param path the camera path.
+ * @param archive the archive describing the benchmark resources.
+ * @param dir the directory containing the data files.
+ * @param hasGraph true if the archive defines a "graph" producer.
+ * @param frames the number of frames to simulate.
+ * @param statsPrefix the prefix of the per frame statistics file, or NULL.
+ * @param interval the number of frames between two per frame statistics.
+ * @param out where the results must be printed.
+ */
+static void runPath(const string &path, const string &archive, const string &dir,
+    bool hasGraph, int frames, const char *statsPrefix, int interval, FILE *out)
+{
+    ptr<XMLResourceLoader> loader = new XMLResourceLoader();
+    loader->addPath(dir);
+    loader->addArchive(archive);
+    ptr<ResourceManager> manager = new ResourceManager(loader, 8);
+
+    ptr<Scheduler> scheduler = manager->loadResource("scheduler").cast<Scheduler>();
+    ptr<TerrainNode> terrain = manager->loadResource("terrain").cast<TerrainNode>();
+
+    vector<string> names;
+    names.push_back("residuals");
+    names.push_back("elevations");
+    names.push_back("ortho");
+    if (hasGraph) {
+        names.push_back("graph");
+    }
+    vector< ptr<TileProducer> > producers;
+    vector< ptr<TileCache> > caches;
+    vector<string> cacheNames;
+    for (unsigned int i = 0; i < names.size(); ++i) {
+        ptr<TileProducer> p = manager->loadResource(names[i]).cast<TileProducer>();
+        producers.push_back(p);
+        if (find(caches.begin(), caches.end(), p->getCache()) == caches.end()) {
+            caches.push_back(p->getCache());
+            cacheNames.push_back(names[i]);
+        }
+    }
+
+    string statsFile = statsPrefix == NULL ? "" : string(statsPrefix) + "-" + path + ".json";
+    ptr<TileStatsWriter> writer = new TileStatsWriter(statsPrefix == NULL ? NULL : statsFile.c_str(), TileStatsWriter::JSON, interval);
+    for (unsigned int i = 0; i < caches.size(); ++i) {
+        writer->addCache(cacheNames[i], caches[i]);
+    }
+    for (unsigned int i = 0; i < producers.size(); ++i) {
+        writer->addProducer(names[i], producers[i]);
+    }
+
+    // the writer resets the cache and producer statistics at each sample,
+    // so the totals are accumulated from the writer after each sample
+    vector<TileCache::AccessStats> cacheTotals(caches.size());
+    vector<TileProducer::CreateStats> producerTotals(producers.size());
+    int sinceSample = 0;
+
+    vector<UsedTile> previous;
+    vector<double> frameTimes;
+    Timer total;
+    total.start();
+    for (int frame = 0; frame < frames; ++frame) {
+        Timer timer;
+        timer.start();
+
+        Camera c = getCamera(path, frames > 1 ? frame / double(frames - 1) : 0.0);
+        mat4d localToCamera = getLocalToCamera(c);
+        mat4d localToScreen = mat4d::perspectiveProjection(80.0, 4.0 / 3.0, 1.0, 1e6) * localToCamera;
+        terrain->update(localToCamera, localToScreen, 1024.0f);
+
+        vector<UsedTile> current;
+        ptr<TaskGraph> graph = new TaskGraph();
+        getTiles(terrain->root, producers, current, graph);
+        for (unsigned int i = 0; i < previous.size(); ++i) {
+            previous[i].producer->putTile(previous[i].tile);
+        }
+        previous.swap(current);
+        if (!graph->isEmpty()) {
+            scheduler->run(graph);
+        }
+
+        frameTimes.push_back(timer.end());
+
+        writer->newFrame();
+        if (++sinceSample == interval || frame == frames - 1) {
+            if (sinceSample < interval) {
+                writer->sample();
+            }
+            sinceSample = 0;
+            for (unsigned int i = 0; i < caches.size(); ++i) {
+                addStats(cacheTotals[i], writer->getCacheStats(i));
+            }
+            for (unsigned int i = 0; i < producers.size(); ++i) {
+                addStats(producerTotals[i], writer->getProducerStats(i));
+            }
+        }
+    }
+    double time = total.end() / 1e6;
+    for (unsigned int i = 0; i < previous.size(); ++i) {
+        previous[i].producer->putTile(previous[i].tile);
+    }
+
+    TileProducer::CreateStats all;
+    for (unsigned int i = 0; i < producers.size(); ++i) {
+        addStats(all, producerTotals[i]);
+    }
+    sort(frameTimes.begin(), frameTimes.end());
+
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+
+    fprintf(out, "{\"path\":\"%s\",\"frames\":%d,\"time\":%.3f,\"tiles\":%d,\"tilesPerSecond\":%.1f,"
+        "\"p50\":%.1f,\"p99\":%.1f,\"maxCreateTime\":%.1f,\"frameP50\":%.1f,\"frameP99\":%.1f,\"peakMemoryKB\":%ld,\"producers\":[",
+        path.c_str(), frames, time, all.tiles, time > 0.0 ? all.tiles / time : 0.0,
+        all.getPercentile(50.0f), all.getPercentile(99.0f), all.maxTime,
+        getPercentile(frameTimes, 50.0f), getPercentile(frameTimes, 99.0f), long(usage.ru_maxrss));
+    for (unsigned int i = 0; i < producers.size(); ++i) {
+        const TileProducer::CreateStats &s = producerTotals[i];
+        fprintf(out, "%s{\"name\":\"%s\",\"tiles\":%d,\"createTime\":%.1f,\"p50\":%.1f,\"p99\":%.1f,\"maxCreateTime\":%.1f}",
+            i == 0 ? "" : ",", names[i].c_str(), s.tiles, s.totalTime, s.getPercentile(50.0f), s.getPercentile(99.0f), s.maxTime);
+    }
+    fprintf(out, "],\"caches\":[");
+    for (unsigned int i = 0; i < caches.size(); ++i) {
+        const TileCache::AccessStats &s = cacheTotals[i];
+        int requests = s.hits + s.misses;
+        fprintf(out, "%s{\"name\":\"%s\",\"hits\":%d,\"misses\":%d,\"failures\":%d,\"evictions\":%d,\"hitRate\":%.4f}",
+            i == 0 ? "" : ",", cacheNames[i].c_str(), s.hits, s.misses, s.failures, s.evictions,
+            requests > 0 ? s.hits / double(requests) : 0.0);
+    }
+    fprintf(out, "]}\n");
+    fflush(out);
+
+    manager->close();
+}
+
+int main(int argc, char *argv[])
+{
+    string dir = "bench-data";
+    string path = "all";
+    string archive;
+    string graph;
+    const char *stats = NULL;
+    const char *output = NULL;
+    int level = 2;
+    int frames = 600;
+    int threads = 0;
+    int capacity = 1024;
+    int interval = 60;
+    for (int i = 1; i < argc; ++i) {
+        if (i + 1 >= argc) {
+            fprintf(stderr, "Missing value for option %s\n", argv[i]);
+            return 1;
+        }
+        const char *option = argv[i];
+        const char *value = argv[++i];
+        if (strcmp(option, "-data") == 0) {
+            dir = value;
+        } else if (strcmp(option, "-level") == 0) {
+            level = atoi(value);
+        } else if (strcmp(option, "-path") == 0) {
+            path = value;
+        } else if (strcmp(option, "-frames") == 0) {
+            frames = atoi(value);
+        } else if (strcmp(option, "-threads") == 0) {
+            threads = atoi(value);
+        } else if (strcmp(option, "-capacity") == 0) {
+            capacity = atoi(value);
+        } else if (strcmp(option, "-archive") == 0) {
+            archive = value;
+        } else if (strcmp(option, "-graph") == 0) {
+            graph = value;
+        } else if (strcmp(option, "-stats") == 0) {
+            stats = value;
+        } else if (strcmp(option, "-interval") == 0) {
+            interval = max(atoi(value), 1);
+        } else if (strcmp(option, "-o") == 0) {
+            output = value;
+        } else {
+            fprintf(stderr, "Unknown option %s\n", option);
+            return 1;
+        }
+    }
+
+    if (archive.size() == 0) {
+        archive = generateData(dir, level, threads, capacity, graph);
+    }
+
+    FILE *out = stdout;
+    if (output != NULL) {
+        out = fopen(output, "w");
+        if (out == NULL) {
+            fprintf(stderr, "Cannot write %s\n", output);
+            return 1;
+        }
+    }
+
+    const char *paths[3] = { "flyover", "orbit", "descent" };
+    for (int i = 0; i < 3; ++i) {
+        if (path == "all" || path == paths[i]) {
+            runPath(paths[i], archive, dir, graph.size() > 0, frames, stats, interval, out);
+        }
+    }
+
+    if (out != stdout) {
+        fclose(out);
+    }
+    return 0;
+}
@@ -0,0 +1,202 @@
+/*
+ * Proland: a procedural landscape rendering library.
+ * Website : http://proland.inrialpes.fr/
+ * Copyright (c) 2008-2015 INRIA - LJK (CNRS - Grenoble University)
+ * All rights reserved.
+ * Redistribution and use in source and binary forms, with or without 
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice, 
+ * this list of conditions and the following disclaimer.
+ * 
+ * 2. Redistributions in binary form must reproduce the above copyright notice, 
+ * this list of conditions and the following disclaimer in the documentation 
+ * and/or other materials provided with the distribution.
+ * 
+ * 3. Neither the name of the copyright holder nor the names of its contributors 
+ * may be used to endorse or promote products derived from this software without 
+ * specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND 
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED 
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. 
+ * IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, 
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, 
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, 
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF 
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE 
+ * OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED 
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+/*
+ * Proland is distributed under the Berkeley Software Distribution 3 Licence. 
+ * For any assistance, feedback and enquiries about training programs, you can check out the 
+ * contact page on our website : 
+ * http://proland.inrialpes.fr/
+ */
+/*
+ * Main authors: Eric Bruneton, Antoine Begault, Guillaume Piolat.
+ */
+
+/*
+ * A benchmark of the terrain quadtree update (see TerrainNode#update, which
+ * is what UpdateTerrainTask does at each frame). For a flat and a spherical
+ * terrain, and for several maximum quadtree levels, it moves a camera a few
+ * meters above the ground, so that the quadtree is subdivided down to its
+ * maximum level, and measures the time needed to update the quadtree at each
+ * frame (without any OpenGL context). The quads are allocated from the pool
+ * of each TerrainNode, so this time includes their allocation and deletion.
+ * Each quadtree is updated sequentially, and in parallel with a
+ * MultithreadScheduler (see TerrainNode#parallelDepth), and the benchmark
+ * checks that both quadtrees are identical at each frame. This is done with
+ * a terrain below the camera, and with a terrain whose bounding boxes are
+ * above the camera, so that horizon occlusion culling is done at each frame
+ * (with many occluded quads). The results are
+ * printed in CSV format: the mean, p50 and p99 update times, the speedup of
+ * the parallel update, and the average number of quads and the maximum depth
+ * of the quadtree. The exit code is 1 if some quadtrees differ.
+ *
+ * Usage: terrainupdate-bench [frames] [threads] [parallelDepth]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <algorithm>
+#include <vector>
+
+#include "ork/core/Timer.h"
+#include "ork/taskgraph/MultithreadScheduler.h"
+#include "proland/terrain/TerrainNode.h"
+#include "proland/terrain/FlatDeformation.h"
+#include "proland/terrain/SphericalDeformation.h"
+
+using namespace std;
+using namespace ork;
+using namespace proland;
+
+/**
+ * Returns true if the two given quadtrees are identical.
+ */
+static bool isSame(const TerrainQuad *p, const TerrainQuad *q)
+{
+    if (p->visible != q->visible || p->occluded != q->occluded || p->isLeaf() != q->isLeaf()) {
+        return false;
+    }
+    if (!p->isLeaf()) {
+        for (int i = 0; i < 4; ++i) {
+            if (!isSame(p->children[i].get(), q->children[i].get())) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+/**
+ * Returns the transformation from the deformed terrain space to the camera
+ * space, for a camera at the given position, looking in the given direction,
+ * with the given up direction.
+ */
+static mat4d getLocalToCamera(const vec3d &p, const vec3d &forward, const vec3d &up)
+{
+    vec3d r = forward.crossProduct(up).normalize();
+    vec3d u = r.crossProduct(forward);
+    vec3d f = forward;
+    return mat4d(r.x, r.y, r.z, -r.dotproduct(p),
+        u.x, u.y, u.z, -u.dotproduct(p),
+        -f.x, -f.y, -f.z, f.dotproduct(p),
+        0.0, 0.0, 0.0, 1.0);
+}
+
+/**
+ * Returns the mean, p50 and p99 of the given times, and sorts them.
+ */
+static void getStats(vector<double> &times, double &mean, double &p50, double &p99)
+{
+    mean = 0.0;
+    for (unsigned int i = 0; i < times.size(); ++i) {
+        mean += times[i];
+    }
+    mean /= times.size();
+    sort(times.begin(), times.end());
+    p50 = times[times.size() / 2];
+    p99 = times[(times.size() * 99) / 100];
+}
+
+int main(int argc, char *argv[])
+{
+    int frames = argc > 1 ? max(2, atoi(argv[1])) : 500;
+    int threads = argc > 2 ? max(1, atoi(argv[2])) : 4;
+    int parallelDepth = argc > 3 ? max(1, atoi(argv[3])) : 3;
+    const int maxLevels[3] = { 16, 18, 20 };
+    const double R = 6360000.0;
+    bool same = true;
+
+    ptr<Scheduler> scheduler = new MultithreadScheduler(0, 0, 0.0f, threads);
+
+    printf("deformation,culling,maxLevel,threads,mean(us),p50(us),p99(us),speedup,quads,depth,same\n");
+    for (int d = 0; d < 4; ++d) {
+        bool spherical = d % 2 == 1;
+        bool culling = d >= 2;
+        for (int m = 0; m < 3; ++m) {
+            int maxLevel = maxLevels[m];
+            float zmax = culling ? 1000.0f : 0.0f;
+            double size = spherical ? R : 50000.0;
+            ptr<Deformation> deform;
+            if (spherical) {
+                deform = new SphericalDeformation(float(R));
+            } else {
+                deform = new FlatDeformation();
+            }
+            ptr<TerrainNode> terrains[2];
+            for (int i = 0; i < 2; ++i) {
+                ptr<TerrainQuad> root = new TerrainQuad(NULL, NULL, 0, 0, -size, -size, 2.0 * size, 0.0f, zmax);
+                terrains[i] = new TerrainNode(deform, root, 2.0f, maxLevel);
+            }
+            terrains[1]->parallelDepth = parallelDepth;
+
+            vector<double> times[2];
+            double quads = 0.0;
+            int depth = 0;
+            bool sameTrees = true;
+            for (int frame = 0; frame < frames; ++frame) {
+                // a low altitude flyover, turning slowly, over 10 km
+                double t = frame / double(frames - 1);
+                double a = 0.5 * sin(2.0 * M_PI * t);
+                vec3d local = vec3d(-5000.0 + 10000.0 * t, 0.0, 0.0);
+                vec3d p = deform->localToDeformed(local + vec3d(0.0, 0.0, 2.0));
+                vec3d up = spherical ? p.normalize() : vec3d::UNIT_Z;
+                vec3d f = deform->localToDeformed(local + vec3d(cos(a), sin(a), 0.0)) - deform->localToDeformed(local);
+                f = (f.normalize() - up * 0.2).normalize();
+                mat4d localToCamera = getLocalToCamera(p, f, up);
+                mat4d localToScreen = mat4d::perspectiveProjection(80.0, 4.0 / 3.0, 0.1, 1e6) * localToCamera;
+
+                for (int i = 0; i < 2; ++i) {
+                    Timer timer;
+                    timer.start();
+                    terrains[i]->update(localToCamera, localToScreen, 1024.0f, i == 0 ? NULL : scheduler);
+                    times[i].push_back(timer.end());
+                }
+
+                sameTrees = sameTrees && isSame(terrains[0]->root.get(), terrains[1]->root.get());
+                quads += terrains[0]->root->getSize();
+                depth = max(depth, terrains[0]->root->getDepth());
+            }
+            same = same && sameTrees;
+
+            double mean[2];
+            double p50[2];
+            double p99[2];
+            for (int i = 0; i < 2; ++i) {
+                getStats(times[i], mean[i], p50[i], p99[i]);
+                printf("%s,%s,%d,%d,%.2f,%.2f,%.2f,%.2f,%.0f,%d,%s\n", spherical ? "spherical" : "flat", culling ? "yes" : "no", maxLevel,
+                    i == 0 ? 1 : threads, mean[i], p50[i], p99[i], mean[0] / mean[i],
+                    quads / frames, depth, sameTrees ? "yes" : "no");
+            }
+            fflush(stdout);
+        }
+    }
+    return same ? 0 : 1;
+}
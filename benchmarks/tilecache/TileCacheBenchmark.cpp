@@ -0,0 +1,189 @@
+/*
+ * Proland: a procedural landscape rendering library.
+ * Website : http://proland.inrialpes.fr/
+ * Copyright (c) 2008-2015 INRIA - LJK (CNRS - Grenoble University)
+ * All rights reserved.
+ * Redistribution and use in source and binary forms, with or without 
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice, 
+ * this list of conditions and the following disclaimer.
+ * 
+ * 2. Redistributions in binary form must reproduce the above copyright notice, 
+ * this list of conditions and the following disclaimer in the documentation 
+ * and/or other materials provided with the distribution.
+ * 
+ * 3. Neither the name of the copyright holder nor the names of its contributors 
+ * may be used to endorse or promote products derived from this software without 
+ * specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND 
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED 
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. 
+ * IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, 
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, 
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, 
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF 
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE 
+ * OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED 
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+/*
+ * Proland is distributed under the Berkeley Software Distribution 3 Licence. 
+ * For any assistance, feedback and enquiries about training programs, you can check out the 
+ * contact page on our website : 
+ * http://proland.inrialpes.fr/
+ */
+/*
+ * Main authors: Eric Bruneton, Antoine Begault, Guillaume Piolat.
+ */
+
+/*
+ * A multithreaded stress benchmark for TileCache. Several threads simulate
+ * TileSampler-like accesses (getTile, findTile on the parent tiles, putTile)
+ * around moving viewpoints, on a CPU-only CPUTileStorage. The tile data is
+ * never actually produced (there is no scheduler), so that only the cost of
+ * the cache itself is measured. The benchmark is run for an increasing number
+ * of threads, with a single shard (the default "tileCache") and with several
+ * shards (the "shardedTileCache"), and prints the throughput in CSV format,
+ * together with the number of heap allocations done by the cache (see
+ * TileCache#getAllocationStats).
+ *
+ * Usage: tilecache-bench [maxThreads [opsPerThread [capacity [shards]]]]
+ */
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <vector>
+
+#include "ork/core/Timer.h"
+#include "proland/producer/CPUTileStorage.h"
+#include "proland/producer/TileProducer.h"
+
+using namespace std;
+using namespace ork;
+using namespace proland;
+
+/**
+ * A CPU producer whose tiles are filled with a constant value.
+ */
+class BenchProducer : public TileProducer
+{
+public:
+    BenchProducer(ptr<TileCache> cache) :
+        TileProducer("BenchProducer", "CreateBenchTile", cache, false)
+    {
+    }
+
+protected:
+    virtual bool doCreateTile(int level, int, int, TileStorage::Slot *data)
+    {
+        CPUTileStorage<float>::CPUSlot *s = dynamic_cast<CPUTileStorage<float>::CPUSlot*>(data);
+        for (int i = 0; i < s->size; ++i) {
+            s->data[i] = float(level);
+        }
+        return true;
+    }
+};
+
+struct BenchThread
+{
+    pthread_t thread;
+
+    ptr<TileProducer> producer;
+
+    unsigned int seed;
+
+    int ops;
+
+    int level;
+};
+
+/**
+ * Simulates a viewpoint moving randomly over the tiles of a quadtree level,
+ * requesting the tiles around it and checking their parent tiles.
+ */
+static void *runBenchThread(void *arg)
+{
+    const int HELD = 16;
+    BenchThread *b = (BenchThread*) arg;
+    int size = 1 << b->level;
+    int cx = rand_r(&b->seed) % size;
+    int cy = rand_r(&b->seed) % size;
+    TileCache::Tile *held[HELD] = { NULL };
+    for (int i = 0; i < b->ops; ++i) {
+        if (i % 64 == 0) {
+            cx = (cx + rand_r(&b->seed) % 3 - 1 + size) % size;
+            cy = (cy + rand_r(&b->seed) % 3 - 1 + size) % size;
+        }
+        int tx = (cx + rand_r(&b->seed) % 5 - 2 + size) % size;
+        int ty = (cy + rand_r(&b->seed) % 5 - 2 + size) % size;
+        TileCache::Tile *t = b->producer->getTile(b->level, tx, ty, 0);
+        for (int l = b->level - 1; l >= b->level - 3 && l >= 0; --l) {
+            int d = b->level - l;
+            b->producer->findTile(l, tx >> d, ty >> d, true);
+        }
+        TileCache::Tile *&h = held[i % HELD];
+        if (h != NULL) {
+            b->producer->putTile(h);
+        }
+        h = t;
+    }
+    for (int i = 0; i < HELD; ++i) {
+        if (held[i] != NULL) {
+            b->producer->putTile(held[i]);
+        }
+    }
+    return NULL;
+}
+
+/**
+ * Runs the benchmark with the given number of threads and shards, and prints
+ * the number of getTile operations per second.
+ */
+static void runBench(int threads, int shards, int ops, int capacity)
+{
+    ptr<TileStorage> storage = new CPUTileStorage<float>(16, 1, capacity);
+    ptr<TileCache> cache = new TileCache(storage, "benchCache", NULL, shards);
+    ptr<TileProducer> producer = new BenchProducer(cache);
+    vector<BenchThread> b(threads);
+    Timer timer;
+    timer.start();
+    for (int i = 0; i < threads; ++i) {
+        b[i].producer = producer;
+        b[i].seed = 1234567u * (i + 1);
+        b[i].ops = ops;
+        b[i].level = 8;
+        pthread_create(&b[i].thread, NULL, runBenchThread, &b[i]);
+    }
+    for (int i = 0; i < threads; ++i) {
+        pthread_join(b[i].thread, NULL);
+    }
+    double duration = timer.end(); // in micro seconds
+    for (int i = 0; i < threads; ++i) {
+        b[i].producer = NULL;
+    }
+    TileCache::AllocationStats stats;
+    cache->getAllocationStats(stats);
+    printf("%d,%d,%.0f,%d,%d\n", threads, shards, (double(threads) * ops) / (duration * 1e-6), stats.tilesCreated, stats.heapAllocations);
+}
+
+int main(int argc, char *argv[])
+{
+    int maxThreads = argc > 1 ? atoi(argv[1]) : 8;
+    int ops = argc > 2 ? atoi(argv[2]) : 200000;
+    int capacity = argc > 3 ? atoi(argv[3]) : 1024;
+    int shards = argc > 4 ? atoi(argv[4]) : 16;
+    if (capacity < 16 * maxThreads) {
+        // each thread holds up to 16 tiles at a time
+        capacity = 16 * maxThreads;
+    }
+    printf("threads,shards,ops/s,tiles created,heap allocations\n");
+    for (int threads = 1; threads <= maxThreads; threads *= 2) {
+        runBench(threads, 1, ops, capacity);
+        runBench(threads, shards, ops, capacity);
+    }
+    return 0;
+}
@@ -0,0 +1,294 @@
+/*
+ * Proland: a procedural landscape rendering library.
+ * Website : http://proland.inrialpes.fr/
+ * Copyright (c) 2008-2015 INRIA - LJK (CNRS - Grenoble University)
+ * All rights reserved.
+ * Redistribution and use in source and binary forms, with or without 
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice, 
+ * this list of conditions and the following disclaimer.
+ * 
+ * 2. Redistributions in binary form must reproduce the above copyright notice, 
+ * this list of conditions and the following disclaimer in the documentation 
+ * and/or other materials provided with the distribution.
+ * 
+ * 3. Neither the name of the copyright holder nor the names of its contributors 
+ * may be used to endorse or promote products derived from this software without 
+ * specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND 
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED 
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. 
+ * IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, 
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, 
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, 
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF 
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE 
+ * OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED 
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+/*
+ * Proland is distributed under the Berkeley Software Distribution 3 Licence. 
+ * For any assistance, feedback and enquiries about training programs, you can check out the 
+ * contact page on our website : 
+ * http://proland.inrialpes.fr/
+ */
+/*
+ * Main authors: Eric Bruneton, Antoine Begault, Guillaume Piolat.
+ */
+
+/*
+ * A benchmark of the residual tile decoding path. It reads all the tiles of
+ * a precomputed residual (DEM) file, decodes them once to get their raw 16
+ * bits residuals, and then re-encodes these residuals in memory with each
+ * available TileCodec. For each codec it measures the time needed to decode
+ * each tile (with libtiff for TileCodec::TIFF, as in the historical format,
+ * and with TileCodec::decompress otherwise). It then measures the time needed
+ * to convert the decoded residuals to floats, with the scalar and with the
+ * vectorized versions of TileCodec::decodeShorts. The results are printed in
+ * CSV format. The zstd and lz4 codecs are only available if Proland is
+ * compiled with the USE_ZSTD and USE_LZ4 options.
+ *
+ * Usage: tiledecode-bench DEM.dat [repeat]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <vector>
+
+#include "tiffio.h"
+
+#include "ork/core/Timer.h"
+#include "proland/producer/TileCodec.h"
+#include "proland/util/mfs.h"
+
+using namespace std;
+using namespace ork;
+using namespace proland;
+
+/**
+ * A residual tile, compressed with some codec.
+ */
+struct Tile
+{
+    /**
+     * The tile width and height, including borders.
+     */
+    int size;
+
+    /**
+     * The compressed tile data.
+     */
+    vector<unsigned char> data;
+};
+
+/**
+ * Decodes a tile stored as a TIFF file in memory.
+ */
+static bool decodeTiff(const unsigned char *src, int srcSize, unsigned char *dst)
+{
+    mfs_file fd;
+    mfs_open((void*) src, srcSize, (char *)"r", &fd);
+    TIFF* tf = TIFFClientOpen("name", "r", &fd,
+        (TIFFReadWriteProc) mfs_read, (TIFFReadWriteProc) mfs_write, (TIFFSeekProc) mfs_lseek,
+        (TIFFCloseProc) mfs_close, (TIFFSizeProc) mfs_size, (TIFFMapFileProc) mfs_map,
+        (TIFFUnmapFileProc) mfs_unmap);
+    if (tf == NULL) {
+        return false;
+    }
+    bool ok = TIFFReadEncodedStrip(tf, 0, dst, (tsize_t) -1) != -1;
+    TIFFClose(tf);
+    return ok;
+}
+
+/**
+ * Reads the tiles of a residual tile file and decodes them.
+ *
+ * @param[out] raw the decoded tiles (16 bits residuals in little endian order).
+ * @param[out] scale the scale factor of the residuals.
+ * @return false if the file cannot be read.
+ */
+static bool readTiles(const char *name, vector<Tile> &raw, float &scale)
+{
+    FILE *f = fopen(name, "rb");
+    if (f == NULL) {
+        return false;
+    }
+    TileCodec::Codec codec = TileCodec::TIFF;
+    int h[6];
+    bool ok = fread(h, sizeof(int), 1, f) == 1;
+    if (ok && h[0] == TileCodec::MAGIC) {
+        int c;
+        ok = fread(&c, sizeof(int), 1, f) == 1 && fread(h, sizeof(int), 1, f) == 1;
+        codec = TileCodec::Codec(c);
+    }
+    ok = ok && TileCodec::isAvailable(codec);
+    ok = ok && fread(h + 1, sizeof(int), 5, f) == 5 && fread(&scale, sizeof(float), 1, f) == 1;
+    if (!ok) {
+        fclose(f);
+        return false;
+    }
+    // minLevel, maxLevel, tileSize, rootLevel, rootTx, rootTy
+    int minLevel = h[0];
+    int maxLevel = h[1];
+    int tileSize = h[2];
+    int ntiles = minLevel + ((1 << (max(maxLevel - minLevel, 0) * 2 + 2)) - 1) / 3;
+    vector<unsigned int> offsets(2 * ntiles);
+    ok = fread(&offsets[0], sizeof(unsigned int), 2 * ntiles, f) == size_t(2 * ntiles);
+    long long header = ftell(f);
+
+    vector<unsigned char> src;
+    for (int i = 0; ok && i < ntiles; ++i) {
+        // constant tiles share the same data, which is decoded only once
+        if (i > 0 && offsets[2 * i] <= offsets[2 * (i - 1)]) {
+            continue;
+        }
+        Tile t;
+        t.size = (i < minLevel ? tileSize >> (minLevel - i) : tileSize) + 5;
+        t.data.resize(t.size * t.size * 2);
+        src.resize(offsets[2 * i + 1] - offsets[2 * i]);
+        fseek(f, header + offsets[2 * i], SEEK_SET);
+        ok = fread(&src[0], src.size(), 1, f) == 1;
+        if (codec == TileCodec::TIFF) {
+            ok = ok && decodeTiff(&src[0], int(src.size()), &t.data[0]);
+        } else {
+            ok = ok && TileCodec::decompress(codec, &src[0], int(src.size()), &t.data[0], int(t.data.size()));
+        }
+        raw.push_back(t);
+    }
+    fclose(f);
+    return ok;
+}
+
+/**
+ * Prints the statistics of the given per tile times (in micro seconds).
+ */
+static void printTimes(const char *step, const char *codec, vector<double> &times,
+    long long rawBytes, long long bytes, unsigned int checksum)
+{
+    double total = 0.0;
+    for (unsigned int i = 0; i < times.size(); ++i) {
+        total += times[i];
+    }
+    sort(times.begin(), times.end());
+    double p50 = times[times.size() / 2];
+    double p99 = times[min(times.size() - 1, times.size() * 99 / 100)];
+    printf("%s,%s,%d,%.2f,%.2f,%.2f,%.2f,%.2f,%.1f,%08x\n", step, codec, int(times.size()),
+        rawBytes / (1024.0 * 1024.0), bytes / (1024.0 * 1024.0), total / times.size(), p50, p99,
+        rawBytes / (1024.0 * 1024.0) / (total / 1e6), checksum);
+    fflush(stdout);
+}
+
+static unsigned int hashTile(const unsigned char *data, int size)
+{
+    unsigned int h = 0;
+    for (int i = 0; i < size; ++i) {
+        h = h * 31 + data[i];
+    }
+    return h;
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc < 2) {
+        fprintf(stderr, "Usage: tiledecode-bench DEM.dat [repeat]\n");
+        return 1;
+    }
+    const char *name = argv[1];
+    int repeat = argc > 2 ? max(1, atoi(argv[2])) : 4;
+
+    vector<Tile> raw;
+    float scale;
+    if (!readTiles(name, raw, scale) || raw.empty()) {
+        fprintf(stderr, "Cannot read %s\n", name);
+        return 1;
+    }
+    long long rawBytes = 0;
+    int maxSize = 0;
+    for (unsigned int i = 0; i < raw.size(); ++i) {
+        rawBytes += raw[i].data.size();
+        maxSize = max(maxSize, raw[i].size);
+    }
+    vector<unsigned char> decoded(maxSize * maxSize * 2);
+    vector<float> result(maxSize * maxSize);
+
+    // the MB/s column is the raw (decoded) data throughput
+    printf("step,codec,tiles,raw MB,compressed MB,mean(us),p50(us),p99(us),MB/s,checksum\n");
+    for (int c = TileCodec::TIFF; c <= TileCodec::LZ4; ++c) {
+        TileCodec::Codec codec = TileCodec::Codec(c);
+        if (!TileCodec::isAvailable(codec)) {
+            continue;
+        }
+        vector<Tile> tiles(raw.size());
+        long long bytes = 0;
+        for (unsigned int i = 0; i < raw.size(); ++i) {
+            tiles[i].size = raw[i].size;
+            bool ok;
+            if (codec == TileCodec::TIFF) {
+                ok = TileCodec::compressTiff(&raw[i].data[0], raw[i].size, 2, 0, tiles[i].data);
+            } else {
+                ok = TileCodec::compress(codec, &raw[i].data[0], int(raw[i].data.size()), tiles[i].data);
+            }
+            if (!ok) {
+                fprintf(stderr, "Cannot compress tile with %s\n", TileCodec::getName(codec));
+                return 1;
+            }
+            bytes += tiles[i].data.size();
+        }
+
+        vector<double> times;
+        unsigned int checksum = 0;
+        for (int r = 0; r < repeat; ++r) {
+            for (unsigned int i = 0; i < tiles.size(); ++i) {
+                const Tile &t = tiles[i];
+                int size = t.size * t.size * 2;
+                bool ok = true;
+                Timer timer;
+                timer.start();
+                if (codec == TileCodec::TIFF) {
+                    decodeTiff(&t.data[0], int(t.data.size()), &decoded[0]);
+                } else {
+                    ok = TileCodec::decompress(codec, &t.data[0], int(t.data.size()), &decoded[0], size);
+                }
+                times.push_back(timer.end());
+                if (!ok) {
+                    fprintf(stderr, "Cannot decompress tile with %s\n", TileCodec::getName(codec));
+                    return 1;
+                }
+                if (r == 0) {
+                    checksum += hashTile(&decoded[0], size);
+                }
+            }
+        }
+        printTimes("decode", TileCodec::getName(codec), times, rawBytes * repeat, bytes * repeat, checksum);
+    }
+
+    for (int simd = 0; simd < 2; ++simd) {
+        vector<double> times;
+        unsigned int checksum = 0;
+        for (int r = 0; r < repeat; ++r) {
+            for (unsigned int i = 0; i < raw.size(); ++i) {
+                const Tile &t = raw[i];
+                Timer timer;
+                timer.start();
+                for (int j = 0; j < t.size; ++j) {
+                    if (simd) {
+                        TileCodec::decodeShorts(&t.data[2 * j * t.size], t.size, scale, NULL, &result[j * t.size]);
+                    } else {
+                        TileCodec::decodeShortsScalar(&t.data[2 * j * t.size], t.size, scale, NULL, &result[j * t.size]);
+                    }
+                }
+                times.push_back(timer.end());
+                if (r == 0) {
+                    checksum += hashTile((unsigned char*) &result[0], t.size * t.size * sizeof(float));
+                }
+            }
+        }
+        printTimes("convert", simd ? "simd" : "scalar", times, rawBytes * repeat, rawBytes * repeat, checksum);
+    }
+    return 0;
+}
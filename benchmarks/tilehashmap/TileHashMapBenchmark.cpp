@@ -0,0 +1,224 @@
+/*
+ * Proland: a procedural landscape rendering library.
+ * Website : http://proland.inrialpes.fr/
+ * Copyright (c) 2008-2015 INRIA - LJK (CNRS - Grenoble University)
+ * All rights reserved.
+ * Redistribution and use in source and binary forms, with or without 
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice, 
+ * this list of conditions and the following disclaimer.
+ * 
+ * 2. Redistributions in binary form must reproduce the above copyright notice, 
+ * this list of conditions and the following disclaimer in the documentation 
+ * and/or other materials provided with the distribution.
+ * 
+ * 3. Neither the name of the copyright holder nor the names of its contributors 
+ * may be used to endorse or promote products derived from this software without 
+ * specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND 
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED 
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. 
+ * IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, 
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, 
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, 
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF 
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE 
+ * OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED 
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+/*
+ * Proland is distributed under the Berkeley Software Distribution 3 Licence. 
+ * For any assistance, feedback and enquiries about training programs, you can check out the 
+ * contact page on our website : 
+ * http://proland.inrialpes.fr/
+ */
+/*
+ * Main authors: Eric Bruneton, Antoine Begault, Guillaume Piolat.
+ */
+
+/*
+ * A micro benchmark comparing the tile index used by TileCache (TileHashMap
+ * with packed TileCache::Tile::Key keys, and an intrusive LRU list) with the
+ * previous one (std::map with nested std::pair keys, and a std::list LRU).
+ * It measures the throughput of lookups of tiles in the cache, and of LRU
+ * evictions (removal of the least recently used tile and insertion of a new
+ * one), and prints the results in CSV format.
+ *
+ * Usage: tilehashmap-bench [tiles [operations]]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <list>
+#include <map>
+#include <vector>
+
+#include "ork/core/Timer.h"
+#include "proland/producer/TileCache.h"
+#include "proland/producer/TileHashMap.h"
+
+using namespace std;
+using namespace ork;
+using namespace proland;
+
+/**
+ * A minimal tile record with intrusive LRU links, as in TileCache::Tile.
+ */
+struct BenchTile
+{
+    int level, tx, ty;
+
+    BenchTile *prev;
+
+    BenchTile *next;
+};
+
+/**
+ * The previous TileCache index: a std::map of nested std::pair keys to
+ * positions in a std::list.
+ */
+struct MapIndex
+{
+    map<TileCache::Tile::TId, list<BenchTile*>::iterator> tiles;
+
+    list<BenchTile*> order;
+
+    void add(BenchTile *t)
+    {
+        TileCache::Tile::TId id = TileCache::Tile::getTId(0, t->level, t->tx, t->ty);
+        tiles[id] = order.insert(order.end(), t);
+    }
+
+    BenchTile *find(int level, int tx, int ty)
+    {
+        map<TileCache::Tile::TId, list<BenchTile*>::iterator>::iterator i = tiles.find(TileCache::Tile::getTId(0, level, tx, ty));
+        return i == tiles.end() ? NULL : *(i->second);
+    }
+
+    BenchTile *evict()
+    {
+        BenchTile *t = order.front();
+        tiles.erase(TileCache::Tile::getTId(0, t->level, t->tx, t->ty));
+        order.pop_front();
+        return t;
+    }
+};
+
+/**
+ * The new TileCache index: a TileHashMap of packed keys, and an intrusive
+ * list.
+ */
+struct HashIndex
+{
+    TileHashMap<BenchTile*> tiles;
+
+    BenchTile *head;
+
+    BenchTile *tail;
+
+    HashIndex() : head(NULL), tail(NULL)
+    {
+    }
+
+    void add(BenchTile *t)
+    {
+        tiles.insert(TileCache::Tile::getKey(0, t->level, t->tx, t->ty), t);
+        t->prev = tail;
+        t->next = NULL;
+        if (tail == NULL) {
+            head = t;
+        } else {
+            tail->next = t;
+        }
+        tail = t;
+    }
+
+    BenchTile *find(int level, int tx, int ty)
+    {
+        BenchTile **t = tiles.find(TileCache::Tile::getKey(0, level, tx, ty));
+        return t == NULL ? NULL : *t;
+    }
+
+    BenchTile *evict()
+    {
+        BenchTile *t = head;
+        tiles.erase(TileCache::Tile::getKey(0, t->level, t->tx, t->ty));
+        head = t->next;
+        if (head == NULL) {
+            tail = NULL;
+        } else {
+            head->prev = NULL;
+        }
+        t->next = NULL;
+        return t;
+    }
+};
+
+/**
+ * Fills the given index with n tiles, then measures n lookups followed by
+ * n evictions. Returns the number of found tiles (which must be the same for
+ * both indexes).
+ */
+template<class Index>
+static int runBench(const char *name, int n, int ops)
+{
+    const int level = 12;
+    const int size = 1 << level;
+    vector<BenchTile> tiles(n);
+    Index index;
+    unsigned int seed = 12345;
+    for (int i = 0; i < n; ++i) {
+        tiles[i].level = level;
+        tiles[i].tx = rand_r(&seed) % size;
+        tiles[i].ty = rand_r(&seed) % size;
+        tiles[i].prev = NULL;
+        tiles[i].next = NULL;
+        if (index.find(level, tiles[i].tx, tiles[i].ty) == NULL) {
+            index.add(&tiles[i]);
+        }
+    }
+
+    int found = 0;
+    Timer timer;
+    timer.start();
+    for (int i = 0; i < ops; ++i) {
+        // half of the lookups are hits, and half are (most probably) misses
+        BenchTile &t = tiles[rand_r(&seed) % n];
+        if (index.find(level, i % 2 == 0 ? t.tx : (t.tx + 1) % size, t.ty) != NULL) {
+            ++found;
+        }
+    }
+    double lookupTime = timer.end();
+
+    timer.start();
+    for (int i = 0; i < ops; ++i) {
+        // evicts the least recently used tile and reuses it for a new tile
+        BenchTile *t = index.evict();
+        do {
+            t->tx = rand_r(&seed) % size;
+            t->ty = rand_r(&seed) % size;
+        } while (index.find(level, t->tx, t->ty) != NULL);
+        index.add(t);
+    }
+    double evictTime = timer.end();
+
+    printf("%s,%d,%.0f,%.0f\n", name, n, ops / (lookupTime * 1e-6), ops / (evictTime * 1e-6));
+    return found;
+}
+
+int main(int argc, char *argv[])
+{
+    int n = argc > 1 ? atoi(argv[1]) : 4096;
+    int ops = argc > 2 ? atoi(argv[2]) : 4000000;
+    printf("index,tiles,lookups/s,evictions/s\n");
+    int f1 = runBench<MapIndex>("std::map", n, ops);
+    int f2 = runBench<HashIndex>("TileHashMap", n, ops);
+    if (f1 != f2) {
+        fprintf(stderr, "inconsistent results: %d != %d\n", f1, f2);
+        return 1;
+    }
+    return 0;
+}
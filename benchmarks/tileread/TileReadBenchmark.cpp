@@ -0,0 +1,252 @@
+/*
+ * Proland: a procedural landscape rendering library.
+ * Website : http://proland.inrialpes.fr/
+ * Copyright (c) 2008-2015 INRIA - LJK (CNRS - Grenoble University)
+ * All rights reserved.
+ * Redistribution and use in source and binary forms, with or without 
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice, 
+ * this list of conditions and the following disclaimer.
+ * 
+ * 2. Redistributions in binary form must reproduce the above copyright notice, 
+ * this list of conditions and the following disclaimer in the documentation 
+ * and/or other materials provided with the distribution.
+ * 
+ * 3. Neither the name of the copyright holder nor the names of its contributors 
+ * may be used to endorse or promote products derived from this software without 
+ * specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND 
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED 
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. 
+ * IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, 
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, 
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, 
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF 
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE 
+ * OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED 
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+/*
+ * Proland is distributed under the Berkeley Software Distribution 3 Licence. 
+ * For any assistance, feedback and enquiries about training programs, you can check out the 
+ * contact page on our website : 
+ * http://proland.inrialpes.fr/
+ */
+/*
+ * Main authors: Eric Bruneton, Antoine Begault, Guillaume Piolat.
+ */
+
+/*
+ * A benchmark of the TileFile reading modes (mmap, pread and io_uring). It
+ * reads all the tiles of a precomputed residual (DEM) or ortho (RGB) file, in
+ * a random order, with several threads. Each thread processes batches of
+ * tiles as a TileSampler update would do: it first announces all the tiles of
+ * the batch with TileFile#willNeed, then reads them one by one and computes a
+ * checksum of their data. Before each run the file pages are evicted from the
+ * page cache with posix_fadvise, so that the benchmark measures cold reads
+ * (for a fully cold cache, including the file metadata, run it as root after
+ * "echo 3 > /proc/sys/vm/drop_caches"). The results are printed in CSV format.
+ * The io_uring mode is only available if Proland is compiled with the
+ * USE_IO_URING option (otherwise it falls back to pread, as indicated by the
+ * "mode" column).
+ *
+ * Usage: tileread-bench file.dat [dem|ortho [threads [batch]]]
+ */
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <algorithm>
+#include <vector>
+
+#include "ork/core/Timer.h"
+#include "proland/producer/TileCodec.h"
+#include "proland/producer/TileFile.h"
+
+using namespace std;
+using namespace ork;
+using namespace proland;
+
+/**
+ * The location of a tile in a tile file.
+ */
+struct TileLocation
+{
+    long long offset;
+
+    int size;
+};
+
+/**
+ * Reads the tile locations of a residual or ortho tile file.
+ *
+ * @return false if the file cannot be read.
+ */
+static bool readLocations(const char *name, bool dem, vector<TileLocation> &tiles)
+{
+    FILE *f = fopen(name, "rb");
+    if (f == NULL) {
+        return false;
+    }
+    int h[7];
+    bool ok = fread(h, sizeof(int), 7, f) == 7;
+    long long magic = 0;
+    if (ok && dem && h[0] == TileCodec::MAGIC) {
+        // magic number and codec, followed by the historical header
+        magic = 2 * sizeof(int);
+        fseek(f, magic, SEEK_SET);
+        ok = fread(h, sizeof(int), 7, f) == 7;
+    }
+    if (ok && dem) {
+        // minLevel, maxLevel, tileSize, rootLevel, rootTx, rootTy, scale
+        int minLevel = h[0];
+        int maxLevel = h[1];
+        int ntiles = minLevel + ((1 << (max(maxLevel - minLevel, 0) * 2 + 2)) - 1) / 3;
+        long long header = magic + sizeof(float) + sizeof(int) * (6 + ntiles * 2);
+        vector<unsigned int> offsets(2 * ntiles);
+        ok = fread(&offsets[0], sizeof(unsigned int), 2 * ntiles, f) == size_t(2 * ntiles);
+        for (int i = 0; ok && i < ntiles; ++i) {
+            TileLocation t = { header + offsets[2 * i], int(offsets[2 * i + 1] - offsets[2 * i]) };
+            tiles.push_back(t);
+        }
+    } else if (ok) {
+        // maxLevel, tileSize, channels, root, tx, ty, flags
+        int maxLevel = h[0];
+        int ntiles = ((1 << (maxLevel * 2 + 2)) - 1) / 3;
+        long long header = 7 * sizeof(int) + 2 * ntiles * sizeof(long long);
+        vector<long long> offsets(2 * ntiles);
+        ok = fread(&offsets[0], sizeof(long long), 2 * ntiles, f) == size_t(2 * ntiles);
+        for (int i = 0; ok && i < ntiles; ++i) {
+            TileLocation t = { header + offsets[2 * i], int(offsets[2 * i + 1] - offsets[2 * i]) };
+            tiles.push_back(t);
+        }
+    }
+    fclose(f);
+    return ok;
+}
+
+/**
+ * Evicts the pages of the given file from the page cache.
+ */
+static void evictFile(const char *name)
+{
+    int fd = open(name, O_RDONLY);
+    if (fd >= 0) {
+        fdatasync(fd);
+        posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+        close(fd);
+    }
+}
+
+struct BenchThread
+{
+    pthread_t thread;
+
+    TileFile *file;
+
+    const vector<TileLocation> *tiles;
+
+    int first;
+
+    int step;
+
+    int batch;
+
+    unsigned int checksum;
+
+    long long bytes;
+};
+
+/**
+ * Reads the batches first, first+step, first+2*step, etc.
+ */
+static void *runBenchThread(void *arg)
+{
+    BenchThread *b = (BenchThread*) arg;
+    const vector<TileLocation> &tiles = *b->tiles;
+    vector<unsigned char> buffer;
+    for (int start = b->first * b->batch; start < int(tiles.size()); start += b->step * b->batch) {
+        int end = min(start + b->batch, int(tiles.size()));
+        for (int i = start; i < end; ++i) {
+            b->file->willNeed(tiles[i].offset, tiles[i].size);
+        }
+        b->file->submit();
+        for (int i = start; i < end; ++i) {
+            buffer.resize(max(size_t(tiles[i].size), buffer.size()));
+            void *handle;
+            const unsigned char *data = b->file->read(tiles[i].offset, tiles[i].size, &buffer[0], handle);
+            if (data != NULL) {
+                // the checksum does not depend on the order of the tiles
+                unsigned int h = 0;
+                for (int j = 0; j < tiles[i].size; j += 64) {
+                    h = h * 31 + data[j];
+                }
+                b->checksum += h;
+                b->bytes += tiles[i].size;
+            }
+            b->file->release(handle);
+        }
+    }
+    return NULL;
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc < 2) {
+        fprintf(stderr, "Usage: tileread-bench file.dat [dem|ortho [threads [batch]]]\n");
+        return 1;
+    }
+    const char *name = argv[1];
+    bool dem = argc <= 2 || strcmp(argv[2], "ortho") != 0;
+    int maxThreads = argc > 3 ? atoi(argv[3]) : 8;
+    int batch = argc > 4 ? atoi(argv[4]) : TileFile::MAX_REQUESTS / 2;
+
+    vector<TileLocation> tiles;
+    if (!readLocations(name, dem, tiles)) {
+        fprintf(stderr, "Cannot read %s\n", name);
+        return 1;
+    }
+    srand(1234);
+    random_shuffle(tiles.begin(), tiles.end());
+
+    const char *modeNames[3] = { "mmap", "pread", "uring" };
+    printf("mode,threads,tiles,MB,time(ms),tiles/s,MB/s,checksum\n");
+    for (int m = 0; m < 3; ++m) {
+        for (int threads = 1; threads <= maxThreads; threads *= 2) {
+            evictFile(name);
+            ptr<TileFile> file = new TileFile(name, TileFile::Mode(m));
+            vector<BenchThread> b(threads);
+            Timer timer;
+            timer.start();
+            for (int i = 0; i < threads; ++i) {
+                b[i].file = file.get();
+                b[i].tiles = &tiles;
+                b[i].first = i;
+                b[i].step = threads;
+                b[i].batch = batch;
+                b[i].checksum = 0;
+                b[i].bytes = 0;
+                pthread_create(&b[i].thread, NULL, runBenchThread, &b[i]);
+            }
+            unsigned int checksum = 0;
+            long long bytes = 0;
+            for (int i = 0; i < threads; ++i) {
+                pthread_join(b[i].thread, NULL);
+                checksum += b[i].checksum;
+                bytes += b[i].bytes;
+            }
+            double time = timer.end() / 1e3;
+            double mb = bytes / (1024.0 * 1024.0);
+            printf("%s,%d,%d,%.1f,%.1f,%.0f,%.1f,%08x\n", modeNames[file->getMode()], threads, int(tiles.size()),
+                mb, time, tiles.size() / (time / 1e3), mb / (time / 1e3), checksum);
+            fflush(stdout);
+        }
+    }
+    return 0;
+}
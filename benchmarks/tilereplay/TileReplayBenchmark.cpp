@@ -0,0 +1,294 @@
+/*
+ * Proland: a procedural landscape rendering library.
+ * Website : http://proland.inrialpes.fr/
+ * Copyright (c) 2008-2015 INRIA - LJK (CNRS - Grenoble University)
+ * All rights reserved.
+ * Redistribution and use in source and binary forms, with or without 
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice, 
+ * this list of conditions and the following disclaimer.
+ * 
+ * 2. Redistributions in binary form must reproduce the above copyright notice, 
+ * this list of conditions and the following disclaimer in the documentation 
+ * and/or other materials provided with the distribution.
+ * 
+ * 3. Neither the name of the copyright holder nor the names of its contributors 
+ * may be used to endorse or promote products derived from this software without 
+ * specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND 
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED 
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. 
+ * IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, 
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, 
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, 
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF 
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE 
+ * OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED 
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+/*
+ * Proland is distributed under the Berkeley Software Distribution 3 Licence. 
+ * For any assistance, feedback and enquiries about training programs, you can check out the 
+ * contact page on our website : 
+ * http://proland.inrialpes.fr/
+ */
+/*
+ * Main authors: Eric Bruneton, Antoine Begault, Guillaume Piolat.
+ */
+
+/*
+ * A benchmark comparing the hit rates of the TileCache eviction policies (see
+ * TileEvictionPolicy). It replays a trace of tile requests, recorded with
+ * TileCache#startTrace (or the "trace" attribute of a tileCache resource), on
+ * caches of several capacities using each policy in turn. If no trace file is
+ * given, a synthetic trace is generated, simulating a viewer flying over a
+ * terrain with two producers of very different tile creation costs. The tile
+ * creation tasks are executed synchronously, each one busy waiting during the
+ * recorded creation time of its producer (multiplied by a scale factor), so
+ * that the GreedyDual policies can measure it. The benchmark prints, in CSV
+ * format, the hit rate of each policy, and the total creation time of the
+ * missed tiles (using the recorded creation times, not the scaled ones).
+ *
+ * Usage: tilereplay-bench [traceFile|- [capacity [scale]]]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <map>
+#include <vector>
+
+#include "ork/core/Timer.h"
+#include "proland/producer/CPUTileStorage.h"
+#include "proland/producer/TileEvictionPolicy.h"
+#include "proland/producer/TileProducer.h"
+
+using namespace std;
+using namespace ork;
+using namespace proland;
+
+/**
+ * A recorded tile request.
+ */
+struct Request
+{
+    char type;
+
+    int producerId;
+
+    int level;
+
+    int tx;
+
+    int ty;
+};
+
+/**
+ * Busy waits during the given duration, in micro seconds.
+ */
+static void spin(double duration)
+{
+    timespec t0, t1;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    do {
+        clock_gettime(CLOCK_MONOTONIC, &t1);
+    } while ((t1.tv_sec - t0.tv_sec) * 1e6 + (t1.tv_nsec - t0.tv_nsec) * 1e-3 < duration);
+}
+
+/**
+ * A CPU producer whose tiles take a given time to create.
+ */
+class ReplayProducer : public TileProducer
+{
+public:
+    ReplayProducer(ptr<TileCache> cache, double cost) :
+        TileProducer("ReplayProducer", "CreateReplayTile", cache, false), cost(cost)
+    {
+    }
+
+protected:
+    virtual bool doCreateTile(int, int, int, TileStorage::Slot*)
+    {
+        spin(cost);
+        return true;
+    }
+
+private:
+    double cost;
+};
+
+/**
+ * Loads a trace recorded with TileCache#startTrace.
+ */
+static bool loadTrace(const char *file, vector<Request> &requests, map<int, double> &costs)
+{
+    FILE *f = fopen(file, "r");
+    if (f == NULL) {
+        return false;
+    }
+    char line[256];
+    while (fgets(line, sizeof(line), f) != NULL) {
+        Request r;
+        double cost;
+        if (line[0] == 'c' && sscanf(line + 1, "%d %lf", &r.producerId, &cost) == 2) {
+            costs[r.producerId] = cost;
+        } else if (sscanf(line, "%c %d %d %d %d", &r.type, &r.producerId, &r.level, &r.tx, &r.ty) == 5) {
+            requests.push_back(r);
+        }
+    }
+    fclose(f);
+    return true;
+}
+
+/**
+ * Adds to the synthetic trace the requests for the tiles of a terrain
+ * quadtree, subdivided around the given viewer position.
+ */
+static void getQuads(double x, double y, int level, int tx, int ty, int maxLevel, vector<Request> &frame)
+{
+    for (int p = 0; p < 2; ++p) {
+        Request r = { 'g', p, level, tx, ty };
+        frame.push_back(r);
+    }
+    double size = 1.0 / (1 << level);
+    double dx = max(fabs(x - (tx + 0.5) * size) - size / 2, 0.0);
+    double dy = max(fabs(y - (ty + 0.5) * size) - size / 2, 0.0);
+    if (level < maxLevel && sqrt(dx * dx + dy * dy) < 2.0 * size) {
+        for (int i = 0; i < 4; ++i) {
+            getQuads(x, y, level + 1, 2 * tx + i % 2, 2 * ty + i / 2, maxLevel, frame);
+        }
+    }
+}
+
+/**
+ * Generates a synthetic trace, simulating a viewer flying over a terrain with
+ * an elevation %producer (producer 0), and a much more expensive texture
+ * %producer (producer 1).
+ */
+static void generateTrace(int frames, vector<Request> &requests, map<int, double> &costs)
+{
+    vector<Request> previous;
+    for (int i = 0; i < frames; ++i) {
+        double t = i * 0.002;
+        double x = 0.5 + 0.45 * sin(t);
+        double y = 0.5 + 0.45 * sin(1.7 * t + 1.0);
+        vector<Request> frame;
+        getQuads(x, y, 0, 0, 0, 12, frame);
+        requests.insert(requests.end(), frame.begin(), frame.end());
+        for (unsigned int j = 0; j < previous.size(); ++j) {
+            previous[j].type = 'p';
+            requests.push_back(previous[j]);
+        }
+        previous = frame;
+    }
+    for (unsigned int j = 0; j < previous.size(); ++j) {
+        previous[j].type = 'p';
+        requests.push_back(previous[j]);
+    }
+    costs[0] = 100.0;
+    costs[1] = 2000.0;
+}
+
+/**
+ * Replays a trace on a cache of the given capacity with the given eviction
+ * policy, and prints the hit rate and the creation time of the missed tiles.
+ */
+static void replay(const char *name, ptr<TileEvictionPolicy> policy, int capacity, double scale,
+    const vector<Request> &requests, map<int, double> &costs)
+{
+    ptr<TileStorage> storage = new CPUTileStorage<float>(4, 1, capacity);
+    ptr<TileCache> cache = new TileCache(storage, "replayCache");
+    cache->setEvictionPolicy(policy);
+    vector< ptr<TileProducer> > producers;
+    int maxId = costs.empty() ? -1 : costs.rbegin()->first;
+    for (unsigned int i = 0; i < requests.size(); ++i) {
+        maxId = max(maxId, requests[i].producerId);
+    }
+    for (int i = 0; i <= maxId; ++i) {
+        // the producers get the same local ids as in the trace, i.e. 0,1,...
+        producers.push_back(new ReplayProducer(cache, costs[i] * scale));
+    }
+
+    map<TileCache::Tile::Key, vector<TileCache::Tile*> > held;
+    int gets = 0;
+    int hits = 0;
+    int failures = 0;
+    double missCost = 0.0;
+    Timer timer;
+    timer.start();
+    for (unsigned int i = 0; i < requests.size(); ++i) {
+        const Request &r = requests[i];
+        TileCache::Tile::Key key = TileCache::Tile::getKey(r.producerId, r.level, r.tx, r.ty);
+        ptr<Task> task;
+        if (r.type == 'g') {
+            ++gets;
+            if (cache->findTile(r.producerId, r.level, r.tx, r.ty, true) != NULL) {
+                ++hits;
+            }
+            TileCache::Tile *t = cache->getTile(r.producerId, r.level, r.tx, r.ty, 0);
+            if (t == NULL) {
+                ++failures;
+                continue;
+            }
+            held[key].push_back(t);
+            task = t->task;
+        } else if (r.type == 'p') {
+            vector<TileCache::Tile*> &h = held[key];
+            if (!h.empty()) {
+                cache->putTile(h.back());
+                h.pop_back();
+            }
+        } else if (r.type == 'f') {
+            task = cache->prefetchTile(r.producerId, r.level, r.tx, r.ty);
+        }
+        if (task != NULL && !task->isDone()) {
+            task->run();
+            task->setIsDone(true, 0);
+            missCost += costs[r.producerId];
+        }
+    }
+    double duration = timer.end();
+    map<TileCache::Tile::Key, vector<TileCache::Tile*> >::iterator j = held.begin();
+    while (j != held.end()) {
+        for (unsigned int k = 0; k < j->second.size(); ++k) {
+            cache->putTile(j->second[k]);
+        }
+        ++j;
+    }
+    printf("%s,%d,%d,%d,%d,%.4f,%.1f,%.1f\n", name, capacity, gets, hits, failures,
+        gets == 0 ? 0.0 : double(hits) / gets, missCost * 1e-3, duration * 1e-3);
+}
+
+int main(int argc, char *argv[])
+{
+    vector<Request> requests;
+    map<int, double> costs;
+    if (argc > 1 && strcmp(argv[1], "-") != 0) {
+        if (!loadTrace(argv[1], requests, costs)) {
+            fprintf(stderr, "cannot read trace file %s\n", argv[1]);
+            return 1;
+        }
+    } else {
+        generateTrace(2000, requests, costs);
+    }
+    int capacity = argc > 2 ? atoi(argv[2]) : 0;
+    double scale = argc > 3 ? atof(argv[3]) : 0.01;
+
+    printf("policy,capacity,gets,hits,failures,hit rate,miss cost (ms),replay time (ms)\n");
+    for (int c = 512; c <= 4096; c *= 2) {
+        int cap = capacity > 0 ? capacity : c;
+        replay("lru", new TileEvictionPolicy(), cap, scale, requests, costs);
+        replay("levelWeighted", new LevelWeightedEvictionPolicy(8, 1.0f), cap, scale, requests, costs);
+        replay("greedyDual", new GreedyDualEvictionPolicy(8), cap, scale, requests, costs);
+        replay("greedyDualLevelWeighted", new GreedyDualEvictionPolicy(8, 1.0f), cap, scale, requests, costs);
+        if (capacity > 0) {
+            break;
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,103 @@
+/*
+ * Proland: a procedural landscape rendering library.
+ * Website : http://proland.inrialpes.fr/
+ * Copyright (c) 2008-2015 INRIA - LJK (CNRS - Grenoble University)
+ * All rights reserved.
+ * Redistribution and use in source and binary forms, with or without 
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice, 
+ * this list of conditions and the following disclaimer.
+ * 
+ * 2. Redistributions in binary form must reproduce the above copyright notice, 
+ * this list of conditions and the following disclaimer in the documentation 
+ * and/or other materials provided with the distribution.
+ * 
+ * 3. Neither the name of the copyright holder nor the names of its contributors 
+ * may be used to endorse or promote products derived from this software without 
+ * specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND 
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED 
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. 
+ * IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, 
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, 
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, 
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF 
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE 
+ * OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED 
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+/*
+ * Proland is distributed under the Berkeley Software Distribution 3 Licence. 
+ * For any assistance, feedback and enquiries about training programs, you can check out the 
+ * contact page on our website : 
+ * http://proland.inrialpes.fr/
+ */
+/*
+ * Main authors: Eric Bruneton, Antoine Begault, Guillaume Piolat.
+ */
+
+/*
+ * A benchmark of the upsampling kernels used to compute elevation tiles from
+ * their parent tile (see proland::upsample). For several tile sizes, and for
+ * each instruction set available on this CPU, it measures the time needed to
+ * upsample a tile. The results are printed in CSV format. The results
+ * themselves are checked by upsample-test.
+ *
+ * Usage: upsample-bench [iterations]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <algorithm>
+#include <vector>
+
+#include "ork/core/Timer.h"
+#include "proland/math/upsample.h"
+
+using namespace std;
+using namespace ork;
+using namespace proland;
+
+int main(int argc, char *argv[])
+{
+    int iterations = argc > 1 ? max(1, atoi(argv[1])) : 2000;
+    const int tileSizes[4] = { 24, 96, 192, 248 };
+
+    srand(1234);
+    printf("isa,tileSize,time(us),tiles/s,speedup\n");
+    for (int t = 0; t < 4; ++t) {
+        int tileSize = tileSizes[t];
+        int n = tileSize + 5;
+        vector<float> parent(n * n);
+        for (int i = 0; i < n * n; ++i) {
+            parent[i] = (rand() % 200001 - 100000) / 37.0f;
+        }
+        vector<float> result(4 * n * n);
+
+        double scalarTime = 0.0;
+        for (int isa = UPSAMPLE_SCALAR; isa <= UPSAMPLE_NEON; ++isa) {
+            if (!isUpsampleIsaAvailable(UpsampleIsa(isa))) {
+                continue;
+            }
+            Timer timer;
+            timer.start();
+            for (int i = 0; i < iterations; ++i) {
+                int q = i % 4;
+                int px = 1 + (q % 2) * tileSize / 2;
+                int py = 1 + (q / 2) * tileSize / 2;
+                upsample(&parent[0], n, px, py, n, &result[q * n * n], UpsampleIsa(isa));
+            }
+            double time = timer.end() / iterations;
+            if (isa == UPSAMPLE_SCALAR) {
+                scalarTime = time;
+            }
+            printf("%s,%d,%.2f,%.0f,%.2f\n", getUpsampleIsaName(UpsampleIsa(isa)), tileSize,
+                time, 1e6 / time, scalarTime / time);
+            fflush(stdout);
+        }
+    }
+    return 0;
+}
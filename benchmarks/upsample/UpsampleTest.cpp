@@ -0,0 +1,101 @@
+/*
+ * Proland: a procedural landscape rendering library.
+ * Website : http://proland.inrialpes.fr/
+ * Copyright (c) 2008-2015 INRIA - LJK (CNRS - Grenoble University)
+ * All rights reserved.
+ * Redistribution and use in source and binary forms, with or without 
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice, 
+ * this list of conditions and the following disclaimer.
+ * 
+ * 2. Redistributions in binary form must reproduce the above copyright notice, 
+ * this list of conditions and the following disclaimer in the documentation 
+ * and/or other materials provided with the distribution.
+ * 
+ * 3. Neither the name of the copyright holder nor the names of its contributors 
+ * may be used to endorse or promote products derived from this software without 
+ * specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND 
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED 
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. 
+ * IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, 
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, 
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, 
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF 
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE 
+ * OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED 
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+/*
+ * Proland is distributed under the Berkeley Software Distribution 3 Licence. 
+ * For any assistance, feedback and enquiries about training programs, you can check out the 
+ * contact page on our website : 
+ * http://proland.inrialpes.fr/
+ */
+/*
+ * Main authors: Eric Bruneton, Antoine Begault, Guillaume Piolat.
+ */
+
+/*
+ * A test of the upsampling kernels used to compute elevation tiles from
+ * their parent tile (see proland::upsample). For several tile sizes, and for
+ * each instruction set available on this CPU, it checks that the result is
+ * identical, bit for bit, to the result of the scalar reference kernel. The
+ * exit code is 1 if some results differ from the reference.
+ *
+ * Usage: upsample-test
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+
+#include "proland/math/upsample.h"
+
+using namespace std;
+using namespace proland;
+
+int main()
+{
+    const int tileSizes[4] = { 24, 96, 192, 248 };
+    bool exact = true;
+
+    srand(1234);
+    printf("isa,tileSize,result\n");
+    for (int t = 0; t < 4; ++t) {
+        int tileSize = tileSizes[t];
+        int n = tileSize + 5;
+        vector<float> parent(n * n);
+        for (int i = 0; i < n * n; ++i) {
+            parent[i] = (rand() % 200001 - 100000) / 37.0f;
+        }
+        vector<float> reference(4 * n * n);
+        vector<float> result(4 * n * n);
+        for (int q = 0; q < 4; ++q) {
+            int px = 1 + (q % 2) * tileSize / 2;
+            int py = 1 + (q / 2) * tileSize / 2;
+            upsample(&parent[0], n, px, py, n, &reference[q * n * n], UPSAMPLE_SCALAR);
+        }
+
+        for (int isa = UPSAMPLE_SCALAR; isa <= UPSAMPLE_NEON; ++isa) {
+            if (!isUpsampleIsaAvailable(UpsampleIsa(isa))) {
+                continue;
+            }
+            // checks the four sub tiles
+            memset(&result[0], 0, result.size() * sizeof(float));
+            for (int q = 0; q < 4; ++q) {
+                int px = 1 + (q % 2) * tileSize / 2;
+                int py = 1 + (q / 2) * tileSize / 2;
+                upsample(&parent[0], n, px, py, n, &result[q * n * n], UpsampleIsa(isa));
+            }
+            bool same = memcmp(&result[0], &reference[0], result.size() * sizeof(float)) == 0;
+            exact = exact && same;
+            printf("%s,%d,%s\n", getUpsampleIsaName(UpsampleIsa(isa)), tileSize, same ? "ok" : "FAILED");
+        }
+    }
+    return exact ? 0 : 1;
+}
@@ -26,20 +26,25 @@
  */
 
 uniform struct {
-    vec4 offset;
-    vec4 camera;
     vec2 blending;
     mat4 localToScreen;
 } deformation;
 
+// quad specific uniforms of all the quads drawn in batched mode, one row per
+// quad (see DrawTerrainTask); the first column contains deformation.offset
+uniform sampler2D quadParameters;
+uniform int firstQuad;
+
 #ifdef _VERTEX_
 
 layout(location=0) in vec3 vertex;
 out vec4 p;
+flat out vec4 offset;
 
 void main() {
-    p = vec4(vertex.xy * deformation.offset.z + deformation.offset.xy, 0.0, 1.0);
-    
+    offset = texelFetch(quadParameters, ivec2(0, firstQuad + gl_InstanceID), 0);
+    p = vec4(vertex.xy * offset.z + offset.xy, 0.0, 1.0);
+
     gl_Position = deformation.localToScreen * p;
 }
 
@@ -48,11 +53,12 @@ void main() {
 #ifdef _FRAGMENT_
 
 in vec4 p;
+flat in vec4 offset;
 layout(location=0) out vec4 data;
 
 void main() {
     data = vec4(vec3(0.2 + 0.2 * sin(0.1 * length(p.xy))), 1.0);
-    data.r += mod(dot(floor(deformation.offset.xy / deformation.offset.z + 0.5), vec2(1.0)), 2.0);
+    data.r += mod(dot(floor(offset.xy / offset.z + 0.5), vec2(1.0)), 2.0);
 }
 
 #endif
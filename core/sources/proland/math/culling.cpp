@@ -0,0 +1,609 @@
+/*
+ * Proland: a procedural landscape rendering library.
+ * Website : http://proland.inrialpes.fr/
+ * Copyright (c) 2008-2015 INRIA - LJK (CNRS - Grenoble University)
+ * All rights reserved.
+ * Redistribution and use in source and binary forms, with or without 
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice, 
+ * this list of conditions and the following disclaimer.
+ * 
+ * 2. Redistributions in binary form must reproduce the above copyright notice, 
+ * this list of conditions and the following disclaimer in the documentation 
+ * and/or other materials provided with the distribution.
+ * 
+ * 3. Neither the name of the copyright holder nor the names of its contributors 
+ * may be used to endorse or promote products derived from this software without 
+ * specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND 
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED 
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. 
+ * IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, 
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, 
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, 
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF 
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE 
+ * OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED 
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+/*
+ * Proland is distributed under the Berkeley Software Distribution 3 Licence. 
+ * For any assistance, feedback and enquiries about training programs, you can check out the 
+ * contact page on our website : 
+ * http://proland.inrialpes.fr/
+ */
+/*
+ * Main authors: Eric Bruneton, Antoine Begault, Guillaume Piolat.
+ */
+
+#include "proland/math/culling.h"
+
+#include <cmath>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define PROLAND_CULLING_SSE2
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define PROLAND_CULLING_AVX
+#endif
+#endif
+
+using namespace std;
+
+namespace proland
+{
+
+// ----------------------------------------------------------------------------
+// Scalar kernels (reference implementation)
+// ----------------------------------------------------------------------------
+
+// max and min with the same semantics as the SSE and AVX instructions (the
+// second argument is returned if the arguments are equal or unordered)
+
+static inline double maxd(double a, double b)
+{
+    return a > b ? a : b;
+}
+
+static inline double mind(double a, double b)
+{
+    return a < b ? a : b;
+}
+
+static inline SceneManager::visibility getVisibility(bool invisible, bool fullyVisible)
+{
+    return invisible ? SceneManager::INVISIBLE : (fullyVisible ? SceneManager::FULLY_VISIBLE : SceneManager::PARTIALLY_VISIBLE);
+}
+
+static SceneManager::visibility frustumScalar(const vec4d *planes, const BoxBatch &b, int i)
+{
+    bool fullyVisible = true;
+    for (int j = 0; j < 5; ++j) {
+        const vec4d &p = planes[j];
+        double x0 = b.xmin[i] * p.x;
+        double x1 = b.xmax[i] * p.x;
+        double y0 = b.ymin[i] * p.y;
+        double y1 = b.ymax[i] * p.y;
+        double z0 = b.zmin[i] * p.z;
+        double z1 = b.zmax[i] * p.z;
+        // the maximum and minimum plane distances of the 8 box corners
+        // (exactly, since rounding is monotonic)
+        double hi = maxd(x0, x1) + maxd(y0, y1) + maxd(z0, z1) + p.w;
+        double lo = mind(x0, x1) + mind(y0, y1) + mind(z0, z1) + p.w;
+        if (hi <= 0.0) {
+            return SceneManager::INVISIBLE;
+        }
+        fullyVisible = fullyVisible && lo > 0.0;
+    }
+    return getVisibility(false, fullyVisible);
+}
+
+static SceneManager::visibility sphericalScalar(double R, const vec3d &c, double lSq, const vec4d *planes, const BoxBatch &b, int i)
+{
+    double xs[4] = { b.xmin[i], b.xmax[i], b.xmax[i], b.xmin[i] };
+    double ys[4] = { b.ymin[i], b.ymin[i], b.ymax[i], b.ymax[i] };
+    double zr = b.zmin[i] + R;
+    double X[4];
+    double Y[4];
+    double Z[4];
+    for (int k = 0; k < 4; ++k) {
+        double s = zr / sqrt(xs[k] * xs[k] + ys[k] * ys[k] + R * R);
+        X[k] = xs[k] * s;
+        Y[k] = ys[k] * s;
+        Z[k] = R * s;
+    }
+    double a = (b.zmax[i] + R) / zr;
+    double dx = (b.xmax[i] - b.xmin[i]) * 0.5 * a;
+    double dy = (b.ymax[i] - b.ymin[i]) * 0.5 * a;
+    double dz = b.zmax[i] + R;
+    double f = sqrt(dx * dx + dy * dy + dz * dz) / zr;
+
+    double rm = R + mind(b.zmin[i], 0.0);
+    double rM = R + b.zmax[i];
+    double rmSq = rm * rm;
+    double rMSq = rM * rM;
+    vec4d farPlane = vec4d(c.x, c.y, c.z, sqrt((lSq - rmSq) * (rMSq - rmSq)) - rmSq);
+
+    bool fullyVisible = true;
+    for (int j = 0; j < 6; ++j) {
+        const vec4d &p = j < 5 ? planes[j] : farPlane;
+        bool all = true;
+        bool any = false;
+        for (int k = 0; k < 4; ++k) {
+            double o = X[k] * p.x + Y[k] * p.y + Z[k] * p.z;
+            bool s1 = o + p.w > 0.0;
+            bool s2 = o * f + p.w > 0.0;
+            all = all && s1 && s2;
+            any = any || s1 || s2;
+        }
+        if (!any) {
+            return SceneManager::INVISIBLE;
+        }
+        fullyVisible = fullyVisible && all;
+    }
+    return getVisibility(false, fullyVisible);
+}
+
+static bool isBelowHorizonScalar(const float *horizon, int imin, int imax, float z)
+{
+    for (int i = imin; i <= imax; ++i) {
+        if (z > horizon[i]) {
+            return false;
+        }
+    }
+    return imax >= imin;
+}
+
+static void raiseHorizonScalar(float *horizon, int imin, int imax, float z)
+{
+    for (int i = imin; i <= imax; ++i) {
+        horizon[i] = z > horizon[i] ? z : horizon[i];
+    }
+}
+
+// ----------------------------------------------------------------------------
+// SSE2 kernels (two boxes at once)
+// ----------------------------------------------------------------------------
+
+#ifdef PROLAND_CULLING_SSE2
+
+static void frustumSSE2(const vec4d *planes, int n, const BoxBatch &b, SceneManager::visibility *result)
+{
+    const __m128d zero = _mm_setzero_pd();
+    int i = 0;
+    for (; i + 2 <= n; i += 2) {
+        __m128d xmin = _mm_loadu_pd(b.xmin + i);
+        __m128d xmax = _mm_loadu_pd(b.xmax + i);
+        __m128d ymin = _mm_loadu_pd(b.ymin + i);
+        __m128d ymax = _mm_loadu_pd(b.ymax + i);
+        __m128d zmin = _mm_loadu_pd(b.zmin + i);
+        __m128d zmax = _mm_loadu_pd(b.zmax + i);
+        __m128d invisible = zero;
+        __m128d fullyVisible = _mm_cmpeq_pd(zero, zero);
+        for (int j = 0; j < 5; ++j) {
+            const vec4d &p = planes[j];
+            __m128d px = _mm_set1_pd(p.x);
+            __m128d py = _mm_set1_pd(p.y);
+            __m128d pz = _mm_set1_pd(p.z);
+            __m128d pw = _mm_set1_pd(p.w);
+            __m128d x0 = _mm_mul_pd(xmin, px);
+            __m128d x1 = _mm_mul_pd(xmax, px);
+            __m128d y0 = _mm_mul_pd(ymin, py);
+            __m128d y1 = _mm_mul_pd(ymax, py);
+            __m128d z0 = _mm_mul_pd(zmin, pz);
+            __m128d z1 = _mm_mul_pd(zmax, pz);
+            __m128d hi = _mm_add_pd(_mm_add_pd(_mm_add_pd(_mm_max_pd(x0, x1), _mm_max_pd(y0, y1)), _mm_max_pd(z0, z1)), pw);
+            __m128d lo = _mm_add_pd(_mm_add_pd(_mm_add_pd(_mm_min_pd(x0, x1), _mm_min_pd(y0, y1)), _mm_min_pd(z0, z1)), pw);
+            invisible = _mm_or_pd(invisible, _mm_cmple_pd(hi, zero));
+            fullyVisible = _mm_and_pd(fullyVisible, _mm_cmpgt_pd(lo, zero));
+        }
+        int inv = _mm_movemask_pd(invisible);
+        int full = _mm_movemask_pd(fullyVisible);
+        result[i] = getVisibility((inv & 1) != 0, (full & 1) != 0);
+        result[i + 1] = getVisibility((inv & 2) != 0, (full & 2) != 0);
+    }
+    for (; i < n; ++i) {
+        result[i] = frustumScalar(planes, b, i);
+    }
+}
+
+static void sphericalSSE2(double R, const vec3d &c, double lSq, const vec4d *planes, int n, const BoxBatch &b, SceneManager::visibility *result)
+{
+    const __m128d zero = _mm_setzero_pd();
+    const __m128d r = _mm_set1_pd(R);
+    const __m128d rSq = _mm_set1_pd(R * R);
+    const __m128d half = _mm_set1_pd(0.5);
+    int i = 0;
+    for (; i + 2 <= n; i += 2) {
+        __m128d xmin = _mm_loadu_pd(b.xmin + i);
+        __m128d xmax = _mm_loadu_pd(b.xmax + i);
+        __m128d ymin = _mm_loadu_pd(b.ymin + i);
+        __m128d ymax = _mm_loadu_pd(b.ymax + i);
+        __m128d zmin = _mm_loadu_pd(b.zmin + i);
+        __m128d zmax = _mm_loadu_pd(b.zmax + i);
+        __m128d xs[4] = { xmin, xmax, xmax, xmin };
+        __m128d ys[4] = { ymin, ymin, ymax, ymax };
+        __m128d zr = _mm_add_pd(zmin, r);
+        __m128d X[4];
+        __m128d Y[4];
+        __m128d Z[4];
+        for (int k = 0; k < 4; ++k) {
+            __m128d l = _mm_sqrt_pd(_mm_add_pd(_mm_add_pd(_mm_mul_pd(xs[k], xs[k]), _mm_mul_pd(ys[k], ys[k])), rSq));
+            __m128d s = _mm_div_pd(zr, l);
+            X[k] = _mm_mul_pd(xs[k], s);
+            Y[k] = _mm_mul_pd(ys[k], s);
+            Z[k] = _mm_mul_pd(r, s);
+        }
+        __m128d a = _mm_div_pd(_mm_add_pd(zmax, r), zr);
+        __m128d dx = _mm_mul_pd(_mm_mul_pd(_mm_sub_pd(xmax, xmin), half), a);
+        __m128d dy = _mm_mul_pd(_mm_mul_pd(_mm_sub_pd(ymax, ymin), half), a);
+        __m128d dz = _mm_add_pd(zmax, r);
+        __m128d f = _mm_div_pd(_mm_sqrt_pd(_mm_add_pd(_mm_add_pd(_mm_mul_pd(dx, dx), _mm_mul_pd(dy, dy)), _mm_mul_pd(dz, dz))), zr);
+
+        __m128d rm = _mm_add_pd(r, _mm_min_pd(zmin, zero));
+        __m128d rM = _mm_add_pd(r, zmax);
+        __m128d rmSq = _mm_mul_pd(rm, rm);
+        __m128d rMSq = _mm_mul_pd(rM, rM);
+        __m128d farW = _mm_sub_pd(_mm_sqrt_pd(_mm_mul_pd(_mm_sub_pd(_mm_set1_pd(lSq), rmSq), _mm_sub_pd(rMSq, rmSq))), rmSq);
+
+        __m128d invisible = zero;
+        __m128d fullyVisible = _mm_cmpeq_pd(zero, zero);
+        for (int j = 0; j < 6; ++j) {
+            __m128d px = _mm_set1_pd(j < 5 ? planes[j].x : c.x);
+            __m128d py = _mm_set1_pd(j < 5 ? planes[j].y : c.y);
+            __m128d pz = _mm_set1_pd(j < 5 ? planes[j].z : c.z);
+            __m128d pw = j < 5 ? _mm_set1_pd(planes[j].w) : farW;
+            __m128d all = _mm_cmpeq_pd(zero, zero);
+            __m128d any = zero;
+            for (int k = 0; k < 4; ++k) {
+                __m128d o = _mm_add_pd(_mm_add_pd(_mm_mul_pd(X[k], px), _mm_mul_pd(Y[k], py)), _mm_mul_pd(Z[k], pz));
+                __m128d s1 = _mm_cmpgt_pd(_mm_add_pd(o, pw), zero);
+                __m128d s2 = _mm_cmpgt_pd(_mm_add_pd(_mm_mul_pd(o, f), pw), zero);
+                all = _mm_and_pd(all, _mm_and_pd(s1, s2));
+                any = _mm_or_pd(any, _mm_or_pd(s1, s2));
+            }
+            invisible = _mm_or_pd(invisible, _mm_xor_pd(any, _mm_cmpeq_pd(zero, zero)));
+            fullyVisible = _mm_and_pd(fullyVisible, all);
+        }
+        int inv = _mm_movemask_pd(invisible);
+        int full = _mm_movemask_pd(fullyVisible);
+        result[i] = getVisibility((inv & 1) != 0, (full & 1) != 0);
+        result[i + 1] = getVisibility((inv & 2) != 0, (full & 2) != 0);
+    }
+    for (; i < n; ++i) {
+        result[i] = sphericalScalar(R, c, lSq, planes, b, i);
+    }
+}
+
+static bool isBelowHorizonSSE2(const float *horizon, int imin, int imax, float z)
+{
+    __m128 zv = _mm_set1_ps(z);
+    int i = imin;
+    for (; i + 4 <= imax + 1; i += 4) {
+        if (_mm_movemask_ps(_mm_cmpgt_ps(zv, _mm_loadu_ps(horizon + i))) != 0) {
+            return false;
+        }
+    }
+    for (; i <= imax; ++i) {
+        if (z > horizon[i]) {
+            return false;
+        }
+    }
+    return imax >= imin;
+}
+
+static void raiseHorizonSSE2(float *horizon, int imin, int imax, float z)
+{
+    __m128 zv = _mm_set1_ps(z);
+    int i = imin;
+    for (; i + 4 <= imax + 1; i += 4) {
+        _mm_storeu_ps(horizon + i, _mm_max_ps(zv, _mm_loadu_ps(horizon + i)));
+    }
+    for (; i <= imax; ++i) {
+        horizon[i] = z > horizon[i] ? z : horizon[i];
+    }
+}
+
+#endif
+
+// ----------------------------------------------------------------------------
+// AVX kernels (four boxes at once, compiled for AVX even if the rest of the
+// code is not)
+// ----------------------------------------------------------------------------
+
+#ifdef PROLAND_CULLING_AVX
+
+__attribute__((target("avx")))
+static inline void getVisibilityAVX(__m256d invisible, __m256d fullyVisible, SceneManager::visibility *result)
+{
+    int inv = _mm256_movemask_pd(invisible);
+    int full = _mm256_movemask_pd(fullyVisible);
+    for (int k = 0; k < 4; ++k) {
+        result[k] = getVisibility((inv & (1 << k)) != 0, (full & (1 << k)) != 0);
+    }
+}
+
+__attribute__((target("avx")))
+static void frustumAVX(const vec4d *planes, int n, const BoxBatch &b, SceneManager::visibility *result)
+{
+    const __m256d zero = _mm256_setzero_pd();
+    int i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m256d xmin = _mm256_loadu_pd(b.xmin + i);
+        __m256d xmax = _mm256_loadu_pd(b.xmax + i);
+        __m256d ymin = _mm256_loadu_pd(b.ymin + i);
+        __m256d ymax = _mm256_loadu_pd(b.ymax + i);
+        __m256d zmin = _mm256_loadu_pd(b.zmin + i);
+        __m256d zmax = _mm256_loadu_pd(b.zmax + i);
+        __m256d invisible = zero;
+        __m256d fullyVisible = _mm256_cmp_pd(zero, zero, _CMP_EQ_OQ);
+        for (int j = 0; j < 5; ++j) {
+            const vec4d &p = planes[j];
+            __m256d px = _mm256_set1_pd(p.x);
+            __m256d py = _mm256_set1_pd(p.y);
+            __m256d pz = _mm256_set1_pd(p.z);
+            __m256d pw = _mm256_set1_pd(p.w);
+            __m256d x0 = _mm256_mul_pd(xmin, px);
+            __m256d x1 = _mm256_mul_pd(xmax, px);
+            __m256d y0 = _mm256_mul_pd(ymin, py);
+            __m256d y1 = _mm256_mul_pd(ymax, py);
+            __m256d z0 = _mm256_mul_pd(zmin, pz);
+            __m256d z1 = _mm256_mul_pd(zmax, pz);
+            __m256d hi = _mm256_add_pd(_mm256_add_pd(_mm256_add_pd(_mm256_max_pd(x0, x1), _mm256_max_pd(y0, y1)), _mm256_max_pd(z0, z1)), pw);
+            __m256d lo = _mm256_add_pd(_mm256_add_pd(_mm256_add_pd(_mm256_min_pd(x0, x1), _mm256_min_pd(y0, y1)), _mm256_min_pd(z0, z1)), pw);
+            invisible = _mm256_or_pd(invisible, _mm256_cmp_pd(hi, zero, _CMP_LE_OQ));
+            fullyVisible = _mm256_and_pd(fullyVisible, _mm256_cmp_pd(lo, zero, _CMP_GT_OQ));
+        }
+        getVisibilityAVX(invisible, fullyVisible, result + i);
+    }
+    for (; i < n; ++i) {
+        result[i] = frustumScalar(planes, b, i);
+    }
+}
+
+__attribute__((target("avx")))
+static void sphericalAVX(double R, const vec3d &c, double lSq, const vec4d *planes, int n, const BoxBatch &b, SceneManager::visibility *result)
+{
+    const __m256d zero = _mm256_setzero_pd();
+    const __m256d ones = _mm256_cmp_pd(zero, zero, _CMP_EQ_OQ);
+    const __m256d r = _mm256_set1_pd(R);
+    const __m256d rSq = _mm256_set1_pd(R * R);
+    const __m256d half = _mm256_set1_pd(0.5);
+    int i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m256d xmin = _mm256_loadu_pd(b.xmin + i);
+        __m256d xmax = _mm256_loadu_pd(b.xmax + i);
+        __m256d ymin = _mm256_loadu_pd(b.ymin + i);
+        __m256d ymax = _mm256_loadu_pd(b.ymax + i);
+        __m256d zmin = _mm256_loadu_pd(b.zmin + i);
+        __m256d zmax = _mm256_loadu_pd(b.zmax + i);
+        __m256d xs[4] = { xmin, xmax, xmax, xmin };
+        __m256d ys[4] = { ymin, ymin, ymax, ymax };
+        __m256d zr = _mm256_add_pd(zmin, r);
+        __m256d X[4];
+        __m256d Y[4];
+        __m256d Z[4];
+        for (int k = 0; k < 4; ++k) {
+            __m256d l = _mm256_sqrt_pd(_mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(xs[k], xs[k]), _mm256_mul_pd(ys[k], ys[k])), rSq));
+            __m256d s = _mm256_div_pd(zr, l);
+            X[k] = _mm256_mul_pd(xs[k], s);
+            Y[k] = _mm256_mul_pd(ys[k], s);
+            Z[k] = _mm256_mul_pd(r, s);
+        }
+        __m256d a = _mm256_div_pd(_mm256_add_pd(zmax, r), zr);
+        __m256d dx = _mm256_mul_pd(_mm256_mul_pd(_mm256_sub_pd(xmax, xmin), half), a);
+        __m256d dy = _mm256_mul_pd(_mm256_mul_pd(_mm256_sub_pd(ymax, ymin), half), a);
+        __m256d dz = _mm256_add_pd(zmax, r);
+        __m256d f = _mm256_div_pd(_mm256_sqrt_pd(_mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(dx, dx), _mm256_mul_pd(dy, dy)), _mm256_mul_pd(dz, dz))), zr);
+
+        __m256d rm = _mm256_add_pd(r, _mm256_min_pd(zmin, zero));
+        __m256d rM = _mm256_add_pd(r, zmax);
+        __m256d rmSq = _mm256_mul_pd(rm, rm);
+        __m256d rMSq = _mm256_mul_pd(rM, rM);
+        __m256d farW = _mm256_sub_pd(_mm256_sqrt_pd(_mm256_mul_pd(_mm256_sub_pd(_mm256_set1_pd(lSq), rmSq), _mm256_sub_pd(rMSq, rmSq))), rmSq);
+
+        __m256d invisible = zero;
+        __m256d fullyVisible = ones;
+        for (int j = 0; j < 6; ++j) {
+            __m256d px = _mm256_set1_pd(j < 5 ? planes[j].x : c.x);
+            __m256d py = _mm256_set1_pd(j < 5 ? planes[j].y : c.y);
+            __m256d pz = _mm256_set1_pd(j < 5 ? planes[j].z : c.z);
+            __m256d pw = j < 5 ? _mm256_set1_pd(planes[j].w) : farW;
+            __m256d all = ones;
+            __m256d any = zero;
+            for (int k = 0; k < 4; ++k) {
+                __m256d o = _mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(X[k], px), _mm256_mul_pd(Y[k], py)), _mm256_mul_pd(Z[k], pz));
+                __m256d s1 = _mm256_cmp_pd(_mm256_add_pd(o, pw), zero, _CMP_GT_OQ);
+                __m256d s2 = _mm256_cmp_pd(_mm256_add_pd(_mm256_mul_pd(o, f), pw), zero, _CMP_GT_OQ);
+                all = _mm256_and_pd(all, _mm256_and_pd(s1, s2));
+                any = _mm256_or_pd(any, _mm256_or_pd(s1, s2));
+            }
+            invisible = _mm256_or_pd(invisible, _mm256_xor_pd(any, ones));
+            fullyVisible = _mm256_and_pd(fullyVisible, all);
+        }
+        getVisibilityAVX(invisible, fullyVisible, result + i);
+    }
+    for (; i < n; ++i) {
+        result[i] = sphericalScalar(R, c, lSq, planes, b, i);
+    }
+}
+
+__attribute__((target("avx")))
+static bool isBelowHorizonAVX(const float *horizon, int imin, int imax, float z)
+{
+    __m256 zv = _mm256_set1_ps(z);
+    int i = imin;
+    for (; i + 8 <= imax + 1; i += 8) {
+        if (_mm256_movemask_ps(_mm256_cmp_ps(zv, _mm256_loadu_ps(horizon + i), _CMP_GT_OQ)) != 0) {
+            return false;
+        }
+    }
+    for (; i <= imax; ++i) {
+        if (z > horizon[i]) {
+            return false;
+        }
+    }
+    return imax >= imin;
+}
+
+__attribute__((target("avx")))
+static void raiseHorizonAVX(float *horizon, int imin, int imax, float z)
+{
+    __m256 zv = _mm256_set1_ps(z);
+    int i = imin;
+    for (; i + 8 <= imax + 1; i += 8) {
+        _mm256_storeu_ps(horizon + i, _mm256_max_ps(zv, _mm256_loadu_ps(horizon + i)));
+    }
+    for (; i <= imax; ++i) {
+        horizon[i] = z > horizon[i] ? z : horizon[i];
+    }
+}
+
+#endif
+
+// ----------------------------------------------------------------------------
+
+bool isCullingIsaAvailable(CullingIsa isa)
+{
+    switch (isa) {
+    case CULLING_SCALAR:
+        return true;
+#ifdef PROLAND_CULLING_SSE2
+    case CULLING_SSE2:
+        return true;
+#endif
+#ifdef PROLAND_CULLING_AVX
+    case CULLING_AVX:
+        __builtin_cpu_init();
+        return __builtin_cpu_supports("avx");
+#endif
+    default:
+        return false;
+    }
+}
+
+CullingIsa getCullingIsa()
+{
+    static CullingIsa isa = isCullingIsaAvailable(CULLING_AVX) ? CULLING_AVX :
+        (isCullingIsaAvailable(CULLING_SSE2) ? CULLING_SSE2 : CULLING_SCALAR);
+    return isa;
+}
+
+const char *getCullingIsaName(CullingIsa isa)
+{
+    switch (isa) {
+    case CULLING_SCALAR:
+        return "scalar";
+    case CULLING_SSE2:
+        return "sse2";
+    case CULLING_AVX:
+        return "avx";
+    }
+    return "unknown";
+}
+
+void getFrustumVisibility(const vec4d *frustumPlanes, int n, const BoxBatch &boxes, SceneManager::visibility *result)
+{
+    getFrustumVisibility(frustumPlanes, n, boxes, result, getCullingIsa());
+}
+
+void getFrustumVisibility(const vec4d *frustumPlanes, int n, const BoxBatch &boxes, SceneManager::visibility *result, CullingIsa isa)
+{
+    switch (isa) {
+#ifdef PROLAND_CULLING_SSE2
+    case CULLING_SSE2:
+        frustumSSE2(frustumPlanes, n, boxes, result);
+        return;
+#endif
+#ifdef PROLAND_CULLING_AVX
+    case CULLING_AVX:
+        frustumAVX(frustumPlanes, n, boxes, result);
+        return;
+#endif
+    default:
+        for (int i = 0; i < n; ++i) {
+            result[i] = frustumScalar(frustumPlanes, boxes, i);
+        }
+        return;
+    }
+}
+
+void getSphericalVisibility(double R, const vec3d &camera, const vec4d *frustumPlanes,
+    int n, const BoxBatch &boxes, SceneManager::visibility *result)
+{
+    getSphericalVisibility(R, camera, frustumPlanes, n, boxes, result, getCullingIsa());
+}
+
+void getSphericalVisibility(double R, const vec3d &camera, const vec4d *frustumPlanes,
+    int n, const BoxBatch &boxes, SceneManager::visibility *result, CullingIsa isa)
+{
+    double lSq = camera.x * camera.x + camera.y * camera.y + camera.z * camera.z;
+    switch (isa) {
+#ifdef PROLAND_CULLING_SSE2
+    case CULLING_SSE2:
+        sphericalSSE2(R, camera, lSq, frustumPlanes, n, boxes, result);
+        return;
+#endif
+#ifdef PROLAND_CULLING_AVX
+    case CULLING_AVX:
+        sphericalAVX(R, camera, lSq, frustumPlanes, n, boxes, result);
+        return;
+#endif
+    default:
+        for (int i = 0; i < n; ++i) {
+            result[i] = sphericalScalar(R, camera, lSq, frustumPlanes, boxes, i);
+        }
+        return;
+    }
+}
+
+bool isBelowHorizon(const float *horizon, int imin, int imax, float z)
+{
+    return isBelowHorizon(horizon, imin, imax, z, getCullingIsa());
+}
+
+bool isBelowHorizon(const float *horizon, int imin, int imax, float z, CullingIsa isa)
+{
+    switch (isa) {
+#ifdef PROLAND_CULLING_SSE2
+    case CULLING_SSE2:
+        return isBelowHorizonSSE2(horizon, imin, imax, z);
+#endif
+#ifdef PROLAND_CULLING_AVX
+    case CULLING_AVX:
+        return isBelowHorizonAVX(horizon, imin, imax, z);
+#endif
+    default:
+        return isBelowHorizonScalar(horizon, imin, imax, z);
+    }
+}
+
+void raiseHorizon(float *horizon, int imin, int imax, float z)
+{
+    raiseHorizon(horizon, imin, imax, z, getCullingIsa());
+}
+
+void raiseHorizon(float *horizon, int imin, int imax, float z, CullingIsa isa)
+{
+    switch (isa) {
+#ifdef PROLAND_CULLING_SSE2
+    case CULLING_SSE2:
+        raiseHorizonSSE2(horizon, imin, imax, z);
+        return;
+#endif
+#ifdef PROLAND_CULLING_AVX
+    case CULLING_AVX:
+        raiseHorizonAVX(horizon, imin, imax, z);
+        return;
+#endif
+    default:
+        raiseHorizonScalar(horizon, imin, imax, z);
+        return;
+    }
+}
+
+}
@@ -0,0 +1,202 @@
+/*
+ * Proland: a procedural landscape rendering library.
+ * Website : http://proland.inrialpes.fr/
+ * Copyright (c) 2008-2015 INRIA - LJK (CNRS - Grenoble University)
+ * All rights reserved.
+ * Redistribution and use in source and binary forms, with or without 
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice, 
+ * this list of conditions and the following disclaimer.
+ * 
+ * 2. Redistributions in binary form must reproduce the above copyright notice, 
+ * this list of conditions and the following disclaimer in the documentation 
+ * and/or other materials provided with the distribution.
+ * 
+ * 3. Neither the name of the copyright holder nor the names of its contributors 
+ * may be used to endorse or promote products derived from this software without 
+ * specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND 
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED 
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. 
+ * IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, 
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, 
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, 
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF 
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE 
+ * OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED 
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+/*
+ * Proland is distributed under the Berkeley Software Distribution 3 Licence. 
+ * For any assistance, feedback and enquiries about training programs, you can check out the 
+ * contact page on our website : 
+ * http://proland.inrialpes.fr/
+ */
+/*
+ * Main authors: Eric Bruneton, Antoine Begault, Guillaume Piolat.
+ */
+
+#ifndef _PROLAND_CULLING_H_
+#define _PROLAND_CULLING_H_
+
+#include "ork/math/vec4.h"
+#include "ork/scenegraph/SceneManager.h"
+
+using namespace ork;
+
+namespace proland
+{
+
+/**
+ * The instruction sets that can be used by the culling functions below.
+ * @ingroup proland_math
+ */
+enum CullingIsa {
+    CULLING_SCALAR, ///< portable C++ code
+    CULLING_SSE2, ///< x86 SSE2 instructions
+    CULLING_AVX ///< x86 AVX instructions
+};
+
+/**
+ * Returns true if the given instruction set can be used by the culling
+ * functions on this CPU.
+ * @ingroup proland_math
+ */
+PROLAND_API bool isCullingIsaAvailable(CullingIsa isa);
+
+/**
+ * Returns the fastest instruction set that can be used by the culling
+ * functions on this CPU. It is detected at runtime, the first time this
+ * function is called.
+ * @ingroup proland_math
+ */
+PROLAND_API CullingIsa getCullingIsa();
+
+/**
+ * Returns the name of the given instruction set.
+ * @ingroup proland_math
+ */
+PROLAND_API const char *getCullingIsaName(CullingIsa isa);
+
+/**
+ * A batch of bounding boxes, in SoA layout. Each array contains one value
+ * per box.
+ * @ingroup proland_math
+ */
+struct BoxBatch
+{
+    const double *xmin; ///< the minimum x coordinate of each box
+
+    const double *xmax; ///< the maximum x coordinate of each box
+
+    const double *ymin; ///< the minimum y coordinate of each box
+
+    const double *ymax; ///< the maximum y coordinate of each box
+
+    const double *zmin; ///< the minimum z coordinate of each box
+
+    const double *zmax; ///< the maximum z coordinate of each box
+};
+
+/**
+ * Computes the visibility of bounding boxes in a view frustum. A box is
+ * invisible if it is fully outside one of the left, right, bottom, top and
+ * near planes, fully visible if it is inside all of them, and partially
+ * visible otherwise (the far plane is ignored). The result is the same, for
+ * all the instruction sets.
+ * @ingroup proland_math
+ *
+ * @param frustumPlanes the frustum planes, as returned by
+ *      SceneManager#getFrustumPlanes (only the first five are used).
+ * @param n the number of boxes.
+ * @param boxes the bounding boxes, in the frustum space.
+ * @param[out] result the visibility of each box.
+ */
+PROLAND_API void getFrustumVisibility(const vec4d *frustumPlanes, int n, const BoxBatch &boxes,
+    SceneManager::visibility *result);
+
+/**
+ * Same as #getFrustumVisibility, but with the given instruction set, which
+ * must be available.
+ * @ingroup proland_math
+ */
+PROLAND_API void getFrustumVisibility(const vec4d *frustumPlanes, int n, const BoxBatch &boxes,
+    SceneManager::visibility *result, CullingIsa isa);
+
+/**
+ * Computes the visibility of bounding boxes on a sphere in a view frustum
+ * (see SphericalDeformation). Each box is defined in the local space of a
+ * spherical deformation, and is bounded in deformed space with the four
+ * deformed corners of its bottom face, and with a factor giving the
+ * position of its top face relatively to the bottom one. A box is invisible
+ * if it is fully outside one of the left, right, bottom, top and near
+ * planes, or outside the horizon seen from the camera, fully visible if it
+ * is inside all of them, and partially visible otherwise. The result is the
+ * same, for all the instruction sets.
+ * @ingroup proland_math
+ *
+ * @param R the radius of the sphere.
+ * @param camera the camera position, in deformed space.
+ * @param frustumPlanes the frustum planes, in deformed space, as returned
+ *      by SceneManager#getFrustumPlanes (only the first five are used).
+ * @param n the number of boxes.
+ * @param boxes the bounding boxes, in local space.
+ * @param[out] result the visibility of each box.
+ */
+PROLAND_API void getSphericalVisibility(double R, const vec3d &camera, const vec4d *frustumPlanes,
+    int n, const BoxBatch &boxes, SceneManager::visibility *result);
+
+/**
+ * Same as #getSphericalVisibility, but with the given instruction set,
+ * which must be available.
+ * @ingroup proland_math
+ */
+PROLAND_API void getSphericalVisibility(double R, const vec3d &camera, const vec4d *frustumPlanes,
+    int n, const BoxBatch &boxes, SceneManager::visibility *result, CullingIsa isa);
+
+/**
+ * Returns true if the given elevation is below or on the given horizon line,
+ * for all the azimuths in [imin,imax], and if this interval is not empty.
+ * @ingroup proland_math
+ *
+ * @param horizon a rasterized horizon line, giving an elevation for each
+ *      azimuth.
+ * @param imin the first azimuth to test.
+ * @param imax the last azimuth to test (inclusive).
+ * @param z the elevation to test.
+ */
+PROLAND_API bool isBelowHorizon(const float *horizon, int imin, int imax, float z);
+
+/**
+ * Same as #isBelowHorizon, but with the given instruction set, which must
+ * be available.
+ * @ingroup proland_math
+ */
+PROLAND_API bool isBelowHorizon(const float *horizon, int imin, int imax, float z, CullingIsa isa);
+
+/**
+ * Raises the given horizon line to the given elevation, for all the
+ * azimuths in [imin,imax].
+ * @ingroup proland_math
+ *
+ * @param[in,out] horizon a rasterized horizon line, giving an elevation for
+ *      each azimuth.
+ * @param imin the first azimuth to update.
+ * @param imax the last azimuth to update (inclusive).
+ * @param z the minimum elevation of the horizon line in [imin,imax].
+ */
+PROLAND_API void raiseHorizon(float *horizon, int imin, int imax, float z);
+
+/**
+ * Same as #raiseHorizon, but with the given instruction set, which must be
+ * available.
+ * @ingroup proland_math
+ */
+PROLAND_API void raiseHorizon(float *horizon, int imin, int imax, float z, CullingIsa isa);
+
+}
+
+#endif
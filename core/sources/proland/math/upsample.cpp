@@ -0,0 +1,336 @@
+/*
+ * Proland: a procedural landscape rendering library.
+ * Website : http://proland.inrialpes.fr/
+ * Copyright (c) 2008-2015 INRIA - LJK (CNRS - Grenoble University)
+ * All rights reserved.
+ * Redistribution and use in source and binary forms, with or without 
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice, 
+ * this list of conditions and the following disclaimer.
+ * 
+ * 2. Redistributions in binary form must reproduce the above copyright notice, 
+ * this list of conditions and the following disclaimer in the documentation 
+ * and/or other materials provided with the distribution.
+ * 
+ * 3. Neither the name of the copyright holder nor the names of its contributors 
+ * may be used to endorse or promote products derived from this software without 
+ * specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND 
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED 
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. 
+ * IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, 
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, 
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, 
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF 
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE 
+ * OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED 
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+/*
+ * Proland is distributed under the Berkeley Software Distribution 3 Licence. 
+ * For any assistance, feedback and enquiries about training programs, you can check out the 
+ * contact page on our website : 
+ * http://proland.inrialpes.fr/
+ */
+/*
+ * Main authors: Eric Bruneton, Antoine Begault, Guillaume Piolat.
+ */
+
+#include "proland/math/upsample.h"
+
+#include <vector>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define PROLAND_UPSAMPLE_SSE2
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define PROLAND_UPSAMPLE_AVX2
+#endif
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#define PROLAND_UPSAMPLE_NEON
+#endif
+
+using namespace std;
+
+namespace proland
+{
+
+/**
+ * Interpolates the samples s[-1..count+1] vertically, from four rows of the
+ * parent tile, into v[-1..count+1].
+ */
+typedef void (*VerticalFilter)(const float *r0, const float *r1, const float *r2, const float *r3, int count, float *v);
+
+/**
+ * Interpolates the samples s[-1..size/2+1] horizontally into out[0..size-1].
+ */
+typedef void (*HorizontalFilter)(const float *s, int size, float *out);
+
+// ----------------------------------------------------------------------------
+// Scalar kernels (reference implementation)
+// ----------------------------------------------------------------------------
+
+static inline float filter(float z0, float z1, float z2, float z3)
+{
+    return ((z1 + z2) * 9.0f - (z0 + z3)) * (1.0f / 16.0f);
+}
+
+static void verticalScalar(const float *r0, const float *r1, const float *r2, const float *r3, int count, float *v)
+{
+    for (int k = -1; k <= count + 1; ++k) {
+        v[k] = filter(r0[k], r1[k], r2[k], r3[k]);
+    }
+}
+
+static void horizontalScalar(const float *s, int size, float *out)
+{
+    for (int i = 0; i < size; i += 2) {
+        out[i] = s[i / 2];
+    }
+    for (int i = 1; i < size; i += 2) {
+        int m = i / 2;
+        out[i] = filter(s[m - 1], s[m], s[m + 1], s[m + 2]);
+    }
+}
+
+// ----------------------------------------------------------------------------
+// SSE2 kernels
+// ----------------------------------------------------------------------------
+
+#ifdef PROLAND_UPSAMPLE_SSE2
+
+static inline __m128 filterSSE2(__m128 z0, __m128 z1, __m128 z2, __m128 z3)
+{
+    __m128 a = _mm_mul_ps(_mm_add_ps(z1, z2), _mm_set1_ps(9.0f));
+    return _mm_mul_ps(_mm_sub_ps(a, _mm_add_ps(z0, z3)), _mm_set1_ps(1.0f / 16.0f));
+}
+
+static void verticalSSE2(const float *r0, const float *r1, const float *r2, const float *r3, int count, float *v)
+{
+    int k = -1;
+    for (; k + 4 <= count + 2; k += 4) {
+        __m128 z = filterSSE2(_mm_loadu_ps(r0 + k), _mm_loadu_ps(r1 + k), _mm_loadu_ps(r2 + k), _mm_loadu_ps(r3 + k));
+        _mm_storeu_ps(v + k, z);
+    }
+    for (; k <= count + 1; ++k) {
+        v[k] = filter(r0[k], r1[k], r2[k], r3[k]);
+    }
+}
+
+static void horizontalSSE2(const float *s, int size, float *out)
+{
+    // computes 4 even and 4 odd samples at once, and interleaves them
+    int m = 0;
+    for (; 2 * m + 8 <= size; m += 4) {
+        __m128 z1 = _mm_loadu_ps(s + m);
+        __m128 odd = filterSSE2(_mm_loadu_ps(s + m - 1), z1, _mm_loadu_ps(s + m + 1), _mm_loadu_ps(s + m + 2));
+        _mm_storeu_ps(out + 2 * m, _mm_unpacklo_ps(z1, odd));
+        _mm_storeu_ps(out + 2 * m + 4, _mm_unpackhi_ps(z1, odd));
+    }
+    for (int i = 2 * m; i < size; ++i) {
+        int k = i / 2;
+        out[i] = i % 2 == 0 ? s[k] : filter(s[k - 1], s[k], s[k + 1], s[k + 2]);
+    }
+}
+
+#endif
+
+// ----------------------------------------------------------------------------
+// AVX2 kernels (compiled for AVX2 even if the rest of the code is not)
+// ----------------------------------------------------------------------------
+
+#ifdef PROLAND_UPSAMPLE_AVX2
+
+__attribute__((target("avx2")))
+static inline __m256 filterAVX2(__m256 z0, __m256 z1, __m256 z2, __m256 z3)
+{
+    __m256 a = _mm256_mul_ps(_mm256_add_ps(z1, z2), _mm256_set1_ps(9.0f));
+    return _mm256_mul_ps(_mm256_sub_ps(a, _mm256_add_ps(z0, z3)), _mm256_set1_ps(1.0f / 16.0f));
+}
+
+__attribute__((target("avx2")))
+static void verticalAVX2(const float *r0, const float *r1, const float *r2, const float *r3, int count, float *v)
+{
+    int k = -1;
+    for (; k + 8 <= count + 2; k += 8) {
+        __m256 z = filterAVX2(_mm256_loadu_ps(r0 + k), _mm256_loadu_ps(r1 + k), _mm256_loadu_ps(r2 + k), _mm256_loadu_ps(r3 + k));
+        _mm256_storeu_ps(v + k, z);
+    }
+    for (; k <= count + 1; ++k) {
+        v[k] = filter(r0[k], r1[k], r2[k], r3[k]);
+    }
+}
+
+__attribute__((target("avx2")))
+static void horizontalAVX2(const float *s, int size, float *out)
+{
+    // unpacklo/hi interleave each 128 bits lane separately, the two lanes
+    // of the results must then be reordered
+    int m = 0;
+    for (; 2 * m + 16 <= size; m += 8) {
+        __m256 z1 = _mm256_loadu_ps(s + m);
+        __m256 odd = filterAVX2(_mm256_loadu_ps(s + m - 1), z1, _mm256_loadu_ps(s + m + 1), _mm256_loadu_ps(s + m + 2));
+        __m256 lo = _mm256_unpacklo_ps(z1, odd);
+        __m256 hi = _mm256_unpackhi_ps(z1, odd);
+        _mm256_storeu_ps(out + 2 * m, _mm256_permute2f128_ps(lo, hi, 0x20));
+        _mm256_storeu_ps(out + 2 * m + 8, _mm256_permute2f128_ps(lo, hi, 0x31));
+    }
+    for (int i = 2 * m; i < size; ++i) {
+        int k = i / 2;
+        out[i] = i % 2 == 0 ? s[k] : filter(s[k - 1], s[k], s[k + 1], s[k + 2]);
+    }
+}
+
+#endif
+
+// ----------------------------------------------------------------------------
+// NEON kernels
+// ----------------------------------------------------------------------------
+
+#ifdef PROLAND_UPSAMPLE_NEON
+
+static inline float32x4_t filterNEON(float32x4_t z0, float32x4_t z1, float32x4_t z2, float32x4_t z3)
+{
+    // vmulq and vsubq instead of vmlsq, to get the same rounding as the
+    // scalar code (compiled with -ffp-contract=off, see CMakeLists.txt)
+    float32x4_t a = vmulq_f32(vaddq_f32(z1, z2), vdupq_n_f32(9.0f));
+    return vmulq_f32(vsubq_f32(a, vaddq_f32(z0, z3)), vdupq_n_f32(1.0f / 16.0f));
+}
+
+static void verticalNEON(const float *r0, const float *r1, const float *r2, const float *r3, int count, float *v)
+{
+    int k = -1;
+    for (; k + 4 <= count + 2; k += 4) {
+        float32x4_t z = filterNEON(vld1q_f32(r0 + k), vld1q_f32(r1 + k), vld1q_f32(r2 + k), vld1q_f32(r3 + k));
+        vst1q_f32(v + k, z);
+    }
+    for (; k <= count + 1; ++k) {
+        v[k] = filter(r0[k], r1[k], r2[k], r3[k]);
+    }
+}
+
+static void horizontalNEON(const float *s, int size, float *out)
+{
+    int m = 0;
+    for (; 2 * m + 8 <= size; m += 4) {
+        float32x4x2_t z;
+        z.val[0] = vld1q_f32(s + m);
+        z.val[1] = filterNEON(vld1q_f32(s + m - 1), z.val[0], vld1q_f32(s + m + 1), vld1q_f32(s + m + 2));
+        vst2q_f32(out + 2 * m, z);
+    }
+    for (int i = 2 * m; i < size; ++i) {
+        int k = i / 2;
+        out[i] = i % 2 == 0 ? s[k] : filter(s[k - 1], s[k], s[k + 1], s[k + 2]);
+    }
+}
+
+#endif
+
+// ----------------------------------------------------------------------------
+
+bool isUpsampleIsaAvailable(UpsampleIsa isa)
+{
+    switch (isa) {
+    case UPSAMPLE_SCALAR:
+        return true;
+#ifdef PROLAND_UPSAMPLE_SSE2
+    case UPSAMPLE_SSE2:
+        return true;
+#endif
+#ifdef PROLAND_UPSAMPLE_AVX2
+    case UPSAMPLE_AVX2:
+        __builtin_cpu_init();
+        return __builtin_cpu_supports("avx2");
+#endif
+#ifdef PROLAND_UPSAMPLE_NEON
+    case UPSAMPLE_NEON:
+        return true;
+#endif
+    default:
+        return false;
+    }
+}
+
+UpsampleIsa getUpsampleIsa()
+{
+    static UpsampleIsa isa = isUpsampleIsaAvailable(UPSAMPLE_AVX2) ? UPSAMPLE_AVX2 :
+        (isUpsampleIsaAvailable(UPSAMPLE_SSE2) ? UPSAMPLE_SSE2 :
+        (isUpsampleIsaAvailable(UPSAMPLE_NEON) ? UPSAMPLE_NEON : UPSAMPLE_SCALAR));
+    return isa;
+}
+
+const char *getUpsampleIsaName(UpsampleIsa isa)
+{
+    switch (isa) {
+    case UPSAMPLE_SCALAR:
+        return "scalar";
+    case UPSAMPLE_SSE2:
+        return "sse2";
+    case UPSAMPLE_AVX2:
+        return "avx2";
+    case UPSAMPLE_NEON:
+        return "neon";
+    }
+    return "unknown";
+}
+
+void upsample(const float *parent, int n, int px, int py, int size, float *result)
+{
+    upsample(parent, n, px, py, size, result, getUpsampleIsa());
+}
+
+void upsample(const float *parent, int n, int px, int py, int size, float *result, UpsampleIsa isa)
+{
+    VerticalFilter vertical = verticalScalar;
+    HorizontalFilter horizontal = horizontalScalar;
+    switch (isa) {
+#ifdef PROLAND_UPSAMPLE_SSE2
+    case UPSAMPLE_SSE2:
+        vertical = verticalSSE2;
+        horizontal = horizontalSSE2;
+        break;
+#endif
+#ifdef PROLAND_UPSAMPLE_AVX2
+    case UPSAMPLE_AVX2:
+        vertical = verticalAVX2;
+        horizontal = horizontalAVX2;
+        break;
+#endif
+#ifdef PROLAND_UPSAMPLE_NEON
+    case UPSAMPLE_NEON:
+        vertical = verticalNEON;
+        horizontal = horizontalNEON;
+        break;
+#endif
+    default:
+        break;
+    }
+
+    // vertically interpolated samples for the odd rows
+    int count = size / 2;
+    float buffer[1024];
+    vector<float> largeBuffer;
+    float *v = buffer;
+    if (count + 4 > 1024) {
+        largeBuffer.resize(count + 4);
+        v = &largeBuffer[0];
+    }
+    v += 1;
+
+    for (int j = 0; j < size; ++j) {
+        const float *row = parent + px + (j / 2 + py) * n;
+        if (j % 2 == 0) {
+            horizontal(row, size, result + j * n);
+        } else {
+            vertical(row - n, row, row + n, row + 2 * n, count, v);
+            horizontal(v, size, result + j * n);
+        }
+    }
+}
+
+}
@@ -0,0 +1,109 @@
+/*
+ * Proland: a procedural landscape rendering library.
+ * Website : http://proland.inrialpes.fr/
+ * Copyright (c) 2008-2015 INRIA - LJK (CNRS - Grenoble University)
+ * All rights reserved.
+ * Redistribution and use in source and binary forms, with or without 
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice, 
+ * this list of conditions and the following disclaimer.
+ * 
+ * 2. Redistributions in binary form must reproduce the above copyright notice, 
+ * this list of conditions and the following disclaimer in the documentation 
+ * and/or other materials provided with the distribution.
+ * 
+ * 3. Neither the name of the copyright holder nor the names of its contributors 
+ * may be used to endorse or promote products derived from this software without 
+ * specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND 
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED 
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. 
+ * IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, 
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, 
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, 
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF 
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE 
+ * OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED 
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+/*
+ * Proland is distributed under the Berkeley Software Distribution 3 Licence. 
+ * For any assistance, feedback and enquiries about training programs, you can check out the 
+ * contact page on our website : 
+ * http://proland.inrialpes.fr/
+ */
+/*
+ * Main authors: Eric Bruneton, Antoine Begault, Guillaume Piolat.
+ */
+
+#ifndef _PROLAND_UPSAMPLE_H_
+#define _PROLAND_UPSAMPLE_H_
+
+namespace proland
+{
+
+/**
+ * The instruction sets that can be used by #upsample.
+ * @ingroup proland_math
+ */
+enum UpsampleIsa {
+    UPSAMPLE_SCALAR, ///< portable C++ code
+    UPSAMPLE_SSE2, ///< x86 SSE2 instructions
+    UPSAMPLE_AVX2, ///< x86 AVX2 instructions
+    UPSAMPLE_NEON ///< ARM NEON instructions
+};
+
+/**
+ * Returns true if the given instruction set can be used by #upsample on
+ * this CPU.
+ * @ingroup proland_math
+ */
+PROLAND_API bool isUpsampleIsaAvailable(UpsampleIsa isa);
+
+/**
+ * Returns the fastest instruction set that can be used by #upsample on this
+ * CPU. It is detected at runtime, the first time this function is called.
+ * @ingroup proland_math
+ */
+PROLAND_API UpsampleIsa getUpsampleIsa();
+
+/**
+ * Returns the name of the given instruction set.
+ * @ingroup proland_math
+ */
+PROLAND_API const char *getUpsampleIsaName(UpsampleIsa isa);
+
+/**
+ * Upsamples a part of a tile with the 4-tap (-1,9,9,-1)/16 filter used by
+ * the residual elevation tiles (see ResidualProducer). The filter is applied
+ * separately in each direction: odd rows are first interpolated vertically,
+ * and all rows are then interpolated horizontally. The result is the same,
+ * bit for bit, for all the instruction sets.
+ * @ingroup proland_math
+ *
+ * @param parent the tile to upsample, of width and height n.
+ * @param n the width and height of the parent and result tiles.
+ * @param px the x coordinate in parent of the sample corresponding to the
+ *      result sample (0,0). There must be at least one sample before it,
+ *      and size/2+1 samples after it.
+ * @param py the y coordinate in parent of the sample corresponding to the
+ *      result sample (0,0), with the same constraints as px.
+ * @param size the number of samples to compute in each direction.
+ * @param result where the upsampled samples (i,j) must be written, at
+ *      i+j*n for i and j in [0,size[.
+ */
+PROLAND_API void upsample(const float *parent, int n, int px, int py, int size, float *result);
+
+/**
+ * Same as #upsample, but with the given instruction set, which must be
+ * available.
+ * @ingroup proland_math
+ */
+PROLAND_API void upsample(const float *parent, int n, int px, int py, int size, float *result, UpsampleIsa isa);
+
+}
+
+#endif
@@ -41,6 +41,15 @@
 
 #include "proland/producer/CPUTileStorage.h"
 
+#include <stdlib.h>
+#include <string.h>
+#if defined(_WIN32) || defined(_WIN64)
+#include <malloc.h>
+#else
+#include <sys/mman.h>
+#endif
+
+#include "ork/core/Logger.h"
 #include "ork/resource/ResourceTemplate.h"
 
 using namespace std;
@@ -49,6 +58,68 @@ using namespace ork;
 namespace proland
 {
 
+CPUTileSlab::CPUTileSlab(size_t slotSize, int capacity, bool mapped, bool hugePages) :
+    data(NULL), mapped(false)
+{
+    this->slotSize = ((slotSize + ALIGNMENT - 1) / ALIGNMENT) * ALIGNMENT;
+    this->size = this->slotSize * capacity;
+#if !defined(_WIN32) && !defined(_WIN64)
+    if (mapped && size > 0) {
+        // anonymous mapped pages are only committed when they are first
+        // written, and MAP_NORESERVE avoids reserving swap space for them
+        void *p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        if (p != MAP_FAILED) {
+            data = (char*) p;
+            this->mapped = true;
+#ifdef MADV_HUGEPAGE
+            if (hugePages && madvise(p, size, MADV_HUGEPAGE) != 0 && Logger::WARNING_LOGGER != NULL) {
+                Logger::WARNING_LOGGER->log("CACHE", "Huge pages not available for tile slab");
+            }
+#endif
+        } else if (Logger::WARNING_LOGGER != NULL) {
+            Logger::WARNING_LOGGER->log("CACHE", "Cannot map tile slab, using heap memory");
+        }
+    }
+#endif
+    if (data == NULL) {
+#if defined(_WIN32) || defined(_WIN64)
+        data = (char*) _aligned_malloc(size, ALIGNMENT);
+#else
+        void *p = NULL;
+        data = posix_memalign(&p, ALIGNMENT, size) == 0 ? (char*) p : NULL;
+#endif
+        if (data == NULL && size > 0) {
+            throw bad_alloc();
+        }
+    }
+}
+
+CPUTileSlab::~CPUTileSlab()
+{
+    if (data == NULL) {
+        return;
+    }
+#if defined(_WIN32) || defined(_WIN64)
+    _aligned_free(data);
+#else
+    if (mapped) {
+        munmap(data, size);
+    } else {
+        free(data);
+    }
+#endif
+}
+
+void *CPUTileSlab::getSlot(int i)
+{
+    return data + i * slotSize;
+}
+
+size_t CPUTileSlab::getSlotSize()
+{
+    return slotSize;
+}
+
 template<class T>
 class CPUTileStorageResource : public ResourceTemplate<0, CPUTileStorage<T> >
 {
@@ -60,11 +131,28 @@ public:
         int tileSize;
         int channels;
         int capacity;
-        Resource::checkParameters(desc, e, "name,tileSize,channels,capacity,");
+        typename CPUTileStorage<T>::SlabMode slabMode = CPUTileStorage<T>::NO_SLAB;
+        bool hugePages = false;
+        Resource::checkParameters(desc, e, "name,tileSize,channels,capacity,slab,hugePages,");
         Resource::getIntParameter(desc, e, "tileSize", &tileSize);
         Resource::getIntParameter(desc, e, "channels", &channels);
         Resource::getIntParameter(desc, e, "capacity", &capacity);
-        CPUTileStorage<T>::init(tileSize, channels, capacity);
+        if (e->Attribute("slab") != NULL) {
+            if (strcmp(e->Attribute("slab"), "aligned") == 0) {
+                slabMode = CPUTileStorage<T>::ALIGNED_SLAB;
+            } else if (strcmp(e->Attribute("slab"), "mapped") == 0) {
+                slabMode = CPUTileStorage<T>::MAPPED_SLAB;
+            } else if (strcmp(e->Attribute("slab"), "none") != 0) {
+                if (Logger::ERROR_LOGGER != NULL) {
+                    Resource::log(Logger::ERROR_LOGGER, desc, e, "Invalid slab attribute (must be none, aligned or mapped)");
+                }
+                throw exception();
+            }
+        }
+        if (e->Attribute("hugePages") != NULL && strcmp(e->Attribute("hugePages"), "true") == 0) {
+            hugePages = true;
+        }
+        CPUTileStorage<T>::init(tileSize, channels, capacity, slabMode, hugePages);
     }
 };
 
@@ -42,11 +42,85 @@
 #ifndef _PROLAND_CPU_TILE_STORAGE_H_
 #define _PROLAND_CPU_TILE_STORAGE_H_
 
+#include <cstring>
+#include <new>
+
 #include "proland/producer/TileStorage.h"
 
 namespace proland
 {
 
+/**
+ * A single memory block divided in equally sized slots, used to store the
+ * data of all the slots of a CPUTileStorage. Each slot is aligned on
+ * #ALIGNMENT bytes. The memory of the slab can be mapped (with mmap) instead
+ * of being allocated on the heap. In this case it is committed lazily, i.e.,
+ * a slot costs no physical memory until its data is written, and it can be
+ * backed by huge pages (with madvise), if the system supports it.
+ * @ingroup producer
+ * @authors Eric Bruneton, Antoine Begault
+ */
+PROLAND_API class CPUTileSlab
+{
+public:
+    /**
+     * The alignment in bytes of each slot.
+     */
+    static const int ALIGNMENT = 64;
+
+    /**
+     * Creates a new CPUTileSlab.
+     *
+     * @param slotSize the minimum size in bytes of each slot. The actual size
+     *      is rounded up to a multiple of #ALIGNMENT.
+     * @param capacity the number of slots.
+     * @param mapped true to map the memory of the slab with mmap, so that it
+     *      is committed lazily. Ignored on systems without mmap.
+     * @param hugePages true to back the mapped memory with huge pages. Only
+     *      used if 'mapped' is true.
+     */
+    CPUTileSlab(size_t slotSize, int capacity, bool mapped, bool hugePages);
+
+    /**
+     * Deletes this CPUTileSlab and the memory of all its slots.
+     */
+    ~CPUTileSlab();
+
+    /**
+     * Returns the memory of the given slot.
+     *
+     * @param i a slot index between 0 and the slab capacity (exclusive).
+     */
+    void *getSlot(int i);
+
+    /**
+     * Returns the actual size in bytes of each slot.
+     */
+    size_t getSlotSize();
+
+private:
+    /**
+     * The memory of this slab.
+     */
+    char *data;
+
+    /**
+     * The actual size in bytes of each slot.
+     */
+    size_t slotSize;
+
+    /**
+     * The total size in bytes of this slab.
+     */
+    size_t size;
+
+    /**
+     * True if the memory of this slab is mapped, false if it is allocated on
+     * the heap.
+     */
+    bool mapped;
+};
+
 /**
  * A TileStorage that store tiles on CPU.
  * @ingroup producer
@@ -81,21 +155,51 @@ public:
          * @param owner the TileStorage that manages this slot.
          * @param size the number of elements in the data array.
          */
-        CPUSlot(TileStorage *owner, int size) : Slot(owner)
+        CPUSlot(TileStorage *owner, int size) : Slot(owner), ownsData(true)
         {
             this->data = new T[size];
             this->size = size;
         }
 
         /**
-         * Deletes this CPUSlot. This deletes the #data array.
+         * Creates a new CPUSlot using an existing array to store the tile
+         * data. This array is not deleted when this slot is deleted.
+         *
+         * @param owner the TileStorage that manages this slot.
+         * @param size the number of elements in the data array.
+         * @param data the array to store the tile data.
+         */
+        CPUSlot(TileStorage *owner, int size, T *data) : Slot(owner), ownsData(false)
+        {
+            this->data = data;
+            this->size = size;
+        }
+
+        /**
+         * Deletes this CPUSlot. This deletes the #data array, if it was
+         * created by this slot.
          */
         virtual ~CPUSlot()
         {
-            if (data != NULL) {
+            if (data != NULL && ownsData) {
                 delete[] data;
             }
         }
+
+    private:
+        /**
+         * True if the #data array was created by this slot.
+         */
+        bool ownsData;
+    };
+
+    /**
+     * How the data of the slots of a CPUTileStorage are allocated.
+     */
+    enum SlabMode {
+        NO_SLAB, ///< each slot allocates its own data array on the heap
+        ALIGNED_SLAB, ///< all slots share a single aligned heap block
+        MAPPED_SLAB ///< all slots share a single lazily committed mapped block
     };
 
     /**
@@ -105,10 +209,17 @@ public:
      * @param channels the number of components per pixel of each tile. Each
      *      component is of type T.
      * @param capacity the number of slots managed by this tile storage.
+     * @param slabMode how the data of the slots are allocated. With a slab,
+     *      the data of each tile starts on a CPUTileSlab#ALIGNMENT bytes
+     *      boundary (as well as each row, if the row size is a multiple of
+     *      this alignment).
+     * @param hugePages true to back the slab with huge pages, if possible.
+     *      Only used with MAPPED_SLAB.
      */
-    CPUTileStorage(int tileSize, int channels, int capacity) : TileStorage()
+    CPUTileStorage(int tileSize, int channels, int capacity, SlabMode slabMode = NO_SLAB, bool hugePages = false) :
+        TileStorage(), slots(NULL), slab(NULL)
     {
-        init(tileSize, channels, capacity);
+        init(tileSize, channels, capacity, slabMode, hugePages);
     }
 
     /**
@@ -116,6 +227,21 @@ public:
      */
     virtual ~CPUTileStorage()
     {
+        // the slots of the #slots array must be destroyed in place; the other
+        // slots, if any, were allocated individually
+        for (unsigned int i = 0; i < freeSlots.size(); ++i) {
+            CPUSlot *s = static_cast<CPUSlot*>(freeSlots[i]);
+            if (s >= slots && s < slots + capacity) {
+                s->~CPUSlot();
+            } else {
+                delete s;
+            }
+        }
+        freeSlots.clear();
+        operator delete(slots);
+        if (slab != NULL) {
+            delete slab;
+        }
     }
 
     /**
@@ -127,11 +253,30 @@ public:
         return channels;
     }
 
+    virtual int getSlotDataSize()
+    {
+        return tileSize * tileSize * channels * sizeof(T);
+    }
+
+    virtual bool getSlotData(Slot *s, void *data)
+    {
+        CPUSlot *c = static_cast<CPUSlot*>(s);
+        memcpy(data, c->data, c->size * sizeof(T));
+        return true;
+    }
+
+    virtual bool setSlotData(Slot *s, const void *data)
+    {
+        CPUSlot *c = static_cast<CPUSlot*>(s);
+        memcpy(c->data, data, c->size * sizeof(T));
+        return true;
+    }
+
 protected:
     /**
      * Creates an uninitialized CPUTileStorage.
      */
-    CPUTileStorage() : TileStorage()
+    CPUTileStorage() : TileStorage(), slots(NULL), slab(NULL)
     {
     }
 
@@ -142,14 +287,27 @@ protected:
      * @param channels the number of components per pixel of each tile. Each
      *      component is of type T.
      * @param capacity the number of slots managed by this tile storage.
+     * @param slabMode how the data of the slots are allocated.
+     * @param hugePages true to back the slab with huge pages, if possible.
      */
-    void init(int tileSize, int channels, int capacity)
+    void init(int tileSize, int channels, int capacity, SlabMode slabMode = NO_SLAB, bool hugePages = false)
     {
         TileStorage::init(tileSize, capacity);
         this->channels = channels;
         int size = tileSize * tileSize * channels;
-        for (int i = 0; i < capacity; ++i) {
-            freeSlots.push_back(new CPUSlot(this, size));
+        if (slabMode != NO_SLAB) {
+            slab = new CPUTileSlab(size * sizeof(T), capacity, slabMode == MAPPED_SLAB, hugePages);
+        }
+        // all the slots are allocated in a single contiguous array; they are
+        // pushed in reverse order so that #newSlot returns them in order
+        slots = static_cast<CPUSlot*>(operator new(capacity * sizeof(CPUSlot)));
+        freeSlots.reserve(capacity);
+        for (int i = capacity - 1; i >= 0; --i) {
+            if (slab == NULL) {
+                freeSlots.push_back(new (slots + i) CPUSlot(this, size));
+            } else {
+                freeSlots.push_back(new (slots + i) CPUSlot(this, size, static_cast<T*>(slab->getSlot(i))));
+            }
         }
     }
 
@@ -162,6 +320,17 @@ private:
      * The number of components per pixel of each tile.
      */
     int channels;
+
+    /**
+     * The slots managed by this storage, in a single contiguous array.
+     */
+    CPUSlot *slots;
+
+    /**
+     * The memory block containing the data of all the slots, or NULL if
+     * each slot allocates its own data.
+     */
+    CPUTileSlab *slab;
 };
 
 }
@@ -168,6 +168,8 @@ void GPUTileStorage::init(int tileSize, int nTiles,
     const Texture::Parameters &params, bool useTileMap)
 {
     TileStorage::init(tileSize, nTiles);
+    this->format = f;
+    this->type = t;
 
     int maxLayers = Texture2DArray::getMaxLayers();
     int nTextures = nTiles / maxLayers + (nTiles % maxLayers == 0 ? 0 : 1);
@@ -235,6 +237,53 @@ ptr<Texture2D> GPUTileStorage::getTileMap()
     return tileMap;
 }
 
+int GPUTileStorage::getSlotDataSize()
+{
+    int componentSize;
+    switch (type) {
+    case UNSIGNED_BYTE:
+    case BYTE:
+        componentSize = 1;
+        break;
+    case UNSIGNED_SHORT:
+    case SHORT:
+    case HALF:
+        componentSize = 2;
+        break;
+    case UNSIGNED_INT:
+    case INT:
+    case FLOAT:
+        componentSize = 4;
+        break;
+    default:
+        return 0;
+    }
+    return tileSize * tileSize * textures[0]->getComponents() * componentSize;
+}
+
+bool GPUTileStorage::getSlotData(Slot *s, void *data)
+{
+    GPUSlot *g = static_cast<GPUSlot*>(s);
+    if (readFbo == NULL) {
+        readFbo = new FrameBuffer();
+        readFbo->setReadBuffer(COLOR0);
+        readFbo->setDrawBuffer(COLOR0);
+    }
+    readFbo->setTextureBuffer(COLOR0, g->t, 0, g->l);
+    // the slot data is tightly packed (see getSlotDataSize), hence the
+    // alignment of 1 instead of the default 4
+    readFbo->readPixels(0, 0, tileSize, tileSize, format, type, Buffer::Parameters().alignment(1), CPUBuffer(data));
+    return true;
+}
+
+bool GPUTileStorage::setSlotData(Slot *s, const void *data)
+{
+    GPUSlot *g = static_cast<GPUSlot*>(s);
+    g->setSubImage(0, 0, tileSize, tileSize, format, type, Buffer::Parameters().alignment(1), CPUBuffer(data));
+    notifyChange(g);
+    return true;
+}
+
 void GPUTileStorage::notifyChange(GPUSlot *s)
 {
     if (needMipmaps) {
@@ -186,6 +186,25 @@ public:
      */
     void generateMipMap();
 
+    /**
+     * Returns the size in bytes of the data of a slot. Only textures whose
+     * pixel type is a non packed type are supported (0 is returned for the
+     * other types).
+     */
+    virtual int getSlotDataSize();
+
+    /**
+     * Reads back the data of a slot from GPU. This method must be called from
+     * the thread that owns the OpenGL context.
+     */
+    virtual bool getSlotData(Slot *s, void *data);
+
+    /**
+     * Copies data from memory to a slot on GPU. This method must be called
+     * from the thread that owns the OpenGL context.
+     */
+    virtual bool setSlotData(Slot *s, const void *data);
+
 protected:
     /**
      * Creates an uninitialized GPUTileStorage.
@@ -241,6 +260,22 @@ private:
      */
     ptr<FrameBuffer> fbo;
 
+    /**
+     * Framebuffer used to read back the data of slots, in #getSlotData.
+     * Created when first needed.
+     */
+    ptr<FrameBuffer> readFbo;
+
+    /**
+     * The texture components in the storage textures.
+     */
+    TextureFormat format;
+
+    /**
+     * The type of each component in the storage textures.
+     */
+    PixelType type;
+
     /**
      * Program used to generate mipmaps.
      */
@@ -41,10 +41,21 @@
 
 #include "proland/producer/TileCache.h"
 
+#include <algorithm>
+#include <cassert>
+#include <cstdio>
+#include <cstring>
+#include <map>
+#include <new>
 #include <sstream>
+#include <vector>
 
 #include "ork/core/Logger.h"
+#include "ork/core/Timer.h"
 #include "ork/resource/ResourceTemplate.h"
+#include "proland/producer/TileDiskCache.h"
+#include "proland/producer/TileEvictionPolicy.h"
+#include "proland/producer/TileHashMap.h"
 #include "proland/producer/TileProducer.h"
 
 #include <pthread.h>
@@ -55,8 +66,57 @@ using namespace ork;
 namespace proland
 {
 
+/**
+ * The tile identifiers that cannot be packed in 64 bits (see
+ * TileCache::Tile#getKey), and their key. These keys have a 255 %producer id
+ * and the index of the identifier in #overflowIds in their lower bits.
+ */
+static map<TileCache::Tile::TId, TileCache::Tile::Key> overflowKeys;
+
+/**
+ * The number of identifiers in each #overflowIds chunk (log2).
+ */
+#define OVERFLOW_CHUNK_BITS 12
+
+/**
+ * The maximum number of #overflowIds chunks.
+ */
+#define OVERFLOW_CHUNKS (1 << 16)
+
+/**
+ * The tile identifiers in #overflowKeys, indexed by key, in chunks of
+ * 2^OVERFLOW_CHUNK_BITS identifiers. The chunks are never moved or freed,
+ * and an identifier is never modified once its key has been returned by
+ * TileCache::Tile#getKey, so that they can be read without any lock (a
+ * key is always obtained after its identifier has been stored).
+ */
+static TileCache::Tile::TId *overflowIds[OVERFLOW_CHUNKS];
+
+/**
+ * The number of identifiers in #overflowIds.
+ */
+static size_t overflowCount = 0;
+
+/**
+ * The mutex used to access #overflowKeys, and to add identifiers in
+ * #overflowIds.
+ */
+static pthread_mutex_t overflowMutex = PTHREAD_MUTEX_INITIALIZER;
+
+static const TileCache::Tile::Key OVERFLOW_KEY = 255ULL << 56;
+
+/**
+ * Returns the tile identifier corresponding to the given overflow key.
+ * This function does not need any lock (see #overflowIds).
+ */
+static const TileCache::Tile::TId &getOverflowId(TileCache::Tile::Key key)
+{
+    size_t i = size_t(key & ((1ULL << 56) - 1));
+    return overflowIds[i >> OVERFLOW_CHUNK_BITS][i & ((1 << OVERFLOW_CHUNK_BITS) - 1)];
+}
+
 TileCache::Tile::Tile(int producerId, int level, int tx, int ty, ptr<Task> task, TileStorage::Slot *data) :
-    producerId(producerId), level(level), tx(tx), ty(ty), task(task), data(data), users(0)
+    producerId(producerId), level(level), tx(tx), ty(ty), task(task), data(data), users(0), prev(NULL), next(NULL), priority(0.0), prefetched(false), cancelled(false), started(false)
 {
     assert(data != NULL);
 }
@@ -94,23 +154,239 @@ TileCache::Tile::TId TileCache::Tile::getTId(int producerId, int level, int tx,
     return make_pair(producerId, make_pair(level, make_pair(tx, ty)));
 }
 
-TileCache::TileCache(ptr<TileStorage> storage,  std::string name, ptr<Scheduler> scheduler) : Object("TileCache")
+TileCache::Tile::Key TileCache::Tile::getKey() const
+{
+    return getKey(producerId, level, tx, ty);
+}
+
+TileCache::Tile::Key TileCache::Tile::getKey(int producerId, int level, int tx, int ty)
+{
+    assert(producerId >= 0 && level >= 0 && tx >= 0 && ty >= 0);
+    if (isPacked(producerId, level, tx, ty)) {
+        return (Key(producerId) << 56) | (Key(level) << 50) | (Key(tx) << 25) | Key(ty);
+    }
+    // the identifier does not fit in 64 bits: uses a unique key from the
+    // overflow table instead, so that it does not alias another tile
+    TId id = getTId(producerId, level, tx, ty);
+    pthread_mutex_lock(&overflowMutex);
+    map<TId, Key>::iterator i = overflowKeys.find(id);
+    Key key;
+    if (i == overflowKeys.end()) {
+        size_t n = overflowCount++;
+        size_t chunk = n >> OVERFLOW_CHUNK_BITS;
+        assert(chunk < OVERFLOW_CHUNKS);
+        if (overflowIds[chunk] == NULL) {
+            overflowIds[chunk] = new TId[1 << OVERFLOW_CHUNK_BITS];
+        }
+        overflowIds[chunk][n & ((1 << OVERFLOW_CHUNK_BITS) - 1)] = id;
+        key = OVERFLOW_KEY | Key(n);
+        overflowKeys.insert(make_pair(id, key));
+    } else {
+        key = i->second;
+    }
+    pthread_mutex_unlock(&overflowMutex);
+    return key;
+}
+
+TileCache::Tile::Key TileCache::Tile::getKey(int level, int tx, int ty)
+{
+    return getKey(0, level, tx, ty);
+}
+
+bool TileCache::Tile::isPacked(int producerId, int level, int tx, int ty)
+{
+    return producerId >= 0 && producerId < 255 && level >= 0 && level <= 25 &&
+        tx >= 0 && tx < (1 << 25) && ty >= 0 && ty < (1 << 25);
+}
+
+int TileCache::Tile::getProducerId(Key key)
+{
+    if ((key >> 56) == 255) {
+        return getOverflowId(key).first;
+    }
+    return int(key >> 56);
+}
+
+TileCache::Tile::Id TileCache::Tile::getId(Key key)
 {
-    init(storage, name, scheduler);
+    if ((key >> 56) == 255) {
+        return getOverflowId(key).second;
+    }
+    int mask = (1 << 25) - 1;
+    return getId(int((key >> 50) & 63), int((key >> 25) & mask), int(key & mask));
+}
+
+/**
+ * A partition of the tiles of a TileCache. See TileCache.
+ */
+class TileCache::Shard
+{
+public:
+    /**
+     * The tiles of this shard currently in use. These tiles cannot be evicted
+     * from the cache and from the TileStorage, until they become unused. Maps
+     * tile identifiers to actual tiles.
+     */
+    TileHashMap<Tile*> usedTiles;
+
+    /**
+     * The unused tiles of this shard. These tiles can be evicted from the
+     * cache at any moment. They are also linked together, via Tile#prev and
+     * Tile#next, in a list ordered by date of last use (to implement a LRU
+     * cache).
+     */
+    TileHashMap<Tile*> unusedTiles;
+
+    /**
+     * The least recently used unused tile of this shard, i.e. the head of the
+     * LRU list of unused tiles.
+     */
+    Tile *lruHead;
+
+    /**
+     * The most recently used unused tile of this shard, i.e. the tail of the
+     * LRU list of unused tiles.
+     */
+    Tile *lruTail;
+
+    /**
+     * The "inflation" value of the eviction priorities of this shard. This is
+     * the priority of the last evicted tile of this shard, which is added to
+     * the cost of the tiles that become unused. See TileEvictionPolicy.
+     */
+    double inflation;
+
+    /**
+     * The tasks to produce the data of deleted tiles. When an unused tile is
+     * evicted from the cache it is destroyed, but its %producer task may not be
+     * destroyed (if there remain some reference to it, for example via a task
+     * graph). If the tile is needed again, #getTile will create a new Tile,
+     * which could produce a new %producer task. Hence we could get two %producer
+     * tasks for the same tile, which could lead to inconsistencies (the two
+     * tasks may not have the same execution state, may not use the same storage
+     * to store their result, etc). To avoid this problem we store the tasks of
+     * deleted tiles in this map, in order to reuse them if a deleted tile is
+     * needed again. When a %producer task gets deleted, it removes itself from
+     * this map by calling #createTileTaskDeleted (because then it is not a
+     * problem to recreate a new Task, there will be no duplication). So the size
+     * of this map cannot grow unbounded.
+     */
+    TileHashMap<Task*> deletedTiles;
+
+    /**
+     * The access statistics of this shard. See TileCache#getAccessStats.
+     */
+    AccessStats stats;
+
+    /**
+     * A mutex to serialize parallel accesses to this shard. It is recursive
+     * because tile creation tasks can be deleted, and can then call
+     * #createTileTaskDeleted, while the shard is locked.
+     */
+    pthread_mutex_t mutex;
+
+    Shard() : lruHead(NULL), lruTail(NULL), inflation(0.0)
+    {
+        pthread_mutexattr_t attrs;
+        pthread_mutexattr_init(&attrs);
+        pthread_mutexattr_settype(&attrs, PTHREAD_MUTEX_RECURSIVE);
+        pthread_mutex_init(&mutex, &attrs);
+        pthread_mutexattr_destroy(&attrs);
+    }
+
+    ~Shard()
+    {
+        pthread_mutex_destroy(&mutex);
+    }
+
+    void lock(bool lock)
+    {
+        if (lock) {
+            if (pthread_mutex_trylock(&mutex) != 0) {
+                // the shard is locked by another thread; measures the time
+                // spent waiting for it (the stats are then protected by the
+                // lock we just acquired)
+                Timer timer;
+                timer.start();
+                pthread_mutex_lock(&mutex);
+                stats.lockWaitTime += timer.end();
+                ++stats.lockWaits;
+            }
+        } else {
+            pthread_mutex_unlock(&mutex);
+        }
+    }
+
+    /**
+     * Adds an unused tile to this shard, as the most recently used one, or
+     * as the least recently used one if leastRecent is true.
+     */
+    void addUnusedTile(Tile *t, bool leastRecent = false)
+    {
+        assert(t->prev == NULL && t->next == NULL);
+        unusedTiles.insert(t->getKey(), t);
+        if (leastRecent) {
+            t->next = lruHead;
+            if (lruHead == NULL) {
+                lruTail = t;
+            } else {
+                lruHead->prev = t;
+            }
+            lruHead = t;
+            return;
+        }
+        t->prev = lruTail;
+        if (lruTail == NULL) {
+            lruHead = t;
+        } else {
+            lruTail->next = t;
+        }
+        lruTail = t;
+    }
+
+    /**
+     * Removes an unused tile from this shard.
+     */
+    void removeUnusedTile(Tile *t)
+    {
+        unusedTiles.erase(t->getKey());
+        if (t->prev == NULL) {
+            lruHead = t->next;
+        } else {
+            t->prev->next = t->next;
+        }
+        if (t->next == NULL) {
+            lruTail = t->prev;
+        } else {
+            t->next->prev = t->prev;
+        }
+        t->prev = NULL;
+        t->next = NULL;
+    }
+};
+
+TileCache::TileCache(ptr<TileStorage> storage,  std::string name, ptr<Scheduler> scheduler, int shards) : Object("TileCache")
+{
+    init(storage, name, scheduler, shards);
 }
 
 TileCache::TileCache() : Object("TileCache")
 {
 }
 
-void TileCache::init(ptr<TileStorage> storage, std::string name, ptr<Scheduler> scheduler)
+void TileCache::init(ptr<TileStorage> storage, std::string name, ptr<Scheduler> scheduler, int shards)
 {
+    assert(shards > 0);
     this->nextProducerId = 0;
     this->storage = storage;
     this->scheduler = scheduler;
-    this->queries = 0;
-    this->misses = 0;
     this->name = name;
+    this->freeTiles = NULL;
+    this->policy = new TileEvictionPolicy();
+    this->trace = NULL;
+    for (int i = 0; i < shards; ++i) {
+        this->shards.push_back(new Shard());
+    }
     mutex = new pthread_mutex_t;
     pthread_mutexattr_t attrs;
     pthread_mutexattr_init(&attrs);
@@ -121,24 +397,37 @@ void TileCache::init(ptr<TileStorage> storage, std::string name, ptr<Scheduler>
 
 TileCache::~TileCache()
 {
+    stopTrace();
     pthread_mutex_destroy((pthread_mutex_t*) mutex);
     delete (pthread_mutex_t*) mutex;
     mutex = NULL;
-    // The users of a TileCache must release all their tiles with putTile
-    // before they erase their reference to the TileCache. Hence a TileCache
-    // cannot be deleted before all tiles are unused. So usedTiles should be
-    // empty at this point
-    assert(usedTiles.size() == 0);
-    unusedTiles.clear();
-    // releases the storage used by the unused tiles
-    list<Tile*>::iterator i = unusedTilesOrder.begin();
-    while (i != unusedTilesOrder.end()) {
-        storage->deleteSlot((*i)->data);
-        delete *i;
-        ++i;
-    }
-    unusedTilesOrder.clear();
-    deletedTiles.clear();
+    for (unsigned int n = 0; n < shards.size(); ++n) {
+        Shard *s = shards[n];
+        // The users of a TileCache must release all their tiles with putTile
+        // before they erase their reference to the TileCache. Hence a TileCache
+        // cannot be deleted before all tiles are unused. So usedTiles should be
+        // empty at this point
+        assert(s->usedTiles.size() == 0);
+        s->unusedTiles.clear();
+        // releases the storage used by the unused tiles
+        Tile *t = s->lruHead;
+        while (t != NULL) {
+            Tile *next = t->next;
+            storage->deleteSlot(t->data);
+            deleteTile(t);
+            t = next;
+        }
+        s->lruHead = NULL;
+        s->lruTail = NULL;
+        s->deletedTiles.clear();
+        delete s;
+    }
+    shards.clear();
+    for (unsigned int i = 0; i < tileChunks.size(); ++i) {
+        delete[] tileChunks[i];
+    }
+    tileChunks.clear();
+    freeTiles = NULL;
 }
 
 ptr<TileStorage> TileCache::getStorage()
@@ -151,90 +440,210 @@ ptr<Scheduler> TileCache::getScheduler()
     return scheduler;
 }
 
+int TileCache::getShardCount()
+{
+    return (int) shards.size();
+}
+
+void TileCache::getAllocationStats(AllocationStats &stats, bool reset)
+{
+    pthread_mutex_lock((pthread_mutex_t*) mutex);
+    stats = this->stats;
+    if (reset) {
+        this->stats = AllocationStats();
+    }
+    pthread_mutex_unlock((pthread_mutex_t*) mutex);
+}
+
+ptr<TileEvictionPolicy> TileCache::getEvictionPolicy()
+{
+    return policy;
+}
+
+void TileCache::setEvictionPolicy(ptr<TileEvictionPolicy> policy)
+{
+    assert(policy != NULL);
+    // the policy is used by putTile, which only locks a shard, so all the
+    // shards must be locked to change it (this is allowed because we hold
+    // the global lock)
+    pthread_mutex_lock((pthread_mutex_t*) mutex);
+    for (unsigned int i = 0; i < shards.size(); ++i) {
+        shards[i]->lock(true);
+    }
+    this->policy = policy;
+    for (unsigned int i = 0; i < shards.size(); ++i) {
+        shards[i]->lock(false);
+    }
+    pthread_mutex_unlock((pthread_mutex_t*) mutex);
+}
+
+ptr<TileDiskCache> TileCache::getDiskCache()
+{
+    return diskCache;
+}
+
+void TileCache::setDiskCache(ptr<TileDiskCache> diskCache)
+{
+    assert(diskCache == NULL || diskCache->getDataSize() == storage->getSlotDataSize());
+    this->diskCache = diskCache;
+}
+
+bool TileCache::startTrace(const char *file)
+{
+    stopTrace();
+    trace = fopen(file, "w");
+    if (trace == NULL) {
+        if (Logger::ERROR_LOGGER != NULL) {
+            Logger::ERROR_LOGGER->logf("CACHE", "%s: cannot open trace file '%s'", name.c_str(), file);
+        }
+        return false;
+    }
+    return true;
+}
+
+void TileCache::stopTrace()
+{
+    if (trace != NULL) {
+        FILE *f = (FILE*) trace;
+        trace = NULL;
+        map<int, TileProducer*>::iterator i = producers.begin();
+        while (i != producers.end()) {
+            fprintf(f, "c %d %f\n", i->first, i->second->getAverageCreateTime());
+            ++i;
+        }
+        fclose(f);
+    }
+}
+
+void TileCache::traceTile(char request, int producerId, int level, int tx, int ty)
+{
+    FILE *f = (FILE*) trace;
+    if (f != NULL) {
+        // fprintf locks the file, so that lines from several threads are
+        // not mixed together
+        fprintf(f, "%c %d %d %d %d\n", request, producerId, level, tx, ty);
+    }
+}
+
+void TileCache::getAccessStats(AccessStats &stats, bool reset)
+{
+    // the shards are locked one at a time, hence the returned statistics are
+    // not an atomic snapshot of the whole cache (but this is not needed for
+    // statistics)
+    stats = AccessStats();
+    for (unsigned int i = 0; i < shards.size(); ++i) {
+        Shard *s = shards[i];
+        s->lock(true);
+        stats.add(s->stats);
+        if (reset) {
+            s->stats = AccessStats();
+        }
+        s->lock(false);
+    }
+    pthread_mutex_lock((pthread_mutex_t*) mutex);
+    stats.add(mutexStats);
+    if (reset) {
+        mutexStats = AccessStats();
+    }
+    pthread_mutex_unlock((pthread_mutex_t*) mutex);
+}
+
 int TileCache::getUsedTiles()
 {
-    return usedTiles.size();
+    int n = 0;
+    for (unsigned int i = 0; i < shards.size(); ++i) {
+        shards[i]->lock(true);
+        n += shards[i]->usedTiles.size();
+        shards[i]->lock(false);
+    }
+    return n;
 }
 
 int TileCache::getUnusedTiles()
 {
-    return unusedTiles.size();
+    int n = 0;
+    for (unsigned int i = 0; i < shards.size(); ++i) {
+        shards[i]->lock(true);
+        n += shards[i]->unusedTiles.size();
+        shards[i]->lock(false);
+    }
+    return n;
 }
 
 TileCache::Tile* TileCache::findTile(int producerId, int level, int tx, int ty, bool includeCache)
 {
     assert(producers.find(producerId) != producers.end());
-    pthread_mutex_lock((pthread_mutex_t*) mutex);
-    Tile::TId id = Tile::getTId(producerId, level, tx, ty);
-    map<Tile::TId, Tile*>::iterator i = usedTiles.find(id);
+    Tile::Key key = Tile::getKey(producerId, level, tx, ty);
+    Shard *s = getShard(key);
+    s->lock(true);
+    Tile **i = s->usedTiles.find(key);
     Tile *t = NULL;
     // looks for the requested tile in the used tiles list
-    if (i != usedTiles.end()) {
-        t = i->second;
+    if (i != NULL) {
+        t = *i;
         assert(t->producerId == producerId && t->level == level && t->tx == tx && t->ty == ty);
     }
     // looks for the requested tile in the unused tiles list (if includeCache is true)
     if (t == NULL && includeCache) {
-        Cache::iterator i = unusedTiles.find(id);
-        if (i != unusedTiles.end()) {
-            t = *(i->second);
+        i = s->unusedTiles.find(key);
+        if (i != NULL) {
+            t = *i;
             assert(t->producerId == producerId && t->level == level && t->tx == tx && t->ty == ty);
         }
     }
-    pthread_mutex_unlock((pthread_mutex_t*) mutex);
+    s->lock(false);
     return t;
 }
 
 TileCache::Tile* TileCache::getTile(int producerId, int level, int tx, int ty, unsigned int deadline, int *users)
 {
     assert(producers.find(producerId) != producers.end());
-    pthread_mutex_lock((pthread_mutex_t*) mutex);
-    Tile::TId id = Tile::getTId(producerId, level, tx, ty);
-    map<Tile::TId, Tile*>::iterator i = usedTiles.find(id);
-    Tile *t;
-    if (i == usedTiles.end()) {
+    traceTile('g', producerId, level, tx, ty);
+    Tile::Key key = Tile::getKey(producerId, level, tx, ty);
+    Shard *s = getShard(key);
+    // first looks for the requested tile in its shard, which only requires
+    // to lock this shard
+    s->lock(true);
+    Tile *t = acquireTile(s, key, users);
+    s->lock(false);
+    if (t != NULL) {
+        return t;
+    }
+
+    // the requested tile is not in storage, it must be created; this requires
+    // the global lock, and then the shard lock again (the tile may have been
+    // created by another thread in the meantime)
+    lockMutex();
+    s->lock(true);
+    t = acquireTile(s, key, users);
+    if (t == NULL) {
         bool deletedTile = false;
-        ++queries;
-        Cache::iterator i = unusedTiles.find(id);
-        if (i == unusedTiles.end()) {
-            // the requested tile is not in storage, it must be created
-            TileStorage::Slot *data = storage->newSlot();
-            if (data == NULL && unusedTiles.size() > 0) {
-                // evict least recently used tile to reuse its data storage
-                list<Tile*>::iterator li = unusedTilesOrder.begin();
-                t = *li;
-                data = t->data;
-                unusedTiles.erase(t->getTId());
-                unusedTilesOrder.erase(li);
-                deletedTiles.insert(make_pair(t->getTId(), t->task.get()));
-                delete t;
+        TileStorage::Slot *data = newSlot(s);
+        if (data == NULL) {
+            ++s->stats.failures;
+        } else {
+            ++s->stats.misses;
+            ptr<Task> task;
+            Task **i = s->deletedTiles.find(key);
+            if (i != NULL) {
+                // if the task for creating this tile still exists, we reuse it
+                task = *i;
+                deletedTile = true;
+                s->deletedTiles.erase(key);
             }
-            if (data == NULL) { // cache is full
-                t = NULL;
-            } else {
-                ++misses;
-                ptr<Task> task;
-                map<Tile::TId, Task*>::iterator i = deletedTiles.find(id);
-                if (i != deletedTiles.end()) {
-                    // if the task for creating this tile still exists, we reuse it
-                    task = i->second;
-                    deletedTile = true;
-                    deletedTiles.erase(i);
-                }
-                task = producers[producerId]->createTile(level, tx, ty, data, deadline, task);
-                // creates the requested tile
-                t = new Tile(producerId, level, tx, ty, task, data);
+            // the shard is unlocked during the task creation, so that the
+            // tiles of this shard remain accessible to other threads (the
+            // global lock guarantees that this tile cannot be created twice)
+            s->lock(false);
+            task = producers[producerId]->createTile(level, tx, ty, data, deadline, task);
+            s->lock(true);
+            // creates the requested tile and marks it as used
+            t = newTile(producerId, level, tx, ty, task, data);
+            s->usedTiles.insert(key, t);
+            if (users != NULL) {
+                *users = 0;
             }
-        } else {
-            // requested tile found in unused tile list
-            list<Tile*>::iterator li = i->second;
-            t = *li;
-            unusedTiles.erase(i);
-            unusedTilesOrder.erase(li);
-        }
-        if (t != NULL) {
-            // marks requested tile as used
-            usedTiles.insert(make_pair(id, t));
+            t->users = 1;
             if (deletedTile) {
                 // if the tile data was not in storage and if the task to create it
                 // was reused from a deleted tile, we need to reexecute the task
@@ -247,60 +656,63 @@ TileCache::Tile* TileCache::getTile(int producerId, int level, int tx, int ty, u
             }
         }
         if (Logger::DEBUG_LOGGER != NULL) {
-            Logger::DEBUG_LOGGER->logf("CACHE", "%s: tiles: %d used, %d reusable, total %d", name.c_str(), usedTiles.size(), unusedTiles.size(), storage->getCapacity());
-//            Logger::DEBUG_LOGGER->logf("CACHE", "%s: queries: %d misses for %d queries", name.c_str(), misses, queries);
-        }
-    } else {
-        // requested tile found in used tiles list -> nothing to do
-        t = i->second;
-        assert(t->producerId == producerId && t->level == level && t->tx == tx && t->ty == ty);
-    }
-    if (t != NULL) {
-        if (users != NULL) {
-            *users = t->users;
+            Logger::DEBUG_LOGGER->logf("CACHE", "%s: tiles: %d used, %d reusable, total %d", name.c_str(), s->usedTiles.size(), s->unusedTiles.size(), storage->getCapacity());
+            Logger::DEBUG_LOGGER->logf("CACHE", "%s: %d misses for %d queries", name.c_str(), s->stats.misses, s->stats.hits + s->stats.misses);
         }
-        t->users += 1;
     }
+    s->lock(false);
     pthread_mutex_unlock((pthread_mutex_t*) mutex);
     return t;
 }
 
-ptr<Task> TileCache::prefetchTile(int producerId, int level, int tx, int ty)
+TileCache::Tile* TileCache::getReadyTile(int producerId, int level, int tx, int ty, bool includeCache, int *users)
 {
     assert(producers.find(producerId) != producers.end());
-    pthread_mutex_lock((pthread_mutex_t*) mutex);
-    Tile::TId id = Tile::getTId(producerId, level, tx, ty);
+    Tile::Key key = Tile::getKey(producerId, level, tx, ty);
+    Shard *s = getShard(key);
+    s->lock(true);
+    Tile **i = s->usedTiles.find(key);
+    if (i == NULL && includeCache) {
+        i = s->unusedTiles.find(key);
+    }
+    Tile *t = NULL;
+    if (i != NULL && (*i)->task->isDone()) {
+        t = acquireTile(s, key, users);
+    }
+    s->lock(false);
+    return t;
+}
+
+ptr<Task> TileCache::prefetchTile(int producerId, int level, int tx, int ty, unsigned int deadline)
+{
+    assert(producers.find(producerId) != producers.end());
+    traceTile('f', producerId, level, tx, ty);
+    Tile::Key key = Tile::getKey(producerId, level, tx, ty);
+    Shard *s = getShard(key);
     ptr<Task> task;
-    if (usedTiles.find(id) == usedTiles.end()) {
-        if (unusedTiles.find(id) == unusedTiles.end()) {
+    lockMutex();
+    s->lock(true);
+    if (s->usedTiles.find(key) == NULL) {
+        if (s->unusedTiles.find(key) == NULL) {
             // the requested tile is not in storage, it must be created
-            TileStorage::Slot *data = storage->newSlot();
-            if (data == NULL && unusedTiles.size() > 0) {
-                // evict least recently used tile to reuse its data storage
-                list<Tile*>::iterator li = unusedTilesOrder.begin();
-                Tile *t = *li;
-                data = t->data;
-                assert(data != NULL);
-                unusedTiles.erase(t->getTId());
-                unusedTilesOrder.erase(li);
-                deletedTiles.insert(make_pair(t->getTId(), t->task.get()));
-                delete t;
-            }
+            TileStorage::Slot *data = newSlot(s);
             if (data != NULL) {
-                unsigned int deadline = 1u << 31u;
                 bool deletedTile = false;
-                map<Tile::TId, Task*>::iterator i = deletedTiles.find(id);
-                if (i != deletedTiles.end()) {
+                Task **i = s->deletedTiles.find(key);
+                if (i != NULL) {
                     // if the task for creating this tile still exists, we reuse it
-                    task = i->second;
+                    task = *i;
                     deletedTile = true;
-                    deletedTiles.erase(i);
+                    s->deletedTiles.erase(key);
                 }
+                s->lock(false);
                 task = producers[producerId]->createTile(level, tx, ty, data, deadline, task);
+                s->lock(true);
                 // creates the requested tile
-                Tile *t = new Tile(producerId, level, tx, ty, task, data);
-                list<Tile*>::iterator li = unusedTilesOrder.insert(unusedTilesOrder.end(), t);
-                unusedTiles[id] = li;
+                Tile *t = newTile(producerId, level, tx, ty, task, data);
+                t->prefetched = true;
+                addUnusedTile(s, t);
+                ++s->stats.prefetches;
                 if (deletedTile) {
                     // if the tile data was not in storage and if the task to create it
                     // was reused from a deleted tile, we need to reexecute the task
@@ -313,122 +725,149 @@ ptr<Task> TileCache::prefetchTile(int producerId, int level, int tx, int ty)
                 }
                 /*if (Logger::DEBUG_LOGGER != NULL) {
                     ostringstream oss;
-                    oss << "tiles: " << usedTiles.size() << " used, " << unusedTiles.size() << " reusable";
+                    oss << "tiles: " << s->usedTiles.size() << " used, " << s->unusedTiles.size() << " reusable";
                     Logger::DEBUG_LOGGER->log("CACHE", oss.str());
                 }*/
             }
         }
     }
+    s->lock(false);
     pthread_mutex_unlock((pthread_mutex_t*) mutex);
     return task;
 }
 
 int TileCache::putTile(Tile *t)
 {
-    pthread_mutex_lock((pthread_mutex_t*) mutex);
+    traceTile('p', t->producerId, t->level, t->tx, t->ty);
+    Tile::Key key = t->getKey();
+    Shard *s = getShard(key);
+    s->lock(true);
     t->users -= 1;
     if (t->users == 0) {
         // the tile is now unused
-        Tile::TId id = t->getTId();
         // removes it from the used tiles list
-        map<Tile::TId, Tile*>::iterator i = usedTiles.find(id);
-        assert(i != usedTiles.end() && i->second == t);
-        usedTiles.erase(i);
+        assert(s->usedTiles.find(key) != NULL && *s->usedTiles.find(key) == t);
+        s->usedTiles.erase(key);
         // adds it to the unused tiles list
-        assert(unusedTiles.find(id) == unusedTiles.end());
-        list<Tile*>::iterator li = unusedTilesOrder.insert(unusedTilesOrder.end(), t);
-        unusedTiles[id] = li;
+        assert(s->unusedTiles.find(key) == NULL);
+        addUnusedTile(s, t);
         /*if (Logger::DEBUG_LOGGER != NULL) {
             ostringstream oss;
-            oss << "tiles: " << usedTiles.size() << " used, " << unusedTiles.size() << " reusable";
+            oss << "tiles: " << s->usedTiles.size() << " used, " << s->unusedTiles.size() << " reusable";
             Logger::DEBUG_LOGGER->log("CACHE", oss.str());
         }*/
     }
     int users = t->users;
-    pthread_mutex_unlock((pthread_mutex_t*) mutex);
+    s->lock(false);
     return users;
 }
 
+bool TileCache::cancelTile(int producerId, int level, int tx, int ty)
+{
+    Tile::Key key = Tile::getKey(producerId, level, tx, ty);
+    Shard *s = getShard(key);
+    bool cancelled = false;
+    s->lock(true);
+    Tile **i = s->unusedTiles.find(key);
+    // only prefetched tiles whose creation has not started can be cancelled
+    if (i != NULL && (*i)->prefetched && !(*i)->cancelled && !(*i)->started && !(*i)->task->isDone()) {
+        Tile *t = *i;
+        s->removeUnusedTile(t);
+        t->cancelled = true;
+        addUnusedTile(s, t);
+        cancelled = true;
+    }
+    s->lock(false);
+    return cancelled;
+}
+
 void TileCache::invalidateTiles(int producerId)
 {
     // marks the tasks to produce the tiles of the given producer as not done
     // so that they will be reexecuted when their result will be needed
-    pthread_mutex_lock((pthread_mutex_t*) mutex);
-    map<Tile::TId, Tile*>::iterator i = usedTiles.begin();
-    while (i != usedTiles.end()) {
-        if (i->second->producerId == producerId) {
-            if (scheduler == NULL) {
-                i->second->task->setIsDone(false, 0, Task::DATA_CHANGED);
-            } else {
-                scheduler->reschedule(i->second->task, Task::DATA_CHANGED, 1u << 31u);
+    lockMutex();
+    // the tiles of this producer stored on disk are no longer valid
+    if (diskCache != NULL && producers[producerId]->getDiskCacheKey() != 0) {
+        diskCache->removeAll(producers[producerId]->getDiskCacheKey());
+    }
+    for (unsigned int n = 0; n < shards.size(); ++n) {
+        Shard *s = shards[n];
+        s->lock(true);
+        Tile::Key key;
+        TileHashMap<Tile*>::Iterator i = s->usedTiles.getEntries();
+        while (i.hasNext()) {
+            Tile *t = i.next(key);
+            if (t->producerId == producerId) {
+                if (scheduler == NULL) {
+                    t->task->setIsDone(false, 0, Task::DATA_CHANGED);
+                } else {
+                    scheduler->reschedule(t->task, Task::DATA_CHANGED, 1u << 31u);
+                }
             }
         }
-        i++;
-    }
-    list<Tile*>::iterator j = unusedTilesOrder.begin();;
-    while (j != unusedTilesOrder.end()) {
-        if ((*j)->producerId == producerId) {
-            if (scheduler == NULL) {
-                (*j)->task->setIsDone(false, 0, Task::DATA_CHANGED);
-            } else {
-                scheduler->reschedule((*j)->task, Task::DATA_CHANGED, 1u << 31u);
+        Tile *j = s->lruHead;
+        while (j != NULL) {
+            if (j->producerId == producerId) {
+                if (scheduler == NULL) {
+                    j->task->setIsDone(false, 0, Task::DATA_CHANGED);
+                } else {
+                    scheduler->reschedule(j->task, Task::DATA_CHANGED, 1u << 31u);
+                }
             }
+            j = j->next;
         }
-        j++;
-    }
-    map<Tile::TId, Task*>::iterator k = deletedTiles.begin();
-    while (k != deletedTiles.end()) {
-        if (k->first.first == producerId) {
-            if (scheduler == NULL) {
-                k->second->setIsDone(false, 0, Task::DATA_CHANGED);
-            } else {
-                scheduler->reschedule(k->second, Task::DATA_CHANGED, 1u << 31u);
+        TileHashMap<Task*>::Iterator k = s->deletedTiles.getEntries();
+        while (k.hasNext()) {
+            Task *t = k.next(key);
+            if (Tile::getProducerId(key) == producerId) {
+                if (scheduler == NULL) {
+                    t->setIsDone(false, 0, Task::DATA_CHANGED);
+                } else {
+                    scheduler->reschedule(t, Task::DATA_CHANGED, 1u << 31u);
+                }
             }
         }
-        k++;
+        s->lock(false);
     }
     pthread_mutex_unlock((pthread_mutex_t*) mutex);
 }
 
 void TileCache::invalidateTile(int producerId, int level, int tx, int ty)
 {
-    Tile::TId id = TileCache::Tile::getTId(producerId, level, tx, ty);
+    Tile::Key key = TileCache::Tile::getKey(producerId, level, tx, ty);
+    Shard *s = getShard(key);
 
-    pthread_mutex_lock((pthread_mutex_t*) mutex);
-    map<Tile::TId, Tile*>::iterator i = usedTiles.begin();
-    while (i != usedTiles.end()) {
-        if (i->first == id) {
-            if (scheduler == NULL) {
-                i->second->task->setIsDone(false, 0, Task::DATA_CHANGED);
-            } else {
-                scheduler->reschedule(i->second->task, Task::DATA_CHANGED, 1u << 31u);
-            }
+    lockMutex();
+    if (diskCache != NULL && producers[producerId]->getDiskCacheKey() != 0) {
+        diskCache->remove(producers[producerId]->getDiskCacheKey(), level, tx, ty);
+    }
+    s->lock(true);
+    Tile **i = s->usedTiles.find(key);
+    if (i != NULL) {
+        if (scheduler == NULL) {
+            (*i)->task->setIsDone(false, 0, Task::DATA_CHANGED);
+        } else {
+            scheduler->reschedule((*i)->task, Task::DATA_CHANGED, 1u << 31u);
         }
-        i++;
     }
 
-    list<Tile*>::iterator j = unusedTilesOrder.begin();;
-    while (j != unusedTilesOrder.end()) {
-        if ((*j)->getTId() == id) {
-            if (scheduler == NULL) {
-                (*j)->task->setIsDone(false, 0, Task::DATA_CHANGED);
-            } else {
-                scheduler->reschedule((*j)->task, Task::DATA_CHANGED, 1u << 31u);
-            }
+    Tile **j = s->unusedTiles.find(key);
+    if (j != NULL) {
+        if (scheduler == NULL) {
+            (*j)->task->setIsDone(false, 0, Task::DATA_CHANGED);
+        } else {
+            scheduler->reschedule((*j)->task, Task::DATA_CHANGED, 1u << 31u);
         }
-        j++;
     }
-    map<Tile::TId, Task*>::iterator k = deletedTiles.begin();
-    while (k != deletedTiles.end()) {
-        if (k->first == id) {
-            if (scheduler == NULL) {
-                k->second->setIsDone(false, 0, Task::DATA_CHANGED);
-            } else {
-                scheduler->reschedule(k->second, Task::DATA_CHANGED, 1u << 31u);
-            }
+    Task **k = s->deletedTiles.find(key);
+    if (k != NULL) {
+        if (scheduler == NULL) {
+            (*k)->setIsDone(false, 0, Task::DATA_CHANGED);
+        } else {
+            scheduler->reschedule(*k, Task::DATA_CHANGED, 1u << 31u);
         }
-        k++;
     }
+    s->lock(false);
     pthread_mutex_unlock((pthread_mutex_t*) mutex);
 }
 
@@ -436,17 +875,274 @@ void TileCache::swap(ptr<TileCache> t)
 {
 }
 
-void TileCache::createTileTaskDeleted(int producerId, int level, int tx, int ty)
+void TileCache::lockMutex()
+{
+    if (pthread_mutex_trylock((pthread_mutex_t*) mutex) != 0) {
+        Timer timer;
+        timer.start();
+        pthread_mutex_lock((pthread_mutex_t*) mutex);
+        mutexStats.lockWaitTime += timer.end();
+        ++mutexStats.lockWaits;
+    }
+}
+
+TileCache::Shard *TileCache::getShard(Tile::Key key)
+{
+    if (shards.size() == 1) {
+        return shards[0];
+    }
+    // mixes the tile coordinates so that neighbor tiles, which are often
+    // requested at the same time, fall into different shards
+    key ^= key >> 33;
+    key *= 0xff51afd7ed558ccdULL;
+    key ^= key >> 33;
+    return shards[key % shards.size()];
+}
+
+TileCache::Tile *TileCache::acquireTile(Shard *s, Tile::Key key, int *users)
+{
+    Tile *t = NULL;
+    Tile **i = s->usedTiles.find(key);
+    if (i != NULL) {
+        // requested tile found in used tiles list -> nothing to do
+        t = *i;
+    } else {
+        i = s->unusedTiles.find(key);
+        if (i == NULL) {
+            return NULL;
+        }
+        // requested tile found in unused tile list -> marks it as used
+        t = *i;
+        s->removeUnusedTile(t);
+        s->usedTiles.insert(key, t);
+        // the tile is needed again before its creation task was skipped, so
+        // this task must now be executed normally
+        t->cancelled = false;
+    }
+    ++s->stats.hits;
+    if (t->prefetched) {
+        ++s->stats.prefetchHits;
+        t->prefetched = false;
+    }
+    assert(t->getKey() == key);
+    if (users != NULL) {
+        *users = t->users;
+    }
+    t->users += 1;
+    return t;
+}
+
+void TileCache::addUnusedTile(Shard *s, Tile *t)
+{
+    map<int, TileProducer*>::iterator i = producers.find(t->producerId);
+    if (t->cancelled) {
+        t->priority = s->inflation;
+        s->addUnusedTile(t, true);
+        return;
+    }
+    double cost = i == producers.end() ? 0.0 : policy->getCost(t, i->second);
+    t->priority = s->inflation + cost;
+    s->addUnusedTile(t);
+}
+
+TileStorage::Slot *TileCache::newSlot(Shard *home)
+{
+    TileStorage::Slot *data = storage->newSlot();
+    if (data != NULL) {
+        ++stats.slotsAllocated;
+        return data;
+    }
+    // evicts an unused tile of the first shard having unused tiles, starting
+    // with 'home', to reuse its data storage; the evicted tile is the one
+    // with the lowest priority among the least recently used ones
+    int candidates = policy->getCandidates();
+    int n = (int) shards.size();
+    int first = 0;
+    while (shards[first] != home) {
+        ++first;
+    }
+    for (int k = 0; k < n && data == NULL; ++k) {
+        Shard *s = shards[(first + k) % n];
+        s->lock(true);
+        if (s->lruHead != NULL) {
+            Tile *t = s->lruHead;
+            Tile *c = t->next;
+            for (int i = 1; i < candidates && c != NULL; ++i) {
+                if (c->priority < t->priority) {
+                    t = c;
+                }
+                c = c->next;
+            }
+            s->inflation = max(s->inflation, t->priority);
+            ++s->stats.evictions;
+            if (t->prefetched) {
+                ++s->stats.wastedPrefetches;
+            }
+            data = t->data;
+            assert(data != NULL);
+            s->removeUnusedTile(t);
+            s->deletedTiles.insert(t->getKey(), t->task.get());
+            deleteTile(t);
+            ++stats.slotsReused;
+        }
+        s->lock(false);
+    }
+    return data;
+}
+
+TileCache::Tile *TileCache::newTile(int producerId, int level, int tx, int ty, ptr<Task> task, TileStorage::Slot *data)
+{
+    if (freeTiles == NULL) {
+        // the pool is empty, allocates a new chunk of records; the first
+        // chunk can contain a record for each slot of the storage, which is
+        // the maximum number of tiles if the storage is not shared
+        int n = tileChunks.empty() ? max(storage->getCapacity(), 1) : 64;
+        int size = max(int(sizeof(Tile)), int(sizeof(void*)));
+        char *chunk = new char[n * size];
+        tileChunks.push_back(chunk);
+        for (int i = n - 1; i >= 0; --i) {
+            *((void**) (chunk + i * size)) = freeTiles;
+            freeTiles = chunk + i * size;
+        }
+        ++stats.heapAllocations;
+    }
+    void *p = freeTiles;
+    freeTiles = *((void**) p);
+    ++stats.tilesCreated;
+    return new (p) Tile(producerId, level, tx, ty, task, data);
+}
+
+void TileCache::deleteTile(Tile *t)
+{
+    t->~Tile();
+    *((void**) t) = freeTiles;
+    freeTiles = t;
+    ++stats.tilesDeleted;
+}
+
+TileCache::AllocationStats::AllocationStats() :
+    tilesCreated(0), tilesDeleted(0), heapAllocations(0), slotsAllocated(0), slotsReused(0)
+{
+}
+
+TileCache::AccessStats::AccessStats() :
+    hits(0), misses(0), failures(0), evictions(0), prefetches(0), prefetchHits(0),
+    wastedPrefetches(0), cancellations(0), lockWaits(0), lockWaitTime(0.0)
 {
-    Tile::TId id = Tile::getTId(producerId, level, tx, ty);
+}
+
+void TileCache::AccessStats::add(const AccessStats &stats)
+{
+    hits += stats.hits;
+    misses += stats.misses;
+    failures += stats.failures;
+    evictions += stats.evictions;
+    prefetches += stats.prefetches;
+    prefetchHits += stats.prefetchHits;
+    wastedPrefetches += stats.wastedPrefetches;
+    cancellations += stats.cancellations;
+    lockWaits += stats.lockWaits;
+    lockWaitTime += stats.lockWaitTime;
+}
+
+void TileCache::createTileTaskDeleted(int producerId, int level, int tx, int ty, Task *task)
+{
+    Tile::Key key = Tile::getKey(producerId, level, tx, ty);
     assert(mutex != NULL);
-    pthread_mutex_lock((pthread_mutex_t*) mutex);
-    map<Tile::TId, Task*>::iterator i = deletedTiles.find(id);
-    assert(i != deletedTiles.end());
-    deletedTiles.erase(i);
-    pthread_mutex_unlock((pthread_mutex_t*) mutex);
+    Shard *s = getShard(key);
+    s->lock(true);
+    // the task may not be in deletedTiles if it was skipped and replaced
+    // with a new task before being done (see #createTileTaskDone)
+    Task **i = s->deletedTiles.find(key);
+    if (i != NULL && *i == task) {
+        s->deletedTiles.erase(key);
+    }
+    s->lock(false);
 }
 
+void TileCache::createTileTaskDone(int producerId, int level, int tx, int ty, Task *task, bool skipped)
+{
+    Tile::Key key = Tile::getKey(producerId, level, tx, ty);
+    Shard *s = getShard(key);
+    s->lock(true);
+    Tile **i = s->usedTiles.find(key);
+    Tile **j = s->unusedTiles.find(key);
+    if (skipped) {
+        // the task can only now be reused for a new tile, since it is now
+        // done and will not be marked as done later; if a new tile, with a
+        // new task, was created in the meantime, this task is simply dropped
+        if (i == NULL && j == NULL && s->deletedTiles.find(key) == NULL) {
+            s->deletedTiles.insert(key, task);
+        }
+    } else if (i != NULL && (*i)->task.get() == task) {
+        (*i)->started = false;
+        (*i)->cancelled = false;
+    } else if (j != NULL && (*j)->task.get() == task) {
+        Tile *t = *j;
+        t->started = false;
+        if (t->cancelled) {
+            // the tile has been created anyway, it must not be evicted first
+            s->removeUnusedTile(t);
+            t->cancelled = false;
+            addUnusedTile(s, t);
+        }
+    }
+    s->lock(false);
+}
+
+bool TileCache::skipCancelledTile(int producerId, int level, int tx, int ty, TileStorage::Slot *data)
+{
+    Tile::Key key = Tile::getKey(producerId, level, tx, ty);
+    Shard *s = getShard(key);
+    bool skip = false;
+    // the global lock is needed to release the tile slot (see newSlot)
+    lockMutex();
+    s->lock(true);
+    Tile **i = s->unusedTiles.find(key);
+    if (i != NULL && (*i)->cancelled && (*i)->data == data) {
+        // removes the tile as if it was evicted, but releases its slot
+        // instead of reusing it; the task is put in deletedTiles, so that it
+        // can be reused and rescheduled if the tile is requested again, only
+        // when it is done (see #createTileTaskDone). Otherwise a new tile
+        // could reuse it before the scheduler marks it as done, and would
+        // then be considered as created.
+        Tile *t = *i;
+        ++s->stats.cancellations;
+        if (t->prefetched) {
+            ++s->stats.wastedPrefetches;
+        }
+        s->removeUnusedTile(t);
+        deleteTile(t);
+        storage->deleteSlot(data);
+        skip = true;
+    } else {
+        // the tile creation starts, it can no longer be cancelled
+        if (i == NULL) {
+            i = s->usedTiles.find(key);
+        }
+        if (i != NULL && (*i)->data == data) {
+            (*i)->started = true;
+            (*i)->cancelled = false;
+        }
+    }
+    s->lock(false);
+    pthread_mutex_unlock((pthread_mutex_t*) mutex);
+    return skip;
+}
+/**
+ * The resource for a TileCache. The number of shards of the cache is given by
+ * the optional "shards" attribute, whose default value is given by the
+ * template parameter. The eviction policy is given by the optional "eviction"
+ * attribute ("lru", "levelWeighted" or "greedyDual"), with optional
+ * "candidates" and "levelWeight" attributes (see TileEvictionPolicy and its
+ * subclasses). "levelWeight" is a float for both policies (1 by default for
+ * "levelWeighted", 0 for "greedyDual"). The optional "trace" attribute gives a file where the tile
+ * requests are recorded (see TileCache#startTrace). The optional "diskCache"
+ * attribute gives the file of a TileDiskCache, whose capacity (in tiles) is
+ * given by the optional "diskCacheCapacity" attribute (by default, four times
+ * the capacity of the storage).
+ */
+template<int defaultShards>
 class TileCacheResource : public ResourceTemplate<1, TileCache>
 {
 public:
@@ -456,7 +1152,8 @@ public:
         e = e == NULL ? desc->descriptor : e;
         ptr<TileStorage> storage;
         ptr<Scheduler> scheduler;
-        checkParameters(desc, e, "name,storage,scheduler,");
+        int shards = defaultShards;
+        checkParameters(desc, e, "name,storage,scheduler,shards,eviction,candidates,levelWeight,trace,diskCache,diskCacheCapacity,");
         if (e->Attribute("storage") != NULL) {
             string id = getParameter(desc, e, "storage");
             storage = manager->loadResource(id).cast<TileStorage>();
@@ -473,12 +1170,66 @@ public:
         }
         string id = getParameter(desc, e, "scheduler");
         scheduler = manager->loadResource(id).cast<Scheduler>();
-        init(storage, name, scheduler);
+        if (e->Attribute("shards") != NULL) {
+            getIntParameter(desc, e, "shards", &shards);
+        }
+        init(storage, name, scheduler, shards);
+        if (e->Attribute("eviction") != NULL) {
+            int candidates = 8;
+            if (e->Attribute("candidates") != NULL) {
+                getIntParameter(desc, e, "candidates", &candidates);
+            }
+            string eviction = getParameter(desc, e, "eviction");
+            if (eviction == "lru") {
+                setEvictionPolicy(new TileEvictionPolicy());
+            } else if (eviction == "levelWeighted") {
+                float weight = 1.0f;
+                if (e->Attribute("levelWeight") != NULL) {
+                    getFloatParameter(desc, e, "levelWeight", &weight);
+                }
+                setEvictionPolicy(new LevelWeightedEvictionPolicy(candidates, weight));
+            } else if (eviction == "greedyDual") {
+                float levelWeight = 0.0f;
+                if (e->Attribute("levelWeight") != NULL) {
+                    getFloatParameter(desc, e, "levelWeight", &levelWeight);
+                }
+                setEvictionPolicy(new GreedyDualEvictionPolicy(candidates, levelWeight));
+            } else {
+                if (Logger::ERROR_LOGGER != NULL) {
+                    Resource::log(Logger::ERROR_LOGGER, desc, e, "Invalid eviction attribute");
+                }
+                throw exception();
+            }
+        }
+        if (e->Attribute("diskCache") != NULL) {
+            int dataSize = storage->getSlotDataSize();
+            if (dataSize == 0) {
+                if (Logger::ERROR_LOGGER != NULL) {
+                    Resource::log(Logger::ERROR_LOGGER, desc, e, "This tile storage does not support a disk cache");
+                }
+                throw exception();
+            }
+            int capacity = 4 * storage->getCapacity();
+            if (e->Attribute("diskCacheCapacity") != NULL) {
+                getIntParameter(desc, e, "diskCacheCapacity", &capacity);
+            }
+            ptr<TileDiskCache> d = new TileDiskCache(getParameter(desc, e, "diskCache").c_str(), dataSize, capacity);
+            if (d->isOpen()) {
+                setDiskCache(d);
+            }
+        }
+        if (e->Attribute("trace") != NULL) {
+            startTrace(getParameter(desc, e, "trace").c_str());
+        }
     }
 };
 
 extern const char tileCache[] = "tileCache";
 
-static ResourceFactory::Type<tileCache, TileCacheResource> TileCacheType;
+extern const char shardedTileCache[] = "shardedTileCache";
+
+static ResourceFactory::Type<tileCache, TileCacheResource<1> > TileCacheType;
+
+static ResourceFactory::Type<shardedTileCache, TileCacheResource<16> > ShardedTileCacheType;
 
 }
@@ -56,6 +56,10 @@ namespace proland
 
 class TileProducer;
 
+class TileEvictionPolicy;
+
+class TileDiskCache;
+
 /**
  * A cache of tiles to avoid recomputing recently produced tiles. A tile cache
  * keeps track of which tiles (identified by their level,tx,ty coordinates) are
@@ -73,6 +77,16 @@ class TileProducer;
  * tiles that are needed to render the current frame should be declared in use,
  * so that they are not evicted between their creation and their actual
  * rendering.
+ * A tile cache can be partitioned in several shards, each tile being assigned
+ * to a shard based on its producer id and level,tx,ty coordinates. Each shard
+ * has its own lock and its own LRU order for unused tiles, so that the
+ * lookups of tiles that are already in the cache (see #findTile, #getTile and
+ * #putTile) only contend with the lookups of tiles in the same shard. The
+ * creation of new tiles is still serialized by a global lock.
+ * The unused tiles that are evicted when storage is needed for new tiles are
+ * selected by a TileEvictionPolicy (LRU by default). A TileCache can also
+ * have a persistent, second level TileDiskCache, used by the producers whose
+ * tiles can be stored on disk (see TileProducer#setDiskCacheKey).
  * @ingroup producer
  * @authors Eric Bruneton, Antoine Begault, Guillaume Piolat
  */
@@ -99,6 +113,17 @@ public:
          */
         typedef std::pair<int, Id> TId;
 
+        /**
+         * A packed tile identifier. Contains a %producer id (8 bits), and
+         * tile coordinates level (6 bits), tx and ty (25 bits each), packed
+         * in a 64 bits integer. See TileHashMap. Identifiers that do not fit
+         * in these bits (%producer id 255 or more, level above 25) get a
+         * unique key with a 255 %producer id from a global overflow table,
+         * whose entries are never removed nor modified, so that they can be
+         * decoded with #getProducerId and #getId without any lock.
+         */
+        typedef unsigned long long Key;
+
         /**
          * The id of the %producer that manages this tile.  This local id is
          * assigned to each new %producer that uses this TileCache.
@@ -184,6 +209,53 @@ public:
          */
         static TId getTId(int producerId, int level, int tx, int ty);
 
+        /**
+         * Returns the packed identifier of this tile.
+         */
+        Key getKey() const;
+
+        /**
+         * Returns the packed identifier of a tile.
+         *
+         * @param producerId the id of the tile's %producer.
+         * @param level the tile's quadtree level.
+         * @param tx the tile's quadtree x coordinate.
+         * @param ty the tile's quadtree y coordinate.
+         */
+        static Key getKey(int producerId, int level, int tx, int ty);
+
+        /**
+         * Returns the packed identifier of a tile, without %producer id (i.e.
+         * with a 0 %producer id).
+         *
+         * @param level the tile's quadtree level.
+         * @param tx the tile's quadtree x coordinate.
+         * @param ty the tile's quadtree y coordinate.
+         */
+        static Key getKey(int level, int tx, int ty);
+
+        /**
+         * Returns true if the given tile identifier can be packed directly
+         * in a Key, i.e. without using the overflow table. Only such keys
+         * are stable across sessions.
+         *
+         * @param producerId the id of the tile's %producer.
+         * @param level the tile's quadtree level.
+         * @param tx the tile's quadtree x coordinate.
+         * @param ty the tile's quadtree y coordinate.
+         */
+        static bool isPacked(int producerId, int level, int tx, int ty);
+
+        /**
+         * Returns the %producer id of a packed tile identifier.
+         */
+        static int getProducerId(Key key);
+
+        /**
+         * Returns the identifier of a tile from its packed identifier.
+         */
+        static Id getId(Key key);
+
     private:
         /**
          * The actual data of this tile. This data is not ready before #task is
@@ -198,11 +270,158 @@ public:
          */
         int users;
 
+        /**
+         * The previous tile in the LRU list of unused tiles, or NULL if this
+         * tile is used or is the least recently used tile.
+         */
+        Tile *prev;
+
+        /**
+         * The next tile in the LRU list of unused tiles, or NULL if this tile
+         * is used or is the most recently used tile.
+         */
+        Tile *next;
+
+        /**
+         * The eviction priority of this tile, if it is unused. Unused tiles
+         * with the lowest priority are evicted first. See TileEvictionPolicy.
+         */
+        double priority;
+
+        /**
+         * True if this tile was created by #prefetchTile, and has not been
+         * requested with #getTile since then. Only prefetched tiles can be
+         * cancelled (see #cancelTile).
+         */
+        bool prefetched;
+
+        /**
+         * True if this tile was cancelled with #cancelTile before its #task
+         * was executed. The creation of a
+         * cancelled tile is skipped, unless it is requested again before its
+         * task is executed.
+         */
+        bool cancelled;
+
+        /**
+         * True if the execution of #task has started (see
+         * #skipCancelledTile) and is not finished yet. The creation of such
+         * a tile can no longer be cancelled.
+         */
+        bool started;
+
         friend class TileCache;
 
         friend class CreateTile;
     };
 
+    /**
+     * Memory allocation statistics of a TileCache. See #getAllocationStats.
+     */
+    class AllocationStats
+    {
+    public:
+        /**
+         * The number of Tile records created by the cache.
+         */
+        int tilesCreated;
+
+        /**
+         * The number of Tile records deleted by the cache.
+         */
+        int tilesDeleted;
+
+        /**
+         * The number of heap allocations done to create Tile records. Tile
+         * records are allocated from a pool, which only needs a new heap
+         * allocation when all its records are in use.
+         */
+        int heapAllocations;
+
+        /**
+         * The number of free slots taken from the TileStorage.
+         */
+        int slotsAllocated;
+
+        /**
+         * The number of slots reused by evicting an unused tile.
+         */
+        int slotsReused;
+
+        AllocationStats();
+    };
+
+    /**
+     * Access statistics of a TileCache. See #getAccessStats.
+     */
+    class AccessStats
+    {
+    public:
+        /**
+         * The number of #getTile calls for which the tile was found in the
+         * cache (used or unused).
+         */
+        int hits;
+
+        /**
+         * The number of #getTile calls for which the tile was not in the
+         * cache, and had to be (re)created.
+         */
+        int misses;
+
+        /**
+         * The number of #getTile calls that failed because the cache was
+         * full.
+         */
+        int failures;
+
+        /**
+         * The number of unused tiles evicted to reuse their storage.
+         */
+        int evictions;
+
+        /**
+         * The number of tiles created by #prefetchTile.
+         */
+        int prefetches;
+
+        /**
+         * The number of prefetched tiles that were requested with #getTile
+         * before being evicted.
+         */
+        int prefetchHits;
+
+        /**
+         * The number of prefetched tiles that were evicted without having
+         * been requested with #getTile.
+         */
+        int wastedPrefetches;
+
+        /**
+         * The number of tile creation tasks that were skipped because their
+         * tile was cancelled.
+         */
+        int cancellations;
+
+        /**
+         * The number of times a thread had to wait for a lock of the cache.
+         */
+        int lockWaits;
+
+        /**
+         * The total time spent waiting for the locks of the cache, in micro
+         * seconds.
+         */
+        double lockWaitTime;
+
+        AccessStats();
+
+        /**
+         * Adds the given statistics to these statistics.
+         */
+        void add(const AccessStats &stats);
+    };
+
     /**
      * Creates a new TileCache.
      *
@@ -211,8 +430,9 @@ public:
      * @param scheduler an optional scheduler to schedule the creation of
      *      prefetched tiles. If no scheduler is specified, prefetch is
      *      disabled.
+     * @param shards the number of shards of this cache (see TileCache).
      */
-    TileCache(ptr<TileStorage> storage, std::string name, ptr<Scheduler> scheduler = NULL);
+    TileCache(ptr<TileStorage> storage, std::string name, ptr<Scheduler> scheduler = NULL, int shards = 1);
 
     /**
      * Deletes this TileCache.
@@ -229,6 +449,60 @@ public:
      */
     ptr<Scheduler> getScheduler();
 
+    /**
+     * Returns the number of shards of this cache.
+     */
+    int getShardCount();
+
+    /**
+     * Returns the policy used to select the unused tiles to be evicted.
+     */
+    ptr<TileEvictionPolicy> getEvictionPolicy();
+
+    /**
+     * Sets the policy used to select the unused tiles to be evicted. The
+     * priorities of the tiles that are already unused are not changed.
+     *
+     * @param policy the new eviction policy.
+     */
+    void setEvictionPolicy(ptr<TileEvictionPolicy> policy);
+
+    /**
+     * Returns the second level, persistent cache of this cache. May be NULL.
+     */
+    ptr<TileDiskCache> getDiskCache();
+
+    /**
+     * Sets the second level, persistent cache of this cache. Its data size
+     * must be equal to the TileStorage#getSlotDataSize of the storage of this
+     * cache. This method must not be called while other threads use this
+     * cache.
+     *
+     * @param diskCache a disk cache, or NULL to disable the second level cache.
+     */
+    void setDiskCache(ptr<TileDiskCache> diskCache);
+
+    /**
+     * Starts recording the tile requests made to this cache in a text file,
+     * for instance to replay them with different eviction policies. Each
+     * request is recorded on one line as "g", "p" or "f" (for #getTile,
+     * #putTile and #prefetchTile respectively) followed by the %producer id
+     * and the level, tx, ty coordinates of the tile. When the recording is
+     * stopped, a "c" line is added for each %producer, containing its id and
+     * its average tile creation time in micro seconds (see
+     * TileProducer#getAverageCreateTime).
+     *
+     * @param file the file where the requests must be recorded.
+     * @return true if the file could be opened.
+     */
+    bool startTrace(const char *file);
+
+    /**
+     * Stops recording the tile requests made to this cache. This method must
+     * not be called while other threads use this cache.
+     */
+    void stopTrace();
+
     /**
      * Returns the number of tiles currently in use in this cache.
      */
@@ -239,6 +513,26 @@ public:
      */
     int getUnusedTiles();
 
+    /**
+     * Returns the memory allocation statistics of this cache, since its
+     * creation or since the last reset of these statistics.
+     *
+     * @param[out] stats the memory allocation statistics of this cache.
+     * @param reset true to reset the statistics after they are returned. This
+     *      can be used to get per frame statistics.
+     */
+    void getAllocationStats(AllocationStats &stats, bool reset = true);
+
+    /**
+     * Returns the access statistics of this cache, since its creation or
+     * since the last reset of these statistics.
+     *
+     * @param[out] stats the access statistics of this cache.
+     * @param reset true to reset the statistics after they are returned. This
+     *      can be used to get per frame statistics.
+     */
+    void getAccessStats(AccessStats &stats, bool reset = true);
+
     /**
      * Looks for a tile in this TileCache.
      *
@@ -273,6 +567,25 @@ public:
      */
     Tile* getTile(int producerId, int level, int tx, int ty, unsigned int deadline, int *users = NULL);
 
+    /**
+     * Returns the requested tile if it is in this cache and if its creation
+     * task is done, or NULL otherwise. Unlike #getTile, this method never
+     * creates a tile. If the tile is returned, its number of users is
+     * incremented by one, as with #getTile, and it must then be released
+     * with #putTile.
+     *
+     * @param producerId the id of the tile's %producer.
+     * @param level the tile's quadtree level.
+     * @param tx the tile's quadtree x coordinate.
+     * @param ty the tile's quadtree y coordinate.
+     * @param includeCache true to include both used and unused tiles in the
+     *      search, false to include only the used tiles.
+     * @param[out] the number of users of this tile, <i>before</i> it is
+     *      incremented.
+     * @return the requested tile, or NULL if it is not ready in this cache.
+     */
+    Tile* getReadyTile(int producerId, int level, int tx, int ty, bool includeCache = false, int *users = NULL);
+
     /**
      * Returns a prefetch task to create the given tile. If the requested tile
      * is currently in use or in cache but unused, this method does nothing.
@@ -285,8 +598,10 @@ public:
      * @param level the tile's quadtree level.
      * @param tx the tile's quadtree x coordinate.
      * @param ty the tile's quadtree y coordinate.
+     * @param deadline the frame number before which the tile should be
+     *      created. The default value gives the lowest priority to the task.
      */
-    ptr<Task> prefetchTile(int producerId, int level, int tx, int ty);
+    ptr<Task> prefetchTile(int producerId, int level, int tx, int ty, unsigned int deadline = 1u << 31u);
 
     /**
      * Decrements the number of users of this tile by one. If this number
@@ -299,6 +614,21 @@ public:
      */
     int putTile(Tile *t);
 
+    /**
+     * Cancels the creation of a prefetched tile that is no longer needed.
+     * If the given tile was created with #prefetchTile, has not been
+     * requested with #getTile since then, and if its creation task has not
+     * started yet, this task will be skipped, and the tile will be removed
+     * from the cache, unless the tile is requested with #getTile before.
+     *
+     * @param producerId the id of the tile's %producer.
+     * @param level the tile's quadtree level.
+     * @param tx the tile's quadtree x coordinate.
+     * @param ty the tile's quadtree y coordinate.
+     * @return true if the tile creation has been cancelled.
+     */
+    bool cancelTile(int producerId, int level, int tx, int ty);
+
     /**
      * Invalidates the tiles from this cache produced by the given producer.
      * This means that the tasks to produce the actual data of these tiles will
@@ -341,16 +671,23 @@ protected:
      * @param scheduler an optional scheduler to schedule the creation of
      *      prefetched tiles. If no scheduler is specified, prefetch is
      *      disabled.
+     * @param shards the number of shards of this cache (see TileCache).
      */
-    void init(ptr<TileStorage> storage, std::string name, ptr<Scheduler> scheduler = NULL);
+    void init(ptr<TileStorage> storage, std::string name, ptr<Scheduler> scheduler = NULL, int shards = 1);
 
     void swap(ptr<TileCache> c);
 
 private:
-    typedef std::map<Tile::TId, std::list<Tile*>::iterator> Cache;
+    /**
+     * A partition of the tiles of this cache, with its own lock. See TileCache.
+     */
+    class Shard;
 
     /**
      * Next local identifier to be used for a TileProducer using this cache.
+     * Identifiers are not reused, because the tiles of a deleted %producer
+     * can stay in the cache until they are evicted. Identifiers of 255 or
+     * more are still valid, but their tiles use overflow keys (see Tile#Key).
      */
     int nextProducerId;
 
@@ -372,62 +709,151 @@ private:
     ptr<Scheduler> scheduler;
 
     /**
-     * The tiles currently in use. These tiles cannot be evicted from the cache
-     * and from the TileStorage, until they become unused. Maps tile identifiers
-     * to actual tiles.
+     * The shards of this cache. Each shard contains the used and unused tiles
+     * whose identifiers are mapped to this shard by #getShard.
      */
-    std::map<Tile::TId, Tile*> usedTiles;
+    std::vector<Shard*> shards;
 
     /**
-     * The unused tiles. These tiles can be evicted from the cache at any
-     * moment. Maps tile identifiers to positions in the ordered list of tiles
-     * #unusedTilesOrder (used to implement a LRU cache).
+     * A mutex to serialize the creation of new tiles, and the accesses to
+     * #storage. This mutex must always be locked <i>before</i> the mutex of a
+     * shard, and a thread that does not hold this mutex must never lock more
+     * than one shard at a time.
      */
-    Cache unusedTiles;
+    void* mutex;
 
     /**
-     * The unused tiles, ordered by date of last use (to implement a LRU cache).
+     * The free Tile records of the pool of Tile records. Each free record
+     * contains a pointer to the next free record. Protected by #mutex.
      */
-    std::list<Tile*> unusedTilesOrder;
+    void *freeTiles;
 
     /**
-     * The tasks to produce the data of deleted tiles. When an unused tile is
-     * evicted from the cache it is destroyed, but its %producer task may not be
-     * destroyed (if there remain some reference to it, for example via a task
-     * graph). If the tile is needed again, #getTile will create a new Tile,
-     * which could produce a new %producer task. Hence we could get two %producer
-     * tasks for the same tile, which could lead to inconsistencies (the two
-     * tasks may not have the same execution state, may not use the same storage
-     * to store their result, etc). To avoid this problem we store the tasks of
-     * deleted tiles in this map, in order to reuse them if a deleted tile is
-     * needed again. When a %producer task gets deleted, it removes itself from
-     * this map by calling #createTileTaskDeleted (because then it is not a
-     * problem to recreate a new Task, there will be no duplication). So the size
-     * of this map cannot grow unbounded.
+     * The memory chunks allocated for the pool of Tile records.
      */
-    std::map<Tile::TId, Task*> deletedTiles;
+    std::vector<char*> tileChunks;
 
     /**
-     * The number of queries to this tile cache. Only used for statistics.
+     * The memory allocation statistics of this cache. Protected by #mutex.
      */
-    int queries;
+    AllocationStats stats;
 
     /**
-     * The number of missed queries to this tile cache. This is the number of
-     * times a tile was requested but not found in the cache, requiring to
-     * (re)create it. Only used for statistics.
+     * The time spent waiting for #mutex. The other access statistics are
+     * stored in the shards. Protected by #mutex.
      */
-    int misses;
+    AccessStats mutexStats;
 
     /**
-     * A mutex to serialize parallel accesses to this cache.
+     * The policy used to select the unused tiles to be evicted.
      */
-    void* mutex;
+    ptr<TileEvictionPolicy> policy;
+
+    /**
+     * The second level, persistent cache of this cache. May be NULL.
+     */
+    ptr<TileDiskCache> diskCache;
+
+    /**
+     * The file where the tile requests are recorded, or NULL. See #startTrace.
+     */
+    void *trace;
+
+    /**
+     * Creates a new Tile record from the pool of Tile records. The global
+     * #mutex must be locked by the caller. See Tile#Tile.
+     */
+    Tile *newTile(int producerId, int level, int tx, int ty, ptr<Task> task, TileStorage::Slot *data);
+
+    /**
+     * Deletes a Tile record and returns it to the pool of Tile records. The
+     * global #mutex must be locked by the caller.
+     */
+    void deleteTile(Tile *t);
+
+    /**
+     * Locks the global #mutex, measuring the time spent waiting for it in
+     * #mutexStats.
+     */
+    void lockMutex();
+
+    /**
+     * Returns the shard that contains the given tile.
+     */
+    Shard *getShard(Tile::Key key);
+
+    /**
+     * Looks for a used or unused tile in the given shard and, if it is found,
+     * marks it as used and increments its number of users. The shard must be
+     * locked by the caller.
+     *
+     * @param s the shard that contains the tile.
+     * @param key the tile identifier.
+     * @param[out] users the number of users of this tile, <i>before</i> it is
+     *      incremented.
+     * @return the requested tile, or NULL if it is not in the shard.
+     */
+    Tile *acquireTile(Shard *s, Tile::Key key, int *users);
+
+    /**
+     * Adds a tile to the unused tiles of the given shard, with an eviction
+     * priority computed with #policy. Cancelled tiles are added as the least
+     * recently used ones, with the lowest priority, so that they are evicted
+     * first. The shard must be locked by the caller.
+     */
+    void addUnusedTile(Shard *s, Tile *t);
+
+    /**
+     * Records a tile request in #trace, if it is not NULL.
+     */
+    void traceTile(char request, int producerId, int level, int tx, int ty);
+
+    /**
+     * Returns a free slot of #storage, evicting an unused tile of a shard if
+     * necessary (selected with #policy). The shards are tried in turn,
+     * starting with the given one. The global #mutex must be locked by the
+     * caller.
+     *
+     * @param home the shard of the tile for which a slot is needed.
+     * @return a free slot, or NULL if the cache is full.
+     */
+    TileStorage::Slot *newSlot(Shard *home);
 
     /**
      * Notifies this TileCache that a tile creation task has been deleted.
      */
-    void createTileTaskDeleted(int producerId, int level, int tx, int ty);
+    void createTileTaskDeleted(int producerId, int level, int tx, int ty, Task *task);
+
+    /**
+     * Notifies this TileCache that a tile creation task is done. If the
+     * task was skipped (see #skipCancelledTile), it is added to the
+     * deleted tiles so that it can be reused if its tile is requested
+     * again. Otherwise the started and cancelled flags of its tile are
+     * cleared.
+     *
+     * @param producerId the id of the tile's %producer.
+     * @param level the tile's quadtree level.
+     * @param tx the tile's quadtree x coordinate.
+     * @param ty the tile's quadtree y coordinate.
+     * @param task the tile creation task.
+     * @param skipped true if the execution of this task was skipped.
+     */
+    void createTileTaskDone(int producerId, int level, int tx, int ty, Task *task, bool skipped);
+
+    /**
+     * Checks if the creation of the given tile has been cancelled. If so,
+     * removes this tile from the cache and releases its slot, so that its
+     * creation task can be skipped. Called by a tile creation task before
+     * it produces the tile.
+     *
+     * @param producerId the id of the tile's %producer.
+     * @param level the tile's quadtree level.
+     * @param tx the tile's quadtree x coordinate.
+     * @param ty the tile's quadtree y coordinate.
+     * @param data the slot where the creation task must store the tile.
+     * @return true if the tile creation task must be skipped.
+     */
+    bool skipCancelledTile(int producerId, int level, int tx, int ty, TileStorage::Slot *data);
 
     friend class TileProducer;
 
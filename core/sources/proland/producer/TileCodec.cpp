@@ -0,0 +1,267 @@
+/*
+ * Proland: a procedural landscape rendering library.
+ * Website : http://proland.inrialpes.fr/
+ * Copyright (c) 2008-2015 INRIA - LJK (CNRS - Grenoble University)
+ * All rights reserved.
+ * Redistribution and use in source and binary forms, with or without 
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice, 
+ * this list of conditions and the following disclaimer.
+ * 
+ * 2. Redistributions in binary form must reproduce the above copyright notice, 
+ * this list of conditions and the following disclaimer in the documentation 
+ * and/or other materials provided with the distribution.
+ * 
+ * 3. Neither the name of the copyright holder nor the names of its contributors 
+ * may be used to endorse or promote products derived from this software without 
+ * specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND 
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED 
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. 
+ * IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, 
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, 
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, 
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF 
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE 
+ * OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED 
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+/*
+ * Proland is distributed under the Berkeley Software Distribution 3 Licence. 
+ * For any assistance, feedback and enquiries about training programs, you can check out the 
+ * contact page on our website : 
+ * http://proland.inrialpes.fr/
+ */
+/*
+ * Main authors: Eric Bruneton, Antoine Begault, Guillaume Piolat.
+ */
+
+#include "proland/producer/TileCodec.h"
+
+#include <cstdlib>
+#include <cstring>
+
+#include <zlib.h>
+#include "tiffio.h"
+
+#ifdef PROLAND_USE_ZSTD
+#include <zstd.h>
+#endif
+
+#ifdef PROLAND_USE_LZ4
+#include <lz4.h>
+#endif
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define PROLAND_DECODE_SSE2
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#define PROLAND_DECODE_NEON
+#endif
+
+#include "proland/util/mfs.h"
+
+namespace proland
+{
+
+bool TileCodec::isAvailable(Codec codec)
+{
+    switch (codec) {
+    case TIFF:
+    case DEFLATE:
+        return true;
+    case ZSTD:
+#ifdef PROLAND_USE_ZSTD
+        return true;
+#else
+        return false;
+#endif
+    case LZ4:
+#ifdef PROLAND_USE_LZ4
+        return true;
+#else
+        return false;
+#endif
+    }
+    return false;
+}
+
+const char *TileCodec::getName(Codec codec)
+{
+    switch (codec) {
+    case TIFF:
+        return "tiff";
+    case DEFLATE:
+        return "deflate";
+    case ZSTD:
+        return "zstd";
+    case LZ4:
+        return "lz4";
+    }
+    return "unknown";
+}
+
+bool TileCodec::getCodec(const char *name, Codec &codec)
+{
+    for (int i = TIFF; i <= LZ4; ++i) {
+        if (strcmp(name, getName(Codec(i))) == 0) {
+            codec = Codec(i);
+            return true;
+        }
+    }
+    return false;
+}
+
+bool TileCodec::compress(Codec codec, const unsigned char *src, int size, vector<unsigned char> &dst)
+{
+    switch (codec) {
+    case DEFLATE: {
+        uLongf dstSize = compressBound(size);
+        dst.resize(dstSize);
+        if (compress2(&dst[0], &dstSize, src, size, Z_BEST_COMPRESSION) != Z_OK) {
+            return false;
+        }
+        dst.resize(dstSize);
+        return true;
+    }
+#ifdef PROLAND_USE_ZSTD
+    case ZSTD: {
+        dst.resize(ZSTD_compressBound(size));
+        size_t dstSize = ZSTD_compress(&dst[0], dst.size(), src, size, 19);
+        if (ZSTD_isError(dstSize)) {
+            return false;
+        }
+        dst.resize(dstSize);
+        return true;
+    }
+#endif
+#ifdef PROLAND_USE_LZ4
+    case LZ4: {
+        dst.resize(LZ4_compressBound(size));
+        int dstSize = LZ4_compress_default((const char*) src, (char*) &dst[0], size, int(dst.size()));
+        if (dstSize <= 0) {
+            return false;
+        }
+        dst.resize(dstSize);
+        return true;
+    }
+#endif
+    default:
+        return false;
+    }
+}
+
+bool TileCodec::compressTiff(const unsigned char *src, int width, int channels, int jpegQuality, vector<unsigned char> &dst)
+{
+    mfs_file fd;
+    mfs_open(NULL, 0, (char*)"w", &fd);
+    // TIFF alone would name the Codec enum value here
+    ::TIFF* tf = TIFFClientOpen("", "w", &fd,
+        (TIFFReadWriteProc) mfs_read, (TIFFReadWriteProc) mfs_write, (TIFFSeekProc) mfs_lseek,
+        (TIFFCloseProc) mfs_close, (TIFFSizeProc) mfs_size, (TIFFMapFileProc) mfs_map,
+        (TIFFUnmapFileProc) mfs_unmap);
+    if (tf == NULL) {
+        free(fd.buf);
+        return false;
+    }
+    TIFFSetField(tf, TIFFTAG_IMAGEWIDTH, width);
+    TIFFSetField(tf, TIFFTAG_IMAGELENGTH, width);
+    if (jpegQuality > 0) {
+        TIFFSetField(tf, TIFFTAG_COMPRESSION, COMPRESSION_JPEG);
+        TIFFSetField(tf, TIFFTAG_JPEGQUALITY, jpegQuality);
+    } else {
+        TIFFSetField(tf, TIFFTAG_COMPRESSION, COMPRESSION_DEFLATE);
+    }
+    TIFFSetField(tf, TIFFTAG_ORIENTATION, ORIENTATION_BOTLEFT);
+    TIFFSetField(tf, TIFFTAG_PLANARCONFIG, PLANARCONFIG_CONTIG);
+    if (channels <= 2) {
+        TIFFSetField(tf, TIFFTAG_PHOTOMETRIC, PHOTOMETRIC_MINISBLACK);
+    } else {
+        TIFFSetField(tf, TIFFTAG_PHOTOMETRIC, PHOTOMETRIC_RGB);
+    }
+    TIFFSetField(tf, TIFFTAG_SAMPLESPERPIXEL, channels);
+    TIFFSetField(tf, TIFFTAG_BITSPERSAMPLE, 8);
+    bool ok = TIFFWriteEncodedStrip(tf, 0, (void*) src, width * width * channels) != -1;
+    TIFFClose(tf);
+    if (ok) {
+        dst.assign((unsigned char*) fd.buf, (unsigned char*) fd.buf + fd.buf_size);
+    }
+    free(fd.buf);
+    return ok;
+}
+
+bool TileCodec::decompress(Codec codec, const unsigned char *src, int srcSize, unsigned char *dst, int dstSize)
+{
+    switch (codec) {
+    case DEFLATE: {
+        uLongf size = dstSize;
+        return uncompress(dst, &size, src, srcSize) == Z_OK && size == uLongf(dstSize);
+    }
+#ifdef PROLAND_USE_ZSTD
+    case ZSTD: {
+        size_t size = ZSTD_decompress(dst, dstSize, src, srcSize);
+        return !ZSTD_isError(size) && size == size_t(dstSize);
+    }
+#endif
+#ifdef PROLAND_USE_LZ4
+    case LZ4:
+        return LZ4_decompress_safe((const char*) src, (char*) dst, srcSize, dstSize) == dstSize;
+#endif
+    default:
+        return false;
+    }
+}
+
+void TileCodec::decodeShortsScalar(const unsigned char *src, int n, float scale, const float *add, float *dst)
+{
+    for (int i = 0; i < n; ++i) {
+        short z = short(src[2 * i] | (src[2 * i + 1] << 8));
+        dst[i] = (add == NULL ? 0.0f : add[i]) + z * scale;
+    }
+}
+
+void TileCodec::decodeShorts(const unsigned char *src, int n, float scale, const float *add, float *dst)
+{
+    int i = 0;
+#if defined(PROLAND_DECODE_SSE2)
+    // x86 is little endian, so the bytes can be loaded directly
+    __m128 s = _mm_set1_ps(scale);
+    for (; i + 8 <= n; i += 8) {
+        __m128i z = _mm_loadu_si128((const __m128i*) (src + 2 * i));
+        // sign extends each short to an int by shifting it into the upper
+        // half of a 32 bits lane and then shifting it back arithmetically
+        __m128i lo = _mm_srai_epi32(_mm_unpacklo_epi16(z, z), 16);
+        __m128i hi = _mm_srai_epi32(_mm_unpackhi_epi16(z, z), 16);
+        __m128 flo = _mm_mul_ps(_mm_cvtepi32_ps(lo), s);
+        __m128 fhi = _mm_mul_ps(_mm_cvtepi32_ps(hi), s);
+        if (add != NULL) {
+            flo = _mm_add_ps(flo, _mm_loadu_ps(add + i));
+            fhi = _mm_add_ps(fhi, _mm_loadu_ps(add + i + 4));
+        }
+        _mm_storeu_ps(dst + i, flo);
+        _mm_storeu_ps(dst + i + 4, fhi);
+    }
+#elif defined(PROLAND_DECODE_NEON) && (__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__)
+    float32x4_t s = vdupq_n_f32(scale);
+    for (; i + 8 <= n; i += 8) {
+        int16x8_t z = vreinterpretq_s16_u8(vld1q_u8(src + 2 * i));
+        float32x4_t flo = vmulq_f32(vcvtq_f32_s32(vmovl_s16(vget_low_s16(z))), s);
+        float32x4_t fhi = vmulq_f32(vcvtq_f32_s32(vmovl_s16(vget_high_s16(z))), s);
+        if (add != NULL) {
+            flo = vaddq_f32(flo, vld1q_f32(add + i));
+            fhi = vaddq_f32(fhi, vld1q_f32(add + i + 4));
+        }
+        vst1q_f32(dst + i, flo);
+        vst1q_f32(dst + i + 4, fhi);
+    }
+#endif
+    if (i < n) {
+        decodeShortsScalar(src + 2 * i, n - i, scale, add == NULL ? NULL : add + i, dst + i);
+    }
+}
+
+}
@@ -0,0 +1,167 @@
+/*
+ * Proland: a procedural landscape rendering library.
+ * Website : http://proland.inrialpes.fr/
+ * Copyright (c) 2008-2015 INRIA - LJK (CNRS - Grenoble University)
+ * All rights reserved.
+ * Redistribution and use in source and binary forms, with or without 
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice, 
+ * this list of conditions and the following disclaimer.
+ * 
+ * 2. Redistributions in binary form must reproduce the above copyright notice, 
+ * this list of conditions and the following disclaimer in the documentation 
+ * and/or other materials provided with the distribution.
+ * 
+ * 3. Neither the name of the copyright holder nor the names of its contributors 
+ * may be used to endorse or promote products derived from this software without 
+ * specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND 
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED 
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. 
+ * IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, 
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, 
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, 
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF 
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE 
+ * OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED 
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+/*
+ * Proland is distributed under the Berkeley Software Distribution 3 Licence. 
+ * For any assistance, feedback and enquiries about training programs, you can check out the 
+ * contact page on our website : 
+ * http://proland.inrialpes.fr/
+ */
+/*
+ * Main authors: Eric Bruneton, Antoine Begault, Guillaume Piolat.
+ */
+
+#ifndef _PROLAND_TILE_CODEC_H_
+#define _PROLAND_TILE_CODEC_H_
+
+#include <vector>
+
+using namespace std;
+
+namespace proland
+{
+
+/**
+ * Compression codecs for the tiles stored in precomputed tile files (see
+ * ResidualProducer and OrthoCPUProducer). The historical format stores each
+ * tile as a complete TIFF file, which must be decoded with libtiff. The other
+ * codecs store the raw tile data, compressed with deflate (zlib), zstd or LZ4,
+ * without any framing. zstd and LZ4 are only available if Proland is compiled
+ * with PROLAND_USE_ZSTD and PROLAND_USE_LZ4 respectively (see the USE_ZSTD and
+ * USE_LZ4 CMake options).
+ *
+ * Residual tile files using one of these codecs start with #MAGIC followed by
+ * the codec (the historical files start directly with their minimum level).
+ * Ortho tile files store the codec in bits 2 to 4 of their flags.
+ * @ingroup producer
+ * @authors Eric Bruneton, Antoine Begault, Guillaume Piolat
+ */
+class TileCodec
+{
+public:
+    /**
+     * The possible codecs for the tiles of a tile file.
+     */
+    enum Codec {
+        TIFF = 0, ///< one TIFF file per tile (historical format)
+        DEFLATE = 1, ///< raw tile data compressed with zlib
+        ZSTD = 2, ///< raw tile data compressed with zstd
+        LZ4 = 3 ///< raw tile data compressed with LZ4
+    };
+
+    /**
+     * The first int of residual tile files whose tiles are not stored as
+     * TIFF files ("PRLC" in little endian order).
+     */
+    static const int MAGIC = 0x434C5250;
+
+    /**
+     * Returns true if the given codec is available.
+     */
+    static bool isAvailable(Codec codec);
+
+    /**
+     * Returns the name of the given codec ("tiff", "deflate", "zstd" or "lz4").
+     */
+    static const char *getName(Codec codec);
+
+    /**
+     * Returns the codec corresponding to the given name.
+     *
+     * @param name a codec name (see #getName).
+     * @param[out] codec the corresponding codec.
+     * @return false if the name is not a valid codec name.
+     */
+    static bool getCodec(const char *name, Codec &codec);
+
+    /**
+     * Compresses the given raw tile data. Must not be called with TIFF.
+     *
+     * @param codec the codec to use.
+     * @param src the raw tile data.
+     * @param size the size of the raw tile data in bytes.
+     * @param[out] dst the compressed tile data.
+     * @return false if the codec is not available or if an error occured.
+     */
+    static bool compress(Codec codec, const unsigned char *src, int size, vector<unsigned char> &dst);
+
+    /**
+     * Compresses the given raw tile data as a TIFF file, with deflate or
+     * JPEG compression. This is the encoder for the TIFF codec.
+     *
+     * @param src the raw tile data, with 8 bits per channel. Tiles with one
+     *      or two channels (e.g. 16 bits residuals) are stored as grayscale
+     *      images, other tiles as RGB images.
+     * @param width the tile width and height in pixels.
+     * @param channels the number of channels per pixel.
+     * @param jpegQuality the JPEG quality, or 0 to use deflate compression.
+     * @param[out] dst the TIFF file data.
+     * @return false if an error occured.
+     */
+    static bool compressTiff(const unsigned char *src, int width, int channels, int jpegQuality, vector<unsigned char> &dst);
+
+    /**
+     * Decompresses the given tile data. Must not be called with TIFF.
+     *
+     * @param codec the codec used to compress the data.
+     * @param src the compressed tile data.
+     * @param srcSize the size of the compressed tile data in bytes.
+     * @param dst where the raw tile data must be written.
+     * @param dstSize the size of the raw tile data in bytes.
+     * @return false if the codec is not available, if an error occured, or
+     *      if the raw data size is not equal to dstSize.
+     */
+    static bool decompress(Codec codec, const unsigned char *src, int srcSize, unsigned char *dst, int dstSize);
+
+    /**
+     * Converts 16 bits signed integers, stored in little endian order, to
+     * floats. This conversion is vectorized with SSE2 or NEON when available.
+     * Computes dst[i] = add[i] + z[i] * scale for i in [0,n[, where z[i] is
+     * the i-th integer of src, and where add[i] is 0 if add is NULL.
+     *
+     * @param src n 16 bits signed integers in little endian order.
+     * @param n the number of values to convert.
+     * @param scale the scale factor to apply to the integers.
+     * @param add optional values to be added to the scaled integers. Can
+     *      be equal to dst.
+     * @param dst where the n converted values must be written.
+     */
+    static void decodeShorts(const unsigned char *src, int n, float scale, const float *add, float *dst);
+
+    /**
+     * Scalar version of #decodeShorts.
+     */
+    static void decodeShortsScalar(const unsigned char *src, int n, float scale, const float *add, float *dst);
+};
+
+}
+
+#endif
@@ -0,0 +1,460 @@
+/*
+ * Proland: a procedural landscape rendering library.
+ * Website : http://proland.inrialpes.fr/
+ * Copyright (c) 2008-2015 INRIA - LJK (CNRS - Grenoble University)
+ * All rights reserved.
+ * Redistribution and use in source and binary forms, with or without 
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice, 
+ * this list of conditions and the following disclaimer.
+ * 
+ * 2. Redistributions in binary form must reproduce the above copyright notice, 
+ * this list of conditions and the following disclaimer in the documentation 
+ * and/or other materials provided with the distribution.
+ * 
+ * 3. Neither the name of the copyright holder nor the names of its contributors 
+ * may be used to endorse or promote products derived from this software without 
+ * specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND 
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED 
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. 
+ * IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, 
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, 
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, 
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF 
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE 
+ * OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED 
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+/*
+ * Proland is distributed under the Berkeley Software Distribution 3 Licence. 
+ * For any assistance, feedback and enquiries about training programs, you can check out the 
+ * contact page on our website : 
+ * http://proland.inrialpes.fr/
+ */
+/*
+ * Main authors: Eric Bruneton, Antoine Begault, Guillaume Piolat.
+ */
+
+#include "proland/producer/TileDiskCache.h"
+
+#include <cstring>
+#include <pthread.h>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "ork/core/Logger.h"
+#include "ork/resource/tinyxml/tinyxml.h"
+#include "proland/producer/TileCache.h"
+
+using namespace std;
+using namespace ork;
+
+namespace proland
+{
+
+/**
+ * The header of a TileDiskCache file.
+ */
+struct DiskCacheHeader
+{
+    char magic[8];
+
+    unsigned int version;
+
+    unsigned int dataSize;
+
+    unsigned int capacity;
+
+    unsigned int ways;
+
+    /**
+     * The date counter used to find the least recently used records.
+     */
+    unsigned long long stamp;
+};
+
+/**
+ * The header of a TileDiskCache record. The tile data follows this header.
+ * A record whose producerKey is 0 is empty.
+ */
+struct DiskCacheRecord
+{
+    unsigned long long producerKey;
+
+    unsigned long long tileKey;
+
+    unsigned long long stamp;
+
+    unsigned long long checksum;
+};
+
+static const char DISK_CACHE_MAGIC[8] = { 'P', 'R', 'O', 'L', 'T', 'D', 'C', '\0' };
+
+static const unsigned int DISK_CACHE_VERSION = 1;
+
+/**
+ * The version of the tile producers, hashed in the producer keys. This
+ * version must be incremented when a change in a %producer implementation
+ * changes the tiles it produces, to invalidate the tiles stored on disk.
+ */
+static const unsigned long long PRODUCER_KEY_VERSION = 1;
+
+/**
+ * The size of the file header. The records start at this offset, which is a
+ * multiple of the page size.
+ */
+static const size_t DISK_CACHE_HEADER_SIZE = 4096;
+
+/**
+ * Computes a checksum of the given data, to detect records that were only
+ * partially written (e.g. if the application crashed while writing them).
+ */
+static unsigned long long checksum(const void *data, int size)
+{
+    const unsigned char *p = (const unsigned char*) data;
+    unsigned long long h = 14695981039346656037ULL;
+    int i = 0;
+    for (; i + 8 <= size; i += 8) {
+        unsigned long long w;
+        memcpy(&w, p + i, 8);
+        h = TileDiskCache::fnvMix(h, w);
+    }
+    for (; i < size; ++i) {
+        h = TileDiskCache::fnvMix(h, p[i]);
+    }
+    return h;
+}
+
+/**
+ * Returns a key for the given tile that is stable across sessions. Unlike
+ * TileCache::Tile#getKey, this never uses the (session specific) overflow
+ * table: tiles that cannot be packed are hashed instead, with the highest
+ * bit set so that they cannot collide with packed keys.
+ */
+static unsigned long long getTileKey(int level, int tx, int ty)
+{
+    if (TileCache::Tile::isPacked(0, level, tx, ty)) {
+        return TileCache::Tile::getKey(level, tx, ty);
+    }
+    int coords[3] = { level, tx, ty };
+    return checksum(coords, sizeof(coords)) | (1ULL << 63);
+}
+
+TileDiskCache::TileDiskCache(const char *file, int dataSize, int capacity) :
+    Object("TileDiskCache"), fd(-1), map(NULL), mapSize(0), dataSize(dataSize), keys(NULL), pins(NULL), hits(0), misses(0), writes(0)
+{
+    assert(dataSize > 0 && capacity > 0);
+    this->recordSize = (int(sizeof(DiskCacheRecord)) + dataSize + 63) & ~63;
+    this->capacity = ((capacity + WAYS - 1) / WAYS) * WAYS;
+    mutex = new pthread_mutex_t;
+    pthread_mutex_init((pthread_mutex_t*) mutex, NULL);
+#ifndef _WIN32
+    mapSize = DISK_CACHE_HEADER_SIZE + size_t(recordSize) * this->capacity;
+    fd = open(file, O_RDWR | O_CREAT, 0644);
+    if (fd >= 0) {
+        DiskCacheHeader h;
+        struct stat s;
+        bool valid = fstat(fd, &s) == 0 && size_t(s.st_size) == mapSize &&
+            pread(fd, &h, sizeof(h), 0) == ssize_t(sizeof(h)) &&
+            memcmp(h.magic, DISK_CACHE_MAGIC, 8) == 0 && h.version == DISK_CACHE_VERSION &&
+            h.dataSize == (unsigned int) dataSize && h.capacity == (unsigned int) this->capacity &&
+            h.ways == (unsigned int) WAYS;
+        // an invalid file is recreated empty (ftruncate fills it with zeros,
+        // i.e. with empty records, without writing them)
+        if (!valid && (ftruncate(fd, 0) != 0 || ftruncate(fd, mapSize) != 0)) {
+            close(fd);
+            fd = -1;
+        }
+        if (fd >= 0) {
+            void *p = mmap(NULL, mapSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+            if (p == MAP_FAILED) {
+                close(fd);
+                fd = -1;
+            } else {
+                map = (unsigned char*) p;
+                if (!valid) {
+                    DiskCacheHeader *header = (DiskCacheHeader*) map;
+                    memcpy(header->magic, DISK_CACHE_MAGIC, 8);
+                    header->version = DISK_CACHE_VERSION;
+                    header->dataSize = dataSize;
+                    header->capacity = this->capacity;
+                    header->ways = WAYS;
+                    header->stamp = 0;
+                }
+                // loads the index of the records in memory
+                keys = new unsigned long long[3 * this->capacity];
+                pins = new int[this->capacity];
+                for (int i = 0; i < this->capacity; ++i) {
+                    DiskCacheRecord *r = (DiskCacheRecord*) (map + DISK_CACHE_HEADER_SIZE + size_t(i) * recordSize);
+                    keys[3 * i] = valid ? r->producerKey : 0;
+                    keys[3 * i + 1] = valid ? r->tileKey : 0;
+                    keys[3 * i + 2] = valid ? r->stamp : 0;
+                    pins[i] = 0;
+                }
+            }
+        }
+    }
+#endif
+    if (map == NULL && Logger::ERROR_LOGGER != NULL) {
+        Logger::ERROR_LOGGER->logf("CACHE", "Cannot open tile disk cache '%s'", file);
+    }
+}
+
+TileDiskCache::~TileDiskCache()
+{
+#ifndef _WIN32
+    if (map != NULL) {
+        munmap(map, mapSize);
+    }
+    if (fd >= 0) {
+        close(fd);
+    }
+#endif
+    delete[] keys;
+    delete[] pins;
+    pthread_mutex_destroy((pthread_mutex_t*) mutex);
+    delete (pthread_mutex_t*) mutex;
+}
+
+bool TileDiskCache::isOpen()
+{
+    return map != NULL;
+}
+
+int TileDiskCache::getDataSize()
+{
+    return dataSize;
+}
+
+int TileDiskCache::getCapacity()
+{
+    return capacity;
+}
+
+int TileDiskCache::getHits()
+{
+    return hits;
+}
+
+int TileDiskCache::getMisses()
+{
+    return misses;
+}
+
+int TileDiskCache::getWrites()
+{
+    return writes;
+}
+
+bool TileDiskCache::get(unsigned long long producerKey, int level, int tx, int ty, void *data)
+{
+    if (map == NULL) {
+        return false;
+    }
+    unsigned long long tileKey = getTileKey(level, tx, ty);
+    pthread_mutex_lock((pthread_mutex_t*) mutex);
+    int i = find(producerKey, tileKey);
+    if (i >= 0) {
+        // the record is pinned while its data is copied, without the lock
+        // (this may need to read the file)
+        pins[i] += 1;
+    }
+    pthread_mutex_unlock((pthread_mutex_t*) mutex);
+    bool found = false;
+    DiskCacheRecord *r = NULL;
+    if (i >= 0) {
+        r = (DiskCacheRecord*) (map + DISK_CACHE_HEADER_SIZE + size_t(i) * recordSize);
+        memcpy(data, r + 1, dataSize);
+        found = checksum(data, dataSize) == r->checksum;
+    }
+    pthread_mutex_lock((pthread_mutex_t*) mutex);
+    if (i >= 0) {
+        pins[i] -= 1;
+        if (keys[3 * i] != producerKey || keys[3 * i + 1] != tileKey) {
+            // removed in the meantime
+            found = false;
+        } else if (found) {
+            keys[3 * i + 2] = r->stamp = nextStamp();
+        } else {
+            // partially written record
+            r->producerKey = 0;
+            keys[3 * i] = 0;
+        }
+    }
+    if (found) {
+        ++hits;
+    } else {
+        ++misses;
+    }
+    pthread_mutex_unlock((pthread_mutex_t*) mutex);
+    return found;
+}
+
+int TileDiskCache::pin(unsigned long long producerKey, int level, int tx, int ty)
+{
+    if (map == NULL) {
+        return -1;
+    }
+    pthread_mutex_lock((pthread_mutex_t*) mutex);
+    int i = find(producerKey, getTileKey(level, tx, ty));
+    if (i >= 0) {
+        pins[i] += 1;
+    } else {
+        ++misses;
+    }
+    pthread_mutex_unlock((pthread_mutex_t*) mutex);
+    return i;
+}
+
+void TileDiskCache::unpin(int record)
+{
+    pthread_mutex_lock((pthread_mutex_t*) mutex);
+    assert(pins[record] > 0);
+    pins[record] -= 1;
+    pthread_mutex_unlock((pthread_mutex_t*) mutex);
+}
+
+void TileDiskCache::put(unsigned long long producerKey, int level, int tx, int ty, const void *data)
+{
+    assert(producerKey != 0);
+    if (map == NULL) {
+        return;
+    }
+    unsigned long long tileKey = getTileKey(level, tx, ty);
+    pthread_mutex_lock((pthread_mutex_t*) mutex);
+    int i = find(producerKey, tileKey);
+    if (i >= 0 && pins[i] > 0) {
+        // the tile is being read or written, it must not be replaced
+        pthread_mutex_unlock((pthread_mutex_t*) mutex);
+        return;
+    }
+    if (i < 0) {
+        // uses an empty record of the set, or the least recently used one,
+        // among the records that are not pinned
+        int set = getSet(producerKey, tileKey);
+        unsigned long long oldest = ~0ULL;
+        for (int j = set; j < set + WAYS; ++j) {
+            unsigned long long stamp = keys[3 * j] == 0 ? 0 : keys[3 * j + 2] + 1;
+            if (pins[j] == 0 && stamp < oldest) {
+                oldest = stamp;
+                i = j;
+            }
+        }
+        if (i < 0) {
+            pthread_mutex_unlock((pthread_mutex_t*) mutex);
+            return;
+        }
+    }
+    // the record is marked empty, and pinned, while its data is written
+    // without the lock
+    keys[3 * i] = 0;
+    pins[i] += 1;
+    pthread_mutex_unlock((pthread_mutex_t*) mutex);
+
+    DiskCacheRecord *r = (DiskCacheRecord*) (map + DISK_CACHE_HEADER_SIZE + size_t(i) * recordSize);
+    r->producerKey = 0;
+    memcpy(r + 1, data, dataSize);
+    r->tileKey = tileKey;
+    r->checksum = checksum(data, dataSize);
+
+    pthread_mutex_lock((pthread_mutex_t*) mutex);
+    r->stamp = nextStamp();
+    r->producerKey = producerKey;
+    keys[3 * i] = producerKey;
+    keys[3 * i + 1] = tileKey;
+    keys[3 * i + 2] = r->stamp;
+    pins[i] -= 1;
+    ++writes;
+    pthread_mutex_unlock((pthread_mutex_t*) mutex);
+}
+
+void TileDiskCache::remove(unsigned long long producerKey, int level, int tx, int ty)
+{
+    if (map == NULL) {
+        return;
+    }
+    pthread_mutex_lock((pthread_mutex_t*) mutex);
+    int i = find(producerKey, getTileKey(level, tx, ty));
+    if (i >= 0) {
+        DiskCacheRecord *r = (DiskCacheRecord*) (map + DISK_CACHE_HEADER_SIZE + size_t(i) * recordSize);
+        r->producerKey = 0;
+        keys[3 * i] = 0;
+    }
+    pthread_mutex_unlock((pthread_mutex_t*) mutex);
+}
+
+void TileDiskCache::removeAll(unsigned long long producerKey)
+{
+    if (map == NULL) {
+        return;
+    }
+    pthread_mutex_lock((pthread_mutex_t*) mutex);
+    for (int i = 0; i < capacity; ++i) {
+        if (keys[3 * i] == producerKey) {
+            DiskCacheRecord *r = (DiskCacheRecord*) (map + DISK_CACHE_HEADER_SIZE + size_t(i) * recordSize);
+            r->producerKey = 0;
+            keys[3 * i] = 0;
+        }
+    }
+    pthread_mutex_unlock((pthread_mutex_t*) mutex);
+}
+
+unsigned long long TileDiskCache::getProducerKey(const string &name, const TiXmlElement *e, unsigned long long sourceKey)
+{
+    TiXmlPrinter printer;
+    e->Accept(&printer);
+    unsigned long long h = checksum(name.c_str(), (int) name.size());
+    h = fnvMix(h, checksum(printer.CStr(), (int) strlen(printer.CStr())));
+    // the producer implementations can change between versions, so the
+    // version is part of the key, as well as the state of the source files
+    h = fnvMix(h, PRODUCER_KEY_VERSION);
+    h = fnvMix(h, sourceKey);
+    return h == 0 ? 1 : h;
+}
+
+unsigned long long TileDiskCache::getFileKey(const string &file)
+{
+    unsigned long long h = checksum(file.c_str(), (int) file.size());
+    struct stat s;
+    if (stat(file.c_str(), &s) == 0) {
+        h = fnvMix(h, (unsigned long long) s.st_size);
+        h = fnvMix(h, (unsigned long long) s.st_mtime);
+    }
+    return h;
+}
+
+int TileDiskCache::getSet(unsigned long long producerKey, unsigned long long tileKey)
+{
+    unsigned long long h = producerKey ^ (tileKey * 0x9e3779b97f4a7c15ULL);
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    return int(h % (unsigned long long) (capacity / WAYS)) * WAYS;
+}
+
+int TileDiskCache::find(unsigned long long producerKey, unsigned long long tileKey)
+{
+    int set = getSet(producerKey, tileKey);
+    for (int i = set; i < set + WAYS; ++i) {
+        if (keys[3 * i] == producerKey && keys[3 * i + 1] == tileKey) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+unsigned long long TileDiskCache::nextStamp()
+{
+    return ++((DiskCacheHeader*) map)->stamp;
+}
+
+}
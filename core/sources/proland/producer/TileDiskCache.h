@@ -0,0 +1,315 @@
+/*
+ * Proland: a procedural landscape rendering library.
+ * Website : http://proland.inrialpes.fr/
+ * Copyright (c) 2008-2015 INRIA - LJK (CNRS - Grenoble University)
+ * All rights reserved.
+ * Redistribution and use in source and binary forms, with or without 
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice, 
+ * this list of conditions and the following disclaimer.
+ * 
+ * 2. Redistributions in binary form must reproduce the above copyright notice, 
+ * this list of conditions and the following disclaimer in the documentation 
+ * and/or other materials provided with the distribution.
+ * 
+ * 3. Neither the name of the copyright holder nor the names of its contributors 
+ * may be used to endorse or promote products derived from this software without 
+ * specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND 
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED 
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. 
+ * IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, 
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, 
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, 
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF 
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE 
+ * OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED 
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+/*
+ * Proland is distributed under the Berkeley Software Distribution 3 Licence. 
+ * For any assistance, feedback and enquiries about training programs, you can check out the 
+ * contact page on our website : 
+ * http://proland.inrialpes.fr/
+ */
+/*
+ * Main authors: Eric Bruneton, Antoine Begault, Guillaume Piolat.
+ */
+
+#ifndef _PROLAND_TILE_DISK_CACHE_H_
+#define _PROLAND_TILE_DISK_CACHE_H_
+
+#include <string>
+
+#include "ork/core/Object.h"
+
+class TiXmlElement;
+
+using namespace ork;
+
+namespace proland
+{
+
+/**
+ * A persistent, second level cache of tiles, stored in a memory mapped file.
+ * A TileDiskCache can be associated with a TileCache to avoid recomputing
+ * tiles that were produced in a previous session, or that were evicted from
+ * the TileCache. Tiles are identified by a %producer key, which must
+ * identify the %producer and its parameters across sessions (see
+ * #getProducerKey), and by their level,tx,ty coordinates. The file contains a
+ * fixed number of records of fixed size, organized as a set associative
+ * cache: each tile can only be stored in one of the #WAYS records of the set
+ * given by its identifier, and the least recently used record of a set is
+ * reused when a new tile must be stored in a full set. The index of the
+ * records is stored in the records themselves, so that a TileDiskCache can
+ * be used immediately after it is opened. A copy of this index is kept in
+ * memory, so that #pin can find a tile without reading the file, and the
+ * data of the records is copied without holding the lock of this cache.
+ * This class is thread safe.
+ * @ingroup producer
+ * @authors Eric Bruneton, Antoine Begault, Guillaume Piolat
+ */
+PROLAND_API class TileDiskCache : public Object
+{
+public:
+    /**
+     * The number of records in each set of records.
+     */
+    static const int WAYS = 8;
+
+    /**
+     * Creates a new TileDiskCache. If the given file already exists and was
+     * created with the same data size and capacity, its content is reused.
+     * Otherwise it is (re)created empty.
+     *
+     * @param file the file containing the cached tiles.
+     * @param dataSize the size in bytes of the data of each tile.
+     * @param capacity the maximum number of tiles stored in the file.
+     */
+    TileDiskCache(const char *file, int dataSize, int capacity);
+
+    /**
+     * Deletes this TileDiskCache. The file is unmapped and closed, but its
+     * content is kept.
+     */
+    virtual ~TileDiskCache();
+
+    /**
+     * Returns true if the file of this cache could be opened and mapped in
+     * memory. If not, this cache is always empty.
+     */
+    bool isOpen();
+
+    /**
+     * Returns the size in bytes of the data of each tile.
+     */
+    int getDataSize();
+
+    /**
+     * Returns the maximum number of tiles stored in this cache.
+     */
+    int getCapacity();
+
+    /**
+     * Returns the number of successful #get calls since this cache was opened.
+     */
+    int getHits();
+
+    /**
+     * Returns the number of failed #get calls since this cache was opened.
+     */
+    int getMisses();
+
+    /**
+     * Returns the number of #put calls since this cache was opened.
+     */
+    int getWrites();
+
+    /**
+     * Looks for a tile in this cache and copies its data if it is found.
+     *
+     * @param producerKey the key of the tile's %producer.
+     * @param level the tile's quadtree level.
+     * @param tx the tile's quadtree x coordinate.
+     * @param ty the tile's quadtree y coordinate.
+     * @param[out] data where the tile data must be copied. Must contain
+     *      #getDataSize bytes.
+     * @return true if the tile was found.
+     */
+    bool get(unsigned long long producerKey, int level, int tx, int ty, void *data);
+
+    /**
+     * Looks for a tile in the in memory index of this cache, without reading
+     * the file, and pins its record if it is found. A pinned record cannot be
+     * reused by #put for another tile until it is unpinned with #unpin. Its
+     * data can still be invalid (if it was only partially written), or be
+     * removed with #remove, so #get can still fail for a pinned tile.
+     *
+     * @param producerKey the key of the tile's %producer.
+     * @param level the tile's quadtree level.
+     * @param tx the tile's quadtree x coordinate.
+     * @param ty the tile's quadtree y coordinate.
+     * @return the index of the record containing this tile, or -1.
+     */
+    int pin(unsigned long long producerKey, int level, int tx, int ty);
+
+    /**
+     * Unpins a record pinned with #pin.
+     *
+     * @param record a record index returned by #pin.
+     */
+    void unpin(int record);
+
+    /**
+     * Stores a tile in this cache, replacing its previous data, if any.
+     *
+     * @param producerKey the key of the tile's %producer.
+     * @param level the tile's quadtree level.
+     * @param tx the tile's quadtree x coordinate.
+     * @param ty the tile's quadtree y coordinate.
+     * @param data the tile data. Must contain #getDataSize bytes.
+     */
+    void put(unsigned long long producerKey, int level, int tx, int ty, const void *data);
+
+    /**
+     * Removes a tile from this cache, if it is present.
+     *
+     * @param producerKey the key of the tile's %producer.
+     * @param level the tile's quadtree level.
+     * @param tx the tile's quadtree x coordinate.
+     * @param ty the tile's quadtree y coordinate.
+     */
+    void remove(unsigned long long producerKey, int level, int tx, int ty);
+
+    /**
+     * Removes all the tiles of the given %producer from this cache.
+     *
+     * @param producerKey the key of a %producer.
+     */
+    void removeAll(unsigned long long producerKey);
+
+    /**
+     * Returns a %producer key computed from the name of a %producer resource,
+     * from its XML description (including its sub elements), from the
+     * version of the %producer implementations, and from a key describing
+     * the source data of the %producer (see TileProducer#getSourceKey). This
+     * key changes if the %producer parameters or source files change, which
+     * invalidates its tiles stored in a TileDiskCache. However it does not
+     * change if other resources referenced by the %producer, such as
+     * shaders, change. The returned key is never 0.
+     *
+     * @param name the name of a %producer resource.
+     * @param e the XML description of this %producer.
+     * @param sourceKey a key describing the source data of this %producer.
+     */
+    static unsigned long long getProducerKey(const std::string &name, const TiXmlElement *e, unsigned long long sourceKey = 0);
+
+    /**
+     * Returns a key computed from the name, the size and the last
+     * modification time of the given file. This key changes if the file is
+     * modified. See TileProducer#getSourceKey.
+     *
+     * @param file the name of a file (which may not exist).
+     */
+    static unsigned long long getFileKey(const std::string &file);
+
+    /**
+     * Mixes a value into a 64 bits FNV-1a hash. This is used to compute the
+     * %producer and source keys, and the checksums of the records.
+     *
+     * @param h the current hash value.
+     * @param v the value to be mixed into this hash.
+     * @return the new hash value.
+     */
+    static unsigned long long fnvMix(unsigned long long h, unsigned long long v)
+    {
+        return (h ^ v) * 1099511628211ULL;
+    }
+
+private:
+    /**
+     * The file descriptor of the file containing the cached tiles, or -1.
+     */
+    int fd;
+
+    /**
+     * The memory mapped content of the file, or NULL.
+     */
+    unsigned char *map;
+
+    /**
+     * The size in bytes of #map.
+     */
+    size_t mapSize;
+
+    /**
+     * The size in bytes of the data of each tile.
+     */
+    int dataSize;
+
+    /**
+     * The size in bytes of each record (header and data).
+     */
+    int recordSize;
+
+    /**
+     * The number of records in the file (a multiple of #WAYS).
+     */
+    int capacity;
+
+    /**
+     * The in memory copy of the producerKey, tileKey and stamp of each record
+     * (three values per record). A producerKey of 0 denotes an empty record.
+     */
+    unsigned long long *keys;
+
+    /**
+     * The number of pins of each record (see #pin). The records being read
+     * or written without holding #mutex are also pinned.
+     */
+    int *pins;
+
+    /**
+     * The number of successful #get calls.
+     */
+    int hits;
+
+    /**
+     * The number of failed #get calls.
+     */
+    int misses;
+
+    /**
+     * The number of #put calls.
+     */
+    int writes;
+
+    /**
+     * A mutex to serialize parallel accesses to the records.
+     */
+    void *mutex;
+
+    /**
+     * Returns the index of the first record of the set that can contain the
+     * given tile.
+     */
+    int getSet(unsigned long long producerKey, unsigned long long tileKey);
+
+    /**
+     * Returns the index of the record containing the given tile, or -1.
+     * Only uses the in memory index #keys.
+     */
+    int find(unsigned long long producerKey, unsigned long long tileKey);
+
+    /**
+     * Returns the next value of the date counter stored in the file header.
+     */
+    unsigned long long nextStamp();
+};
+
+}
+
+#endif
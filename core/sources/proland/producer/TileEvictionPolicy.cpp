@@ -0,0 +1,111 @@
+/*
+ * Proland: a procedural landscape rendering library.
+ * Website : http://proland.inrialpes.fr/
+ * Copyright (c) 2008-2015 INRIA - LJK (CNRS - Grenoble University)
+ * All rights reserved.
+ * Redistribution and use in source and binary forms, with or without 
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice, 
+ * this list of conditions and the following disclaimer.
+ * 
+ * 2. Redistributions in binary form must reproduce the above copyright notice, 
+ * this list of conditions and the following disclaimer in the documentation 
+ * and/or other materials provided with the distribution.
+ * 
+ * 3. Neither the name of the copyright holder nor the names of its contributors 
+ * may be used to endorse or promote products derived from this software without 
+ * specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND 
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED 
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. 
+ * IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, 
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, 
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, 
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF 
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE 
+ * OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED 
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+/*
+ * Proland is distributed under the Berkeley Software Distribution 3 Licence. 
+ * For any assistance, feedback and enquiries about training programs, you can check out the 
+ * contact page on our website : 
+ * http://proland.inrialpes.fr/
+ */
+/*
+ * Main authors: Eric Bruneton, Antoine Begault, Guillaume Piolat.
+ */
+
+#include "proland/producer/TileEvictionPolicy.h"
+
+#include "proland/producer/TileProducer.h"
+
+using namespace std;
+using namespace ork;
+
+namespace proland
+{
+
+TileEvictionPolicy::TileEvictionPolicy() : Object("TileEvictionPolicy")
+{
+    init(1);
+}
+
+TileEvictionPolicy::TileEvictionPolicy(const char *type, int candidates) : Object(type)
+{
+    init(candidates);
+}
+
+void TileEvictionPolicy::init(int candidates)
+{
+    assert(candidates > 0);
+    this->candidates = candidates;
+}
+
+TileEvictionPolicy::~TileEvictionPolicy()
+{
+}
+
+int TileEvictionPolicy::getCandidates()
+{
+    return candidates;
+}
+
+double TileEvictionPolicy::getCost(TileCache::Tile *t, TileProducer *producer)
+{
+    return 0.0;
+}
+
+LevelWeightedEvictionPolicy::LevelWeightedEvictionPolicy(int candidates, float weight) :
+    TileEvictionPolicy("LevelWeightedEvictionPolicy", candidates), weight(weight)
+{
+}
+
+LevelWeightedEvictionPolicy::~LevelWeightedEvictionPolicy()
+{
+}
+
+double LevelWeightedEvictionPolicy::getCost(TileCache::Tile *t, TileProducer *producer)
+{
+    return weight / (t->level + 1.0);
+}
+
+GreedyDualEvictionPolicy::GreedyDualEvictionPolicy(int candidates, float levelWeight) :
+    TileEvictionPolicy("GreedyDualEvictionPolicy", candidates), levelWeight(levelWeight)
+{
+}
+
+GreedyDualEvictionPolicy::~GreedyDualEvictionPolicy()
+{
+}
+
+double GreedyDualEvictionPolicy::getCost(TileCache::Tile *t, TileProducer *producer)
+{
+    double cost = producer->getAverageCreateTime();
+    return cost / (1.0 + levelWeight * t->level);
+}
+
+}
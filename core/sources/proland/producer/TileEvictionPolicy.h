@@ -0,0 +1,193 @@
+/*
+ * Proland: a procedural landscape rendering library.
+ * Website : http://proland.inrialpes.fr/
+ * Copyright (c) 2008-2015 INRIA - LJK (CNRS - Grenoble University)
+ * All rights reserved.
+ * Redistribution and use in source and binary forms, with or without 
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice, 
+ * this list of conditions and the following disclaimer.
+ * 
+ * 2. Redistributions in binary form must reproduce the above copyright notice, 
+ * this list of conditions and the following disclaimer in the documentation 
+ * and/or other materials provided with the distribution.
+ * 
+ * 3. Neither the name of the copyright holder nor the names of its contributors 
+ * may be used to endorse or promote products derived from this software without 
+ * specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND 
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED 
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. 
+ * IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, 
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, 
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, 
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF 
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE 
+ * OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED 
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+/*
+ * Proland is distributed under the Berkeley Software Distribution 3 Licence. 
+ * For any assistance, feedback and enquiries about training programs, you can check out the 
+ * contact page on our website : 
+ * http://proland.inrialpes.fr/
+ */
+/*
+ * Main authors: Eric Bruneton, Antoine Begault, Guillaume Piolat.
+ */
+
+#ifndef _PROLAND_TILE_EVICTION_POLICY_H_
+#define _PROLAND_TILE_EVICTION_POLICY_H_
+
+#include "proland/producer/TileCache.h"
+
+namespace proland
+{
+
+/**
+ * A policy to select the unused tiles that a TileCache evicts when it needs
+ * storage for new tiles. The policies are variants of the GreedyDual
+ * algorithm: when a tile becomes unused, it gets a priority equal to the
+ * current "inflation" value of its cache shard, plus a cost given by
+ * #getCost. When a tile must be evicted, the cache examines the
+ * #getCandidates least recently used tiles of a shard, evicts the one with
+ * the lowest priority, and sets the inflation value of the shard to the
+ * priority of this tile. Hence tiles with a high cost stay longer in the
+ * cache, but are eventually evicted if they are not used. This default
+ * implementation returns a 0 cost with a single candidate, which gives a LRU
+ * policy.
+ * @ingroup producer
+ * @authors Eric Bruneton, Antoine Begault, Guillaume Piolat
+ */
+PROLAND_API class TileEvictionPolicy : public Object
+{
+public:
+    /**
+     * Creates a new LRU TileEvictionPolicy.
+     */
+    TileEvictionPolicy();
+
+    /**
+     * Deletes this TileEvictionPolicy.
+     */
+    virtual ~TileEvictionPolicy();
+
+    /**
+     * Returns the number of least recently used tiles that are examined to
+     * select the tile to be evicted.
+     */
+    int getCandidates();
+
+    /**
+     * Returns the cost of evicting the given tile, i.e. the cost of
+     * recreating it if it is needed again.
+     *
+     * @param t an unused tile.
+     * @param producer the %producer of this tile.
+     */
+    virtual double getCost(TileCache::Tile *t, TileProducer *producer);
+
+protected:
+    /**
+     * Creates a new TileEvictionPolicy.
+     *
+     * @param type the type of this policy.
+     * @param candidates the number of least recently used tiles that are
+     *      examined to select the tile to be evicted.
+     */
+    TileEvictionPolicy(const char *type, int candidates);
+
+    /**
+     * Initializes this TileEvictionPolicy.
+     *
+     * @param candidates the number of least recently used tiles that are
+     *      examined to select the tile to be evicted.
+     */
+    void init(int candidates);
+
+private:
+    /**
+     * The number of least recently used tiles that are examined to select the
+     * tile to be evicted.
+     */
+    int candidates;
+};
+
+/**
+ * A TileEvictionPolicy that keeps coarse tiles longer than fine tiles. Coarse
+ * tiles are used to render large parts of the terrain, and are needed again
+ * as soon as the viewer moves away, while fine tiles are only needed near the
+ * viewer. The cost of a tile at level l is weight / (l + 1).
+ * @ingroup producer
+ * @authors Eric Bruneton, Antoine Begault, Guillaume Piolat
+ */
+PROLAND_API class LevelWeightedEvictionPolicy : public TileEvictionPolicy
+{
+public:
+    /**
+     * Creates a new LevelWeightedEvictionPolicy.
+     *
+     * @param candidates the number of least recently used tiles that are
+     *      examined to select the tile to be evicted.
+     * @param weight the cost of a tile at level 0.
+     */
+    LevelWeightedEvictionPolicy(int candidates, float weight);
+
+    /**
+     * Deletes this LevelWeightedEvictionPolicy.
+     */
+    virtual ~LevelWeightedEvictionPolicy();
+
+    virtual double getCost(TileCache::Tile *t, TileProducer *producer);
+
+private:
+    /**
+     * The cost of a tile at level 0.
+     */
+    float weight;
+};
+
+/**
+ * A TileEvictionPolicy that keeps the tiles that are the most expensive to
+ * recreate. The cost of a tile is the average duration of
+ * TileProducer#doCreateTile for its %producer (see
+ * TileProducer#getAverageCreateTime), multiplied by an optional factor
+ * favoring coarse levels (as in LevelWeightedEvictionPolicy).
+ * @ingroup producer
+ * @authors Eric Bruneton, Antoine Begault, Guillaume Piolat
+ */
+PROLAND_API class GreedyDualEvictionPolicy : public TileEvictionPolicy
+{
+public:
+    /**
+     * Creates a new GreedyDualEvictionPolicy.
+     *
+     * @param candidates the number of least recently used tiles that are
+     *      examined to select the tile to be evicted.
+     * @param levelWeight how much coarse levels are favored: the cost of a
+     *      tile at level l is divided by 1 + levelWeight * l. 0 disables this
+     *      factor, and 1 divides the cost by l + 1.
+     */
+    GreedyDualEvictionPolicy(int candidates, float levelWeight = 0.0f);
+
+    /**
+     * Deletes this GreedyDualEvictionPolicy.
+     */
+    virtual ~GreedyDualEvictionPolicy();
+
+    virtual double getCost(TileCache::Tile *t, TileProducer *producer);
+
+private:
+    /**
+     * How much coarse levels are favored. The cost of a tile at level l is
+     * divided by 1 + levelWeight * l.
+     */
+    float levelWeight;
+};
+
+}
+
+#endif
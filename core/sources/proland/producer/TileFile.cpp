@@ -0,0 +1,508 @@
+/*
+ * Proland: a procedural landscape rendering library.
+ * Website : http://proland.inrialpes.fr/
+ * Copyright (c) 2008-2015 INRIA - LJK (CNRS - Grenoble University)
+ * All rights reserved.
+ * Redistribution and use in source and binary forms, with or without 
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice, 
+ * this list of conditions and the following disclaimer.
+ * 
+ * 2. Redistributions in binary form must reproduce the above copyright notice, 
+ * this list of conditions and the following disclaimer in the documentation 
+ * and/or other materials provided with the distribution.
+ * 
+ * 3. Neither the name of the copyright holder nor the names of its contributors 
+ * may be used to endorse or promote products derived from this software without 
+ * specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND 
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED 
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. 
+ * IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, 
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, 
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, 
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF 
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE 
+ * OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED 
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+/*
+ * Proland is distributed under the Berkeley Software Distribution 3 Licence. 
+ * For any assistance, feedback and enquiries about training programs, you can check out the 
+ * contact page on our website : 
+ * http://proland.inrialpes.fr/
+ */
+/*
+ * Main authors: Eric Bruneton, Antoine Begault, Guillaume Piolat.
+ */
+
+#include "proland/producer/TileFile.h"
+
+#include <cstring>
+#include <pthread.h>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#ifdef PROLAND_USE_IO_URING
+#include <liburing.h>
+#endif
+
+#include "ork/core/Logger.h"
+
+using namespace std;
+
+namespace proland
+{
+
+/**
+ * The windows are mapped at offsets that are multiples of WINDOW_STEP, so
+ * that any data smaller than WINDOW_STEP is entirely contained in a window.
+ */
+#define WINDOW_STEP (TileFile::WINDOW_SIZE / 2)
+
+struct TileFile::Block
+{
+    long long start;
+
+    size_t size;
+
+    unsigned char *data;
+
+    int users;
+
+    unsigned int lastUse;
+
+    /**
+     * For asynchronous reads, true if the read is completed.
+     */
+    bool done;
+
+    /**
+     * For asynchronous reads, the number of bytes read, or a negative error
+     * code.
+     */
+    int result;
+};
+
+TileFile::TileFile(const char *name, Mode mode, long long budget) :
+    Object("TileFile"), fd(-1), file(NULL), size(0), mode(mode), data(NULL), maxWindows(0),
+    ring(NULL), queued(0), clock(0), reaping(false)
+{
+    mutex = new pthread_mutex_t;
+    pthread_mutex_init((pthread_mutex_t*) mutex, NULL);
+    reaped = new pthread_cond_t;
+    pthread_cond_init((pthread_cond_t*) reaped, NULL);
+#ifndef _WIN32
+    fd = open(name, O_RDONLY);
+    struct stat s;
+    if (fd >= 0 && fstat(fd, &s) == 0) {
+        size = s.st_size;
+        if (mode == MMAP && size > 0 && size <= budget) {
+            void *p = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+            if (p != MAP_FAILED) {
+                data = (unsigned char*) p;
+                // tiles are read in quadtree order, not in file order
+                madvise(data, size, MADV_RANDOM);
+            }
+        } else if (mode == MMAP && size > budget) {
+            maxWindows = max(int(budget / WINDOW_SIZE), 1);
+        }
+    }
+    if (fd >= 0 && mode != MMAP) {
+        // the kernel read ahead is useless with random tile accesses
+        posix_fadvise(fd, 0, 0, POSIX_FADV_RANDOM);
+    }
+#ifdef PROLAND_USE_IO_URING
+    if (fd >= 0 && mode == URING) {
+        struct io_uring *r = new struct io_uring;
+        if (io_uring_queue_init(MAX_REQUESTS, r, 0) == 0) {
+            ring = r;
+        } else {
+            delete r;
+        }
+    }
+#endif
+#else
+    fopen(&file, name, "rb");
+    if (file != NULL) {
+        fseek64(file, 0, SEEK_END);
+        size = _ftelli64(file);
+    }
+#endif
+    if (this->mode == URING && ring == NULL) {
+        this->mode = PREAD;
+    }
+    if (!isOpen() && Logger::ERROR_LOGGER != NULL) {
+        Logger::ERROR_LOGGER->logf("CACHE", "Cannot open tile file '%s'", name);
+    }
+}
+
+TileFile::~TileFile()
+{
+#ifndef _WIN32
+    for (unsigned int i = 0; i < windows.size(); ++i) {
+        assert(windows[i]->users == 0);
+        munmap(windows[i]->data, windows[i]->size);
+        delete windows[i];
+    }
+#ifdef PROLAND_USE_IO_URING
+    if (ring != NULL) {
+        // the pending reads must be completed before their buffers are freed
+        submit();
+        for (unsigned int i = 0; i < requests.size(); ++i) {
+            wait(requests[i]);
+        }
+        io_uring_queue_exit((struct io_uring*) ring);
+        delete (struct io_uring*) ring;
+    }
+#endif
+    for (unsigned int i = 0; i < requests.size(); ++i) {
+        assert(requests[i]->users == 0);
+        delete[] requests[i]->data;
+        delete requests[i];
+    }
+    if (data != NULL) {
+        munmap(data, size);
+    }
+    if (fd >= 0) {
+        close(fd);
+    }
+#else
+    if (file != NULL) {
+        fclose(file);
+    }
+#endif
+    pthread_mutex_destroy((pthread_mutex_t*) mutex);
+    delete (pthread_mutex_t*) mutex;
+    pthread_cond_destroy((pthread_cond_t*) reaped);
+    delete (pthread_cond_t*) reaped;
+}
+
+bool TileFile::isOpen()
+{
+    return fd >= 0 || file != NULL;
+}
+
+long long TileFile::getSize()
+{
+    return size;
+}
+
+TileFile::Mode TileFile::getMode()
+{
+    return mode;
+}
+
+bool TileFile::getMode(const char *name, Mode &mode)
+{
+    if (strcmp(name, "mmap") == 0) {
+        mode = MMAP;
+    } else if (strcmp(name, "pread") == 0) {
+        mode = PREAD;
+    } else if (strcmp(name, "uring") == 0) {
+        mode = URING;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+bool TileFile::isWindowed()
+{
+    return maxWindows > 0;
+}
+
+const unsigned char *TileFile::read(long long offset, int size, unsigned char *buffer, void *&handle)
+{
+    handle = NULL;
+    if (offset < 0 || size < 0 || offset + size > this->size) {
+        return NULL;
+    }
+    if (data != NULL) {
+        return data + offset;
+    }
+    const unsigned char *result = NULL;
+    if (maxWindows > 0) {
+        result = readWindow(offset, size, handle);
+    } else if (ring != NULL) {
+        result = readRequest(offset, size, handle);
+    }
+    return result != NULL ? result : readBuffer(offset, size, buffer);
+}
+
+void TileFile::release(void *handle)
+{
+    if (handle != NULL) {
+        pthread_mutex_lock((pthread_mutex_t*) mutex);
+        ((Block*) handle)->users -= 1;
+        pthread_mutex_unlock((pthread_mutex_t*) mutex);
+    }
+}
+
+void TileFile::willNeed(long long offset, int size)
+{
+    if (offset < 0 || size <= 0 || offset + size > this->size) {
+        return;
+    }
+#ifndef _WIN32
+    if (data != NULL) {
+        long long page = sysconf(_SC_PAGESIZE);
+        long long start = (offset / page) * page;
+        madvise(data + start, size_t(offset + size - start), MADV_WILLNEED);
+        return;
+    }
+#ifdef PROLAND_USE_IO_URING
+    if (ring != NULL) {
+        pthread_mutex_lock((pthread_mutex_t*) mutex);
+        // reaps the completed reads, so that they can be reused (unless
+        // another thread is currently reaping them)
+        struct io_uring_cqe *cqe;
+        while (!reaping && io_uring_peek_cqe((struct io_uring*) ring, &cqe) == 0) {
+            complete(cqe);
+        }
+        Block *lru = NULL;
+        for (unsigned int i = 0; i < requests.size(); ++i) {
+            Block *r = requests[i];
+            if (offset >= r->start && offset + size <= r->start + (long long) r->size) {
+                pthread_mutex_unlock((pthread_mutex_t*) mutex);
+                return;
+            }
+            if (r->done && r->users == 0 && (lru == NULL || r->lastUse < lru->lastUse)) {
+                lru = r;
+            }
+        }
+        struct io_uring_sqe *sqe = NULL;
+        if (int(requests.size()) < MAX_REQUESTS || lru != NULL) {
+            sqe = io_uring_get_sqe((struct io_uring*) ring);
+        }
+        if (sqe != NULL) {
+            Block *r = lru;
+            if (int(requests.size()) < MAX_REQUESTS) {
+                r = new Block();
+                r->data = NULL;
+                requests.push_back(r);
+            }
+            if (r->data == NULL || r->size < size_t(size)) {
+                delete[] r->data;
+                r->data = new unsigned char[size];
+            }
+            r->start = offset;
+            r->size = size;
+            r->users = 0;
+            r->lastUse = ++clock;
+            r->done = false;
+            r->result = 0;
+            io_uring_prep_read(sqe, fd, r->data, size, offset);
+            io_uring_sqe_set_data(sqe, r);
+            queued += 1;
+        }
+        pthread_mutex_unlock((pthread_mutex_t*) mutex);
+        if (sqe != NULL) {
+            return;
+        }
+    }
+#endif
+    if (fd >= 0) {
+        posix_fadvise(fd, offset, size, POSIX_FADV_WILLNEED);
+    }
+#endif
+}
+
+void TileFile::submit()
+{
+#ifdef PROLAND_USE_IO_URING
+    if (ring != NULL) {
+        pthread_mutex_lock((pthread_mutex_t*) mutex);
+        if (queued > 0) {
+            io_uring_submit((struct io_uring*) ring);
+            queued = 0;
+        }
+        pthread_mutex_unlock((pthread_mutex_t*) mutex);
+    }
+#endif
+}
+
+const unsigned char *TileFile::readWindow(long long offset, int size, void *&handle)
+{
+#ifndef _WIN32
+    if (size > WINDOW_STEP) {
+        return NULL;
+    }
+    long long start = (offset / WINDOW_STEP) * WINDOW_STEP;
+    Block *w = NULL;
+    pthread_mutex_lock((pthread_mutex_t*) mutex);
+    w = findWindow(start);
+    pthread_mutex_unlock((pthread_mutex_t*) mutex);
+    if (w == NULL) {
+        // the window is mapped without holding the mutex, so that other
+        // threads can use the already mapped windows in the meantime
+        size_t wsize = size_t(min(WINDOW_SIZE, this->size - start));
+        void *p = mmap(NULL, wsize, PROT_READ, MAP_SHARED, fd, start);
+        if (p == MAP_FAILED) {
+            return NULL;
+        }
+        madvise(p, wsize, MADV_RANDOM);
+        void *unused = NULL;
+        size_t unusedSize = 0;
+        pthread_mutex_lock((pthread_mutex_t*) mutex);
+        // another thread may have mapped the same window in the meantime
+        w = findWindow(start);
+        if (w != NULL) {
+            unused = p;
+            unusedSize = wsize;
+        } else {
+            // reuses the least recently used window if there are too
+            // many windows, and if this window is not currently used
+            Block *lru = NULL;
+            for (unsigned int i = 0; i < windows.size(); ++i) {
+                Block *v = windows[i];
+                if (v->users == 0 && (lru == NULL || v->lastUse < lru->lastUse)) {
+                    lru = v;
+                }
+            }
+            if (lru != NULL && int(windows.size()) >= maxWindows) {
+                unused = lru->data;
+                unusedSize = lru->size;
+                w = lru;
+            } else {
+                w = new Block();
+                windows.push_back(w);
+            }
+            w->start = start;
+            w->size = wsize;
+            w->data = (unsigned char*) p;
+            w->users = 1;
+            w->lastUse = ++clock;
+        }
+        pthread_mutex_unlock((pthread_mutex_t*) mutex);
+        if (unused != NULL) {
+            munmap(unused, unusedSize);
+        }
+    }
+    if (w != NULL) {
+        handle = w;
+        return w->data + (offset - start);
+    }
+#endif
+    return NULL;
+}
+
+TileFile::Block *TileFile::findWindow(long long start)
+{
+    for (unsigned int i = 0; i < windows.size(); ++i) {
+        Block *w = windows[i];
+        if (w->start == start) {
+            w->users += 1;
+            w->lastUse = ++clock;
+            return w;
+        }
+    }
+    return NULL;
+}
+
+const unsigned char *TileFile::readRequest(long long offset, int size, void *&handle)
+{
+    Block *r = NULL;
+    pthread_mutex_lock((pthread_mutex_t*) mutex);
+    for (unsigned int i = 0; i < requests.size(); ++i) {
+        Block *v = requests[i];
+        if (offset >= v->start && offset + size <= v->start + (long long) v->size) {
+            r = v;
+            break;
+        }
+    }
+    if (r != NULL) {
+        // prevents the reuse of this request while waiting for it
+        r->users += 1;
+    }
+    pthread_mutex_unlock((pthread_mutex_t*) mutex);
+    if (r == NULL) {
+        return NULL;
+    }
+    submit();
+    wait(r);
+    if (r->result != int(r->size)) {
+        release(r);
+        return NULL;
+    }
+    handle = r;
+    return r->data + (offset - r->start);
+}
+
+void TileFile::wait(Block *r)
+{
+#ifdef PROLAND_USE_IO_URING
+    pthread_mutex_lock((pthread_mutex_t*) mutex);
+    // the completions are reaped by a single thread, which also completes
+    // the reads waited for by the other threads. This thread does not hold
+    // the mutex while waiting, so that the other threads can still read the
+    // completed requests, and queue and submit new ones
+    bool failed = false;
+    while (!r->done && !failed) {
+        if (reaping) {
+            pthread_cond_wait((pthread_cond_t*) reaped, (pthread_mutex_t*) mutex);
+            continue;
+        }
+        reaping = true;
+        pthread_mutex_unlock((pthread_mutex_t*) mutex);
+        struct io_uring_cqe *cqe;
+        failed = io_uring_wait_cqe((struct io_uring*) ring, &cqe) != 0;
+        pthread_mutex_lock((pthread_mutex_t*) mutex);
+        if (!failed) {
+            complete(cqe);
+            while (io_uring_peek_cqe((struct io_uring*) ring, &cqe) == 0) {
+                complete(cqe);
+            }
+        }
+        reaping = false;
+        pthread_cond_broadcast((pthread_cond_t*) reaped);
+    }
+    pthread_mutex_unlock((pthread_mutex_t*) mutex);
+#else
+    (void) r;
+#endif
+}
+
+void TileFile::complete(void *cqe)
+{
+#ifdef PROLAND_USE_IO_URING
+    struct io_uring_cqe *c = (struct io_uring_cqe*) cqe;
+    Block *r = (Block*) io_uring_cqe_get_data(c);
+    r->result = c->res;
+    r->done = true;
+    io_uring_cqe_seen((struct io_uring*) ring, c);
+#else
+    (void) cqe;
+#endif
+}
+
+const unsigned char *TileFile::readBuffer(long long offset, int size, unsigned char *buffer)
+{
+#ifndef _WIN32
+    int n = 0;
+    while (n < size) {
+        ssize_t r = pread(fd, buffer + n, size - n, offset + n);
+        if (r <= 0) {
+            return NULL;
+        }
+        n += int(r);
+    }
+    return buffer;
+#else
+    pthread_mutex_lock((pthread_mutex_t*) mutex);
+    fseek64(file, offset, SEEK_SET);
+    bool ok = fread(buffer, size, 1, file) == 1;
+    pthread_mutex_unlock((pthread_mutex_t*) mutex);
+    return ok ? buffer : NULL;
+#endif
+}
+
+}
@@ -0,0 +1,321 @@
+/*
+ * Proland: a procedural landscape rendering library.
+ * Website : http://proland.inrialpes.fr/
+ * Copyright (c) 2008-2015 INRIA - LJK (CNRS - Grenoble University)
+ * All rights reserved.
+ * Redistribution and use in source and binary forms, with or without 
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice, 
+ * this list of conditions and the following disclaimer.
+ * 
+ * 2. Redistributions in binary form must reproduce the above copyright notice, 
+ * this list of conditions and the following disclaimer in the documentation 
+ * and/or other materials provided with the distribution.
+ * 
+ * 3. Neither the name of the copyright holder nor the names of its contributors 
+ * may be used to endorse or promote products derived from this software without 
+ * specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND 
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED 
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. 
+ * IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, 
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, 
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, 
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF 
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE 
+ * OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED 
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+/*
+ * Proland is distributed under the Berkeley Software Distribution 3 Licence. 
+ * For any assistance, feedback and enquiries about training programs, you can check out the 
+ * contact page on our website : 
+ * http://proland.inrialpes.fr/
+ */
+/*
+ * Main authors: Eric Bruneton, Antoine Begault, Guillaume Piolat.
+ */
+
+#ifndef _PROLAND_TILE_FILE_H_
+#define _PROLAND_TILE_FILE_H_
+
+#include <cstdio>
+#include <vector>
+
+#include "ork/core/Object.h"
+
+using namespace ork;
+
+namespace proland
+{
+
+/**
+ * A read only file containing precomputed tiles, such as the files used by
+ * the ResidualProducer and the OrthoCPUProducer. Several reading modes are
+ * available:
+ * - MMAP: the file is mapped in memory, so that the tile data can be read
+ * without any system call and without any lock, and can be passed directly to
+ * a decoder without being copied (see #read). Files larger than a given
+ * address space budget are mapped with fixed size windows, which are mapped on
+ * demand and unmapped when they are no longer used (a mutex protects the list
+ * of windows in this case). The mapping is advised for random accesses.
+ * - PREAD: the data is read with positional reads on a file descriptor shared
+ * by all threads, in a buffer provided by the caller.
+ * - URING: as PREAD, but the reads announced with #willNeed are queued in an
+ * io_uring submission queue, and are submitted together with #submit, or
+ * at the latest by the next #read. These reads are then completed
+ * asynchronously, in internal buffers that #read returns directly. This mode
+ * is only available if Proland is compiled with PROLAND_USE_IO_URING,
+ * otherwise it is equivalent to PREAD.
+ *
+ * In all modes the tiles that are likely to be needed soon (e.g., the tiles
+ * whose creation task has just been created, or the children of a produced
+ * tile) should be announced with #willNeed, so that they can be loaded
+ * asynchronously. This class is thread safe.
+ * @ingroup producer
+ * @authors Eric Bruneton, Antoine Begault, Guillaume Piolat
+ */
+PROLAND_API class TileFile : public Object
+{
+public:
+    /**
+     * The possible modes to read a TileFile.
+     */
+    enum Mode {
+        MMAP, ///< memory mapped file, with windows for large files
+        PREAD, ///< positional reads on a shared file descriptor
+        URING ///< batched asynchronous reads with io_uring
+    };
+
+    /**
+     * The maximum number of pending or completed reads in URING mode.
+     */
+    static const int MAX_REQUESTS = 64;
+
+    /**
+     * The size in bytes of the windows used to map large files.
+     */
+    static const long long WINDOW_SIZE = 64LL << 20;
+
+    /**
+     * The default address space budget for a file. Files larger than this
+     * are mapped with windows of #WINDOW_SIZE bytes.
+     */
+    static const long long DEFAULT_BUDGET = sizeof(void*) == 8 ? 4LL << 30 : 256LL << 20;
+
+    /**
+     * Creates a new TileFile.
+     *
+     * @param name the name of the file.
+     * @param mode how the file must be read.
+     * @param budget the maximum number of bytes of this file that can be
+     *      mapped in memory at the same time, in MMAP mode.
+     */
+    TileFile(const char *name, Mode mode = MMAP, long long budget = DEFAULT_BUDGET);
+
+    /**
+     * Deletes this TileFile. This unmaps and closes the file.
+     */
+    virtual ~TileFile();
+
+    /**
+     * Returns true if the file could be opened.
+     */
+    bool isOpen();
+
+    /**
+     * Returns the size of the file in bytes.
+     */
+    long long getSize();
+
+    /**
+     * Returns the mode used to read this file. This can be different from
+     * the mode given in the constructor, if this mode is not available.
+     */
+    Mode getMode();
+
+    /**
+     * Returns the mode corresponding to the given name.
+     *
+     * @param name a mode name ("mmap", "pread" or "uring").
+     * @param[out] mode the corresponding mode.
+     * @return false if the name is not a valid mode name.
+     */
+    static bool getMode(const char *name, Mode &mode);
+
+    /**
+     * Returns true if the file is mapped in memory with windows, instead of
+     * being entirely mapped at once.
+     */
+    bool isWindowed();
+
+    /**
+     * Returns the given part of the file. If possible the returned pointer
+     * points directly to the memory mapped file content, or to the result of
+     * a previous asynchronous read (see #willNeed). Otherwise the data is read
+     * in the given buffer, and this buffer is returned. In all cases the data
+     * must be released with #release when it is no longer needed.
+     *
+     * @param offset the offset of the data in the file.
+     * @param size the size of the data in bytes.
+     * @param buffer a buffer of at least size bytes, used if the data cannot
+     *      be returned directly from the memory mapped file.
+     * @param[out] handle a handle to be passed to #release.
+     * @return the requested data, or NULL if it cannot be read.
+     */
+    const unsigned char *read(long long offset, int size, unsigned char *buffer, void *&handle);
+
+    /**
+     * Releases the data returned by a previous call to #read.
+     *
+     * @param handle the handle returned by #read.
+     */
+    void release(void *handle);
+
+    /**
+     * Indicates that the given part of the file will probably be needed soon.
+     * In MMAP and PREAD modes the corresponding pages are then loaded
+     * asynchronously by the kernel, if they are not already in memory. In
+     * URING mode an asynchronous read is queued, and is submitted with the
+     * other queued reads by #submit or by the next #read.
+     *
+     * @param offset the offset of the data in the file.
+     * @param size the size of the data in bytes.
+     */
+    void willNeed(long long offset, int size);
+
+    /**
+     * Submits the asynchronous reads queued by #willNeed, in URING mode.
+     * Does nothing in the other modes.
+     */
+    void submit();
+
+private:
+    /**
+     * A mapped window of a large file, or an asynchronous read.
+     */
+    struct Block;
+
+    /**
+     * The file descriptor of the file, or -1 if it cannot be opened.
+     */
+    int fd;
+
+    /**
+     * The file, if file descriptors and memory mapped files are not
+     * available on this platform.
+     */
+    FILE *file;
+
+    /**
+     * The size of the file in bytes.
+     */
+    long long size;
+
+    /**
+     * The mode used to read this file.
+     */
+    Mode mode;
+
+    /**
+     * The memory mapped file content, or NULL if the file is not entirely
+     * mapped in memory.
+     */
+    unsigned char *data;
+
+    /**
+     * The maximum number of windows that can be mapped at the same time.
+     */
+    int maxWindows;
+
+    /**
+     * The currently mapped windows, if the file is mapped with windows.
+     */
+    std::vector<Block*> windows;
+
+    /**
+     * The pending or completed asynchronous reads, in URING mode.
+     */
+    std::vector<Block*> requests;
+
+    /**
+     * The io_uring instance used in URING mode.
+     */
+    void *ring;
+
+    /**
+     * The number of reads queued in #ring but not yet submitted.
+     */
+    int queued;
+
+    /**
+     * A counter used to find the least recently used windows and reads.
+     */
+    unsigned int clock;
+
+    /**
+     * A mutex used to serialize accesses to #windows, #requests, #ring and
+     * #file. The completion queue of #ring is an exception: it is only read
+     * by the thread that sets #reaping, which does not hold the mutex while
+     * waiting for completions.
+     */
+    void *mutex;
+
+    /**
+     * True if a thread is waiting for io_uring completions. Only this thread
+     * can then read the completion queue of #ring.
+     */
+    bool reaping;
+
+    /**
+     * A condition variable used to wake up the threads waiting for a read
+     * when the reaping thread has reaped some completions.
+     */
+    void *reaped;
+
+    /**
+     * Returns the given part of the file from a mapped window, or NULL if
+     * this is not possible.
+     */
+    const unsigned char *readWindow(long long offset, int size, void *&handle);
+
+    /**
+     * Returns the mapped window starting at the given offset, or NULL if
+     * there is no such window. If found, the window is marked as used.
+     * The mutex must be locked.
+     */
+    Block *findWindow(long long start);
+
+    /**
+     * Returns the given part of the file from a queued asynchronous read,
+     * or NULL if this is not possible. Waits for the completion of the
+     * read if necessary.
+     */
+    const unsigned char *readRequest(long long offset, int size, void *&handle);
+
+    /**
+     * Waits until the given asynchronous read is completed. The mutex must
+     * not be locked.
+     */
+    void wait(Block *r);
+
+    /**
+     * Marks the asynchronous read corresponding to the given io_uring
+     * completion queue entry as completed. The mutex must be locked.
+     */
+    void complete(void *cqe);
+
+    /**
+     * Reads the given part of the file in the given buffer.
+     *
+     * @return buffer, or NULL if the data cannot be read.
+     */
+    const unsigned char *readBuffer(long long offset, int size, unsigned char *buffer);
+};
+
+}
+
+#endif
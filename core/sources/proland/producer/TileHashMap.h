@@ -0,0 +1,331 @@
+/*
+ * Proland: a procedural landscape rendering library.
+ * Website : http://proland.inrialpes.fr/
+ * Copyright (c) 2008-2015 INRIA - LJK (CNRS - Grenoble University)
+ * All rights reserved.
+ * Redistribution and use in source and binary forms, with or without 
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice, 
+ * this list of conditions and the following disclaimer.
+ * 
+ * 2. Redistributions in binary form must reproduce the above copyright notice, 
+ * this list of conditions and the following disclaimer in the documentation 
+ * and/or other materials provided with the distribution.
+ * 
+ * 3. Neither the name of the copyright holder nor the names of its contributors 
+ * may be used to endorse or promote products derived from this software without 
+ * specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND 
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED 
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. 
+ * IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, 
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, 
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, 
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF 
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE 
+ * OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED 
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+/*
+ * Proland is distributed under the Berkeley Software Distribution 3 Licence. 
+ * For any assistance, feedback and enquiries about training programs, you can check out the 
+ * contact page on our website : 
+ * http://proland.inrialpes.fr/
+ */
+/*
+ * Main authors: Eric Bruneton, Antoine Begault, Guillaume Piolat.
+ */
+
+#ifndef _PROLAND_TILE_HASH_MAP_H_
+#define _PROLAND_TILE_HASH_MAP_H_
+
+#include <cassert>
+#include <cstddef>
+#include <vector>
+
+namespace proland
+{
+
+/**
+ * An open addressing hash map whose keys are packed 64 bits tile keys (see
+ * TileCache::Tile#getKey). The entries are stored in a single contiguous
+ * array, with linear probing, which is much faster than a std::map of nested
+ * std::pair for the frequent lookups done by tile caches and producers.
+ * Removed entries are deleted with backward shifting, so that no tombstones
+ * accumulate in the table.
+ * @ingroup producer
+ * @authors Eric Bruneton, Antoine Begault
+ *
+ * @tparam V the type of the values associated with the tile keys.
+ */
+template<class V>
+class TileHashMap
+{
+public:
+    /**
+     * A packed tile key. See TileCache::Tile#getKey.
+     */
+    typedef unsigned long long Key;
+
+    /**
+     * An iterator over the entries of a TileHashMap. The map must not be
+     * modified while it is iterated.
+     */
+    class Iterator
+    {
+    public:
+        /**
+         * Creates a new iterator over the entries of the given map.
+         */
+        Iterator(TileHashMap<V> *map) : map(map), i(-1)
+        {
+            advance();
+        }
+
+        /**
+         * Returns true if there remains entries to iterate.
+         */
+        bool hasNext()
+        {
+            return i < (int) map->keys.size();
+        }
+
+        /**
+         * Returns the value of the next entry and advances the iterator.
+         *
+         * @param[out] key the key of the returned entry.
+         */
+        V &next(Key &key)
+        {
+            int j = i;
+            advance();
+            key = map->keys[j];
+            return map->values[j];
+        }
+
+    private:
+        TileHashMap<V> *map;
+
+        int i;
+
+        void advance()
+        {
+            ++i;
+            while (i < (int) map->keys.size() && map->keys[i] == EMPTY) {
+                ++i;
+            }
+        }
+    };
+
+    /**
+     * Creates a new, empty TileHashMap.
+     *
+     * @param capacity the initial number of entries that can be inserted
+     *      without resizing the table.
+     */
+    TileHashMap(int capacity = 16) : count(0)
+    {
+        int n = 16;
+        while (n < 2 * capacity) {
+            n *= 2;
+        }
+        keys.assign(n, EMPTY);
+        values.resize(n);
+    }
+
+    /**
+     * Returns the number of entries in this map.
+     */
+    int size() const
+    {
+        return count;
+    }
+
+    /**
+     * Returns true if this map is empty.
+     */
+    bool empty() const
+    {
+        return count == 0;
+    }
+
+    /**
+     * Returns the value associated with the given key, or NULL if there is
+     * no such value.
+     */
+    V *find(Key key)
+    {
+        assert(key != EMPTY);
+        int mask = (int) keys.size() - 1;
+        int i = hash(key) & mask;
+        while (keys[i] != EMPTY) {
+            if (keys[i] == key) {
+                return &values[i];
+            }
+            i = (i + 1) & mask;
+        }
+        return NULL;
+    }
+
+    /**
+     * Inserts a new entry in this map. If there is already an entry with the
+     * same key, this method does nothing (like std::map#insert).
+     *
+     * @return true if the entry has been inserted.
+     */
+    bool insert(Key key, const V &value)
+    {
+        assert(key != EMPTY);
+        if (2 * (count + 1) > (int) keys.size()) {
+            resize(2 * (int) keys.size());
+        }
+        int mask = (int) keys.size() - 1;
+        int i = hash(key) & mask;
+        while (keys[i] != EMPTY) {
+            if (keys[i] == key) {
+                return false;
+            }
+            i = (i + 1) & mask;
+        }
+        keys[i] = key;
+        values[i] = value;
+        ++count;
+        return true;
+    }
+
+    /**
+     * Returns the value associated with the given key, inserting a default
+     * value if necessary (like std::map#operator[]).
+     */
+    V &operator[](Key key)
+    {
+        V *v = find(key);
+        if (v == NULL) {
+            insert(key, V());
+            v = find(key);
+        }
+        return *v;
+    }
+
+    /**
+     * Removes the entry with the given key from this map.
+     *
+     * @return true if an entry has been removed.
+     */
+    bool erase(Key key)
+    {
+        assert(key != EMPTY);
+        int mask = (int) keys.size() - 1;
+        int i = hash(key) & mask;
+        while (keys[i] != key) {
+            if (keys[i] == EMPTY) {
+                return false;
+            }
+            i = (i + 1) & mask;
+        }
+        // shifts back the following entries of the probe sequence, unless
+        // they are already at or after their ideal position
+        int j = i;
+        while (true) {
+            j = (j + 1) & mask;
+            if (keys[j] == EMPTY) {
+                break;
+            }
+            int h = hash(keys[j]) & mask;
+            if (i <= j ? (i < h && h <= j) : (i < h || h <= j)) {
+                continue;
+            }
+            keys[i] = keys[j];
+            values[i] = values[j];
+            i = j;
+        }
+        keys[i] = EMPTY;
+        values[i] = V();
+        --count;
+        return true;
+    }
+
+    /**
+     * Removes all the entries of this map.
+     */
+    void clear()
+    {
+        keys.assign(keys.size(), EMPTY);
+        values.assign(values.size(), V());
+        count = 0;
+    }
+
+    /**
+     * Returns an iterator over the entries of this map.
+     */
+    Iterator getEntries()
+    {
+        return Iterator(this);
+    }
+
+private:
+    /**
+     * The key of empty entries. This value is not a valid tile key, because
+     * its level is 63.
+     */
+    static const Key EMPTY = ~0ULL;
+
+    /**
+     * The keys of the entries of this map, or EMPTY for unused entries. The
+     * size of this vector is always a power of two.
+     */
+    std::vector<Key> keys;
+
+    /**
+     * The values of the entries of this map.
+     */
+    std::vector<V> values;
+
+    /**
+     * The number of entries in this map.
+     */
+    int count;
+
+    /**
+     * Returns the hash code of a key. The key bits are well mixed, so that
+     * the low bits of the result can be used directly as a table index.
+     */
+    static int hash(Key key)
+    {
+        key ^= key >> 33;
+        key *= 0xff51afd7ed558ccdULL;
+        key ^= key >> 33;
+        key *= 0xc4ceb9fe1a85ec53ULL;
+        key ^= key >> 33;
+        return (int) (key & 0x7fffffff);
+    }
+
+    /**
+     * Resizes the table and reinserts all the entries.
+     *
+     * @param n the new table size, a power of two.
+     */
+    void resize(int n)
+    {
+        std::vector<Key> oldKeys(n, EMPTY);
+        std::vector<V> oldValues(n);
+        oldKeys.swap(keys);
+        oldValues.swap(values);
+        count = 0;
+        for (int i = 0; i < (int) oldKeys.size(); ++i) {
+            if (oldKeys[i] != EMPTY) {
+                insert(oldKeys[i], oldValues[i]);
+            }
+        }
+    }
+};
+
+template<class V>
+const typename TileHashMap<V>::Key TileHashMap<V>::EMPTY;
+
+}
+
+#endif
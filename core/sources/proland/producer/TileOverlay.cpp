@@ -0,0 +1,361 @@
+/*
+ * Proland: a procedural landscape rendering library.
+ * Website : http://proland.inrialpes.fr/
+ * Copyright (c) 2008-2015 INRIA - LJK (CNRS - Grenoble University)
+ * All rights reserved.
+ * Redistribution and use in source and binary forms, with or without 
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice, 
+ * this list of conditions and the following disclaimer.
+ * 
+ * 2. Redistributions in binary form must reproduce the above copyright notice, 
+ * this list of conditions and the following disclaimer in the documentation 
+ * and/or other materials provided with the distribution.
+ * 
+ * 3. Neither the name of the copyright holder nor the names of its contributors 
+ * may be used to endorse or promote products derived from this software without 
+ * specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND 
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED 
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. 
+ * IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, 
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, 
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, 
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF 
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE 
+ * OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED 
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+/*
+ * Proland is distributed under the Berkeley Software Distribution 3 Licence. 
+ * For any assistance, feedback and enquiries about training programs, you can check out the 
+ * contact page on our website : 
+ * http://proland.inrialpes.fr/
+ */
+/*
+ * Main authors: Eric Bruneton, Antoine Begault, Guillaume Piolat.
+ */
+
+#include "proland/producer/TileOverlay.h"
+
+#include <algorithm>
+#include <pthread.h>
+#include <sys/stat.h>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/file.h>
+#include <unistd.h>
+#endif
+
+#include "ork/core/Logger.h"
+
+using namespace std;
+
+namespace proland
+{
+
+/**
+ * The first int of overlay index files ("PRLO" in little endian order).
+ */
+#define OVERLAY_MAGIC 0x4F4C5250
+
+#define OVERLAY_VERSION 2
+
+/**
+ * Returns the size of the given file in bytes, or -1 if it does not exist.
+ *
+ * @param[out] time the modification time of the file, or 0.
+ */
+static long long getFileSize(const char *name, long long &time)
+{
+#ifndef _WIN32
+    struct stat s;
+    bool ok = stat(name, &s) == 0;
+#else
+    struct _stat64 s;
+    bool ok = _stat64(name, &s) == 0;
+#endif
+    time = ok ? (long long) s.st_mtime : 0;
+    return ok ? (long long) s.st_size : -1;
+}
+
+TileOverlay::TileOverlay(const char *name) :
+    Object("TileOverlay"), dataSize(0), fd(-1), file(NULL)
+{
+    dataName = string(name) + ".overlay";
+    indexName = dataName + ".index";
+    baseSize = getFileSize(name, baseTime);
+    mutex = new pthread_mutex_t;
+    pthread_mutex_init((pthread_mutex_t*) mutex, NULL);
+    writeMutex = new pthread_mutex_t;
+    pthread_mutex_init((pthread_mutex_t*) writeMutex, NULL);
+    long long committed;
+    if (loadIndex(entries, committed)) {
+        dataSize = committed;
+        openData();
+    }
+}
+
+TileOverlay::~TileOverlay()
+{
+#ifndef _WIN32
+    if (fd >= 0) {
+        close(fd);
+    }
+#else
+    if (file != NULL) {
+        fclose(file);
+    }
+#endif
+    pthread_mutex_destroy((pthread_mutex_t*) mutex);
+    delete (pthread_mutex_t*) mutex;
+    pthread_mutex_destroy((pthread_mutex_t*) writeMutex);
+    delete (pthread_mutex_t*) writeMutex;
+}
+
+bool TileOverlay::isEmpty()
+{
+    pthread_mutex_lock((pthread_mutex_t*) mutex);
+    bool empty = entries.empty();
+    pthread_mutex_unlock((pthread_mutex_t*) mutex);
+    return empty;
+}
+
+bool TileOverlay::hasTile(int id)
+{
+    pthread_mutex_lock((pthread_mutex_t*) mutex);
+    bool found = entries.find(id) != entries.end();
+    pthread_mutex_unlock((pthread_mutex_t*) mutex);
+    return found;
+}
+
+bool TileOverlay::read(int id, unsigned char *buffer, int capacity, int &size)
+{
+    Entry e;
+    pthread_mutex_lock((pthread_mutex_t*) mutex);
+    map<int, Entry>::iterator i = entries.find(id);
+    bool found = i != entries.end() && i->second.size <= capacity;
+    if (found) {
+        e = i->second;
+#ifdef _WIN32
+        found = file != NULL && fseek64(file, e.offset, SEEK_SET) == 0 && fread(buffer, e.size, 1, file) == 1;
+#endif
+    }
+    pthread_mutex_unlock((pthread_mutex_t*) mutex);
+#ifndef _WIN32
+    // the data referenced by the index is never modified, even by a
+    // concurrent #write of this or another overlay, so it can be read
+    // without holding the mutex
+    int n = 0;
+    while (found && n < e.size) {
+        ssize_t r = pread(fd, buffer + n, e.size - n, e.offset + n);
+        found = r > 0;
+        n += found ? int(r) : 0;
+    }
+#endif
+    if (found) {
+        size = e.size;
+    }
+    return found;
+}
+
+bool TileOverlay::write(const map< int, vector<unsigned char> > &tiles)
+{
+    // the whole save, from the index reload to the index replacement, is
+    // serialized with the other saves of this overlay and, thanks to the lock
+    // on the data file, with the saves of other overlays of the same file
+    pthread_mutex_lock((pthread_mutex_t*) writeMutex);
+    bool ok = true;
+#ifndef _WIN32
+    int wfd = open(dataName.c_str(), O_WRONLY | O_CREAT, 0644);
+    ok = wfd >= 0 && flock(wfd, LOCK_EX) == 0;
+#endif
+
+    // the new index starts from the index on disk, which may contain tiles
+    // saved by other overlays since this one was loaded or saved
+    map<int, Entry> newEntries;
+    long long committed;
+    bool reloaded = ok && loadIndex(newEntries, committed);
+    pthread_mutex_lock((pthread_mutex_t*) mutex);
+    if (!reloaded) {
+        newEntries = entries;
+        committed = dataSize;
+    }
+    // the data referenced by the current index of this overlay must not be
+    // overwritten either, since it can be read concurrently
+    long long offset = max(committed, dataSize);
+    pthread_mutex_unlock((pthread_mutex_t*) mutex);
+
+    // the new tiles are written after the data referenced by the current
+    // index, which is therefore left unchanged if this save is interrupted
+    map< int, vector<unsigned char> >::const_iterator i = tiles.begin();
+#ifndef _WIN32
+    ok = ok && ftruncate(wfd, offset) == 0;
+    for (; ok && i != tiles.end(); ++i) {
+        const vector<unsigned char> &data = i->second;
+        size_t n = 0;
+        while (ok && n < data.size()) {
+            ssize_t r = pwrite(wfd, &data[n], data.size() - n, offset + n);
+            ok = r > 0;
+            n += ok ? size_t(r) : 0;
+        }
+        if (!data.empty()) {
+            Entry e;
+            e.offset = offset;
+            e.size = int(data.size());
+            newEntries[i->first] = e;
+            offset += data.size();
+        }
+    }
+    ok = ok && fsync(wfd) == 0;
+#else
+    FILE *f;
+    fopen(&f, dataName.c_str(), "r+b");
+    if (f == NULL) {
+        fopen(&f, dataName.c_str(), "w+b");
+    }
+    ok = f != NULL && fseek64(f, offset, SEEK_SET) == 0;
+    for (; ok && i != tiles.end(); ++i) {
+        const vector<unsigned char> &data = i->second;
+        if (!data.empty()) {
+            ok = fwrite(&data[0], data.size(), 1, f) == 1;
+            Entry e;
+            e.offset = offset;
+            e.size = int(data.size());
+            newEntries[i->first] = e;
+            offset += data.size();
+        }
+    }
+    ok = ok && fflush(f) == 0;
+    if (f != NULL) {
+        fclose(f);
+    }
+#endif
+
+    // the new index is written in a temporary file, which then atomically
+    // replaces the current index
+    string tmpName = indexName + ".tmp";
+    if (ok) {
+        FILE *f;
+        fopen(&f, tmpName.c_str(), "wb");
+        ok = f != NULL;
+        if (ok) {
+            int header[2] = { OVERLAY_MAGIC, OVERLAY_VERSION };
+            int count = int(newEntries.size());
+            ok = fwrite(header, sizeof(int), 2, f) == 2;
+            ok = ok && fwrite(&baseSize, sizeof(long long), 1, f) == 1;
+            ok = ok && fwrite(&baseTime, sizeof(long long), 1, f) == 1;
+            ok = ok && fwrite(&offset, sizeof(long long), 1, f) == 1;
+            ok = ok && fwrite(&count, sizeof(int), 1, f) == 1;
+            map<int, Entry>::iterator j = newEntries.begin();
+            for (; ok && j != newEntries.end(); ++j) {
+                ok = fwrite(&j->first, sizeof(int), 1, f) == 1;
+                ok = ok && fwrite(&j->second.size, sizeof(int), 1, f) == 1;
+                ok = ok && fwrite(&j->second.offset, sizeof(long long), 1, f) == 1;
+            }
+            ok = ok && fflush(f) == 0;
+#ifndef _WIN32
+            ok = ok && fsync(fileno(f)) == 0;
+#endif
+            ok = fclose(f) == 0 && ok;
+        }
+#ifdef _WIN32
+        // rename does not replace an existing file on Windows
+        if (ok) {
+            remove(indexName.c_str());
+        }
+#endif
+        ok = ok && rename(tmpName.c_str(), indexName.c_str()) == 0;
+        if (!ok) {
+            remove(tmpName.c_str());
+        }
+    }
+
+    if (ok) {
+        pthread_mutex_lock((pthread_mutex_t*) mutex);
+        entries.swap(newEntries);
+        dataSize = offset;
+        openData();
+        pthread_mutex_unlock((pthread_mutex_t*) mutex);
+    }
+
+    // the data file lock is released only once the new index is committed
+#ifndef _WIN32
+    if (wfd >= 0) {
+        close(wfd);
+    }
+#endif
+    pthread_mutex_unlock((pthread_mutex_t*) writeMutex);
+
+    if (!ok && Logger::ERROR_LOGGER != NULL) {
+        Logger::ERROR_LOGGER->logf("CACHE", "Cannot save tiles in overlay '%s'", dataName.c_str());
+    }
+    return ok;
+}
+
+bool TileOverlay::loadIndex(map<int, Entry> &index, long long &committed)
+{
+    FILE *f;
+    fopen(&f, indexName.c_str(), "rb");
+    if (f == NULL) {
+        return false;
+    }
+    int header[2] = { 0, 0 };
+    long long size = 0;
+    long long time = 0;
+    int count = 0;
+    committed = 0;
+    bool ok = fread(header, sizeof(int), 2, f) == 2;
+    ok = ok && fread(&size, sizeof(long long), 1, f) == 1;
+    ok = ok && fread(&time, sizeof(long long), 1, f) == 1;
+    ok = ok && fread(&committed, sizeof(long long), 1, f) == 1;
+    ok = ok && fread(&count, sizeof(int), 1, f) == 1;
+    ok = ok && header[0] == OVERLAY_MAGIC && header[1] == OVERLAY_VERSION;
+    if (ok && (size != baseSize || time != baseTime)) {
+        // the base file has been regenerated since the overlay was saved
+        if (Logger::WARNING_LOGGER != NULL) {
+            Logger::WARNING_LOGGER->logf("CACHE", "Ignoring overlay '%s' of a modified tile file", dataName.c_str());
+        }
+        fclose(f);
+        return false;
+    }
+    for (int i = 0; ok && i < count; ++i) {
+        int id;
+        Entry e;
+        ok = fread(&id, sizeof(int), 1, f) == 1;
+        ok = ok && fread(&e.size, sizeof(int), 1, f) == 1;
+        ok = ok && fread(&e.offset, sizeof(long long), 1, f) == 1;
+        ok = ok && e.offset >= 0 && e.size > 0 && e.offset + e.size <= committed;
+        if (ok) {
+            index[id] = e;
+        }
+    }
+    fclose(f);
+    if (!ok) {
+        if (Logger::ERROR_LOGGER != NULL) {
+            Logger::ERROR_LOGGER->logf("CACHE", "Invalid overlay index '%s'", indexName.c_str());
+        }
+        index.clear();
+        return false;
+    }
+    return true;
+}
+
+void TileOverlay::openData()
+{
+#ifndef _WIN32
+    if (fd < 0) {
+        fd = open(dataName.c_str(), O_RDONLY);
+    }
+#else
+    if (file == NULL) {
+        fopen(&file, dataName.c_str(), "rb");
+    }
+#endif
+}
+
+}
@@ -0,0 +1,213 @@
+/*
+ * Proland: a procedural landscape rendering library.
+ * Website : http://proland.inrialpes.fr/
+ * Copyright (c) 2008-2015 INRIA - LJK (CNRS - Grenoble University)
+ * All rights reserved.
+ * Redistribution and use in source and binary forms, with or without 
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice, 
+ * this list of conditions and the following disclaimer.
+ * 
+ * 2. Redistributions in binary form must reproduce the above copyright notice, 
+ * this list of conditions and the following disclaimer in the documentation 
+ * and/or other materials provided with the distribution.
+ * 
+ * 3. Neither the name of the copyright holder nor the names of its contributors 
+ * may be used to endorse or promote products derived from this software without 
+ * specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND 
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED 
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. 
+ * IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, 
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, 
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, 
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF 
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE 
+ * OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED 
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+/*
+ * Proland is distributed under the Berkeley Software Distribution 3 Licence. 
+ * For any assistance, feedback and enquiries about training programs, you can check out the 
+ * contact page on our website : 
+ * http://proland.inrialpes.fr/
+ */
+/*
+ * Main authors: Eric Bruneton, Antoine Begault, Guillaume Piolat.
+ */
+
+#ifndef _PROLAND_TILE_OVERLAY_H_
+#define _PROLAND_TILE_OVERLAY_H_
+
+#include <cstdio>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "ork/core/Object.h"
+
+using namespace ork;
+
+namespace proland
+{
+
+/**
+ * A copy-on-write overlay of a precomputed tile file, such as the files used
+ * by the ResidualProducer and the OrthoCPUProducer. It stores compressed tiles
+ * that replace the corresponding tiles of the base file, so that edited tiles
+ * can be saved without rewriting the whole base file. The overlay of a file
+ * 'name' is stored in two files:
+ * - 'name.overlay' contains the data of the saved tiles, in the order in
+ * which they were saved. This file is append only: the data of a tile that is
+ * saved again is not overwritten, but the new data is appended to the file.
+ * - 'name.overlay.index' contains the offset and size of the data of each
+ * saved tile in 'name.overlay', and the size and modification time of the
+ * base file. It is replaced atomically each time some tiles are saved (see
+ * #write), so that an interrupted save leaves the previously saved tiles
+ * unchanged. The overlay is ignored if the base file size or modification
+ * time has changed since the index was written, i.e., if the base file has
+ * been regenerated.
+ *
+ * This class is thread safe. Several overlays of the same base file, in one
+ * or several processes, can also save tiles at the same time: each save holds
+ * an exclusive lock on the data file (on POSIX systems), and starts from the
+ * index found on disk, which may contain tiles saved by the other overlays.
+ * @ingroup producer
+ * @authors Eric Bruneton, Antoine Begault, Guillaume Piolat
+ */
+PROLAND_API class TileOverlay : public Object
+{
+public:
+    /**
+     * Creates a new TileOverlay. This loads the overlay index, if it exists.
+     *
+     * @param name the name of the base file.
+     */
+    TileOverlay(const char *name);
+
+    /**
+     * Deletes this TileOverlay.
+     */
+    virtual ~TileOverlay();
+
+    /**
+     * Returns true if this overlay does not contain any tile.
+     */
+    bool isEmpty();
+
+    /**
+     * Returns true if this overlay contains the given tile.
+     *
+     * @param id a tile id, as used in the base file.
+     */
+    bool hasTile(int id);
+
+    /**
+     * Reads the compressed data of the given tile.
+     *
+     * @param id a tile id, as used in the base file.
+     * @param buffer where the compressed tile data must be stored.
+     * @param capacity the size of buffer in bytes.
+     * @param[out] size the size of the compressed tile data.
+     * @return false if this overlay does not contain the given tile, or if
+     *      its data cannot be read.
+     */
+    bool read(int id, unsigned char *buffer, int capacity, int &size);
+
+    /**
+     * Saves the given tiles in this overlay. Only the data of these tiles is
+     * written, followed by the new overlay index. The tiles saved by other
+     * overlays of the same base file since this one was loaded are kept, and
+     * become visible in this overlay.
+     *
+     * @param tiles the compressed data of the tiles to save, indexed by tile
+     *      ids (as used in the base file).
+     * @return false if the tiles cannot be saved. In this case this overlay is
+     *      unchanged, on disk and in memory.
+     */
+    bool write(const std::map< int, std::vector<unsigned char> > &tiles);
+
+private:
+    /**
+     * The location of a tile in the data file.
+     */
+    struct Entry
+    {
+        long long offset;
+
+        int size;
+    };
+
+    /**
+     * The name of the overlay data file.
+     */
+    std::string dataName;
+
+    /**
+     * The name of the overlay index file.
+     */
+    std::string indexName;
+
+    /**
+     * The size of the base file in bytes.
+     */
+    long long baseSize;
+
+    /**
+     * The modification time of the base file.
+     */
+    long long baseTime;
+
+    /**
+     * The size of the data file that is referenced by #entries. Any data after
+     * this offset comes from an interrupted save and can be overwritten.
+     */
+    long long dataSize;
+
+    /**
+     * The location of the saved tiles in the data file, indexed by tile ids.
+     */
+    std::map<int, Entry> entries;
+
+    /**
+     * The file descriptor used to read the data file, or -1.
+     */
+    int fd;
+
+    /**
+     * The data file, if file descriptors are not available on this platform.
+     */
+    FILE *file;
+
+    /**
+     * A mutex used to serialize accesses to #entries, #dataSize and #file.
+     */
+    void *mutex;
+
+    /**
+     * A mutex used to serialize the calls to #write. It is held during a whole
+     * save, while #mutex is only held to read or update #entries.
+     */
+    void *writeMutex;
+
+    /**
+     * Loads the overlay index.
+     *
+     * @param[out] index the location of the saved tiles in the data file.
+     * @param[out] committed the size of the data file referenced by index.
+     * @return false if the index does not exist or is not valid.
+     */
+    bool loadIndex(std::map<int, Entry> &index, long long &committed);
+
+    /**
+     * Opens the data file for reading.
+     */
+    void openData();
+};
+
+}
+
+#endif
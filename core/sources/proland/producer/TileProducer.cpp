@@ -39,13 +39,18 @@
  * Main authors: Eric Bruneton, Antoine Begault, Guillaume Piolat.
  */
 
+#include <algorithm>
+#include <cstring>
 #include <pthread.h>
 
 #include "proland/producer/TileProducer.h"
 
 #include "ork/core/Logger.h"
+#include "ork/core/Timer.h"
+#include "ork/resource/tinyxml/tinyxml.h"
 #include "ork/scenegraph/SceneManager.h"
 #include "proland/producer/GPUTileStorage.h"
+#include "proland/producer/TileDiskCache.h"
 
 using namespace std;
 
@@ -101,11 +106,42 @@ public:
      */
     bool initialized;
 
+    /**
+     * True if the last execution of this task was skipped because its tile
+     * was cancelled (see TileCache#skipCancelledTile).
+     */
+    bool skipped;
+
+    /**
+     * The TileDiskCache of the owner's cache, if this tile was found in it
+     * when the tiles needed to create it should have been acquired, or NULL.
+     * In this case these tiles are not acquired at all, and the tile data is
+     * loaded from disk when this task is executed. Only the in memory index
+     * of the disk cache is used to find the tile, so that no file is read
+     * on the thread requesting the tile (see TileDiskCache#pin).
+     */
+    ptr<TileDiskCache> disk;
+
+    /**
+     * The record of #disk containing the data of this tile, pinned with
+     * TileDiskCache#pin until this data is loaded.
+     */
+    int diskRecord;
+
+    /**
+     * True if this tile was found in the TileDiskCache of the owner's cache,
+     * but could not be loaded from it (because its record was partially
+     * written, or removed in the meantime). The tile must then be created
+     * with TileProducer#doCreateTile, after acquiring the tiles it needs.
+     */
+    bool diskMiss;
+
     /**
      * Creates a new CreateTile Task.
      */
-    CreateTile(TileProducer *owner, int level, int tx, int ty, TileStorage::Slot *data, unsigned deadline) :
-        Task(owner->taskType, owner->isGpuProducer(), deadline), parent(NULL), owner(owner), level(level), tx(tx), ty(ty), data(data), initialized(true)
+    CreateTile(TileProducer *owner, int level, int tx, int ty, TileStorage::Slot *data, unsigned deadline, ptr<TileDiskCache> disk = NULL, int diskRecord = -1) :
+        Task(owner->taskType, owner->isGpuProducer(), deadline), parent(NULL), owner(owner), level(level), tx(tx), ty(ty), data(data),
+        initialized(disk == NULL), skipped(false), disk(disk), diskRecord(diskRecord), diskMiss(false)
     {
         // the task to produce 'data' is 'this'
         data->lock(true);
@@ -122,7 +158,7 @@ public:
             if (owner->cache != NULL) {
                 // cache is NULL if the owner producer is being deleted
                 // in this case it is not necessary to update the cache
-                owner->cache->createTileTaskDeleted(owner->getId(), level, tx, ty);
+                owner->cache->createTileTaskDeleted(owner->getId(), level, tx, ty, this);
             }
         }
         if (parent != NULL) {
@@ -131,6 +167,7 @@ public:
            // is no longer referenced at this point, and can be deleted.
            delete parent;
         }
+        unpinDisk();
     }
 
     /**
@@ -169,7 +206,13 @@ public:
      */
     void start()
     {
-        if (!initialized) {
+        if (!initialized && disk == NULL) {
+            // if the tile is on disk there is no need to acquire the tiles
+            // needed to create it (unless it could not be loaded from disk
+            // in a previous execution)
+            if (!diskMiss) {
+                disk = owner->pinDiskCache(level, tx, ty, diskRecord);
+            }
             if (parent != NULL) {
                 // as we will reconstruct the content of #parent in
                 // startCreateTile, we clear it first; in fact we remove all
@@ -181,7 +224,10 @@ public:
 
             // acquires the tiles needed to create this tile, and completes the
             // tasks graph with the corresponding tasks and task dependencies
-            owner->startCreateTile(level, tx, ty, getDeadline(), this, parent);
+            if (disk == NULL) {
+                owner->startCreateTile(level, tx, ty, getDeadline(), this, parent);
+                initialized = true;
+            }
 
             if (parent != NULL) {
                 // removes no longer used tasks; these are all the tasks without
@@ -196,7 +242,6 @@ public:
                     }
                 }
             }
-            initialized = true;
         }
     }
 
@@ -216,6 +261,14 @@ public:
     {
         bool changes = true;
         assert(!isDone());
+        if (owner->cache->skipCancelledTile(owner->getId(), level, tx, ty, data)) {
+            // the tile was cancelled before this task was executed, and its
+            // slot has been released; the task will be rescheduled, with
+            // the new deadline, if the tile is requested again
+            skipped = true;
+            unpinDisk();
+            return false;
+        }
         data->lock(true);
         if (data->producerTask == this) {
             // since the creation of this CreateTile task,
@@ -225,10 +278,27 @@ public:
             // from the cache between the creation and the execution of the
             // task). In this case we do not execute the task, otherwise it
             // could override data already produced for the reaffected tile.
-            changes = owner->doCreateTile(level, tx, ty, data);
-            data->id = TileCache::Tile::getTId(owner->getId(), level, tx, ty);
+            if (disk != NULL) {
+                // the tiles needed by doCreateTile are not acquired, so the
+                // tile must not be created if it cannot be loaded; it is
+                // then recreated after acquiring them (see #setIsDone)
+                diskMiss = !owner->readDiskCache(disk, level, tx, ty, data);
+                changes = !diskMiss;
+            } else {
+                assert(initialized);
+                Timer timer;
+                timer.start();
+                changes = owner->doCreateTile(level, tx, ty, data);
+                owner->tileCreated(timer.end());
+                owner->writeDiskCache(level, tx, ty, data);
+                diskMiss = false;
+            }
+            if (!diskMiss) {
+                data->id = TileCache::Tile::getTId(owner->getId(), level, tx, ty);
+            }
         }
         data->lock(false);
+        unpinDisk();
         return changes;
     }
 
@@ -240,6 +310,19 @@ public:
         owner->endCreateTile();
     }
 
+    /**
+     * Unpins the record of #disk containing the data of this tile, if this
+     * is not already done.
+     */
+    void unpinDisk()
+    {
+        if (disk != NULL) {
+            disk->unpin(diskRecord);
+            disk = NULL;
+            diskRecord = -1;
+        }
+    }
+
     /**
      * Releases the tiles used to create this tile with TileProducer#putTile,
      * if this is not already done.
@@ -260,6 +343,20 @@ public:
         if (done) {
             // releases the tiles used to create this tile, if necessary
             stop();
+            if (owner != NULL && owner->cache != NULL) {
+                // a skipped task can be reused for a new tile only from now
+                // on, otherwise it could be marked as done after its reuse
+                owner->cache->createTileTaskDone(owner->getId(), level, tx, ty, this, skipped);
+            }
+            skipped = false;
+            if (diskMiss && owner != NULL && owner->findTile(level, tx, ty, true) != NULL) {
+                // the tile could not be loaded from disk, and was not
+                // created (see #run); this task must be executed again, to
+                // create it after acquiring the tiles it needs. If the tile
+                // is no longer in cache, this is done if it is requested
+                // again (see TileCache#getTile)
+                setIsDone(false, 0, DATA_NEEDED);
+            }
         } else if (r == DATA_NEEDED) {
             // the task will need to be reexecuted soon (this is not the case
             // if the reason is DATA_CHANGED - when invalidating tiles, see
@@ -385,6 +482,9 @@ void TileProducer::init(ptr<TileCache> cache, bool gpuProducer)
     this->cache = cache;
     this->gpuProducer = gpuProducer;
     this->rootQuadSize = 0.0;
+    this->averageCreateTime = 0.0f;
+    this->diskCacheKey = 0;
+    this->diskCacheWrite = false;
     this->id = cache->nextProducerId++;
     cache->producers.insert(make_pair(id, this));
     tileMap = NULL;
@@ -443,6 +543,131 @@ bool TileProducer::isGpuProducer()
     return gpuProducer;
 }
 
+float TileProducer::getAverageCreateTime()
+{
+    return averageCreateTime;
+}
+
+void TileProducer::tileCreated(double duration)
+{
+    pthread_mutex_lock((pthread_mutex_t*) mutex);
+    if (averageCreateTime == 0.0f) {
+        averageCreateTime = float(duration);
+    } else {
+        averageCreateTime = 0.9f * averageCreateTime + 0.1f * float(duration);
+    }
+    createStats.add(duration);
+    pthread_mutex_unlock((pthread_mutex_t*) mutex);
+}
+
+void TileProducer::getCreateStats(CreateStats &stats, bool reset)
+{
+    pthread_mutex_lock((pthread_mutex_t*) mutex);
+    stats = createStats;
+    if (reset) {
+        createStats = CreateStats();
+    }
+    pthread_mutex_unlock((pthread_mutex_t*) mutex);
+}
+
+unsigned long long TileProducer::getDiskCacheKey()
+{
+    return diskCacheKey;
+}
+
+void TileProducer::setDiskCacheKey(unsigned long long key, bool write)
+{
+    diskCacheKey = key;
+    diskCacheWrite = write;
+}
+
+void TileProducer::initDiskCache(const string &name, const TiXmlElement *e)
+{
+    const char *mode = e->Attribute("diskCache");
+    if (mode != NULL && (strcmp(mode, "true") == 0 || strcmp(mode, "read") == 0)) {
+        setDiskCacheKey(TileDiskCache::getProducerKey(name, e, getSourceKey()), strcmp(mode, "true") == 0);
+    }
+}
+
+unsigned long long TileProducer::getSourceKey()
+{
+    unsigned long long h = 0;
+    vector< ptr<TileProducer> > producers;
+    getReferencedProducers(producers);
+    for (unsigned int i = 0; i < producers.size(); ++i) {
+        h = TileDiskCache::fnvMix(h, producers[i]->getSourceKey());
+    }
+    return h;
+}
+
+ptr<TileDiskCache> TileProducer::pinDiskCache(int level, int tx, int ty, int &record)
+{
+    record = -1;
+    ptr<TileDiskCache> disk = cache->getDiskCache();
+    // the disk cache is unsupported if the storage cannot set the slot data
+    if (diskCacheKey == 0 || disk == NULL || disk->getDataSize() != cache->getStorage()->getSlotDataSize()) {
+        return NULL;
+    }
+    record = disk->pin(diskCacheKey, level, tx, ty);
+    return record < 0 ? NULL : disk;
+}
+
+bool TileProducer::readDiskCache(ptr<TileDiskCache> disk, int level, int tx, int ty, TileStorage::Slot *data)
+{
+    unsigned char *buffer = new unsigned char[disk->getDataSize()];
+    bool found = disk->get(diskCacheKey, level, tx, ty, buffer) && cache->getStorage()->setSlotData(data, buffer);
+    delete[] buffer;
+    return found;
+}
+
+void TileProducer::writeDiskCache(int level, int tx, int ty, TileStorage::Slot *data)
+{
+    ptr<TileDiskCache> disk = cache->getDiskCache();
+    if (diskCacheKey == 0 || !diskCacheWrite || disk == NULL || disk->getDataSize() != cache->getStorage()->getSlotDataSize()) {
+        return;
+    }
+    unsigned char *buffer = new unsigned char[disk->getDataSize()];
+    if (cache->getStorage()->getSlotData(data, buffer)) {
+        disk->put(diskCacheKey, level, tx, ty, buffer);
+    }
+    delete[] buffer;
+}
+
+TileProducer::CreateStats::CreateStats() :
+    tiles(0), totalTime(0.0), maxTime(0.0)
+{
+    for (int i = 0; i < BINS; ++i) {
+        histogram[i] = 0;
+    }
+}
+
+void TileProducer::CreateStats::add(double duration)
+{
+    int bin = 0;
+    while (bin < BINS - 1 && duration >= double(1 << bin)) {
+        ++bin;
+    }
+    ++histogram[bin];
+    ++tiles;
+    totalTime += duration;
+    maxTime = max(maxTime, duration);
+}
+
+double TileProducer::CreateStats::getPercentile(float p) const
+{
+    if (tiles == 0) {
+        return 0.0;
+    }
+    int n = 0;
+    for (int i = 0; i < BINS - 1; ++i) {
+        n += histogram[i];
+        if (n >= p / 100.0f * tiles) {
+            return min(double(1 << i), maxTime);
+        }
+    }
+    return maxTime;
+}
+
 int TileProducer::getBorder()
 {
     return 0;
@@ -479,6 +704,18 @@ TileCache::Tile* TileProducer::getTile(int level, int tx, int ty, unsigned int d
     return t;
 }
 
+TileCache::Tile* TileProducer::getReadyTile(int level, int tx, int ty, bool includeCache)
+{
+    int users = 0;
+    TileCache::Tile *t = cache->getReadyTile(id, level, tx, ty, includeCache, &users);
+    if (t != NULL && users == 0) {
+        for (unsigned int i = 0; i < layers.size(); i++) {
+            layers[i]->useTile(level, tx, ty, 0);
+        }
+    }
+    return t;
+}
+
 vec4f TileProducer::getGpuTileCoords(int level, int tx, int ty, TileCache::Tile **tile)
 {
     assert(isGpuProducer());
@@ -534,10 +771,10 @@ vec4f TileProducer::getGpuTileCoords(int level, int tx, int ty, TileCache::Tile
     }
 }
 
-bool TileProducer::prefetchTile(int level, int tx, int ty)
+bool TileProducer::prefetchTile(int level, int tx, int ty, unsigned int deadline)
 {
     if (cache->getScheduler() != NULL && cache->getScheduler()->supportsPrefetch(isGpuProducer())) {
-        ptr<Task> task = cache->prefetchTile(id, level, tx, ty);
+        ptr<Task> task = cache->prefetchTile(id, level, tx, ty, deadline);
         if (task != NULL) {
             cache->getScheduler()->schedule(task);
             return true;
@@ -549,6 +786,11 @@ bool TileProducer::prefetchTile(int level, int tx, int ty)
     return false;
 }
 
+bool TileProducer::cancelTile(int level, int tx, int ty)
+{
+    return cache->cancelTile(id, level, tx, ty);
+}
+
 void TileProducer::putTile(TileCache::Tile *t)
 {
     if (cache->putTile(t) == 0) {
@@ -774,8 +1016,18 @@ ptr<Task> TileProducer::createTile(int level, int tx, int ty, TileStorage::Slot
         }
         return old;
     }
-    ptr<CreateTile> t = new CreateTile(this, level, tx, ty, data, deadline);
-    ptr<Task> r = startCreateTile(level, tx, ty, deadline, t, NULL);
+    // if the tile is on disk there is no need to acquire the tiles needed to
+    // create it, nor to create the tasks to produce them. We still need a
+    // task graph, to acquire them later if the tile must be recreated
+    int diskRecord;
+    ptr<TileDiskCache> disk = pinDiskCache(level, tx, ty, diskRecord);
+    ptr<CreateTile> t = new CreateTile(this, level, tx, ty, data, deadline, disk, diskRecord);
+    ptr<Task> r;
+    if (disk == NULL) {
+        r = startCreateTile(level, tx, ty, deadline, t, NULL);
+    } else {
+        r = createTaskGraph(t);
+    }
     pthread_mutex_lock((pthread_mutex_t*) mutex);
     tasks.push_back(t.get());
     if (r.get() != t.get()) {
@@ -49,6 +49,8 @@
 #include "proland/producer/TileCache.h"
 #include "proland/producer/TileLayer.h"
 
+class TiXmlElement;
+
 using namespace ork;
 
 namespace ork
@@ -71,6 +73,61 @@ namespace proland
 PROLAND_API class TileProducer : public Object
 {
 public:
+    /**
+     * Tile creation statistics of a TileProducer. See #getCreateStats.
+     */
+    class CreateStats
+    {
+    public:
+        /**
+         * The number of bins of #histogram.
+         */
+        static const int BINS = 24;
+
+        /**
+         * The number of tiles created with #doCreateTile.
+         */
+        int tiles;
+
+        /**
+         * The total duration of the #doCreateTile calls, in micro seconds.
+         */
+        double totalTime;
+
+        /**
+         * The maximum duration of a #doCreateTile call, in micro seconds.
+         */
+        double maxTime;
+
+        /**
+         * A histogram of the durations of the #doCreateTile calls. The first
+         * bin counts the durations less than 1 micro second, and the bin i > 0
+         * counts the durations between 2^(i-1) and 2^i micro seconds (the
+         * last bin also counts the larger durations).
+         */
+        int histogram[BINS];
+
+        CreateStats();
+
+        /**
+         * Adds a #doCreateTile duration to these statistics.
+         *
+         * @param duration a duration in micro seconds.
+         */
+        void add(double duration);
+
+        /**
+         * Returns an approximation of the given percentile of the
+         * #doCreateTile durations, computed from the #histogram (the upper
+         * bound of the bin containing this percentile).
+         *
+         * @param p a percentile between 0 and 100.
+         * @return the requested percentile in micro seconds, or 0 if no tile
+         *      has been created.
+         */
+        double getPercentile(float p) const;
+    };
+
     /**
      * Creates a new TileProducer.
      *
@@ -115,6 +172,61 @@ public:
      */
     bool isGpuProducer();
 
+    /**
+     * Returns the average duration of #doCreateTile for this %producer, in
+     * micro seconds, or 0 if no tile has been created yet. This average is
+     * an exponential moving average of the durations measured by the tasks
+     * that create the tiles of this %producer.
+     */
+    float getAverageCreateTime();
+
+    /**
+     * Returns the tile creation statistics of this %producer, since its
+     * creation or since the last reset of these statistics.
+     *
+     * @param[out] stats the tile creation statistics of this %producer.
+     * @param reset true to reset the statistics after they are returned.
+     */
+    void getCreateStats(CreateStats &stats, bool reset = true);
+
+    /**
+     * Returns the key identifying this %producer and its parameters in the
+     * TileDiskCache of its TileCache, or 0 if the tiles of this %producer must
+     * not be stored on disk.
+     */
+    unsigned long long getDiskCacheKey();
+
+    /**
+     * Sets the key identifying this %producer and its parameters in the
+     * TileDiskCache of its TileCache. If this key is not 0, and if the
+     * TileCache has a TileDiskCache, the tiles of this %producer are loaded
+     * from disk if they are found there, without acquiring the tiles they
+     * depend on, instead of being recreated with #doCreateTile. Only the in
+     * memory index of the disk cache is used when a tile is requested; its
+     * data is loaded by the task creating the tile (if this fails, the task
+     * is executed again, after acquiring the tiles it depends on). If 'write'
+     * is true, the tiles created with #doCreateTile are also stored on disk.
+     * This is done synchronously, in the task that creates the tile, and
+     * requires a readback for tiles stored on GPU. This must only
+     * be enabled for producers whose tiles only depend on their parameters
+     * (and not, for instance, on the current time), and whose #doCreateTile
+     * has no side effects. See TileDiskCache#getProducerKey.
+     *
+     * @param key a key identifying this %producer and its parameters across
+     *      sessions, or 0 to disable the disk cache for this %producer.
+     * @param write true to store the created tiles on disk, false to only
+     *      load the tiles that are already on disk.
+     */
+    void setDiskCacheKey(unsigned long long key, bool write = true);
+
+    /**
+     * Returns a key describing the source data of this %producer, such as
+     * the files it reads, which is hashed in its disk cache key (see
+     * TileDiskCache#getProducerKey). The default implementation combines the
+     * source keys of the producers returned by #getReferencedProducers.
+     */
+    virtual unsigned long long getSourceKey();
+
     /**
      * Returns the size in pixels of the border of each tile. Tiles made of
      * raster data may have a border that contains the value of the neighboring
@@ -177,6 +289,22 @@ public:
      */
     virtual TileCache::Tile* getTile(int level, int tx, int ty, unsigned int deadline);
 
+    /**
+     * Returns the requested tile if it is in the TileCache of this
+     * %producer and if it is ready, or NULL otherwise. Unlike #getTile,
+     * this method never creates a tile. If the tile is returned, its number
+     * of users is incremented by one, and it must be released with #putTile.
+     * See TileCache#getReadyTile.
+     *
+     * @param level the tile's quadtree level.
+     * @param tx the tile's quadtree x coordinate.
+     * @param ty the tile's quadtree y coordinate.
+     * @param includeCache true to include both used and unused tiles in the
+     *      search, false to include only the used tiles.
+     * @return the requested tile, or NULL if it is not ready in cache.
+     */
+    virtual TileCache::Tile* getReadyTile(int level, int tx, int ty, bool includeCache = false);
+
     /**
      * Returns the coordinates in the GPU storage of the given tile. If the
      * given tile is not in the GPU storage, this method uses the first ancestor
@@ -208,10 +336,13 @@ public:
      * @param level the tile's quadtree level.
      * @param tx the tile's quadtree x coordinate.
      * @param ty the tile's quadtree y coordinate.
+     * @param deadline the frame number before which the tile should be
+     *      created. The default value gives the lowest priority to the
+     *      prefetch task.
      * @return true if this method has been able to schedule a prefetch task
      *      for the given tile.
      */
-    virtual bool prefetchTile(int level, int tx, int ty);
+    virtual bool prefetchTile(int level, int tx, int ty, unsigned int deadline = 1u << 31u);
 
     /**
      * Decrements the number of users of this tile by one. If this number
@@ -222,6 +353,18 @@ public:
      */
     virtual void putTile(TileCache::Tile *t);
 
+    /**
+     * Cancels the creation of an unused tile, if it is not already created.
+     * This is useful to cancel prefetched tiles that are no longer needed.
+     * See TileCache#cancelTile.
+     *
+     * @param level the tile's quadtree level.
+     * @param tx the tile's quadtree x coordinate.
+     * @param ty the tile's quadtree y coordinate.
+     * @return true if the tile creation has been cancelled.
+     */
+    virtual bool cancelTile(int level, int tx, int ty);
+
     /**
      * Invalidates the tiles produced by this producer.
      * This means that the tasks to produce the actual data of these tiles will
@@ -311,6 +454,18 @@ protected:
      */
     void init(ptr<TileCache> cache, bool gpuProducer);
 
+    /**
+     * Sets the disk cache key of this %producer from the optional "diskCache"
+     * attribute of its XML description: "true" to load the tiles from disk
+     * and to store the created tiles on disk, "read" to only load them. See
+     * #setDiskCacheKey. This must be called at the end of the constructor of
+     * the %producer resource, once #getSourceKey can be computed.
+     *
+     * @param name the name of the %producer resource.
+     * @param e the XML description of the %producer.
+     */
+    void initDiskCache(const std::string &name, const TiXmlElement *e);
+
     virtual void swap(ptr<TileProducer> p);
 
     /**
@@ -462,10 +617,66 @@ private:
     unsigned char* tileMap;
 
     /**
-     * A mutex to serialize parallel accesses to #tasks.
+     * The average duration of #doCreateTile, in micro seconds. See
+     * #getAverageCreateTime.
+     */
+    float averageCreateTime;
+
+    /**
+     * The tile creation statistics of this %producer. See #getCreateStats.
+     */
+    CreateStats createStats;
+
+    /**
+     * The key of this %producer in the TileDiskCache of #cache, or 0. See
+     * #setDiskCacheKey.
+     */
+    unsigned long long diskCacheKey;
+
+    /**
+     * True if the tiles created with #doCreateTile must be stored in the
+     * TileDiskCache of #cache. See #setDiskCacheKey.
+     */
+    bool diskCacheWrite;
+
+    /**
+     * A mutex to serialize parallel accesses to #tasks, #averageCreateTime
+     * and #createStats.
      */
     void* mutex;
 
+    /**
+     * Notifies this %producer that a tile has been created.
+     *
+     * @param duration the duration of #doCreateTile, in micro seconds.
+     */
+    void tileCreated(double duration);
+
+    /**
+     * Looks for a tile in the TileDiskCache of #cache, if any, without
+     * reading the disk cache file, and pins it if it is found (see
+     * TileDiskCache#pin).
+     *
+     * @param[out] record the index of the pinned record, or -1.
+     * @return the disk cache containing the tile, or NULL.
+     */
+    ptr<TileDiskCache> pinDiskCache(int level, int tx, int ty, int &record);
+
+    /**
+     * Loads the data of a tile found with #pinDiskCache in the given slot.
+     * This reads the disk cache file, and must be called from the task
+     * creating the tile.
+     *
+     * @return true if the data was loaded, false if the record of the tile
+     *      was invalid or removed in the meantime.
+     */
+    bool readDiskCache(ptr<TileDiskCache> disk, int level, int tx, int ty, TileStorage::Slot *data);
+
+    /**
+     * Stores the data of a tile in the TileDiskCache of #cache, if possible.
+     */
+    void writeDiskCache(int level, int tx, int ty, TileStorage::Slot *data);
+
     /**
      * Creates a Task to produce the data of the given tile.
      *
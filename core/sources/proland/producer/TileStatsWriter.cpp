@@ -0,0 +1,202 @@
+/*
+ * Proland: a procedural landscape rendering library.
+ * Website : http://proland.inrialpes.fr/
+ * Copyright (c) 2008-2015 INRIA - LJK (CNRS - Grenoble University)
+ * All rights reserved.
+ * Redistribution and use in source and binary forms, with or without 
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice, 
+ * this list of conditions and the following disclaimer.
+ * 
+ * 2. Redistributions in binary form must reproduce the above copyright notice, 
+ * this list of conditions and the following disclaimer in the documentation 
+ * and/or other materials provided with the distribution.
+ * 
+ * 3. Neither the name of the copyright holder nor the names of its contributors 
+ * may be used to endorse or promote products derived from this software without 
+ * specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND 
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED 
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. 
+ * IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, 
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, 
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, 
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF 
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE 
+ * OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED 
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+/*
+ * Proland is distributed under the Berkeley Software Distribution 3 Licence. 
+ * For any assistance, feedback and enquiries about training programs, you can check out the 
+ * contact page on our website : 
+ * http://proland.inrialpes.fr/
+ */
+/*
+ * Main authors: Eric Bruneton, Antoine Begault, Guillaume Piolat.
+ */
+
+#include "proland/producer/TileStatsWriter.h"
+
+#include "ork/core/Logger.h"
+
+using namespace std;
+using namespace ork;
+
+namespace proland
+{
+
+TileStatsWriter::TileStatsWriter(const char *file, Format format, int frames) :
+    Object("TileStatsWriter"), out(NULL), format(format), frames(frames), frame(0), lastSample(0)
+{
+    assert(frames > 0);
+    if (file != NULL) {
+        out = fopen(file, "w");
+        if (out == NULL) {
+            if (Logger::ERROR_LOGGER != NULL) {
+                Logger::ERROR_LOGGER->logf("CACHE", "Cannot open statistics file '%s'", file);
+            }
+        } else if (format == CSV) {
+            fprintf(out, "frame,frames,type,name,hits,misses,failures,evictions,prefetches,prefetchHits,wastedPrefetches,cancellations,lockWaits,lockWaitTime,usedTiles,unusedTiles,capacity,tiles,createTime,p50,p99,maxCreateTime\n");
+        }
+    }
+}
+
+TileStatsWriter::~TileStatsWriter()
+{
+    if (out != NULL) {
+        fclose(out);
+    }
+}
+
+void TileStatsWriter::addCache(const string &name, ptr<TileCache> cache)
+{
+    caches.push_back(make_pair(name, cache));
+    cacheStats.push_back(TileCache::AccessStats());
+}
+
+void TileStatsWriter::addProducer(const string &name, ptr<TileProducer> producer)
+{
+    producers.push_back(make_pair(name, producer));
+    producerStats.push_back(TileProducer::CreateStats());
+}
+
+void TileStatsWriter::clear()
+{
+    caches.clear();
+    cacheStats.clear();
+    producers.clear();
+    producerStats.clear();
+}
+
+int TileStatsWriter::getFrames()
+{
+    return frames;
+}
+
+void TileStatsWriter::setFrames(int frames)
+{
+    assert(frames > 0);
+    this->frames = frames;
+}
+
+int TileStatsWriter::getCacheCount()
+{
+    return (int) caches.size();
+}
+
+const string &TileStatsWriter::getCacheName(int i)
+{
+    return caches[i].first;
+}
+
+const TileCache::AccessStats &TileStatsWriter::getCacheStats(int i)
+{
+    return cacheStats[i];
+}
+
+int TileStatsWriter::getProducerCount()
+{
+    return (int) producers.size();
+}
+
+const string &TileStatsWriter::getProducerName(int i)
+{
+    return producers[i].first;
+}
+
+const TileProducer::CreateStats &TileStatsWriter::getProducerStats(int i)
+{
+    return producerStats[i];
+}
+
+void TileStatsWriter::newFrame()
+{
+    ++frame;
+    if (frame - lastSample >= frames) {
+        sample();
+    }
+}
+
+void TileStatsWriter::sample()
+{
+    int n = frame - lastSample;
+    lastSample = frame;
+    for (unsigned int i = 0; i < caches.size(); ++i) {
+        caches[i].second->getAccessStats(cacheStats[i]);
+    }
+    for (unsigned int i = 0; i < producers.size(); ++i) {
+        producers[i].second->getCreateStats(producerStats[i]);
+    }
+    if (out == NULL) {
+        return;
+    }
+    if (format == JSON) {
+        fprintf(out, "{\"frame\":%d,\"frames\":%d,\"caches\":[", frame, n);
+    }
+    for (unsigned int i = 0; i < caches.size(); ++i) {
+        ptr<TileCache> c = caches[i].second;
+        const TileCache::AccessStats &s = cacheStats[i];
+        if (format == JSON) {
+            fprintf(out, "%s{\"name\":\"%s\",\"hits\":%d,\"misses\":%d,\"failures\":%d,\"evictions\":%d,"
+                "\"prefetches\":%d,\"prefetchHits\":%d,\"wastedPrefetches\":%d,\"cancellations\":%d,\"lockWaits\":%d,\"lockWaitTime\":%.1f,"
+                "\"usedTiles\":%d,\"unusedTiles\":%d,\"capacity\":%d}",
+                i == 0 ? "" : ",", caches[i].first.c_str(), s.hits, s.misses, s.failures, s.evictions,
+                s.prefetches, s.prefetchHits, s.wastedPrefetches, s.cancellations, s.lockWaits, s.lockWaitTime,
+                c->getUsedTiles(), c->getUnusedTiles(), c->getStorage()->getCapacity());
+        } else {
+            fprintf(out, "%d,%d,cache,%s,%d,%d,%d,%d,%d,%d,%d,%d,%d,%.1f,%d,%d,%d,,,,,\n",
+                frame, n, caches[i].first.c_str(), s.hits, s.misses, s.failures, s.evictions,
+                s.prefetches, s.prefetchHits, s.wastedPrefetches, s.cancellations, s.lockWaits, s.lockWaitTime,
+                c->getUsedTiles(), c->getUnusedTiles(), c->getStorage()->getCapacity());
+        }
+    }
+    if (format == JSON) {
+        fprintf(out, "],\"producers\":[");
+    }
+    for (unsigned int i = 0; i < producers.size(); ++i) {
+        const TileProducer::CreateStats &s = producerStats[i];
+        if (format == JSON) {
+            fprintf(out, "%s{\"name\":\"%s\",\"tiles\":%d,\"createTime\":%.1f,\"p50\":%.1f,\"p99\":%.1f,\"maxCreateTime\":%.1f,\"histogram\":[",
+                i == 0 ? "" : ",", producers[i].first.c_str(), s.tiles, s.totalTime,
+                s.getPercentile(50.0f), s.getPercentile(99.0f), s.maxTime);
+            for (int j = 0; j < TileProducer::CreateStats::BINS; ++j) {
+                fprintf(out, j == 0 ? "%d" : ",%d", s.histogram[j]);
+            }
+            fprintf(out, "]}");
+        } else {
+            fprintf(out, "%d,%d,producer,%s,,,,,,,,,,,,,,%d,%.1f,%.1f,%.1f,%.1f\n",
+                frame, n, producers[i].first.c_str(), s.tiles, s.totalTime,
+                s.getPercentile(50.0f), s.getPercentile(99.0f), s.maxTime);
+        }
+    }
+    if (format == JSON) {
+        fprintf(out, "]}\n");
+    }
+    fflush(out);
+}
+
+}
@@ -0,0 +1,213 @@
+/*
+ * Proland: a procedural landscape rendering library.
+ * Website : http://proland.inrialpes.fr/
+ * Copyright (c) 2008-2015 INRIA - LJK (CNRS - Grenoble University)
+ * All rights reserved.
+ * Redistribution and use in source and binary forms, with or without 
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice, 
+ * this list of conditions and the following disclaimer.
+ * 
+ * 2. Redistributions in binary form must reproduce the above copyright notice, 
+ * this list of conditions and the following disclaimer in the documentation 
+ * and/or other materials provided with the distribution.
+ * 
+ * 3. Neither the name of the copyright holder nor the names of its contributors 
+ * may be used to endorse or promote products derived from this software without 
+ * specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND 
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED 
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. 
+ * IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, 
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, 
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, 
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF 
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE 
+ * OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED 
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+/*
+ * Proland is distributed under the Berkeley Software Distribution 3 Licence. 
+ * For any assistance, feedback and enquiries about training programs, you can check out the 
+ * contact page on our website : 
+ * http://proland.inrialpes.fr/
+ */
+/*
+ * Main authors: Eric Bruneton, Antoine Begault, Guillaume Piolat.
+ */
+
+#ifndef _PROLAND_TILE_STATS_WRITER_H_
+#define _PROLAND_TILE_STATS_WRITER_H_
+
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include "proland/producer/TileProducer.h"
+
+namespace proland
+{
+
+/**
+ * Collects the statistics of a set of TileCache and TileProducer at regular
+ * intervals, and optionally writes them to a file. Each sample contains the
+ * statistics since the previous one (see TileCache#getAccessStats and
+ * TileProducer#getCreateStats, which are reset at each sample). Samples are
+ * written either as JSON (one JSON object per line and per sample) or as CSV
+ * (one line per cache and per %producer for each sample).
+ * @ingroup producer
+ * @authors Eric Bruneton, Antoine Begault, Guillaume Piolat
+ */
+PROLAND_API class TileStatsWriter : public Object
+{
+public:
+    /**
+     * The format of the written statistics.
+     */
+    enum Format {
+        JSON, ///< one JSON object per line and per sample
+        CSV ///< one CSV line per cache and per %producer for each sample
+    };
+
+    /**
+     * Creates a new TileStatsWriter.
+     *
+     * @param file the file where the statistics must be written, or NULL to
+     *      only collect them (see #getCacheStats and #getProducerStats).
+     * @param format the format of the written statistics.
+     * @param frames the number of frames between two samples (see
+     *      #newFrame).
+     */
+    TileStatsWriter(const char *file, Format format, int frames);
+
+    /**
+     * Deletes this TileStatsWriter.
+     */
+    virtual ~TileStatsWriter();
+
+    /**
+     * Adds a cache whose statistics must be collected.
+     *
+     * @param name the name of this cache in the written statistics.
+     * @param cache the cache whose statistics must be collected.
+     */
+    void addCache(const std::string &name, ptr<TileCache> cache);
+
+    /**
+     * Adds a %producer whose statistics must be collected.
+     *
+     * @param name the name of this %producer in the written statistics.
+     * @param producer the %producer whose statistics must be collected.
+     */
+    void addProducer(const std::string &name, ptr<TileProducer> producer);
+
+    /**
+     * Removes all the caches and producers of this TileStatsWriter.
+     */
+    void clear();
+
+    /**
+     * Returns the number of frames between two samples.
+     */
+    int getFrames();
+
+    /**
+     * Sets the number of frames between two samples.
+     */
+    void setFrames(int frames);
+
+    /**
+     * Returns the number of caches whose statistics are collected.
+     */
+    int getCacheCount();
+
+    /**
+     * Returns the name of a cache whose statistics are collected.
+     */
+    const std::string &getCacheName(int i);
+
+    /**
+     * Returns the statistics of a cache in the last sample.
+     */
+    const TileCache::AccessStats &getCacheStats(int i);
+
+    /**
+     * Returns the number of producers whose statistics are collected.
+     */
+    int getProducerCount();
+
+    /**
+     * Returns the name of a %producer whose statistics are collected.
+     */
+    const std::string &getProducerName(int i);
+
+    /**
+     * Returns the statistics of a %producer in the last sample.
+     */
+    const TileProducer::CreateStats &getProducerStats(int i);
+
+    /**
+     * Notifies this TileStatsWriter that a new frame has been rendered. This
+     * method calls #sample every #getFrames frames.
+     */
+    void newFrame();
+
+    /**
+     * Collects the statistics of all the caches and producers, and writes
+     * them to the file of this TileStatsWriter, if any.
+     */
+    void sample();
+
+private:
+    /**
+     * The file where the statistics are written, or NULL.
+     */
+    FILE *out;
+
+    /**
+     * The format of the written statistics.
+     */
+    Format format;
+
+    /**
+     * The number of frames between two samples.
+     */
+    int frames;
+
+    /**
+     * The number of frames since the creation of this TileStatsWriter.
+     */
+    int frame;
+
+    /**
+     * The frame at which the last sample was collected.
+     */
+    int lastSample;
+
+    /**
+     * The caches whose statistics are collected, with their names.
+     */
+    std::vector< std::pair<std::string, ptr<TileCache> > > caches;
+
+    /**
+     * The statistics of the caches in the last sample.
+     */
+    std::vector<TileCache::AccessStats> cacheStats;
+
+    /**
+     * The producers whose statistics are collected, with their names.
+     */
+    std::vector< std::pair<std::string, ptr<TileProducer> > > producers;
+
+    /**
+     * The statistics of the producers in the last sample.
+     */
+    std::vector<TileProducer::CreateStats> producerStats;
+};
+
+}
+
+#endif
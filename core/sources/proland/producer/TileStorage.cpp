@@ -51,14 +51,12 @@ namespace proland
 TileStorage::Slot::Slot(TileStorage *owner) :
     producerTask(NULL), owner(owner)
 {
-    mutex = new pthread_mutex_t;
-    pthread_mutex_init((pthread_mutex_t*) mutex, NULL);
+    pthread_mutex_init(&mutex, NULL);
 }
 
 TileStorage::Slot::~Slot()
 {
-    pthread_mutex_destroy((pthread_mutex_t*) mutex);
-    delete (pthread_mutex_t*) mutex;
+    pthread_mutex_destroy(&mutex);
 }
 
 TileStorage *TileStorage::Slot::getOwner()
@@ -69,9 +67,9 @@ TileStorage *TileStorage::Slot::getOwner()
 void TileStorage::Slot::lock(bool lock)
 {
     if (lock) {
-        pthread_mutex_lock((pthread_mutex_t*) mutex);
+        pthread_mutex_lock(&mutex);
     } else {
-        pthread_mutex_unlock((pthread_mutex_t*) mutex);
+        pthread_mutex_unlock(&mutex);
     }
 }
 
@@ -93,24 +91,20 @@ void TileStorage::init(int tileSize, int capacity)
 
 TileStorage::~TileStorage()
 {
-    list<Slot*>::iterator i = freeSlots.begin();
-    while (i != freeSlots.end()) {
-        delete *i;
-        i++;
+    for (unsigned int i = 0; i < freeSlots.size(); ++i) {
+        delete freeSlots[i];
     }
     freeSlots.clear();
 }
 
 TileStorage::Slot *TileStorage::newSlot()
 {
-    list<Slot*>::iterator i = freeSlots.begin();
-    if (i != freeSlots.end()) {
-        Slot* s = *i;
-        freeSlots.erase(i);
-        return s;
-    } else {
+    if (freeSlots.empty()) {
         return NULL;
     }
+    Slot *s = freeSlots.back();
+    freeSlots.pop_back();
+    return s;
 }
 
 void TileStorage::deleteSlot(TileStorage::Slot *t)
@@ -133,4 +127,19 @@ int TileStorage::getFreeSlots()
     return (int) freeSlots.size();
 }
 
+int TileStorage::getSlotDataSize()
+{
+    return 0;
+}
+
+bool TileStorage::getSlotData(Slot *s, void *data)
+{
+    return false;
+}
+
+bool TileStorage::setSlotData(Slot *s, const void *data)
+{
+    return false;
+}
+
 }
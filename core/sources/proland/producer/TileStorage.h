@@ -43,6 +43,9 @@
 #define _PROLAND_TILE_STORAGE_H_
 
 #include <list>
+#include <vector>
+
+#include <pthread.h>
 
 #include "ork/core/Object.h"
 
@@ -137,9 +140,10 @@ public:
         TileStorage *owner;
 
         /**
-         * A mutex used to serialize parallel accesses to this slot.
+         * A mutex used to serialize parallel accesses to this slot. It is
+         * stored inline to avoid an extra heap allocation per slot.
          */
-        void* mutex;
+        pthread_mutex_t mutex;
     };
 
     /**
@@ -195,6 +199,40 @@ public:
      */
     int getFreeSlots();
 
+    /**
+     * Returns the size in bytes of the data of a slot, as copied by
+     * #getSlotData and #setSlotData, or 0 if the data of the slots of this
+     * storage cannot be copied to or from memory. This is used to store tiles
+     * in a TileDiskCache. If this size is not 0, #getSlotData and
+     * #setSlotData must be overridden and must always succeed (the tiles
+     * loaded from disk are created without the tiles they depend on, so
+     * there is no fallback if their data cannot be set). The default
+     * implementation returns 0.
+     */
+    virtual int getSlotDataSize();
+
+    /**
+     * Copies the data of a slot to memory. The default implementation does
+     * nothing and returns false.
+     *
+     * @param s a slot of this storage.
+     * @param[out] data where the data of the slot must be copied. Must
+     *      contain #getSlotDataSize bytes.
+     * @return true if the data has been copied.
+     */
+    virtual bool getSlotData(Slot *s, void *data);
+
+    /**
+     * Copies data from memory to a slot. The default implementation does
+     * nothing and returns false.
+     *
+     * @param s a slot of this storage.
+     * @param data the data to be copied in the slot. Must contain
+     *      #getSlotDataSize bytes.
+     * @return true if the data has been copied.
+     */
+    virtual bool setSlotData(Slot *s, const void *data);
+
 protected:
     /**
      * The size of each tile. For tiles made of raster data, this size is the
@@ -210,9 +248,10 @@ protected:
     int capacity;
 
     /**
-     * The currently free slots.
+     * The currently free slots. This vector is used as a stack, so that
+     * #newSlot and #deleteSlot do not allocate any memory.
      */
-    std::list<Slot*> freeSlots;
+    std::vector<Slot*> freeSlots;
 
     /**
      * Creates a new uninitialized TileStorage.
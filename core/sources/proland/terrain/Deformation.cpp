@@ -133,44 +133,87 @@ void Deformation::setUniforms(ptr<SceneNode> context, ptr<TerrainQuad> q, ptr<Pr
         offsetU->set(vec4d(q->ox, q->oy, q->l, q->level).cast<float>());
     }
     if (cameraU != NULL) {
-        vec3d camera = q->getOwner()->getLocalCamera();
-        cameraU->set(vec4f(float((camera.x - q->ox) / q->l),
-            float((camera.y - q->oy) / q->l),
-            float((camera.z - TerrainNode::groundHeightAtCamera) / (q->l * q->getOwner()->getDistFactor())),
-            camera.z));
+        cameraU->set(getQuadCamera(q.get()));
     }
     if (tileToTangentU != NULL) {
-        vec3d c = q->getOwner()->getLocalCamera();
-        mat3f m = localToTangent * mat3f(q->l, 0.0, q->ox - c.x, 0.0, q->l, q->oy - c.y, 0.0, 0.0, 1.0);
-        tileToTangentU->setMatrix(m);
+        tileToTangentU->setMatrix(getTileToTangent(q.get()));
     }
 
     setScreenUniforms(context, q, prog);
 }
 
+void Deformation::getQuadParameters(ptr<SceneNode> context, TerrainQuad *q, vec4f *params) const
+{
+    mat3f m = getTileToTangent(q);
+    mat4d corners;
+    mat4d verticals;
+    getScreenQuad(q, &corners, &verticals);
+
+    params[0] = vec4d(q->ox, q->oy, q->l, q->level).cast<float>();
+    params[1] = getQuadCamera(q);
+    for (int i = 0; i < 3; ++i) {
+        params[2 + i] = vec4f(m[i][0], m[i][1], m[i][2], 0.0f);
+    }
+    for (int i = 0; i < 4; ++i) {
+        params[5 + i] = vec4d(corners[i][0], corners[i][1], corners[i][2], corners[i][3]).cast<float>();
+        params[9 + i] = vec4d(verticals[i][0], verticals[i][1], verticals[i][2], verticals[i][3]).cast<float>();
+    }
+    for (int i = 13; i < QUAD_PARAMETERS; ++i) {
+        params[i] = vec4f(0.0f, 0.0f, 0.0f, 0.0f);
+    }
+}
+
 void Deformation::setScreenUniforms(ptr<SceneNode> context, ptr<TerrainQuad> q, ptr<Program> prog) const
+{
+    mat4d corners;
+    mat4d verticals;
+    getScreenQuad(q.get(), screenQuadCornersU == NULL ? NULL : &corners, screenQuadVerticalsU == NULL ? NULL : &verticals);
+
+    if (screenQuadCornersU != NULL) {
+        screenQuadCornersU->setMatrix(corners.cast<float>());
+    }
+
+    if (screenQuadVerticalsU != NULL) {
+        screenQuadVerticalsU->setMatrix(verticals.cast<float>());
+    }
+}
+
+vec4f Deformation::getQuadCamera(TerrainQuad *q) const
+{
+    vec3d camera = q->getOwner()->getLocalCamera();
+    return vec4f(float((camera.x - q->ox) / q->l),
+        float((camera.y - q->oy) / q->l),
+        float((camera.z - TerrainNode::groundHeightAtCamera) / (q->l * q->getOwner()->getDistFactor())),
+        camera.z);
+}
+
+mat3f Deformation::getTileToTangent(TerrainQuad *q) const
+{
+    vec3d c = q->getOwner()->getLocalCamera();
+    return localToTangent * mat3f(q->l, 0.0, q->ox - c.x, 0.0, q->l, q->oy - c.y, 0.0, 0.0, 1.0);
+}
+
+void Deformation::getScreenQuad(TerrainQuad *q, mat4d *corners, mat4d *verticals) const
 {
     vec3d p0 = vec3d(q->ox, q->oy, 0.0);
     vec3d p1 = vec3d(q->ox + q->l, q->oy, 0.0);
     vec3d p2 = vec3d(q->ox, q->oy + q->l, 0.0);
     vec3d p3 = vec3d(q->ox + q->l, q->oy + q->l, 0.0);
 
-    if (screenQuadCornersU != NULL) {
-        mat4d corners = mat4d(
+    if (corners != NULL) {
+        *corners = localToScreen * mat4d(
             p0.x, p1.x, p2.x, p3.x,
             p0.y, p1.y, p2.y, p3.y,
             p0.z, p1.z, p2.z, p3.z,
             1.0, 1.0, 1.0, 1.0);
-        screenQuadCornersU->setMatrix((localToScreen * corners).cast<float>());
     }
 
-    if (screenQuadVerticalsU != NULL) {
-        mat4d verticals = mat4d(
+    if (verticals != NULL) {
+        *verticals = localToScreen * mat4d(
             0.0, 0.0, 0.0, 0.0,
             0.0, 0.0, 0.0, 0.0,
             1.0, 1.0, 1.0, 1.0,
             0.0, 0.0, 0.0, 0.0);
-        screenQuadVerticalsU->setMatrix((localToScreen * verticals).cast<float>());
     }
 }
 
@@ -184,7 +227,18 @@ float Deformation::getLocalDist(const vec3d &localPt, const box3d &localBox) con
 SceneManager::visibility Deformation::getVisibility(const TerrainNode *t, const box3d &localBox) const
 {
     // localBox = deformedBox, so we can compare the deformed frustum with it
-    return SceneManager::getVisibility(t->getDeformedFrustumPlanes(), localBox);
+    BoxBatch b = { &localBox.xmin, &localBox.xmax, &localBox.ymin, &localBox.ymax, &localBox.zmin, &localBox.zmax };
+    SceneManager::visibility v;
+    getFrustumVisibility(t->getDeformedFrustumPlanes(), 1, b, &v);
+    return v;
+}
+
+void Deformation::getVisibility(const TerrainNode *t, int n, const BoxBatch &localBoxes, SceneManager::visibility *result) const
+{
+    for (int i = 0; i < n; ++i) {
+        box3d b(localBoxes.xmin[i], localBoxes.xmax[i], localBoxes.ymin[i], localBoxes.ymax[i], localBoxes.zmin[i], localBoxes.zmax[i]);
+        result[i] = getVisibility(t, b);
+    }
 }
 
 }
@@ -47,6 +47,7 @@
 #include "ork/math/box3.h"
 #include "ork/render/FrameBuffer.h"
 #include "ork/scenegraph/SceneManager.h"
+#include "proland/math/culling.h"
 #include "proland/terrain/TerrainQuad.h"
 
 using namespace ork;
@@ -159,6 +160,32 @@ public:
      */
     virtual void setUniforms(ptr<SceneNode> context, ptr<TerrainQuad> q, ptr<Program> prog) const;
 
+    /**
+     * The number of vec4f values per quad written by #getQuadParameters.
+     */
+    static const int QUAD_PARAMETERS = 17;
+
+    /**
+     * Computes the values of the quad specific uniforms that #setUniforms(ptr<SceneNode>,
+     * ptr<TerrainQuad>, ptr<Program>) would set for the given quad. This is
+     * used to draw several quads with a single instanced draw call (see
+     * DrawTerrainTask). #setUniforms(ptr<SceneNode>, ptr<TerrainNode>, ptr<Program>)
+     * must be called before this method. The values are stored as follows
+     * (matrices are stored row by row, one row per vec4f):
+     * - 0: deformation.offset,
+     * - 1: deformation.camera,
+     * - 2-4: deformation.tileToTangent,
+     * - 5-8: deformation.screenQuadCorners,
+     * - 9-12: deformation.screenQuadVerticals,
+     * - 13: deformation.screenQuadCornerNorms (only for spherical deformations),
+     * - 14-16: deformation.tangentFrameToWorld (only for spherical deformations).
+     *
+     * @param context the SceneNode to which the TerrainNode belongs.
+     * @param q a TerrainQuad.
+     * @param[out] params the #QUAD_PARAMETERS values for this quad.
+     */
+    virtual void getQuadParameters(ptr<SceneNode> context, TerrainQuad *q, vec4f *params) const;
+
     /**
      * Returns the distance in local (i.e., source) space between a point and a
      * bounding box.
@@ -181,6 +208,21 @@ public:
      */
     virtual SceneManager::visibility getVisibility(const TerrainNode *t, const box3d &localBox) const;
 
+    /**
+     * Returns the visibility of several bounding boxes in local space, in a
+     * view frustum defined in deformed space. The result is the same as with
+     * #getVisibility(const TerrainNode*, const box3d&) for each box. The
+     * default implementation calls this method for each box, but subclasses
+     * can test several boxes at once with SIMD instructions (see
+     * FlatDeformation and SphericalDeformation).
+     *
+     * @param t a TerrainNode (see #getVisibility(const TerrainNode*, const box3d&)).
+     * @param n the number of bounding boxes.
+     * @param localBoxes the bounding boxes in local space.
+     * @param[out] result the visibility of each bounding box.
+     */
+    virtual void getVisibility(const TerrainNode *t, int n, const BoxBatch &localBoxes, SceneManager::visibility *result) const;
+
 protected:
     /**
      * The transformation from camera space to screen space.
@@ -249,6 +291,29 @@ protected:
     mutable ptr<UniformMatrix4f> screenQuadVerticalsU;
 
     virtual void setScreenUniforms(ptr<SceneNode> context, ptr<TerrainQuad> q, ptr<Program> prog) const;
+
+    /**
+     * Returns the camera coordinates relatively to the given quad (see #cameraU).
+     */
+    vec4f getQuadCamera(TerrainQuad *q) const;
+
+    /**
+     * Returns the transformation from local tile coordinates to tangent
+     * space for the given quad (see #tileToTangentU).
+     */
+    mat3f getTileToTangent(TerrainQuad *q) const;
+
+private:
+    /**
+     * Computes the corners of the given quad and the vertical vectors at
+     * these corners, in screen space (see #screenQuadCornersU and
+     * #screenQuadVerticalsU).
+     *
+     * @param q a TerrainQuad.
+     * @param[out] corners the quad corners, or NULL if they are not needed.
+     * @param[out] verticals the vertical vectors, or NULL if they are not needed.
+     */
+    void getScreenQuad(TerrainQuad *q, mat4d *corners, mat4d *verticals) const;
 };
 
 }
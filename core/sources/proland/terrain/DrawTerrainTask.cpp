@@ -41,6 +41,9 @@
 
 #include "proland/terrain/DrawTerrainTask.h"
 
+#include <algorithm>
+
+#include "ork/core/Timer.h"
 #include "ork/resource/ResourceTemplate.h"
 #include "ork/render/FrameBuffer.h"
 
@@ -54,17 +57,18 @@ DrawTerrainTask::DrawTerrainTask() : AbstractTask("DrawTerrainTask")
 {
 }
 
-DrawTerrainTask::DrawTerrainTask(const QualifiedName &terrain, const QualifiedName &mesh, bool culling) :
+DrawTerrainTask::DrawTerrainTask(const QualifiedName &terrain, const QualifiedName &mesh, bool culling, bool batched) :
     AbstractTask("DrawTerrainTask")
 {
-    init(terrain, mesh, culling);
+    init(terrain, mesh, culling, batched);
 }
 
-void DrawTerrainTask::init(const QualifiedName &terrain, const QualifiedName &mesh, bool culling)
+void DrawTerrainTask::init(const QualifiedName &terrain, const QualifiedName &mesh, bool culling, bool batched)
 {
     this->terrain = terrain;
     this->mesh = mesh;
     this->culling = culling;
+    this->batched = batched;
 }
 
 DrawTerrainTask::~DrawTerrainTask()
@@ -102,7 +106,20 @@ ptr<Task> DrawTerrainTask::getTask(ptr<Object> context)
         }
         throw exception();
     }
-    return new Impl(n, t, m, culling);
+    return new Impl(this, n, t, m);
+}
+
+DrawTerrainTask::SubmissionStats::SubmissionStats() :
+    frames(0), quads(0), drawCalls(0), submissionTime(0.0)
+{
+}
+
+void DrawTerrainTask::getSubmissionStats(SubmissionStats &stats, bool reset)
+{
+    stats = this->stats;
+    if (reset) {
+        this->stats = SubmissionStats();
+    }
 }
 
 void DrawTerrainTask::swap(ptr<DrawTerrainTask> t)
@@ -110,8 +127,8 @@ void DrawTerrainTask::swap(ptr<DrawTerrainTask> t)
     std::swap(*this, *t);
 }
 
-DrawTerrainTask::Impl::Impl(ptr<SceneNode> n, ptr<TerrainNode> t, ptr<MeshBuffers> m, bool culling) :
-    Task("DrawTerrain", true, 0), n(n), t(t), m(m), culling(culling)
+DrawTerrainTask::Impl::Impl(ptr<DrawTerrainTask> owner, ptr<SceneNode> n, ptr<TerrainNode> t, ptr<MeshBuffers> m) :
+    Task("DrawTerrain", true, 0), owner(owner), n(n), t(t), m(m), culling(owner->culling), batched(owner->batched)
 {
 }
 
@@ -125,6 +142,8 @@ bool DrawTerrainTask::Impl::run()
         if (Logger::DEBUG_LOGGER != NULL) {
             Logger::DEBUG_LOGGER->log("TERRAIN", "DrawTerrain");
         }
+        Timer timer;
+        timer.start();
         ptr<FrameBuffer> fb = SceneManager::getCurrentFrameBuffer();
         async = false;
         vector< ptr<TileSampler> > uniforms;
@@ -171,14 +190,19 @@ bool DrawTerrainTask::Impl::run()
             gridSize = (n / 2) * (n / 2) * k;
             assert(m->nindices >= gridSize * 32);
 
-            findDrawableQuads(t->root, uniforms);
+            findDrawableQuads(t->root.get(), uniforms);
+        }
+        drawQuad(t->root.get(), uniforms);
+        if (batched) {
+            drawBatch(uniforms);
         }
-        drawQuad(t->root, uniforms);
+        owner->stats.frames += 1;
+        owner->stats.submissionTime += timer.end();
     }
     return true;
 }
 
-void DrawTerrainTask::Impl::findDrawableQuads(ptr<TerrainQuad> q, const vector< ptr<TileSampler> > &uniforms)
+void DrawTerrainTask::Impl::findDrawableQuads(TerrainQuad *q, const vector< ptr<TileSampler> > &uniforms)
 {
     q->drawable = false;
 
@@ -200,7 +224,7 @@ void DrawTerrainTask::Impl::findDrawableQuads(ptr<TerrainQuad> q, const vector<
     } else {
         int nDrawable = 0;
         for (int i = 0; i < 4; ++i) {
-            findDrawableQuads(q->children[i], uniforms);
+            findDrawableQuads(q->children[i].get(), uniforms);
             if (q->children[i]->drawable) {
                 ++nDrawable;
             }
@@ -221,7 +245,7 @@ void DrawTerrainTask::Impl::findDrawableQuads(ptr<TerrainQuad> q, const vector<
     q->drawable = true;
 }
 
-void DrawTerrainTask::Impl::drawQuad(ptr<TerrainQuad> q, const vector< ptr<TileSampler> > &uniforms)
+void DrawTerrainTask::Impl::drawQuad(TerrainQuad *q, const vector< ptr<TileSampler> > &uniforms)
 {
     if (culling && q->visible == SceneManager::INVISIBLE) {
         return;
@@ -230,19 +254,14 @@ void DrawTerrainTask::Impl::drawQuad(ptr<TerrainQuad> q, const vector< ptr<TileS
         return;
     }
 
-    ptr<Program> p = SceneManager::getCurrentProgram();
     if (q->isLeaf()) {
-        for (unsigned int i = 0; i < uniforms.size(); ++i) {
-            uniforms[i]->setTile(q->level, q->tx, q->ty);
-        }
-        t->deform->setUniforms(n, q, p);
         if (async) {
-            SceneManager::getCurrentFrameBuffer()->draw(p, *m, m->mode, 0, gridSize * 4);
+            drawMesh(q, uniforms, 0, gridSize * 4);
         } else {
             if (m->nindices == 0) {
-                SceneManager::getCurrentFrameBuffer()->draw(p, *m, m->mode, 0, m->nvertices);
+                drawMesh(q, uniforms, 0, m->nvertices);
             } else {
-                SceneManager::getCurrentFrameBuffer()->draw(p, *m, m->mode, 0, m->nindices);
+                drawMesh(q, uniforms, 0, m->nindices);
             }
         }
     } else {
@@ -283,21 +302,115 @@ void DrawTerrainTask::Impl::drawQuad(ptr<TerrainQuad> q, const vector< ptr<TileS
             if (culling && q->children[order[i]]->visible == SceneManager::INVISIBLE) {
                 done |= (1 << order[i]);
             } else if (!async || q->children[order[i]]->drawable) {
-                drawQuad(q->children[order[i]], uniforms);
+                drawQuad(q->children[order[i]].get(), uniforms);
                 done |= (1 << order[i]);
             }
         }
         if (done < 15) {
             int sizes[16] = { 0, 4, 7, 10, 12, 15, 17, 19, 20, 23, 25, 27, 28, 30, 31, 32 };
-            for (unsigned int i = 0; i < uniforms.size(); ++i) {
-                uniforms[i]->setTile(q->level, q->tx, q->ty);
-            }
-            t->deform->setUniforms(n, q, p);
-            SceneManager::getCurrentFrameBuffer()->draw(p, *m, m->mode, gridSize * sizes[done], gridSize * (sizes[done+1] - sizes[done]));
+            drawMesh(q, uniforms, gridSize * sizes[done], gridSize * (sizes[done+1] - sizes[done]));
         }
     }
 }
 
+void DrawTerrainTask::Impl::drawMesh(TerrainQuad *q, const vector< ptr<TileSampler> > &uniforms, int first, int count)
+{
+    if (batched) {
+        QuadDraw d = { q, first, count };
+        draws.push_back(d);
+        return;
+    }
+
+    ptr<Program> p = SceneManager::getCurrentProgram();
+    for (unsigned int i = 0; i < uniforms.size(); ++i) {
+        uniforms[i]->setTile(q->level, q->tx, q->ty);
+    }
+    t->deform->setUniforms(n, q, p);
+    SceneManager::getCurrentFrameBuffer()->draw(p, *m, m->mode, first, count);
+    owner->stats.quads += 1;
+    owner->stats.drawCalls += 1;
+}
+
+void DrawTerrainTask::Impl::drawBatch(const vector< ptr<TileSampler> > &uniforms)
+{
+    int nDraws = int(draws.size());
+    if (nDraws == 0) {
+        return;
+    }
+
+    ptr<Program> p = SceneManager::getCurrentProgram();
+    if (owner->lastProg != p) {
+        owner->quadParametersU = p->getUniformSampler("quadParameters");
+        owner->firstQuadU = p->getUniform1i("firstQuad");
+        owner->lastProg = p;
+    }
+    if (owner->quadParametersU == NULL) {
+        // the program does not support batched draws
+        batched = false;
+        for (int i = 0; i < nDraws; ++i) {
+            drawMesh(draws[i].q, uniforms, draws[i].first, draws[i].count);
+        }
+        return;
+    }
+
+    // computes the quad specific uniforms of each quad, and the textures
+    // containing their tiles
+    int nUniforms = int(uniforms.size());
+    int width = Deformation::QUAD_PARAMETERS + nUniforms;
+    vector<vec4f> &params = owner->quadParameters;
+    vector<Texture2DArray*> textures(nDraws * nUniforms);
+    params.resize(nDraws * width);
+    for (int i = 0; i < nDraws; ++i) {
+        TerrainQuad *q = draws[i].q;
+        vec4f *row = &params[i * width];
+        t->deform->getQuadParameters(n, q, row);
+        for (int j = 0; j < nUniforms; ++j) {
+            row[Deformation::QUAD_PARAMETERS + j] = vec4f(0.0f, 0.0f, 0.0f, 0.0f);
+            textures[i * nUniforms + j] = uniforms[j]->getTileCoords(q->level, q->tx, q->ty, row[Deformation::QUAD_PARAMETERS + j]).get();
+        }
+    }
+
+    // uploads them to GPU, in a texture large enough for this frame
+    ptr<Texture2D> quadTexture = owner->quadTexture;
+    if (quadTexture == NULL || quadTexture->getWidth() != width || quadTexture->getHeight() < nDraws) {
+        int height = 64;
+        while (height < nDraws) {
+            height *= 2;
+        }
+        quadTexture = new Texture2D(width, height, RGBA32F, RGBA, FLOAT,
+            Texture::Parameters().wrapS(CLAMP_TO_EDGE).wrapT(CLAMP_TO_EDGE).min(NEAREST).mag(NEAREST),
+            Buffer::Parameters(), CPUBuffer());
+        owner->quadTexture = quadTexture;
+    }
+    quadTexture->setSubImage(0, 0, 0, width, nDraws, RGBA, FLOAT, Buffer::Parameters(), CPUBuffer(&params[0]));
+    owner->quadParametersU->set(quadTexture);
+
+    // draws the quads, with one instanced draw call for each sequence of
+    // consecutive quads using the same part of the mesh and the same textures
+    ptr<FrameBuffer> fb = SceneManager::getCurrentFrameBuffer();
+    int i = 0;
+    while (i < nDraws) {
+        int j = i + 1;
+        while (j < nDraws && draws[j].first == draws[i].first && draws[j].count == draws[i].count &&
+            equal(textures.begin() + j * nUniforms, textures.begin() + (j + 1) * nUniforms, textures.begin() + i * nUniforms)) {
+            ++j;
+        }
+        // binds the textures containing the tiles of these quads (this also
+        // sets the uniforms of the first quad, which are not used)
+        TerrainQuad *q = draws[i].q;
+        for (int k = 0; k < nUniforms; ++k) {
+            uniforms[k]->setTile(q->level, q->tx, q->ty);
+        }
+        if (owner->firstQuadU != NULL) {
+            owner->firstQuadU->set(i);
+        }
+        fb->draw(p, *m, m->mode, draws[i].first, draws[i].count, j - i);
+        owner->stats.quads += j - i;
+        owner->stats.drawCalls += 1;
+        i = j;
+    }
+}
+
 class DrawTerrainTaskResource : public ResourceTemplate<40, DrawTerrainTask>
 {
 public:
@@ -305,14 +418,18 @@ public:
         ResourceTemplate<40, DrawTerrainTask>(manager, name, desc)
     {
         e = e == NULL ? desc->descriptor : e;
-        checkParameters(desc, e, "name,mesh,culling,");
+        checkParameters(desc, e, "name,mesh,culling,batched,");
         string n = getParameter(desc, e, "name");
         string m = getParameter(desc, e, "mesh");
         bool culling = false;
+        bool batched = false;
         if (e->Attribute("culling") != NULL && strcmp(e->Attribute("culling"), "true") == 0) {
             culling = true;
         }
-        init(QualifiedName(n), QualifiedName(m), culling);
+        if (e->Attribute("batched") != NULL && strcmp(e->Attribute("batched"), "true") == 0) {
+            batched = true;
+        }
+        init(QualifiedName(n), QualifiedName(m), culling, batched);
     }
 };
 
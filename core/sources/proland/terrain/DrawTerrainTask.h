@@ -42,6 +42,7 @@
 #ifndef _PROLAND_DRAW_TERRAIN_TASK_H_
 #define _PROLAND_DRAW_TERRAIN_TASK_H_
 
+#include "ork/render/Texture2D.h"
 #include "ork/scenegraph/AbstractTask.h"
 #include "proland/terrain/TerrainNode.h"
 #include "proland/terrain/TileSampler.h"
@@ -57,6 +58,23 @@ namespace proland
  * Before drawing each quad, this task calls TileSampler::setTile on each
  * TileSampler associated with the TerrainNode in its owner SceneNode. It
  * also calls the Deformation#setUniforms methods using the %terrain deformation.
+ * <p>
+ * In batched mode, this task instead stores the quad specific uniforms of
+ * all the quads to be drawn in a RGBA32F texture, with one row per quad,
+ * in drawing order. Each row contains the Deformation#QUAD_PARAMETERS
+ * values computed with Deformation#getQuadParameters, followed by one value
+ * per TileSampler of the owner SceneNode that would be set with
+ * TileSampler#setTile, in the order of the SceneNode fields (this value
+ * contains the tileCoords uniform in xyz and the tileSize.xy uniform in w,
+ * see TileSampler#getTileCoords). All the quads are then drawn with a single
+ * instanced draw call (or with a few ones if some quads must only be
+ * partially drawn, or if their tiles are not in the same texture). The
+ * program must read its quad specific uniforms with
+ * <tt>texelFetch(quadParameters, ivec2(i, firstQuad + gl_InstanceID), 0)</tt>,
+ * where quadParameters is a sampler2D uniform and firstQuad is an int
+ * uniform, both set by this task. If the program does not have a
+ * quadParameters uniform, the quads are drawn one by one, as in the
+ * default mode.
  * @ingroup terrain
  * @authors Eric Bruneton, Antoine Begault, Guillaume Piolat
  */
@@ -75,7 +93,7 @@ public:
      * @param culling true to draw only visible leaf quads, false to draw all
      *      leaf quads.
      */
-    DrawTerrainTask(const QualifiedName &terrain, const QualifiedName &mesh, bool culling);
+    DrawTerrainTask(const QualifiedName &terrain, const QualifiedName &mesh, bool culling, bool batched = false);
 
     /**
      * Deletes this DrawTerrainTask.
@@ -84,6 +102,47 @@ public:
 
     virtual ptr<Task> getTask(ptr<Object> context);
 
+    /**
+     * Draw call submission statistics of a DrawTerrainTask. See
+     * #getSubmissionStats.
+     */
+    class SubmissionStats
+    {
+    public:
+        /**
+         * The number of frames drawn.
+         */
+        int frames;
+
+        /**
+         * The number of quads drawn (a partially drawn quad counts for one).
+         */
+        int quads;
+
+        /**
+         * The number of draw calls issued.
+         */
+        int drawCalls;
+
+        /**
+         * The total CPU time spent to set the uniforms and to issue the
+         * draw calls, in micro seconds.
+         */
+        double submissionTime;
+
+        SubmissionStats();
+    };
+
+    /**
+     * Returns the draw call submission statistics of this task, since its
+     * creation or since the last reset of these statistics.
+     *
+     * @param[out] stats the submission statistics of this task.
+     * @param reset true to reset the statistics after they are returned. This
+     *      can be used to get per frame statistics.
+     */
+    void getSubmissionStats(SubmissionStats &stats, bool reset = true);
+
 protected:
     /**
      * Creates an uninitialized DrawTerrainTask.
@@ -101,8 +160,10 @@ protected:
      *      field. The second part specifies the name of this mesh field.
      * @param culling true to draw only visible leaf quads, false to draw all
      *      leaf quads.
+     * @param batched true to draw all the quads with a single instanced draw
+     *      call (see DrawTerrainTask).
      */
-    void init(const QualifiedName &terrain, const QualifiedName &mesh, bool culling);
+    void init(const QualifiedName &terrain, const QualifiedName &mesh, bool culling, bool batched = false);
 
     void swap(ptr<DrawTerrainTask> t);
 
@@ -126,12 +187,76 @@ private:
      */
     bool culling;
 
+    /**
+     * True to draw all the quads with a single instanced draw call.
+     */
+    bool batched;
+
+    /**
+     * The quad specific uniforms of the quads drawn in batched mode, with
+     * one row per quad. Recreated when it is too small.
+     */
+    ptr<Texture2D> quadTexture;
+
+    /**
+     * The CPU copy of #quadTexture.
+     */
+    std::vector<vec4f> quadParameters;
+
+    /**
+     * The program that contains the uniforms that were set during the last
+     * batched draw.
+     */
+    ptr<Program> lastProg;
+
+    /**
+     * The sampler uniform used to access #quadTexture.
+     */
+    ptr<UniformSampler> quadParametersU;
+
+    /**
+     * The row of #quadTexture corresponding to the first instance of a
+     * batched draw call.
+     */
+    ptr<Uniform1i> firstQuadU;
+
+    /**
+     * The draw call submission statistics of this task.
+     */
+    SubmissionStats stats;
+
+    /**
+     * A quad, or a part of a quad, to be drawn.
+     */
+    struct QuadDraw
+    {
+        /**
+         * The quad to be drawn.
+         */
+        TerrainQuad *q;
+
+        /**
+         * The first index of the part of the mesh to be drawn.
+         */
+        int first;
+
+        /**
+         * The number of indices of the part of the mesh to be drawn.
+         */
+        int count;
+    };
+
     /**
      * A Task to draw a %terrain.
      */
     class Impl : public Task
     {
     public:
+        /**
+         * The DrawTerrainTask that created this task.
+         */
+        ptr<DrawTerrainTask> owner;
+
         /**
          * The SceneNode describing the %terrain position and its associated
          * data (via TileSampler fields).
@@ -153,6 +278,16 @@ private:
          */
         bool culling;
 
+        /**
+         * True to draw all the quads with a single instanced draw call.
+         */
+        bool batched;
+
+        /**
+         * The quads to be drawn with #drawBatch, in drawing order.
+         */
+        std::vector<QuadDraw> draws;
+
         /**
          * True if one the TileSampler associated with this terrain
          * uses the asynchronous mode.
@@ -169,12 +304,12 @@ private:
         /**
          * Creates a new Impl.
          *
+         * @param owner the DrawTerrainTask that created this task.
          * @param n the SceneNode describing the %terrain position.
          * @param t the TerrainNode describing the %terrain and its quadtree.
          * @param m the mesh to be drawn for each leaf quad.
-         * @param culling true to draw only visible leaf quads.
          */
-        Impl(ptr<SceneNode> n, ptr<TerrainNode> t, ptr<MeshBuffers> m, bool culling);
+        Impl(ptr<DrawTerrainTask> owner, ptr<SceneNode> n, ptr<TerrainNode> t, ptr<MeshBuffers> m);
 
         /**
          * Deletes this Impl.
@@ -190,7 +325,7 @@ private:
          * @param q the %terrain quadtree to be drawn.
          * @param uniforms the TileSampler associated with the %terrain.
          */
-        void findDrawableQuads(ptr<TerrainQuad> q, const std::vector< ptr<TileSampler> > &uniforms);
+        void findDrawableQuads(TerrainQuad *q, const std::vector< ptr<TileSampler> > &uniforms);
 
         /**
          * Draw the mesh #m for the leaf quads of the given quadtree. Before drawing each
@@ -200,7 +335,26 @@ private:
          * @param q the %terrain quadtree to be drawn.
          * @param uniforms the TileSampler associated with the %terrain.
          */
-        void drawQuad(ptr<TerrainQuad> q, const std::vector< ptr<TileSampler> > &uniforms);
+        void drawQuad(TerrainQuad *q, const std::vector< ptr<TileSampler> > &uniforms);
+
+        /**
+         * Draws a part of the mesh #m for the given quad. In batched mode,
+         * this method only adds this quad to #draws.
+         *
+         * @param q the quad to be drawn.
+         * @param uniforms the TileSampler associated with the %terrain.
+         * @param first the first index of the part of the mesh to be drawn.
+         * @param count the number of indices of the part of the mesh to be drawn.
+         */
+        void drawMesh(TerrainQuad *q, const std::vector< ptr<TileSampler> > &uniforms, int first, int count);
+
+        /**
+         * Draws the quads in #draws with as few instanced draw calls as
+         * possible (see DrawTerrainTask).
+         *
+         * @param uniforms the TileSampler associated with the %terrain.
+         */
+        void drawBatch(const std::vector< ptr<TileSampler> > &uniforms);
     };
 };
 
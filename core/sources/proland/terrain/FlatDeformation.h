@@ -0,0 +1,79 @@
+/*
+ * Proland: a procedural landscape rendering library.
+ * Website : http://proland.inrialpes.fr/
+ * Copyright (c) 2008-2015 INRIA - LJK (CNRS - Grenoble University)
+ * All rights reserved.
+ * Redistribution and use in source and binary forms, with or without 
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice, 
+ * this list of conditions and the following disclaimer.
+ * 
+ * 2. Redistributions in binary form must reproduce the above copyright notice, 
+ * this list of conditions and the following disclaimer in the documentation 
+ * and/or other materials provided with the distribution.
+ * 
+ * 3. Neither the name of the copyright holder nor the names of its contributors 
+ * may be used to endorse or promote products derived from this software without 
+ * specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND 
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED 
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. 
+ * IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, 
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, 
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, 
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF 
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE 
+ * OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED 
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+/*
+ * Proland is distributed under the Berkeley Software Distribution 3 Licence. 
+ * For any assistance, feedback and enquiries about training programs, you can check out the 
+ * contact page on our website : 
+ * http://proland.inrialpes.fr/
+ */
+/*
+ * Main authors: Eric Bruneton, Antoine Begault, Guillaume Piolat.
+ */
+
+#ifndef _PROLAND_FLAT_DEFORMATION_H_
+#define _PROLAND_FLAT_DEFORMATION_H_
+
+#include "proland/terrain/Deformation.h"
+
+namespace proland
+{
+
+/**
+ * The identity Deformation, optimized for the terrain quadtree update. This
+ * deformation is identical to the default implementation of Deformation,
+ * but tests the visibility of several boxes at once with SIMD instructions
+ * (see proland::getFrustumVisibility). Subclasses that override the single
+ * box #getVisibility method should extend Deformation instead.
+ * @ingroup terrain
+ * @authors Eric Bruneton, Antoine Begault
+ */
+PROLAND_API class FlatDeformation : public Deformation
+{
+public:
+    /**
+     * Creates a new FlatDeformation.
+     */
+    FlatDeformation();
+
+    /**
+     * Deletes this FlatDeformation.
+     */
+    virtual ~FlatDeformation();
+
+    virtual SceneManager::visibility getVisibility(const TerrainNode *t, const box3d &localBox) const;
+
+    virtual void getVisibility(const TerrainNode *t, int n, const BoxBatch &localBoxes, SceneManager::visibility *result) const;
+};
+
+}
+
+#endif
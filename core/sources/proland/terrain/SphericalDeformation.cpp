@@ -185,130 +185,114 @@ void SphericalDeformation::setUniforms(ptr<SceneNode> context, ptr<TerrainQuad>
     Deformation::setUniforms(context, q, prog);
 }
 
+void SphericalDeformation::getQuadParameters(ptr<SceneNode> context, TerrainQuad *q, vec4f *params) const
+{
+    Deformation::getQuadParameters(context, q, params);
+
+    mat4d corners;
+    mat4d verticals;
+    vec4d norms;
+    getScreenQuad(q, &corners, &verticals, &norms);
+    mat3d tangentFrameToWorld = getTangentFrameToWorld(context, q);
+
+    for (int i = 0; i < 4; ++i) {
+        params[5 + i] = vec4d(corners[i][0], corners[i][1], corners[i][2], corners[i][3]).cast<float>();
+        params[9 + i] = vec4d(verticals[i][0], verticals[i][1], verticals[i][2], verticals[i][3]).cast<float>();
+    }
+    params[13] = norms.cast<float>();
+    for (int i = 0; i < 3; ++i) {
+        params[14 + i] = vec4d(tangentFrameToWorld[i][0], tangentFrameToWorld[i][1], tangentFrameToWorld[i][2], 0.0).cast<float>();
+    }
+}
+
 void SphericalDeformation::setScreenUniforms(ptr<SceneNode> context, ptr<TerrainQuad> q, ptr<Program> prog) const
+{
+    mat4d corners;
+    mat4d verticals;
+    vec4d norms;
+    getScreenQuad(q.get(), screenQuadCornersU == NULL ? NULL : &corners, screenQuadVerticalsU == NULL ? NULL : &verticals, &norms);
+
+    if (screenQuadCornersU != NULL) {
+        screenQuadCornersU->setMatrix(corners.cast<float>());
+    }
+
+    if (screenQuadVerticalsU != NULL) {
+        screenQuadVerticalsU->setMatrix(verticals.cast<float>());
+    }
+
+    if (screenQuadCornerNormsU != NULL) {
+        screenQuadCornerNormsU->set(norms.cast<float>());
+    }
+    if (tangentFrameToWorldU != NULL) {
+        tangentFrameToWorldU->setMatrix(getTangentFrameToWorld(context, q.get()).cast<float>());
+    }
+}
+
+void SphericalDeformation::getScreenQuad(TerrainQuad *q, mat4d *corners, mat4d *verticals, vec4d *norms) const
 {
     vec3d p0 = vec3d(q->ox, q->oy, R);
     vec3d p1 = vec3d(q->ox + q->l, q->oy, R);
     vec3d p2 = vec3d(q->ox, q->oy + q->l, R);
     vec3d p3 = vec3d(q->ox + q->l, q->oy + q->l, R);
-    vec3d pc = (p0 + p3) * 0.5;
     double l0, l1, l2, l3;
     vec3d v0 = p0.normalize(&l0);
     vec3d v1 = p1.normalize(&l1);
     vec3d v2 = p2.normalize(&l2);
     vec3d v3 = p3.normalize(&l3);
 
-    if (screenQuadCornersU != NULL) {
-        mat4d deformedCorners = mat4d(
+    if (corners != NULL) {
+        *corners = localToScreen * mat4d(
             v0.x * R, v1.x * R, v2.x * R, v3.x * R,
             v0.y * R, v1.y * R, v2.y * R, v3.y * R,
             v0.z * R, v1.z * R, v2.z * R, v3.z * R,
             1.0, 1.0, 1.0, 1.0);
-        screenQuadCornersU->setMatrix((localToScreen * deformedCorners).cast<float>());
     }
 
-    if (screenQuadVerticalsU != NULL) {
-        mat4d deformedVerticals = mat4d(
+    if (verticals != NULL) {
+        *verticals = localToScreen * mat4d(
             v0.x, v1.x, v2.x, v3.x,
             v0.y, v1.y, v2.y, v3.y,
             v0.z, v1.z, v2.z, v3.z,
             0.0, 0.0, 0.0, 0.0);
-        screenQuadVerticalsU->setMatrix((localToScreen * deformedVerticals).cast<float>());
     }
 
-    if (screenQuadCornerNormsU != NULL) {
-        screenQuadCornerNormsU->set(vec4d(l0, l1, l2, l3).cast<float>());
-    }
-    if (tangentFrameToWorldU != NULL) {
-        vec3d uz = pc.normalize();
-        vec3d ux = vec3d::UNIT_Y.crossProduct(uz).normalize();
-        vec3d uy = uz.crossProduct(ux);
+    *norms = vec4d(l0, l1, l2, l3);
+}
 
-        mat4d ltow = context->getLocalToWorld();
-        mat3d tangentFrameToWorld = mat3d(
-            ltow[0][0], ltow[0][1], ltow[0][2],
-            ltow[1][0], ltow[1][1], ltow[1][2],
-            ltow[2][0], ltow[2][1], ltow[2][2]) *
-        mat3d(
-            ux.x, uy.x, uz.x,
-            ux.y, uy.y, uz.y,
-            ux.z, uy.z, uz.z);
-        tangentFrameToWorldU->setMatrix(tangentFrameToWorld.cast<float>());
-    }
+mat3d SphericalDeformation::getTangentFrameToWorld(ptr<SceneNode> context, TerrainQuad *q) const
+{
+    vec3d p0 = vec3d(q->ox, q->oy, R);
+    vec3d p3 = vec3d(q->ox + q->l, q->oy + q->l, R);
+    vec3d pc = (p0 + p3) * 0.5;
+    vec3d uz = pc.normalize();
+    vec3d ux = vec3d::UNIT_Y.crossProduct(uz).normalize();
+    vec3d uy = uz.crossProduct(ux);
+
+    mat4d ltow = context->getLocalToWorld();
+    return mat3d(
+        ltow[0][0], ltow[0][1], ltow[0][2],
+        ltow[1][0], ltow[1][1], ltow[1][2],
+        ltow[2][0], ltow[2][1], ltow[2][2]) *
+    mat3d(
+        ux.x, uy.x, uz.x,
+        ux.y, uy.y, uz.y,
+        ux.z, uy.z, uz.z);
 }
 
 SceneManager::visibility SphericalDeformation::getVisibility(const TerrainNode *t, const box3d &localBox) const
 {
-    vec3d deformedBox[4];
-    deformedBox[0] = localToDeformed(vec3d(localBox.xmin, localBox.ymin, localBox.zmin));
-    deformedBox[1] = localToDeformed(vec3d(localBox.xmax, localBox.ymin, localBox.zmin));
-    deformedBox[2] = localToDeformed(vec3d(localBox.xmax, localBox.ymax, localBox.zmin));
-    deformedBox[3] = localToDeformed(vec3d(localBox.xmin, localBox.ymax, localBox.zmin));
-    double a = (localBox.zmax + R) / (localBox.zmin + R);
-    double dx = (localBox.xmax - localBox.xmin) / 2 * a;
-    double dy = (localBox.ymax - localBox.ymin) / 2 * a;
-    double dz = localBox.zmax + R;
-    double f = sqrt(dx * dx + dy * dy + dz * dz) / (localBox.zmin + R);
-
-    const vec4d *deformedFrustumPlanes = t->getDeformedFrustumPlanes();
-    SceneManager::visibility v0 = getVisibility(deformedFrustumPlanes[0], deformedBox, f);
-    if (v0 == SceneManager::INVISIBLE) {
-        return SceneManager::INVISIBLE;
-    }
-    SceneManager::visibility v1 = getVisibility(deformedFrustumPlanes[1], deformedBox, f);
-    if (v1 == SceneManager::INVISIBLE) {
-        return SceneManager::INVISIBLE;
-    }
-    SceneManager::visibility v2 = getVisibility(deformedFrustumPlanes[2], deformedBox, f);
-    if (v2 == SceneManager::INVISIBLE) {
-        return SceneManager::INVISIBLE;
-    }
-    SceneManager::visibility v3 = getVisibility(deformedFrustumPlanes[3], deformedBox, f);
-    if (v3 == SceneManager::INVISIBLE) {
-        return SceneManager::INVISIBLE;
-    }
-    SceneManager::visibility v4 = getVisibility(deformedFrustumPlanes[4], deformedBox, f);
-    if (v4 == SceneManager::INVISIBLE) {
-        return SceneManager::INVISIBLE;
-    }
-
-    vec3d c = t->getDeformedCamera();
-    double lSq = c.squaredLength();
-    double rm = R + min(0.0, localBox.zmin);
-    double rM = R + localBox.zmax;
-    double rmSq = rm * rm;
-    double rMSq = rM * rM;
-    vec4d farPlane = vec4d(c.x, c.y, c.z, sqrt((lSq - rmSq) * (rMSq - rmSq)) - rmSq);
-
-    SceneManager::visibility v5 = getVisibility(farPlane, deformedBox, f);
-    if (v5 == SceneManager::INVISIBLE) {
-        return SceneManager::INVISIBLE;
-    }
-
-    if (v0 == SceneManager::FULLY_VISIBLE && v1 == SceneManager::FULLY_VISIBLE &&
-        v2 == SceneManager::FULLY_VISIBLE && v3 == SceneManager::FULLY_VISIBLE &&
-        v4 == SceneManager::FULLY_VISIBLE && v5 == SceneManager::FULLY_VISIBLE)
-    {
-        return SceneManager::FULLY_VISIBLE;
-    }
-    return SceneManager::PARTIALLY_VISIBLE;
+    BoxBatch b = { &localBox.xmin, &localBox.xmax, &localBox.ymin, &localBox.ymax, &localBox.zmin, &localBox.zmax };
+    SceneManager::visibility v;
+    getSphericalVisibility(R, t->getDeformedCamera(), t->getDeformedFrustumPlanes(), 1, b, &v);
+    return v;
 }
 
-SceneManager::visibility SphericalDeformation::getVisibility(const vec4d &clip, const vec3d *b, double f)
+void SphericalDeformation::getVisibility(const TerrainNode *t, int n, const BoxBatch &localBoxes, SceneManager::visibility *result) const
 {
-    double o = b[0].x * clip.x + b[0].y * clip.y + b[0].z * clip.z;
-    bool p = o + clip.w > 0.0;
-    if ((o * f + clip.w > 0.0) == p) {
-        o = b[1].x * clip.x + b[1].y * clip.y + b[1].z * clip.z;
-        if ((o + clip.w > 0.0) == p && (o * f + clip.w > 0.0) == p) {
-            o = b[2].x * clip.x + b[2].y * clip.y + b[2].z * clip.z;
-            if ((o + clip.w > 0.0) == p && (o * f + clip.w > 0.0) == p) {
-                o = b[3].x * clip.x + b[3].y * clip.y + b[3].z * clip.z;
-                return (o + clip.w > 0.0) == p && (o * f + clip.w > 0.0) == p ? (p ? SceneManager::FULLY_VISIBLE : SceneManager::INVISIBLE) : SceneManager::PARTIALLY_VISIBLE;
-            }
-        }
-    }
-    return SceneManager::PARTIALLY_VISIBLE;
+    // each box is bounded with the deformed corners of its bottom face, and
+    // with the far plane tangent to the sphere of radius R+zmin, as seen
+    // from the camera (parts of the box beyond it are below the horizon)
+    getSphericalVisibility(R, t->getDeformedCamera(), t->getDeformedFrustumPlanes(), n, localBoxes, result);
 }
 
 }
@@ -91,8 +91,12 @@ public:
 
     virtual void setUniforms(ptr<SceneNode> context, ptr<TerrainQuad> q, ptr<Program> prog) const;
 
+    virtual void getQuadParameters(ptr<SceneNode> context, TerrainQuad *q, vec4f *params) const;
+
     virtual SceneManager::visibility getVisibility(const TerrainNode *t, const box3d &localBox) const;
 
+    virtual void getVisibility(const TerrainNode *t, int n, const BoxBatch &localBoxes, SceneManager::visibility *result) const;
+
 protected:
     virtual void setScreenUniforms(ptr<SceneNode> context, ptr<TerrainQuad> q, ptr<Program> prog) const;
 
@@ -119,7 +123,23 @@ private:
      */
     mutable ptr<UniformMatrix3f> tangentFrameToWorldU;
 
-    static SceneManager::visibility getVisibility(const vec4d &clip, const vec3d *b, double f);
+    /**
+     * Computes the deformed corners of the given quad, the vertical vectors
+     * at these corners in screen space (see Deformation#getScreenQuad), and
+     * the norms of the (x,y,R) vectors corresponding to these corners.
+     *
+     * @param q a TerrainQuad.
+     * @param[out] corners the deformed quad corners, or NULL if they are not needed.
+     * @param[out] verticals the vertical vectors, or NULL if they are not needed.
+     * @param[out] norms the norms of the (x,y,R) corner vectors.
+     */
+    void getScreenQuad(TerrainQuad *q, mat4d *corners, mat4d *verticals, vec4d *norms) const;
+
+    /**
+     * Returns the transformation from the tangent space at the center of
+     * the given quad to world space.
+     */
+    mat3d getTangentFrameToWorld(ptr<SceneNode> context, TerrainQuad *q) const;
 };
 
 }
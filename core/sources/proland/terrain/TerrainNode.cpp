@@ -43,8 +43,10 @@
 
 #include "ork/resource/ResourceTemplate.h"
 #include "ork/render/FrameBuffer.h"
+#include "ork/taskgraph/TaskGraph.h"
 #include "proland/terrain/SphericalDeformation.h"
 #include "proland/terrain/CylindricalDeformation.h"
+#include "proland/terrain/FlatDeformation.h"
 
 // Lars F mod
 #include "ork/math/pmath.h"
@@ -57,17 +59,43 @@ using namespace ork;
 namespace proland
 {
 
+/**
+ * A task to update a subtree of a %terrain quadtree (see TerrainNode#update).
+ */
+class UpdateQuadTask : public Task
+{
+public:
+    TerrainQuad *q;
+
+    bool occlusion;
+
+    UpdateQuadTask(TerrainQuad *q, bool occlusion) : Task("UpdateQuadTask", false, 0), q(q), occlusion(occlusion)
+    {
+    }
+
+    virtual ~UpdateQuadTask()
+    {
+    }
+
+    virtual bool run()
+    {
+        vector<TerrainQuad*> subtrees;
+        q->update(-1, occlusion, subtrees);
+        return true;
+    }
+};
+
 float TerrainNode::groundHeightAtCamera = 0.0f;
 
 float TerrainNode::nextGroundHeightAtCamera = 0.0f;
 
 TerrainNode::TerrainNode(ptr<Deformation> deform, ptr<TerrainQuad> root, float splitFactor, int maxLevel) :
-    Object("TerrainNode")
+    Object("TerrainNode"), pool(NULL)
 {
     init(deform, root, splitFactor, maxLevel);
 }
 
-TerrainNode::TerrainNode() : Object("TerrainNode")
+TerrainNode::TerrainNode() : Object("TerrainNode"), pool(NULL)
 {
 }
 
@@ -80,13 +108,20 @@ void TerrainNode::init(ptr<Deformation> deform, ptr<TerrainQuad> root, float spl
     this->horizonCulling = true;
     this->splitDist = 1.1f;
     this->maxLevel = maxLevel;
+    this->parallelDepth = 0;
     root->owner = this;
     horizon = new float[HORIZON_SIZE];
+    pool = TerrainQuad::createPool();
 }
 
 TerrainNode::~TerrainNode()
 {
     delete[] horizon;
+    // the pool is deleted when the quadtree is deleted (after this method)
+    // or when the last quad referenced elsewhere is deleted
+    if (pool != NULL) {
+        TerrainQuad::closePool(pool);
+    }
 }
 
 vec3d TerrainNode::getDeformedCamera() const
@@ -116,6 +151,11 @@ SceneManager::visibility TerrainNode::getVisibility(const box3d &localBox) const
     return deform->getVisibility(this, localBox);
 }
 
+void TerrainNode::getVisibility(int n, const BoxBatch &localBoxes, SceneManager::visibility *result) const
+{
+    deform->getVisibility(this, n, localBoxes, result);
+}
+
 float TerrainNode::getSplitDistance() const
 {
     assert(isFinite(splitDist));
@@ -130,25 +170,30 @@ float TerrainNode::getDistFactor() const
 
 void TerrainNode::update(ptr<SceneNode> owner)
 {
-    deformedCameraPos = owner->getLocalToCamera().inverse() * vec3d::ZERO;
-    SceneManager::getFrustumPlanes(owner->getLocalToScreen(), deformedFrustumPlanes);
+    ptr<FrameBuffer> fb = SceneManager::getCurrentFrameBuffer();
+    update(owner->getLocalToCamera(), owner->getLocalToScreen(), float(fb->getViewport().z), owner->getOwner()->getScheduler());
+}
+
+void TerrainNode::update(const mat4d &localToCamera, const mat4d &localToScreen, float viewportWidth, ptr<Scheduler> scheduler)
+{
+    deformedCameraPos = localToCamera.inverse() * vec3d::ZERO;
+    SceneManager::getFrustumPlanes(localToScreen, deformedFrustumPlanes);
     localCameraPos = deform->deformedToLocal(deformedCameraPos);
 
     mat4d m = deform->localToDeformedDifferential(localCameraPos, true);
     distFactor = max(vec3d(m[0][0], m[1][0], m[2][0]).length(), vec3d(m[0][1], m[1][1], m[2][1]).length());
 
-    ptr<FrameBuffer> fb = SceneManager::getCurrentFrameBuffer();
     vec3d left = deformedFrustumPlanes[0].xyz().normalize();
     vec3d right = deformedFrustumPlanes[1].xyz().normalize();
     float fov = (float) safe_acos(-left.dotproduct(right));
-    splitDist = splitFactor * fb->getViewport().z / 1024.0f * tan(40.0f / 180.0f * M_PI) / tan(fov / 2.0f);
+    splitDist = splitFactor * viewportWidth / 1024.0f * tan(40.0f / 180.0f * M_PI) / tan(fov / 2.0f);
     if (splitDist < 1.1f || !(isFinite(splitDist))) {
         splitDist = 1.1f;
     }
 
     // initializes data structures for horizon occlusion culling
     if (horizonCulling && localCameraPos.z <= root->zmax) {
-        vec3d deformedDir = owner->getLocalToCamera().inverse() * vec3d::UNIT_Z;
+        vec3d deformedDir = localToCamera.inverse() * vec3d::UNIT_Z;
         vec2d localDir = (deform->deformedToLocal(deformedDir) - localCameraPos).xy().normalize();
         localCameraDir = mat2f(localDir.y, -localDir.x, -localDir.x, -localDir.y);
         for (int i = 0; i < HORIZON_SIZE; ++i) {
@@ -156,7 +201,35 @@ void TerrainNode::update(ptr<SceneNode> owner)
         }
     }
 
-    root->update();
+    if (scheduler == NULL || parallelDepth <= 0) {
+        root->update();
+        return;
+    }
+
+    // horizon occlusion culling depends on the order in which the quads are
+    // updated, so the subtrees at parallelDepth are updated without it, and
+    // the occlusion tests are then done sequentially, from front to back
+    bool culling = horizonCulling && !(localCameraPos.z > root->zmax);
+    vector<TerrainQuad*> subtrees;
+    root->update(parallelDepth, !culling, subtrees);
+    if (subtrees.size() > 1) {
+        // each task only creates and deletes the quads of its own subtree,
+        // which are not referenced outside of this subtree, so that their
+        // reference counts are never modified concurrently
+        ptr<TaskGraph> graph = new TaskGraph();
+        for (unsigned int i = 0; i < subtrees.size(); ++i) {
+            graph->addTask(new UpdateQuadTask(subtrees[i], !culling));
+        }
+        scheduler->run(graph);
+    } else if (subtrees.size() == 1) {
+        vector<TerrainQuad*> none;
+        subtrees[0]->update(-1, !culling, none);
+    }
+    if (culling) {
+        root->updateOcclusion();
+    } else {
+        root->updateOcclusion(parallelDepth);
+    }
 }
 
 bool TerrainNode::addOccluder(const box3d &occluder)
@@ -191,20 +264,12 @@ bool TerrainNode::addOccluder(const box3d &occluder)
     int imax = min(int(ceil(xmax * HORIZON_SIZE)), HORIZON_SIZE - 1);
 
     // first checks if the bounding box projection is below the current horizon line
-    bool occluded = imax >= imin;
-    for (int i = imin; i <= imax; ++i) {
-        if (zmax > horizon[i]) {
-            occluded = false;
-            break;
-        }
-    }
+    bool occluded = isBelowHorizon(horizon, imin, imax, zmax);
     if (!occluded) {
         // if it is not, updates the horizon line with the projection of this bounding box
         imin = max(int(ceil(xmin * HORIZON_SIZE)), 0);
         imax = min(int(floor(xmax * HORIZON_SIZE)), HORIZON_SIZE - 1);
-        for (int i = imin; i <= imax; ++i) {
-            horizon[i] = max(horizon[i], zmin);
-        }
+        raiseHorizon(horizon, imin, imax, zmin);
     }
     return occluded;
 }
@@ -233,12 +298,7 @@ bool TerrainNode::isOccluded(const box3d &box)
     float zmax = max(max(corners[0].y, corners[1].y), max(corners[2].y, corners[3].y));
     int imin = max(int(floor(xmin * HORIZON_SIZE)), 0);
     int imax = min(int(ceil(xmax * HORIZON_SIZE)), HORIZON_SIZE - 1);
-    for (int i = imin; i <= imax; ++i) {
-        if (zmax > horizon[i]) {
-            return false;
-        }
-    }
-    return imax >= imin;
+    return isBelowHorizon(horizon, imin, imax, zmax);
 }
 
 void TerrainNode::swap(ptr<TerrainNode> t)
@@ -247,9 +307,11 @@ void TerrainNode::swap(ptr<TerrainNode> t)
     std::swap(root, t->root);
     std::swap(splitFactor, t->splitFactor);
     std::swap(maxLevel, t->maxLevel);
+    std::swap(parallelDepth, t->parallelDepth);
     std::swap(deformedCameraPos, t->deformedCameraPos);
     std::swap(localCameraPos, t->localCameraPos);
     std::swap(splitDist, t->splitDist);
+    std::swap(pool, t->pool);
 
     for (int i = 0; i < 6; ++i) {
         std::swap(deformedFrustumPlanes[i], t->deformedFrustumPlanes[i]);
@@ -269,7 +331,7 @@ public:
         ptr<Deformation> deform;
         float splitFactor;
         int maxLevel;
-        checkParameters(desc, e, "name,size,zmin,zmax,deform,radius,splitFactor,horizonCulling,maxLevel,");
+        checkParameters(desc, e, "name,size,zmin,zmax,deform,radius,splitFactor,horizonCulling,maxLevel,parallelDepth,");
         getFloatParameter(desc, e, "size", &size);
         getFloatParameter(desc, e, "zmin", &zmin);
         getFloatParameter(desc, e, "zmax", &zmax);
@@ -282,7 +344,7 @@ public:
             deform = new CylindricalDeformation(radius);
         }
         if (deform == NULL) {
-            deform = new Deformation();
+            deform = new FlatDeformation();
         }
         getFloatParameter(desc, e, "splitFactor", &splitFactor);
         getIntParameter(desc, e, "maxLevel", &maxLevel);
@@ -293,6 +355,9 @@ public:
         if (e->Attribute("horizonCulling") != NULL && strcmp(e->Attribute("horizonCulling"), "false") == 0) {
             horizonCulling = false;
         }
+        if (e->Attribute("parallelDepth") != NULL) {
+            getIntParameter(desc, e, "parallelDepth", &parallelDepth);
+        }
     }
 };
 
@@ -44,6 +44,7 @@
 
 #include "ork/math/mat2.h"
 #include "ork/scenegraph/SceneNode.h"
+#include "ork/taskgraph/Scheduler.h"
 #include "proland/terrain/Deformation.h"
 #include "proland/terrain/TerrainQuad.h"
 
@@ -120,6 +121,19 @@ public:
      */
     int maxLevel;
 
+    /**
+     * The quadtree level at which #update splits the %terrain quadtree into
+     * independent subtrees, updated in parallel by the Scheduler. The default
+     * value, 0, means that the quadtree is always updated on the calling
+     * thread. Horizon occlusion culling (see #horizonCulling) depends on
+     * the order in which the quads are updated. Hence, when it is enabled,
+     * the subtrees are updated in parallel without it, and the occlusion
+     * tests are then done on the calling thread, in a front to back
+     * traversal of the quadtree. In any case the result is the same as with
+     * a sequential update.
+     */
+    int parallelDepth;
+
     /**
      * The %terrain elevation below the current viewer position. This field must be
      * updated manually by users (the TileSamplerZ class can do this for you).
@@ -179,10 +193,17 @@ public:
     /**
      * Returns the visibility of the given bounding box from the current
      * viewer position. This visibility is computed with
-     * Deformation#getVisbility.
+     * Deformation#getVisibility.
      */
     SceneManager::visibility getVisibility(const box3d &localBox) const;
 
+    /**
+     * Returns the visibility of the given bounding boxes from the current
+     * viewer position. This visibility is computed with
+     * Deformation#getVisibility, for all the boxes at once.
+     */
+    void getVisibility(int n, const BoxBatch &localBoxes, SceneManager::visibility *result) const;
+
     /**
      * Returns the viewer distance at which a quad is subdivided, relatively
      * to the quad size. This relative distance is equal to #splitFactor for
@@ -201,13 +222,39 @@ public:
      * The viewer position relatively to the local and deformed %terrain
      * spaces is computed based on the given SceneNode, which represents
      * the %terrain position in the scene graph (which also contains the
-     * current viewer position).
+     * current viewer position). The quadtree is updated in parallel with
+     * the Scheduler of the SceneManager if #parallelDepth is not 0. This
+     * method waits for the end of this parallel update, and must therefore
+     * not be called from a Task executed by this Scheduler. It is called by
+     * UpdateTerrainTask#getTask, i.e. while the task graph of the current
+     * frame is built, before it is executed. During this method, no other
+     * thread must use the quads of this quadtree.
      *
      * @param owner the SceneNode representing the terrain position in
      *      the global scene graph.
      */
     void update(ptr<SceneNode> owner);
 
+    /**
+     * Updates the %terrain quadtree based on the given viewer position and
+     * projection. This method does not need a SceneNode nor a current
+     * FrameBuffer, and can therefore be used without any OpenGL context
+     * (e.g. in benchmarks or to produce tiles offline).
+     *
+     * @param localToCamera the transformation from the local %terrain space
+     *      (before deformation) to the camera space.
+     * @param localToScreen the transformation from the local %terrain space
+     *      (before deformation) to the screen space.
+     * @param viewportWidth the width of the viewport, in pixels.
+     * @param scheduler the scheduler used to update the quadtree in
+     *      parallel (see #parallelDepth), or NULL to update it on the
+     *      calling thread. This method waits for the end of the parallel
+     *      update, and must not be called from a Task executed by this
+     *      scheduler (if all its threads were waiting in this method, the
+     *      subtrees would never be updated).
+     */
+    void update(const mat4d &localToCamera, const mat4d &localToScreen, float viewportWidth, ptr<Scheduler> scheduler = NULL);
+
     /**
      * Adds the given bounding box as an occluder. <i>The bounding boxes must
      * be added in front to back order</i>.
@@ -283,6 +330,13 @@ private:
      * Rasterized horizon elevation angle for each azimuth angle.
      */
     float *horizon;
+
+    /**
+     * The memory pool used to allocate the quads of the %terrain quadtree.
+     */
+    TerrainQuad::Pool *pool;
+
+    friend class TerrainQuad;
 };
 
 }
@@ -42,6 +42,9 @@
 #include "proland/terrain/TerrainQuad.h"
 
 #include <algorithm>
+#include <cstdlib>
+#include <new>
+#include <pthread.h>
 
 #include "proland/terrain/TerrainNode.h"
 
@@ -50,6 +53,255 @@ using namespace std;
 namespace proland
 {
 
+/**
+ * The size of the header before each quad, which points to the Block
+ * containing this quad, or is NULL for quads allocated on the heap.
+ */
+#define QUAD_HEADER 16
+
+/**
+ * The number of blocks allocated at once by an arena of a TerrainQuad::Pool.
+ */
+#define BLOCKS_PER_CHUNK 16
+
+/**
+ * The quadtree level whose subtrees get their own arena in a
+ * TerrainQuad::Pool. The quads above this level share another arena.
+ */
+#define ARENA_LEVEL 3
+
+/**
+ * The number of arenas of a TerrainQuad::Pool.
+ */
+#define ARENAS ((1 << (2 * ARENA_LEVEL)) + 1)
+
+static size_t align16(size_t size)
+{
+    return (size + 15) & ~size_t(15);
+}
+
+struct TerrainQuad::Block
+{
+    /**
+     * The pool containing this block.
+     */
+    Pool *pool;
+
+    /**
+     * The next free block, if this block is free.
+     */
+    Block *next;
+
+    /**
+     * The index of the arena containing this block in #pool.
+     */
+    int arena;
+
+    /**
+     * The number of quads of this block that are not yet deleted.
+     */
+    int quads;
+};
+
+class TerrainQuad::Pool
+{
+public:
+    /**
+     * The size of a quad slot in a block, header included.
+     */
+    static const size_t SLOT_SIZE;
+
+    /**
+     * The size of a block, including its header and its four slots.
+     */
+    static const size_t BLOCK_SIZE;
+
+    Pool() : liveArenas(0), closed(false)
+    {
+        for (int i = 0; i < ARENAS; ++i) {
+            arenas[i].chunkBlocks = BLOCKS_PER_CHUNK;
+            arenas[i].freeBlocks = NULL;
+            arenas[i].usedBlocks = 0;
+            arenas[i].mutex = new pthread_mutex_t;
+            pthread_mutex_init((pthread_mutex_t*) arenas[i].mutex, NULL);
+        }
+        mutex = new pthread_mutex_t;
+        pthread_mutex_init((pthread_mutex_t*) mutex, NULL);
+    }
+
+    ~Pool()
+    {
+        for (int i = 0; i < ARENAS; ++i) {
+            Arena &a = arenas[i];
+            for (unsigned int j = 0; j < a.chunks.size(); ++j) {
+                free(a.chunks[j]);
+            }
+            pthread_mutex_destroy((pthread_mutex_t*) a.mutex);
+            delete (pthread_mutex_t*) a.mutex;
+        }
+        pthread_mutex_destroy((pthread_mutex_t*) mutex);
+        delete (pthread_mutex_t*) mutex;
+    }
+
+    /**
+     * Returns a block of four quad slots, for the four subquads of the
+     * given quad.
+     */
+    Block *allocate(int level, int tx, int ty)
+    {
+        // the subtrees below ARENA_LEVEL use distinct arenas, so that the
+        // tasks updating them in parallel (see TerrainNode#parallelDepth)
+        // do not contend for the same lock
+        int index = ARENAS - 1;
+        if (level >= ARENA_LEVEL) {
+            int shift = level - ARENA_LEVEL;
+            index = (tx >> shift) + (ty >> shift) * (1 << ARENA_LEVEL);
+        }
+        Arena &a = arenas[index];
+
+        pthread_mutex_lock((pthread_mutex_t*) a.mutex);
+        // reuses the most recently released block first, whose memory is
+        // likely to be still in cache
+        Block *b = a.freeBlocks;
+        if (b != NULL) {
+            a.freeBlocks = b->next;
+        } else {
+            if (a.chunkBlocks == BLOCKS_PER_CHUNK) {
+                unsigned char *chunk = (unsigned char*) malloc(BLOCKS_PER_CHUNK * BLOCK_SIZE);
+                if (chunk == NULL) {
+                    pthread_mutex_unlock((pthread_mutex_t*) a.mutex);
+                    throw bad_alloc();
+                }
+                a.chunks.push_back(chunk);
+                a.chunkBlocks = 0;
+            }
+            b = (Block*) (a.chunks.back() + a.chunkBlocks * BLOCK_SIZE);
+            a.chunkBlocks += 1;
+        }
+        if (a.usedBlocks++ == 0) {
+            pthread_mutex_lock((pthread_mutex_t*) mutex);
+            liveArenas += 1;
+            pthread_mutex_unlock((pthread_mutex_t*) mutex);
+        }
+        pthread_mutex_unlock((pthread_mutex_t*) a.mutex);
+
+        b->pool = this;
+        b->next = NULL;
+        b->arena = index;
+        b->quads = 4;
+        for (int i = 0; i < 4; ++i) {
+            *((Block**) ((unsigned char*) getSlot(b, i) - QUAD_HEADER)) = b;
+        }
+        return b;
+    }
+
+    /**
+     * Returns the i-th quad slot of the given block.
+     */
+    void *getSlot(Block *b, int i)
+    {
+        return (unsigned char*) b + align16(sizeof(Block)) + i * SLOT_SIZE + QUAD_HEADER;
+    }
+
+    /**
+     * Notifies this pool that a quad of the given block has been deleted.
+     */
+    void release(Block *b)
+    {
+        Arena &a = arenas[b->arena];
+        bool unused = false;
+        pthread_mutex_lock((pthread_mutex_t*) a.mutex);
+        if (--b->quads == 0) {
+            b->next = a.freeBlocks;
+            a.freeBlocks = b;
+            if (--a.usedBlocks == 0) {
+                pthread_mutex_lock((pthread_mutex_t*) mutex);
+                liveArenas -= 1;
+                unused = closed && liveArenas == 0;
+                pthread_mutex_unlock((pthread_mutex_t*) mutex);
+            }
+        }
+        pthread_mutex_unlock((pthread_mutex_t*) a.mutex);
+        if (unused) {
+            delete this;
+        }
+    }
+
+    /**
+     * Notifies this pool that its TerrainNode has been deleted. The pool
+     * is deleted when all its quads are deleted.
+     */
+    void close()
+    {
+        pthread_mutex_lock((pthread_mutex_t*) mutex);
+        closed = true;
+        bool unused = liveArenas == 0;
+        pthread_mutex_unlock((pthread_mutex_t*) mutex);
+        if (unused) {
+            delete this;
+        }
+    }
+
+private:
+    /**
+     * A part of a pool, with its own blocks and its own lock.
+     */
+    struct Arena
+    {
+        /**
+         * The memory chunks of this arena, each containing BLOCKS_PER_CHUNK
+         * blocks.
+         */
+        vector<unsigned char*> chunks;
+
+        /**
+         * The number of blocks of the last chunk that have been used.
+         */
+        int chunkBlocks;
+
+        /**
+         * The list of free blocks, linked with Block#next.
+         */
+        Block *freeBlocks;
+
+        /**
+         * The number of blocks containing at least one quad.
+         */
+        int usedBlocks;
+
+        /**
+         * A mutex to serialize parallel accesses to this arena.
+         */
+        void *mutex;
+    };
+
+    /**
+     * The arenas of this pool. The last one contains the quads above
+     * ARENA_LEVEL, and the others the quads of the subtrees at this level.
+     */
+    Arena arenas[ARENAS];
+
+    /**
+     * The number of arenas containing at least one quad.
+     */
+    int liveArenas;
+
+    /**
+     * True if the TerrainNode owning this pool has been deleted.
+     */
+    bool closed;
+
+    /**
+     * A mutex to serialize the accesses to #liveArenas and #closed. Always
+     * locked after, never before, an arena mutex.
+     */
+    void *mutex;
+};
+
+const size_t TerrainQuad::Pool::SLOT_SIZE = QUAD_HEADER + align16(sizeof(TerrainQuad));
+
+const size_t TerrainQuad::Pool::BLOCK_SIZE = align16(sizeof(TerrainQuad::Block)) + 4 * TerrainQuad::Pool::SLOT_SIZE;
+
 TerrainQuad::TerrainQuad(TerrainNode *owner, const TerrainQuad *parent,
     int tx, int ty, double ox, double oy, double l, float zmin, float zmax) :
     Object("TerrainQuad"), parent(parent), level(parent == NULL ? 0 : parent->level + 1), tx(tx), ty(ty),
@@ -61,6 +313,50 @@ TerrainQuad::~TerrainQuad()
 {
 }
 
+void *TerrainQuad::operator new(size_t size)
+{
+    unsigned char *p = (unsigned char*) malloc(size + QUAD_HEADER);
+    if (p == NULL) {
+        throw bad_alloc();
+    }
+    *((Block**) p) = NULL;
+    return p + QUAD_HEADER;
+}
+
+void *TerrainQuad::operator new(size_t size, void *slot)
+{
+    assert(size + QUAD_HEADER <= Pool::SLOT_SIZE);
+    return slot;
+}
+
+void TerrainQuad::operator delete(void *p)
+{
+    if (p != NULL) {
+        unsigned char *header = (unsigned char*) p - QUAD_HEADER;
+        Block *b = *((Block**) header);
+        if (b == NULL) {
+            free(header);
+        } else {
+            b->pool->release(b);
+        }
+    }
+}
+
+void TerrainQuad::operator delete(void *p, void *slot)
+{
+    operator delete(p);
+}
+
+TerrainQuad::Pool *TerrainQuad::createPool()
+{
+    return new Pool();
+}
+
+void TerrainQuad::closePool(Pool *pool)
+{
+    pool->close();
+}
+
 TerrainNode *TerrainQuad::getOwner()
 {
     return owner;
@@ -93,20 +389,30 @@ int TerrainQuad::getDepth() const
 }
 
 void TerrainQuad::update()
+{
+    vector<TerrainQuad*> subtrees;
+    update(-1, true, subtrees);
+}
+
+void TerrainQuad::update(int splitLevel, bool occlusion, vector<TerrainQuad*> &subtrees)
 {
     SceneManager::visibility v = parent == NULL ? SceneManager::PARTIALLY_VISIBLE : parent->visible;
     if (v == SceneManager::PARTIALLY_VISIBLE) {
         box3d localBox(ox, ox + l, oy, oy + l, zmin, zmax);
-        visible = owner->getVisibility(localBox);
-    } else {
-        visible = v;
+        v = owner->getVisibility(localBox);
     }
+    update(v, splitLevel, occlusion, subtrees);
+}
+
+void TerrainQuad::update(SceneManager::visibility v, int splitLevel, bool occlusion, vector<TerrainQuad*> &subtrees)
+{
+    visible = v;
 
     // here we reuse the occlusion test from the previous frame:
     // if the quad was found unoccluded in the previous frame, we suppose it is
     // still unoccluded at this frame. If it was found occluded, we perform
     // an occlusion test to check if it is still occluded.
-    if (visible != SceneManager::INVISIBLE && occluded) {
+    if (occlusion && visible != SceneManager::INVISIBLE && occluded) {
         occluded = owner->isOccluded(box3d(ox, ox + l, oy, oy + l, zmin, zmax));
         if (occluded) {
             visible = SceneManager::INVISIBLE;
@@ -116,52 +422,69 @@ void TerrainQuad::update()
     double ground = TerrainNode::groundHeightAtCamera;
     float dist = owner->getCameraDist(box3d(ox, ox + l, oy, oy + l, min(0.0, ground), max(0.0, ground)));
 
-    if ((owner->splitInvisibleQuads || visible != SceneManager::INVISIBLE) && dist < l * owner->getSplitDistance() && level < owner->maxLevel) {
+    bool split = (owner->splitInvisibleQuads || visible != SceneManager::INVISIBLE) && dist < l * owner->getSplitDistance() && level < owner->maxLevel;
+
+    // if the occlusion tests are deferred, a leaf that was occluded in the
+    // previous frame is not subdivided: it is probably still occluded, and
+    // its subquads would then be removed by updateOcclusion. Instead,
+    // updateOcclusion subdivides it if it is no longer occluded.
+    if (split && !occlusion && occluded && isLeaf() && !owner->splitInvisibleQuads) {
+        split = false;
+    }
+
+    if (split) {
         if (isLeaf()) {
             subdivide();
         }
 
         int order[4];
-        double ox = owner->getLocalCamera().x;
-        double oy = owner->getLocalCamera().y;
-        double cx = this->ox + l / 2.0;
-        double cy = this->oy + l / 2.0;
-        if (oy < cy) {
-            if (ox < cx) {
-                order[0] = 0;
-                order[1] = 1;
-                order[2] = 2;
-                order[3] = 3;
-            } else {
-                order[0] = 1;
-                order[1] = 0;
-                order[2] = 3;
-                order[3] = 2;
-            }
-        } else {
-            if (ox < cx) {
-                order[0] = 2;
-                order[1] = 0;
-                order[2] = 3;
-                order[3] = 1;
-            } else {
-                order[0] = 3;
-                order[1] = 1;
-                order[2] = 2;
-                order[3] = 0;
+        getSubQuadsOrder(order);
+
+        if (level + 1 == splitLevel) {
+            subtrees.push_back(children[order[0]].get());
+            subtrees.push_back(children[order[1]].get());
+            subtrees.push_back(children[order[2]].get());
+            subtrees.push_back(children[order[3]].get());
+            return;
+        }
+
+        // the subquads inherit the visibility of this quad, unless it is
+        // partially visible, in which case their visibility is computed for
+        // the four subquads at once (which is faster than one by one)
+        SceneManager::visibility cv[4] = { visible, visible, visible, visible };
+        if (visible == SceneManager::PARTIALLY_VISIBLE) {
+            double x0[4];
+            double x1[4];
+            double y0[4];
+            double y1[4];
+            double z0[4];
+            double z1[4];
+            for (int i = 0; i < 4; ++i) {
+                const TerrainQuad *c = children[i].get();
+                x0[i] = c->ox;
+                x1[i] = c->ox + c->l;
+                y0[i] = c->oy;
+                y1[i] = c->oy + c->l;
+                z0[i] = c->zmin;
+                z1[i] = c->zmax;
             }
+            BoxBatch boxes = { x0, x1, y0, y1, z0, z1 };
+            owner->getVisibility(4, boxes, cv);
         }
 
-        children[order[0]]->update();
-        children[order[1]]->update();
-        children[order[2]]->update();
-        children[order[3]]->update();
+        children[order[0]]->update(cv[order[0]], splitLevel, occlusion, subtrees);
+        children[order[1]]->update(cv[order[1]], splitLevel, occlusion, subtrees);
+        children[order[2]]->update(cv[order[2]], splitLevel, occlusion, subtrees);
+        children[order[3]]->update(cv[order[3]], splitLevel, occlusion, subtrees);
 
         // we compute a more precise occlusion for the next frame (see above),
-        // by combining the occlusion status of the child nodes
-        occluded = children[0]->occluded && children[1]->occluded && children[2]->occluded && children[3]->occluded;
+        // by combining the occlusion status of the child nodes (if they are
+        // all up to date, otherwise this is done in updateOcclusion)
+        if (splitLevel < 0 && occlusion) {
+            occluded = children[0]->occluded && children[1]->occluded && children[2]->occluded && children[3]->occluded;
+        }
     } else {
-        if (visible != SceneManager::INVISIBLE) {
+        if (occlusion && visible != SceneManager::INVISIBLE) {
             // we add the bounding box of this quad to the occluders list
             occluded = owner->addOccluder(box3d(ox, ox + l, oy, oy + l, zmin, zmax));
             if (occluded) {
@@ -177,13 +500,115 @@ void TerrainQuad::update()
     }
 }
 
+void TerrainQuad::updateOcclusion(int splitLevel)
+{
+    // the quads above splitLevel are subdivided if and only if they
+    // were split by update, and only these quads need to be updated
+    if (level < splitLevel && !isLeaf()) {
+        for (int i = 0; i < 4; ++i) {
+            children[i]->updateOcclusion(splitLevel);
+        }
+        occluded = children[0]->occluded && children[1]->occluded && children[2]->occluded && children[3]->occluded;
+    }
+}
+
+void TerrainQuad::updateOcclusion()
+{
+    // a quad inherits the visibility of its parent if it is invisible,
+    // otherwise its visibility in the view frustum is already computed
+    if (parent != NULL && parent->visible == SceneManager::INVISIBLE) {
+        visible = SceneManager::INVISIBLE;
+    } else if (isLeaf()) {
+        // same tests as in update, which also subdivides this quad if update
+        // did not do it because it was occluded in the previous frame, but
+        // if it is no longer occluded
+        vector<TerrainQuad*> none;
+        update(visible, -1, true, none);
+        return;
+    } else if (visible != SceneManager::INVISIBLE && occluded) {
+        // same occlusion test as in update
+        occluded = owner->isOccluded(box3d(ox, ox + l, oy, oy + l, zmin, zmax));
+        if (occluded) {
+            visible = SceneManager::INVISIBLE;
+        }
+    }
+
+    if (!isLeaf()) {
+        if (owner->splitInvisibleQuads || visible != SceneManager::INVISIBLE) {
+            int order[4];
+            getSubQuadsOrder(order);
+            children[order[0]]->updateOcclusion();
+            children[order[1]]->updateOcclusion();
+            children[order[2]]->updateOcclusion();
+            children[order[3]]->updateOcclusion();
+            occluded = children[0]->occluded && children[1]->occluded && children[2]->occluded && children[3]->occluded;
+            return;
+        }
+        // update would not have subdivided this quad, because it is occluded
+        children[0] = NULL;
+        children[1] = NULL;
+        children[2] = NULL;
+        children[3] = NULL;
+    }
+    if (visible != SceneManager::INVISIBLE) {
+        // same occluder as in update
+        occluded = owner->addOccluder(box3d(ox, ox + l, oy, oy + l, zmin, zmax));
+        if (occluded) {
+            visible = SceneManager::INVISIBLE;
+        }
+    }
+}
+
+void TerrainQuad::getSubQuadsOrder(int order[4]) const
+{
+    double ox = owner->getLocalCamera().x;
+    double oy = owner->getLocalCamera().y;
+    double cx = this->ox + l / 2.0;
+    double cy = this->oy + l / 2.0;
+    if (oy < cy) {
+        if (ox < cx) {
+            order[0] = 0;
+            order[1] = 1;
+            order[2] = 2;
+            order[3] = 3;
+        } else {
+            order[0] = 1;
+            order[1] = 0;
+            order[2] = 3;
+            order[3] = 2;
+        }
+    } else {
+        if (ox < cx) {
+            order[0] = 2;
+            order[1] = 0;
+            order[2] = 3;
+            order[3] = 1;
+        } else {
+            order[0] = 3;
+            order[1] = 1;
+            order[2] = 2;
+            order[3] = 0;
+        }
+    }
+}
+
 void TerrainQuad::subdivide()
 {
     float hl = (float) l / 2.0f;
-    children[0] = new TerrainQuad(owner, this, 2 * tx, 2 * ty, ox, oy, hl, zmin, zmax);
-    children[1] = new TerrainQuad(owner, this, 2 * tx + 1, 2 * ty, ox + hl, oy, hl, zmin, zmax);
-    children[2] = new TerrainQuad(owner, this, 2 * tx, 2 * ty + 1, ox, oy + hl, hl, zmin, zmax);
-    children[3] = new TerrainQuad(owner, this, 2 * tx + 1, 2 * ty + 1, ox + hl, oy + hl, hl, zmin, zmax);
+    Pool *pool = owner->pool;
+    if (pool == NULL) {
+        children[0] = new TerrainQuad(owner, this, 2 * tx, 2 * ty, ox, oy, hl, zmin, zmax);
+        children[1] = new TerrainQuad(owner, this, 2 * tx + 1, 2 * ty, ox + hl, oy, hl, zmin, zmax);
+        children[2] = new TerrainQuad(owner, this, 2 * tx, 2 * ty + 1, ox, oy + hl, hl, zmin, zmax);
+        children[3] = new TerrainQuad(owner, this, 2 * tx + 1, 2 * ty + 1, ox + hl, oy + hl, hl, zmin, zmax);
+    } else {
+        // the four subquads are allocated together, in a single block
+        Block *b = pool->allocate(level + 1, 2 * tx, 2 * ty);
+        children[0] = new (pool->getSlot(b, 0)) TerrainQuad(owner, this, 2 * tx, 2 * ty, ox, oy, hl, zmin, zmax);
+        children[1] = new (pool->getSlot(b, 1)) TerrainQuad(owner, this, 2 * tx + 1, 2 * ty, ox + hl, oy, hl, zmin, zmax);
+        children[2] = new (pool->getSlot(b, 2)) TerrainQuad(owner, this, 2 * tx, 2 * ty + 1, ox, oy + hl, hl, zmin, zmax);
+        children[3] = new (pool->getSlot(b, 3)) TerrainQuad(owner, this, 2 * tx + 1, 2 * ty + 1, ox + hl, oy + hl, hl, zmin, zmax);
+    }
 }
 
 }
@@ -42,6 +42,8 @@
 #ifndef _PROLAND_TERRAIN_QUAD_H_
 #define _PROLAND_TERRAIN_QUAD_H_
 
+#include <vector>
+
 #include "ork/scenegraph/SceneManager.h"
 
 using namespace ork;
@@ -59,6 +61,26 @@ class TerrainNode;
  * in TileSampler to decide whether or not data must be produced
  * for invisible tiles (we recall that the %terrain quadtree itself
  * does not store any %terrain data).
+ *
+ * The subquads created by #update are allocated in a memory pool owned by
+ * the TerrainNode, by blocks of four siblings, instead of being allocated
+ * individually on the heap. The blocks released when quads are merged are
+ * reused first (most recently released first). The pool only changes where
+ * the quads are stored: the quads are still reference counted Object, the
+ * #children links are still ptr<TerrainQuad> references, and a quad is
+ * deleted (and its slot returned to the pool) when its last reference is
+ * released, as before. Hence subdividing and merging quads still updates
+ * reference counts, and the pool allocations and releases are serialized
+ * with mutexes (quads can be subdivided in parallel, see TerrainNode). The
+ * subtrees at level 3 have their own part of the pool, with its own mutex,
+ * so that the tasks updating distinct subtrees in parallel (with a
+ * TerrainNode#parallelDepth of 3 or less) do not contend for it, except
+ * for the few quads above this level. A
+ * quad stays valid as long as it is referenced, even if it is no longer in
+ * the quadtree, and even if its TerrainNode is deleted. The code traversing
+ * the current quadtree can use plain TerrainQuad pointers, which avoids
+ * reference count updates, since each quad is referenced by its parent
+ * while it is in the quadtree.
  * @ingroup terrain
  * @authors Eric Bruneton, Antoine Begault, Guillaume Piolat
  */
@@ -120,6 +142,8 @@ public:
      * The four subquads of this quad. If this quad is not subdivided,
      * the four values are NULL. The subquads are stored in the
      * following order: bottomleft, bottomright, topleft, topright.
+     * These references own the subquads, even though their memory comes
+     * from the pool of the TerrainNode.
      */
     ptr<TerrainQuad> children[4];
 
@@ -165,6 +189,27 @@ public:
      */
     virtual ~TerrainQuad();
 
+    /**
+     * Allocates a TerrainQuad on the heap (used for root quads).
+     */
+    static void *operator new(size_t size);
+
+    /**
+     * Constructs a TerrainQuad in a slot of the memory pool of a TerrainNode.
+     */
+    static void *operator new(size_t size, void *slot);
+
+    /**
+     * Releases the memory of a TerrainQuad, either to the heap or to the
+     * memory pool from which it was allocated.
+     */
+    static void operator delete(void *p);
+
+    /**
+     * Releases the memory of a TerrainQuad whose constructor failed.
+     */
+    static void operator delete(void *p, void *slot);
+
     /**
      * Returns the TerrainNode to which the %terrain quadtree belongs.
      */
@@ -194,17 +239,102 @@ public:
     void update();
 
 private:
+    /**
+     * A block of four sibling quads in a Pool.
+     */
+    struct Block;
+
+    /**
+     * A memory pool for the quads of a %terrain quadtree. See TerrainQuad.
+     */
+    class Pool;
+
     /**
      * The TerrainNode to which this %terrain quadtree belongs.
      */
     TerrainNode *owner;
 
+    /**
+     * Creates a memory pool for the quads of a %terrain quadtree.
+     */
+    static Pool *createPool();
+
+    /**
+     * Releases a memory pool created with #createPool. The pool is deleted
+     * when all its quads are deleted.
+     */
+    static void closePool(Pool *pool);
+
+    /**
+     * Subdivides or unsubdivides this quad, like #update(), but does not
+     * update the quads at the given level. Instead these quads are added
+     * to the given list, in the order in which #update() would have updated
+     * them. They can then be updated independently with this method,
+     * followed by a call to #updateOcclusion(int) or, if horizon occlusion
+     * culling was skipped, to #updateOcclusion().
+     *
+     * @param splitLevel the level of the quads that must not be updated, or
+     *      -1 to update all the quads.
+     * @param occlusion false to skip the horizon occlusion culling tests.
+     *      These tests depend on the order in which the quads are updated,
+     *      and must then be done with #updateOcclusion(), after all the
+     *      quads have been updated. Until then the leaves that were occluded
+     *      in the previous frame are not subdivided (#updateOcclusion()
+     *      subdivides them if they are no longer occluded), while the other
+     *      quads that would have been found occluded can be subdivided.
+     * @param[out] subtrees the quads at splitLevel that must be updated.
+     */
+    void update(int splitLevel, bool occlusion, std::vector<TerrainQuad*> &subtrees);
+
+    /**
+     * Same as #update(int, bool, std::vector<TerrainQuad*>&), with the given
+     * frustum visibility for this quad.
+     *
+     * @param v the visibility of this quad in the view frustum, as returned
+     *      by TerrainNode#getVisibility, or the visibility of its parent if
+     *      it is not partially visible.
+     * @param splitLevel the level of the quads that must not be updated.
+     * @param occlusion false to skip the horizon occlusion culling tests.
+     * @param[out] subtrees the quads at splitLevel that must be updated.
+     */
+    void update(SceneManager::visibility v, int splitLevel, bool occlusion, std::vector<TerrainQuad*> &subtrees);
+
+    /**
+     * Updates the occlusion status of the subdivided quads above the given
+     * level, from the occlusion status of their subquads. This completes
+     * #update(int, bool, std::vector<TerrainQuad*>&), once the quads it
+     * returned have been updated with horizon occlusion culling.
+     *
+     * @param splitLevel the level passed to #update(int, bool, std::vector<TerrainQuad*>&).
+     */
+    void updateOcclusion(int splitLevel);
+
+    /**
+     * Does the horizon occlusion culling tests skipped by #update(int, bool,
+     * std::vector<TerrainQuad*>&), in the same order as #update() would have
+     * done, removes the subquads that #update() would not have created
+     * because of these tests, and subdivides the leaves that were not
+     * subdivided because they were occluded in the previous frame, if they
+     * are no longer occluded. The result is the same as with #update().
+     */
+    void updateOcclusion();
+
+    /**
+     * Returns the order in which the subquads of this quad must be updated,
+     * from the nearest to the farthest from the viewer.
+     *
+     * @param[out] order the indices of the subquads, from front to back.
+     */
+    void getSubQuadsOrder(int order[4]) const;
+
     /**
      * Creates the four subquads of this quad.
      */
     void subdivide();
 
     friend class TerrainNode;
+
+    friend class UpdateQuadTask;
 };
 
 }
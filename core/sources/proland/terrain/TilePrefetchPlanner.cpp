@@ -0,0 +1,189 @@
+/*
+ * Proland: a procedural landscape rendering library.
+ * Website : http://proland.inrialpes.fr/
+ * Copyright (c) 2008-2015 INRIA - LJK (CNRS - Grenoble University)
+ * All rights reserved.
+ * Redistribution and use in source and binary forms, with or without 
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice, 
+ * this list of conditions and the following disclaimer.
+ * 
+ * 2. Redistributions in binary form must reproduce the above copyright notice, 
+ * this list of conditions and the following disclaimer in the documentation 
+ * and/or other materials provided with the distribution.
+ * 
+ * 3. Neither the name of the copyright holder nor the names of its contributors 
+ * may be used to endorse or promote products derived from this software without 
+ * specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND 
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED 
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. 
+ * IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, 
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, 
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, 
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF 
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE 
+ * OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED 
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+/*
+ * Proland is distributed under the Berkeley Software Distribution 3 Licence. 
+ * For any assistance, feedback and enquiries about training programs, you can check out the 
+ * contact page on our website : 
+ * http://proland.inrialpes.fr/
+ */
+/*
+ * Main authors: Eric Bruneton, Antoine Begault, Guillaume Piolat.
+ */
+
+#include "proland/terrain/TilePrefetchPlanner.h"
+
+using namespace std;
+using namespace ork;
+
+namespace proland
+{
+
+TilePrefetchPlanner::TilePrefetchPlanner(int frames, int budget) :
+    Object("TilePrefetchPlanner"), frames(frames), budget(budget), hasCamera(false),
+    camera(vec3d::ZERO), cameraFrame(0), velocity(vec3d::ZERO), producerId(-1), prefetched(0), used(0), wasted(0)
+{
+}
+
+TilePrefetchPlanner::~TilePrefetchPlanner()
+{
+}
+
+int TilePrefetchPlanner::getFrames()
+{
+    return frames;
+}
+
+void TilePrefetchPlanner::setFrames(int frames)
+{
+    this->frames = frames;
+}
+
+int TilePrefetchPlanner::getBudget()
+{
+    return budget;
+}
+
+void TilePrefetchPlanner::setBudget(int budget)
+{
+    this->budget = budget;
+}
+
+int TilePrefetchPlanner::getPendingTiles()
+{
+    return int(pending.size());
+}
+
+void TilePrefetchPlanner::getStats(int &prefetched, int &used, int &wasted, bool reset)
+{
+    prefetched = this->prefetched;
+    used = this->used;
+    wasted = this->wasted;
+    if (reset) {
+        this->prefetched = 0;
+        this->used = 0;
+        this->wasted = 0;
+    }
+}
+
+void TilePrefetchPlanner::update(ptr<SceneManager> scene, ptr<TerrainNode> terrain, ptr<TileProducer> producer, bool storeParent, int maxTiles)
+{
+    unsigned int frame = scene->getFrameNumber();
+    producerId = producer->getId();
+
+    // prefetched tiles that have not been used in time are considered wasted
+    // (they remain in cache if they are already created, but no longer count
+    // in the budget)
+    map<TileCache::Tile::Key, PendingTile>::iterator i = pending.begin();
+    while (i != pending.end()) {
+        if (frame - i->second.frame > 2 * (unsigned int) frames) {
+            producer->cancelTile(i->second.level, i->second.tx, i->second.ty);
+            ++wasted;
+            pending.erase(i++);
+        } else {
+            ++i;
+        }
+    }
+
+    // updates the camera velocity, smoothed over the last frames; a camera
+    // jump larger than the terrain size (e.g. a teleport) resets it
+    vec3d c = terrain->getLocalCamera();
+    if (hasCamera && frame > cameraFrame) {
+        vec3d v = (c - camera) * (1.0 / (frame - cameraFrame));
+        if (v.length() > terrain->root->l) {
+            velocity = vec3d::ZERO;
+        } else {
+            velocity = velocity * 0.5 + v * 0.5;
+        }
+    }
+    camera = c;
+    cameraFrame = frame;
+    hasCamera = true;
+
+    int count = min(maxTiles, budget - int(pending.size()));
+    if (count <= 0 || velocity.length() == 0.0) {
+        return;
+    }
+    ptr<TerrainQuad> q = terrain->root;
+    vec3d predicted = c + velocity * double(frames);
+    prefetch(terrain, producer, predicted, q->level, q->tx, q->ty, q->ox, q->oy, q->l, storeParent, frame, count);
+}
+
+void TilePrefetchPlanner::tileUsed(int level, int tx, int ty)
+{
+    if (pending.empty()) {
+        return;
+    }
+    map<TileCache::Tile::Key, PendingTile>::iterator i = pending.find(TileCache::Tile::getKey(producerId, level, tx, ty));
+    if (i != pending.end()) {
+        ++used;
+        pending.erase(i);
+    }
+}
+
+void TilePrefetchPlanner::prefetch(ptr<TerrainNode> terrain, ptr<TileProducer> producer, const vec3d &c,
+    int level, int tx, int ty, double ox, double oy, double l, bool storeParent, unsigned int frame, int &count)
+{
+    if (count <= 0 || !producer->hasTile(level, tx, ty)) {
+        return;
+    }
+
+    // same subdivision criterion as in TerrainQuad::update, but with the
+    // predicted camera position (visibility can not be predicted, and is
+    // ignored)
+    double ground = TerrainNode::groundHeightAtCamera;
+    double dist = max(abs(c.z - max(0.0, ground)) / terrain->getDistFactor(),
+                   max(min(abs(c.x - ox), abs(c.x - ox - l)), min(abs(c.y - oy), abs(c.y - oy - l))));
+    bool split = dist < l * terrain->getSplitDistance() && level < terrain->maxLevel && producer->hasChildren(level, tx, ty);
+
+    if (!split || storeParent) {
+        if (producer->prefetchTile(level, tx, ty, frame + frames)) {
+            PendingTile p = { level, tx, ty, frame };
+            pending[TileCache::Tile::getKey(producerId, level, tx, ty)] = p;
+            ++prefetched;
+            --count;
+        }
+    }
+
+    if (split) {
+        // subquads closest to the predicted camera first
+        int i0 = (c.x < ox + l / 2.0 ? 0 : 1) | (c.y < oy + l / 2.0 ? 0 : 2);
+        int order[4] = { i0, i0 ^ 1, i0 ^ 2, i0 ^ 3 };
+        double hl = l / 2.0;
+        for (int i = 0; i < 4; ++i) {
+            int dx = order[i] & 1;
+            int dy = order[i] >> 1;
+            prefetch(terrain, producer, c, level + 1, 2 * tx + dx, 2 * ty + dy, ox + dx * hl, oy + dy * hl, hl, storeParent, frame, count);
+        }
+    }
+}
+
+}
@@ -0,0 +1,262 @@
+/*
+ * Proland: a procedural landscape rendering library.
+ * Website : http://proland.inrialpes.fr/
+ * Copyright (c) 2008-2015 INRIA - LJK (CNRS - Grenoble University)
+ * All rights reserved.
+ * Redistribution and use in source and binary forms, with or without 
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice, 
+ * this list of conditions and the following disclaimer.
+ * 
+ * 2. Redistributions in binary form must reproduce the above copyright notice, 
+ * this list of conditions and the following disclaimer in the documentation 
+ * and/or other materials provided with the distribution.
+ * 
+ * 3. Neither the name of the copyright holder nor the names of its contributors 
+ * may be used to endorse or promote products derived from this software without 
+ * specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND 
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED 
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. 
+ * IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, 
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, 
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, 
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF 
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE 
+ * OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED 
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+/*
+ * Proland is distributed under the Berkeley Software Distribution 3 Licence. 
+ * For any assistance, feedback and enquiries about training programs, you can check out the 
+ * contact page on our website : 
+ * http://proland.inrialpes.fr/
+ */
+/*
+ * Main authors: Eric Bruneton, Antoine Begault, Guillaume Piolat.
+ */
+
+#ifndef _PROLAND_TILE_PREFETCH_PLANNER_H_
+#define _PROLAND_TILE_PREFETCH_PLANNER_H_
+
+#include <map>
+
+#include "ork/scenegraph/SceneManager.h"
+#include "proland/producer/TileProducer.h"
+#include "proland/terrain/TerrainNode.h"
+
+using namespace ork;
+
+namespace proland
+{
+
+/**
+ * Prefetches the tiles that will be needed by a TileSampler in the next
+ * frames. This class extrapolates the trajectory of the camera from its
+ * positions in the local space of a TerrainNode, at the previous frames.
+ * It then computes the %terrain quadtree that TerrainQuad#update would
+ * produce at the predicted camera position, and schedules prefetch tasks
+ * for the tiles of this quadtree that are not yet in cache. These tasks
+ * have a deadline several frames ahead, so that they are executed after
+ * the tasks needed for the current frame. The number of prefetched tiles
+ * that have not been used yet is bounded by a budget, which limits the
+ * number of cache slots (and thus the memory) that can be used for
+ * prefetching. Prefetched tiles that are not used before a given number of
+ * frames are counted as wasted, their creation is cancelled if it has not
+ * been done yet, and they no longer count in this budget.
+ * @ingroup terrain
+ * @authors Eric Bruneton, Antoine Begault
+ */
+PROLAND_API class TilePrefetchPlanner : public Object
+{
+public:
+    /**
+     * Creates a new TilePrefetchPlanner.
+     *
+     * @param frames how many frames ahead the camera position is predicted.
+     * @param budget the maximum number of prefetched tiles that have not yet
+     *      been used. Each such tile uses one slot of the tile storage.
+     */
+    TilePrefetchPlanner(int frames = 8, int budget = 64);
+
+    /**
+     * Deletes this TilePrefetchPlanner.
+     */
+    virtual ~TilePrefetchPlanner();
+
+    /**
+     * Returns how many frames ahead the camera position is predicted.
+     */
+    int getFrames();
+
+    /**
+     * Sets how many frames ahead the camera position is predicted.
+     *
+     * @param frames a number of frames.
+     */
+    void setFrames(int frames);
+
+    /**
+     * Returns the maximum number of prefetched tiles that have not yet been
+     * used.
+     */
+    int getBudget();
+
+    /**
+     * Sets the maximum number of prefetched tiles that have not yet been
+     * used.
+     *
+     * @param budget a number of tiles (i.e. of tile storage slots).
+     */
+    void setBudget(int budget);
+
+    /**
+     * Returns the number of prefetched tiles that have not yet been used,
+     * and that are not yet considered as wasted.
+     */
+    int getPendingTiles();
+
+    /**
+     * Returns the statistics of this planner since the last reset.
+     *
+     * @param[out] prefetched the number of tiles prefetched by this planner.
+     * @param[out] used the number of prefetched tiles that were used by the
+     *      TileSampler before they were considered as wasted.
+     * @param[out] wasted the number of prefetched tiles that were not used
+     *      in time.
+     * @param reset true to reset the statistics after they are returned.
+     */
+    void getStats(int &prefetched, int &used, int &wasted, bool reset = true);
+
+    /**
+     * Updates the camera trajectory and schedules the prefetch tasks for the
+     * tiles of the predicted quadtree. Must be called once per frame, after
+     * the %terrain quadtree has been updated.
+     *
+     * @param scene the scene manager.
+     * @param terrain the %terrain whose camera trajectory must be predicted.
+     * @param producer the %producer whose tiles must be prefetched.
+     * @param storeParent true if tiles are needed for non leaf quads.
+     * @param maxTiles the maximum number of tiles that can be prefetched at
+     *      this frame without evicting tiles in use.
+     */
+    void update(ptr<SceneManager> scene, ptr<TerrainNode> terrain, ptr<TileProducer> producer, bool storeParent, int maxTiles);
+
+    /**
+     * Notifies this planner that a tile is used by the TileSampler.
+     *
+     * @param level the tile's quadtree level.
+     * @param tx the tile's quadtree x coordinate.
+     * @param ty the tile's quadtree y coordinate.
+     */
+    void tileUsed(int level, int tx, int ty);
+
+private:
+    /**
+     * How many frames ahead the camera position is predicted.
+     */
+    int frames;
+
+    /**
+     * The maximum number of prefetched tiles that have not yet been used.
+     */
+    int budget;
+
+    /**
+     * True if #camera contains the camera position of a previous frame.
+     */
+    bool hasCamera;
+
+    /**
+     * The camera position in local space at #cameraFrame.
+     */
+    vec3d camera;
+
+    /**
+     * The frame number when #camera was recorded.
+     */
+    unsigned int cameraFrame;
+
+    /**
+     * The smoothed camera velocity in local space, per frame.
+     */
+    vec3d velocity;
+
+    /**
+     * A prefetched tile that has not yet been used.
+     */
+    struct PendingTile
+    {
+        /**
+         * The tile's quadtree level.
+         */
+        int level;
+
+        /**
+         * The tile's quadtree x coordinate.
+         */
+        int tx;
+
+        /**
+         * The tile's quadtree y coordinate.
+         */
+        int ty;
+
+        /**
+         * The frame number at which the tile was prefetched.
+         */
+        unsigned int frame;
+    };
+
+    /**
+     * The prefetched tiles that have not yet been used.
+     */
+    std::map<TileCache::Tile::Key, PendingTile> pending;
+
+    /**
+     * The id of the %producer whose tiles are prefetched.
+     */
+    int producerId;
+
+    /**
+     * The number of tiles prefetched since the last reset of the statistics.
+     */
+    int prefetched;
+
+    /**
+     * The number of prefetched tiles used since the last reset.
+     */
+    int used;
+
+    /**
+     * The number of prefetched tiles wasted since the last reset.
+     */
+    int wasted;
+
+    /**
+     * Prefetches the tiles of the predicted quadtree below the given quad.
+     *
+     * @param terrain the %terrain whose tiles must be prefetched.
+     * @param producer the %producer whose tiles must be prefetched.
+     * @param c the predicted camera position in local space.
+     * @param level the quad level.
+     * @param tx the quad logical x coordinate.
+     * @param ty the quad logical y coordinate.
+     * @param ox the quad physical x coordinate.
+     * @param oy the quad physical y coordinate.
+     * @param l the quad physical size.
+     * @param storeParent true if tiles are needed for non leaf quads.
+     * @param frame the current frame number.
+     * @param[in,out] count the maximum number of tiles that can still be
+     *      prefetched.
+     */
+    void prefetch(ptr<TerrainNode> terrain, ptr<TileProducer> producer, const vec3d &c,
+        int level, int tx, int ty, double ox, double oy, double l, bool storeParent, unsigned int frame, int &count);
+};
+
+}
+
+#endif
@@ -93,6 +93,7 @@ void TileSampler::init(const string &name, ptr<TileProducer> producer)
     this->storeInvisible = true;
     this->async = false;
     this->mipmap = false;
+    this->frameNumber = 0;
     ptr<GPUTileStorage> storage = producer->getCache()->getStorage().cast<GPUTileStorage>();
     assert(storage != NULL);
     lastProgram = NULL;
@@ -181,6 +182,16 @@ void TileSampler::setMipMap(bool mipmap)
     this->mipmap = mipmap;
 }
 
+ptr<TilePrefetchPlanner> TileSampler::getPrefetchPlanner()
+{
+    return planner;
+}
+
+void TileSampler::setPrefetchPlanner(ptr<TilePrefetchPlanner> planner)
+{
+    this->planner = planner;
+}
+
 void TileSampler::checkUniforms()
 {
     ptr<Program> p = SceneManager::getCurrentProgram();
@@ -203,10 +214,25 @@ void TileSampler::checkUniforms()
 }
 
 void TileSampler::setTile(int level, int tx, int ty)
+{
+    vec4f coords;
+    ptr<Texture2DArray> t = getTileCoords(level, tx, ty, coords);
+    if (t == NULL) {
+        return;
+    }
+    int b = producer->getBorder();
+    int s = producer->getCache()->getStorage()->getTileSize();
+
+    samplerU->set(t);
+    coordsU->set(vec3f(coords.x, coords.y, coords.z));
+    sizeU->set(vec3f(coords.w, coords.w, (s / 2) * 2.0f - 2.0f * b));
+}
+
+ptr<Texture2DArray> TileSampler::getTileCoords(int level, int tx, int ty, vec4f &coords)
 {
     checkUniforms();
     if (samplerU == NULL) {
-        return;
+        return NULL;
     }
     TileCache::Tile *t = NULL;
     int b = producer->getBorder();
@@ -270,16 +296,12 @@ void TileSampler::setTile(int level, int tx, int ty)
     float h = gput->getHeight();
     assert(w == h);
 
-    vec4f coords;
     if (s%2 == 0) {
         coords = vec4f((dx + b) / w, (dy + b) / h, float(gput->l), ds / w);
     } else {
         coords = vec4f((dx + b + 0.5f) / w, (dy + b + 0.5f) / h, float(gput->l), ds / w);
     }
-
-    samplerU->set(gput->t);
-    coordsU->set(vec3f(coords.x, coords.y, coords.z));
-    sizeU->set(vec3f(coords.w, coords.w, (s / 2) * 2.0f - 2.0f * b));
+    return gput->t;
 }
 
 void TileSampler::setTileMap()
@@ -326,16 +348,21 @@ ptr<Task> TileSampler::update(ptr<SceneManager> scene, ptr<TerrainQuad> root)
 {
     ptr<TaskGraph> result = new TaskGraph();
     if (terrains.size() == 0) {
+        frameNumber = scene->getFrameNumber();
         producer->update(scene);
         if (storeInvisible) {
             root->getOwner()->splitInvisibleQuads = true;
         }
         if (!async && storeLeaf && this->root != NULL) {
             int prefetchCount = producer->getCache()->getUnusedTiles() + producer->getCache()->getStorage()->getFreeSlots();
-            prefetch(this->root, root, prefetchCount);
+            prefetch(this->root, root.get(), prefetchCount);
+        }
+        putTiles(&(this->root), root.get());
+        getTiles(NULL, &(this->root), root.get(), result);
+        if (planner != NULL && storeLeaf) {
+            int prefetchCount = producer->getCache()->getUnusedTiles() + producer->getCache()->getStorage()->getFreeSlots();
+            planner->update(scene, root->getOwner(), producer, storeParent, prefetchCount);
         }
-        putTiles(&(this->root), root);
-        getTiles(NULL, &(this->root), root, result);
 
         ptr<GPUTileStorage> storage = producer->getCache()->getStorage().cast<GPUTileStorage>();
         if (storage->getTileMap() != NULL) {
@@ -375,7 +402,7 @@ void TileSampler::setDummyTileMap()
     */
    return;
 }
-TileSampler::Tree::Tree(Tree *parent) : newTree(true), needTile(false), parent(parent), t(NULL)
+TileSampler::Tree::Tree(Tree *parent) : newTree(true), needTile(false), prefetched(false), parent(parent), t(NULL)
 {
     children[0] = NULL;
     children[1] = NULL;
@@ -402,7 +429,7 @@ void TileSampler::Tree::recursiveDelete(TileSampler *owner)
     delete this;
 }
 
-bool TileSampler::needTile(ptr<TerrainQuad> q)
+bool TileSampler::needTile(TerrainQuad *q)
 {
     bool needTile = storeLeaf;
     if (!storeParent && (q->children[0] != NULL) && (producer->hasChildren(q->level, q->tx, q->ty))) {
@@ -422,7 +449,7 @@ bool TileSampler::needTile(ptr<TerrainQuad> q)
     return needTile;
 }
 
-void TileSampler::putTiles(Tree **t, ptr<TerrainQuad> q)
+void TileSampler::putTiles(Tree **t, TerrainQuad *q)
 {
     if (*t == NULL) {
         return;
@@ -436,24 +463,28 @@ void TileSampler::putTiles(Tree **t, ptr<TerrainQuad> q)
         if ((*t)->t != NULL) {
             producer->putTile((*t)->t);
             (*t)->t = NULL;
+        } else if ((*t)->prefetched) {
+            producer->cancelTile(q->level, q->tx, q->ty);
+            (*t)->prefetched = false;
         }
     }
 
     if (q->children[0] == NULL) {
         if ((*t)->children[0] != NULL) {
             for (int i = 0; i < 4; ++i) {
+                cancelTiles((*t)->children[i], q->level + 1, 2 * q->tx + (i & 1), 2 * q->ty + (i >> 1));
                 (*t)->children[i]->recursiveDelete(this);
                 (*t)->children[i] = NULL;
             }
         }
     } else if (producer->hasChildren(q->level, q->tx, q->ty)) {
         for (int i = 0; i < 4; ++i) {
-            putTiles(&((*t)->children[i]), q->children[i]);
+            putTiles(&((*t)->children[i]), q->children[i].get());
         }
     }
 }
 
-void TileSampler::getTiles(Tree *parent, Tree **t, ptr<TerrainQuad> q, ptr<TaskGraph> result)
+void TileSampler::getTiles(Tree *parent, Tree **t, TerrainQuad *q, ptr<TaskGraph> result)
 {
     if (*t == NULL) {
         *t = new Tree(parent);
@@ -471,11 +502,16 @@ void TileSampler::getTiles(Tree *parent, Tree **t, ptr<TerrainQuad> q, ptr<TaskG
                 (*t)->t = producer->findTile(q->level, q->tx, q->ty, true);
                 if ((*t)->t == NULL) {
                     if (q->isLeaf()) {
-                        producer->prefetchTile(q->level, q->tx, q->ty);
+                        producer->prefetchTile(q->level, q->tx, q->ty, getDeadline(q));
+                        (*t)->prefetched = true;
                     }
                 } else {
+                    (*t)->prefetched = false;
                     (*t)->t = producer->getTile(q->level, q->tx, q->ty, 0);
                     assert((*t)->t != NULL);
+                    if (planner != NULL) {
+                        planner->tileUsed(q->level, q->tx, q->ty);
+                    }
                 }
             } else {
                 (*t)->t = producer->getTile(q->level, q->tx, q->ty, 0);
@@ -483,6 +519,9 @@ void TileSampler::getTiles(Tree *parent, Tree **t, ptr<TerrainQuad> q, ptr<TaskG
                     Logger::ERROR_LOGGER->log("TERRAIN", "Insufficient tile cache size for '" + name + "' uniform");
                 }
                 assert((*t)->t != NULL);
+                if (planner != NULL) {
+                    planner->tileUsed(q->level, q->tx, q->ty);
+                }
             }
         }
         if ((*t)->t != NULL) {
@@ -495,12 +534,40 @@ void TileSampler::getTiles(Tree *parent, Tree **t, ptr<TerrainQuad> q, ptr<TaskG
 
     if (q->children[0] != NULL && producer->hasChildren(q->level, q->tx, q->ty)) {
         for (int i = 0; i < 4; ++i) {
-            getTiles(*t, &((*t)->children[i]), q->children[i], result);
+            getTiles(*t, &((*t)->children[i]), q->children[i].get(), result);
         }
     }
 }
 
-void TileSampler::prefetch(Tree *t, ptr<TerrainQuad> q, int &prefetchCount)
+void TileSampler::cancelTiles(Tree *t, int level, int tx, int ty)
+{
+    if (t->prefetched) {
+        producer->cancelTile(level, tx, ty);
+        t->prefetched = false;
+    }
+    if (t->children[0] != NULL) {
+        for (int i = 0; i < 4; ++i) {
+            cancelTiles(t->children[i], level + 1, 2 * tx + (i & 1), 2 * ty + (i >> 1));
+        }
+    }
+}
+
+unsigned int TileSampler::getDeadline(TerrainQuad *q)
+{
+    // the ratio between the camera distance and the quad size is inversely
+    // proportional to the screen space size of the quad; it is less than
+    // the split distance for the quads that are subdivided
+    TerrainNode *n = q->getOwner();
+    double ground = TerrainNode::groundHeightAtCamera;
+    float dist = n->getCameraDist(box3d(q->ox, q->ox + q->l, q->oy, q->oy + q->l, min(0.0, ground), max(0.0, ground)));
+    int delay = min(int(8.0 * dist / (q->l * n->getSplitDistance())), 16);
+    if (q->visible == SceneManager::INVISIBLE) {
+        delay += 16;
+    }
+    return frameNumber + 1 + delay;
+}
+
+void TileSampler::prefetch(Tree *t, TerrainQuad *q, int &prefetchCount)
 {
     if (t->children[0] == NULL) {
         if (t->newTree && q != NULL) {
@@ -529,7 +596,7 @@ void TileSampler::prefetch(Tree *t, ptr<TerrainQuad> q, int &prefetchCount)
         }
     } else {
         for (int i = 0; i < 4; ++i) {
-            prefetch(t->children[i], q == NULL ? NULL : q->children[i], prefetchCount);
+            prefetch(t->children[i], q == NULL ? NULL : q->children[i].get(), prefetchCount);
         }
     }
     t->newTree = false;
@@ -554,6 +621,7 @@ void TileSampler::swap(ptr<TileSampler> p)
     std::swap(storeFilters, p->storeFilters);
     std::swap(async, p->async);
     std::swap(mipmap, p->mipmap);
+    std::swap(planner, p->planner);
 }
 
 class TileSamplerResource : public ResourceTemplate<10, TileSampler>
@@ -563,7 +631,7 @@ public:
         ResourceTemplate<10, TileSampler>(manager, name, desc)
     {
         e = e == NULL ? desc->descriptor : e;
-        checkParameters(desc, e, "id,name,sampler,producer,terrains,storeLeaf,storeParent,storeInvisible,async,mipmap,");
+        checkParameters(desc, e, "id,name,sampler,producer,terrains,storeLeaf,storeParent,storeInvisible,async,mipmap,prefetchFrames,prefetchBudget,");
         string uname;
         ptr<TileProducer> producer;
         uname = getParameter(desc, e, "sampler");
@@ -594,6 +662,17 @@ public:
         if (e->Attribute("mipmap") != NULL && strcmp(e->Attribute("mipmap"), "true") == 0) {
             setMipMap(true);
         }
+        if (e->Attribute("prefetchFrames") != NULL || e->Attribute("prefetchBudget") != NULL) {
+            int frames = 8;
+            int budget = 64;
+            if (e->Attribute("prefetchFrames") != NULL) {
+                getIntParameter(desc, e, "prefetchFrames", &frames);
+            }
+            if (e->Attribute("prefetchBudget") != NULL) {
+                getIntParameter(desc, e, "prefetchBudget", &budget);
+            }
+            setPrefetchPlanner(new TilePrefetchPlanner(frames, budget));
+        }
     }
 };
 
@@ -42,10 +42,12 @@
 #ifndef _PROLAND_UNIFORM_SAMPLER_TILE_H_
 #define _PROLAND_UNIFORM_SAMPLER_TILE_H_
 
+#include "ork/render/Texture2DArray.h"
 #include "ork/taskgraph/TaskGraph.h"
 #include "ork/scenegraph/SceneManager.h"
 #include "proland/producer/TileProducer.h"
 #include "proland/terrain/TerrainNode.h"
+#include "proland/terrain/TilePrefetchPlanner.h"
 
 using namespace ork;
 
@@ -195,6 +197,22 @@ public:
      */
     void setMipMap(bool mipmap);
 
+    /**
+     * Returns the planner used to prefetch the tiles needed in the next
+     * frames. May be NULL.
+     */
+    ptr<TilePrefetchPlanner> getPrefetchPlanner();
+
+    /**
+     * Sets the planner used to prefetch the tiles needed in the next frames,
+     * based on the predicted camera trajectory. This requires a scheduler
+     * that supports prefetching.
+     *
+     * @param planner a prefetch planner, or NULL to disable this kind of
+     *      prefetching.
+     */
+    void setPrefetchPlanner(ptr<TilePrefetchPlanner> planner);
+
     /**
      * Sets the GLSL uniforms necessary to access the texture tile for
      * the given quad. This methods does nothing if terrains are associated
@@ -206,6 +224,22 @@ public:
      */
     void setTile(int level, int tx, int ty);
 
+    /**
+     * Returns the location of the texture tile for the given quad, i.e.,
+     * the values that #setTile would set in the GLSL uniforms, without
+     * setting them. This is used to draw several quads with a single draw
+     * call (see DrawTerrainTask).
+     *
+     * @param level a quad level.
+     * @param tx a quad logical x coordinate.
+     * @param ty a quad logical y coordinate.
+     * @param[out] coords the coordinates of the tile in its texture (x,y and
+     *      layer), and the relative size of the tile in this texture (w).
+     * @return the texture containing the tile, or NULL if the current
+     *      program does not use this uniform.
+     */
+    ptr<Texture2DArray> getTileCoords(int level, int tx, int ty, vec4f &coords);
+
     /**
      * Sets the GLSL uniforms necessary to access the texture tiles for
      * arbitrary quads on GPU. This method does nothing if terrains have
@@ -248,6 +282,13 @@ protected:
 
         bool needTile;
 
+        /**
+         * True if the tile of this quad has been requested with
+         * TileProducer#prefetchTile, and not yet acquired with
+         * TileProducer#getTile. Only such tiles can be cancelled.
+         */
+        bool prefetched;
+
         /**
          * The parent quad of this quad.
          */
@@ -306,7 +347,7 @@ protected:
      *
      * @param q a quadtree node.
      */
-    virtual bool needTile(ptr<TerrainQuad> q);
+    virtual bool needTile(TerrainQuad *q);
 
     /**
      * Updates the internal quadtree to make it identical to the given %terrain
@@ -316,7 +357,7 @@ protected:
      * @param t the internal quadtree node corresponding to q.
      * @param q a quadtree node.
      */
-    virtual void putTiles(Tree **t, ptr<TerrainQuad> q);
+    virtual void putTiles(Tree **t, TerrainQuad *q);
 
     /**
      * Updates the internal quadtree to make it identical to the given %terrain
@@ -327,7 +368,29 @@ protected:
      * @param q a quadtree node.
      * @param result the task %graph to collect the tile %producer tasks.
      */
-    virtual void getTiles(Tree *parent, Tree **t, ptr<TerrainQuad> q, ptr<TaskGraph> result);
+    virtual void getTiles(Tree *parent, Tree **t, TerrainQuad *q, ptr<TaskGraph> result);
+
+    /**
+     * Cancels the creation of the tiles that were requested asynchronously
+     * for the given quad and its sub quads, and that are not yet available.
+     * Called when these quads are deleted (see TileProducer#cancelTile).
+     *
+     * @param t the internal quadtree node corresponding to the quad.
+     * @param level the quad level.
+     * @param tx the quad logical x coordinate.
+     * @param ty the quad logical y coordinate.
+     */
+    void cancelTiles(Tree *t, int level, int tx, int ty);
+
+    /**
+     * Returns the deadline of the task to create the tile of the given quad,
+     * in asynchronous mode. This deadline is derived from the screen space
+     * size of the quad, so that the tiles covering the most pixels are
+     * produced first.
+     *
+     * @param q a quadtree node.
+     */
+    unsigned int getDeadline(TerrainQuad *q);
 
     /**
      * Creates prefetch tasks for the sub quads of quads marked as new in
@@ -338,7 +401,7 @@ protected:
      * @param[in,out] prefetchCount the maximum number of prefetch tasks
      *      that can be created by this method.
      */
-    void prefetch(Tree *t, ptr<TerrainQuad> q, int &prefetchCount);
+    void prefetch(Tree *t, TerrainQuad *q, int &prefetchCount);
 
     /**
      * Checks if the last checked Program is the same as the current one,
@@ -443,6 +506,17 @@ private:
      * True if a parent tile can be used instead of the tile itself for rendering.
      */
     bool mipmap;
+
+    /**
+     * The planner used to prefetch the tiles needed in the next frames. May
+     * be NULL.
+     */
+    ptr<TilePrefetchPlanner> planner;
+
+    /**
+     * The current frame number, updated in #update.
+     */
+    unsigned int frameNumber;
 };
 
 }
@@ -570,7 +570,7 @@ ptr<Task> TileSamplerZ::update(ptr<SceneManager> scene, ptr<TerrainQuad> root)
     return result;
 }
 
-bool TileSamplerZ::needTile(ptr<TerrainQuad> q)
+bool TileSamplerZ::needTile(TerrainQuad *q)
 {
     vec3d c = q->getOwner()->getLocalCamera();
     if (c.x >= q->ox && c.x < q->ox + q->l && c.y >= q->oy && c.y < q->oy + q->l) {
@@ -579,7 +579,7 @@ bool TileSamplerZ::needTile(ptr<TerrainQuad> q)
     return TileSampler::needTile(q);
 }
 
-void TileSamplerZ::getTiles(Tree *parent, Tree **t, ptr<TerrainQuad> q, ptr<TaskGraph> result)
+void TileSamplerZ::getTiles(Tree *parent, Tree **t, TerrainQuad *q, ptr<TaskGraph> result)
 {
     if (*t == NULL) {
         *t = new TreeZ(parent, q);
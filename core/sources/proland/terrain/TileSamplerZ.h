@@ -102,9 +102,9 @@ protected:
      */
     virtual void init(const std::string &name, ptr<TileProducer> producer = NULL);
 
-    virtual bool needTile(ptr<TerrainQuad> q);
+    virtual bool needTile(TerrainQuad *q);
 
-    virtual void getTiles(Tree *parent, Tree **t, ptr<TerrainQuad> q, ptr<TaskGraph> result);
+    virtual void getTiles(Tree *parent, Tree **t, TerrainQuad *q, ptr<TaskGraph> result);
 
 private:
     /**
@@ -0,0 +1,268 @@
+/*
+ * Proland: a procedural landscape rendering library.
+ * Website : http://proland.inrialpes.fr/
+ * Copyright (c) 2008-2015 INRIA - LJK (CNRS - Grenoble University)
+ * All rights reserved.
+ * Redistribution and use in source and binary forms, with or without 
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice, 
+ * this list of conditions and the following disclaimer.
+ * 
+ * 2. Redistributions in binary form must reproduce the above copyright notice, 
+ * this list of conditions and the following disclaimer in the documentation 
+ * and/or other materials provided with the distribution.
+ * 
+ * 3. Neither the name of the copyright holder nor the names of its contributors 
+ * may be used to endorse or promote products derived from this software without 
+ * specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND 
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED 
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. 
+ * IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, 
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, 
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, 
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF 
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE 
+ * OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED 
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+/*
+ * Proland is distributed under the Berkeley Software Distribution 3 Licence. 
+ * For any assistance, feedback and enquiries about training programs, you can check out the 
+ * contact page on our website : 
+ * http://proland.inrialpes.fr/
+ */
+/*
+ * Main authors: Eric Bruneton, Antoine Begault, Guillaume Piolat.
+ */
+
+#include "proland/ui/twbar/TweakTileStats.h"
+
+#include "ork/resource/ResourceTemplate.h"
+#include "proland/ui/SceneVisitor.h"
+
+using namespace std;
+using namespace ork;
+
+namespace proland
+{
+
+/**
+ * A SceneVisitor to find the caches and producers of a scene graph.
+ */
+class TileStatsSceneVisitor : public SceneVisitor
+{
+public:
+    ptr<TileStatsWriter> writer;
+
+    set<TileProducer*> producers;
+
+    TileStatsSceneVisitor(ptr<TileStatsWriter> writer) : writer(writer)
+    {
+    }
+
+    virtual ptr<SceneVisitor> visitProducer(ptr<TileProducer> producer)
+    {
+        if (producers.insert(producer.get()).second) {
+            char name[256];
+            Resource *r = dynamic_cast<Resource*>(producer.get());
+            if (r != NULL && r->getName().length() > 0) {
+                sprintf(name, "%s", r->getName().c_str());
+            } else {
+                sprintf(name, "Producer %d", int(producers.size()));
+            }
+            writer->addProducer(name, producer);
+        }
+        return this;
+    }
+
+    virtual ptr<SceneVisitor> visitCache(ptr<TileCache> cache)
+    {
+        char name[256];
+        Resource *r = dynamic_cast<Resource*>(cache.get());
+        if (r != NULL && r->getName().length() > 0) {
+            sprintf(name, "%s", r->getName().c_str());
+        } else {
+            sprintf(name, "Cache %d", writer->getCacheCount() + 1);
+        }
+        writer->addCache(name, cache);
+        return this;
+    }
+};
+
+TweakTileStats::TweakTileStats() : TweakBarHandler()
+{
+}
+
+TweakTileStats::TweakTileStats(ptr<SceneNode> scene, ptr<TileStatsWriter> writer, bool active)
+{
+    init(scene, writer, active);
+}
+
+void TweakTileStats::init(ptr<SceneNode> scene, ptr<TileStatsWriter> writer, bool active)
+{
+    TweakBarHandler::init("Tile statistics", NULL, active);
+    this->scene = scene;
+    this->writer = writer;
+}
+
+TweakTileStats::~TweakTileStats()
+{
+}
+
+void TweakTileStats::redisplay(double t, double dt, bool &needUpdate)
+{
+    writer->newFrame();
+    updateValues();
+    TweakBarHandler::redisplay(t, dt, needUpdate);
+}
+
+void TweakTileStats::updateValues()
+{
+    float frames = float(writer->getFrames());
+    for (unsigned int i = 0; i < cacheValues.size(); ++i) {
+        const TileCache::AccessStats &s = writer->getCacheStats(i);
+        CacheValues &v = cacheValues[i];
+        int queries = s.hits + s.misses + s.failures;
+        v.hitRate = queries == 0 ? 100.0f : (100.0f * s.hits) / queries;
+        v.misses = s.misses / frames;
+        v.evictions = s.evictions / frames;
+        v.prefetchHits = s.prefetchHits / frames;
+        v.wastedPrefetches = s.wastedPrefetches / frames;
+        v.lockWaitTime = float(s.lockWaitTime * 1e-3) / frames;
+    }
+    for (unsigned int i = 0; i < producerValues.size(); ++i) {
+        const TileProducer::CreateStats &s = writer->getProducerStats(i);
+        ProducerValues &v = producerValues[i];
+        v.tiles = s.tiles / frames;
+        v.averageTime = s.tiles == 0 ? 0.0f : float(s.totalTime * 1e-3 / s.tiles);
+        v.p50 = float(s.getPercentile(50.0f) * 1e-3);
+        v.p99 = float(s.getPercentile(99.0f) * 1e-3);
+    }
+}
+
+void TweakTileStats::updateBar(TwBar *bar)
+{
+    writer->clear();
+    ptr<TileStatsSceneVisitor> v = new TileStatsSceneVisitor(writer);
+    v->accept(scene);
+
+    // the vectors must not be resized after this point, since the tweak bar
+    // variables point to their elements
+    cacheValues.assign(writer->getCacheCount(), CacheValues());
+    producerValues.assign(writer->getProducerCount(), ProducerValues());
+    for (unsigned int i = 0; i < cacheValues.size(); ++i) {
+        CacheValues &c = cacheValues[i];
+        c.hitRate = 100.0f;
+        c.misses = c.evictions = c.prefetchHits = c.wastedPrefetches = c.lockWaitTime = 0.0f;
+    }
+    for (unsigned int i = 0; i < producerValues.size(); ++i) {
+        ProducerValues &p = producerValues[i];
+        p.tiles = p.averageTime = p.p50 = p.p99 = 0.0f;
+    }
+
+    char id[256];
+    char def[256];
+    for (int i = 0; i < writer->getCacheCount(); ++i) {
+        char group[256];
+        sprintf(group, "tilestats-cache-%d", i);
+        CacheValues &v = cacheValues[i];
+        sprintf(id, "%s-hits", group);
+        sprintf(def, "label='Hit rate (%%)' group='%s' precision=1", group);
+        TwAddVarRO(bar, id, TW_TYPE_FLOAT, &v.hitRate, def);
+        sprintf(id, "%s-misses", group);
+        sprintf(def, "label='Misses/frame' group='%s' precision=2", group);
+        TwAddVarRO(bar, id, TW_TYPE_FLOAT, &v.misses, def);
+        sprintf(id, "%s-evictions", group);
+        sprintf(def, "label='Evictions/frame' group='%s' precision=2", group);
+        TwAddVarRO(bar, id, TW_TYPE_FLOAT, &v.evictions, def);
+        sprintf(id, "%s-prefetchHits", group);
+        sprintf(def, "label='Prefetch hits/frame' group='%s' precision=2", group);
+        TwAddVarRO(bar, id, TW_TYPE_FLOAT, &v.prefetchHits, def);
+        sprintf(id, "%s-wastedPrefetches", group);
+        sprintf(def, "label='Wasted prefetches/frame' group='%s' precision=2", group);
+        TwAddVarRO(bar, id, TW_TYPE_FLOAT, &v.wastedPrefetches, def);
+        sprintf(id, "%s-lockWait", group);
+        sprintf(def, "label='Lock wait (ms/frame)' group='%s' precision=3", group);
+        TwAddVarRO(bar, id, TW_TYPE_FLOAT, &v.lockWaitTime, def);
+        sprintf(def, "%s/%s group='caches' label='%s' opened='false'", TwGetBarName(bar), group, writer->getCacheName(i).c_str());
+        TwDefine(def);
+    }
+    for (int i = 0; i < writer->getProducerCount(); ++i) {
+        char group[256];
+        sprintf(group, "tilestats-producer-%d", i);
+        ProducerValues &v = producerValues[i];
+        sprintf(id, "%s-tiles", group);
+        sprintf(def, "label='Tiles/frame' group='%s' precision=2", group);
+        TwAddVarRO(bar, id, TW_TYPE_FLOAT, &v.tiles, def);
+        sprintf(id, "%s-average", group);
+        sprintf(def, "label='Average (ms)' group='%s' precision=3", group);
+        TwAddVarRO(bar, id, TW_TYPE_FLOAT, &v.averageTime, def);
+        sprintf(id, "%s-p50", group);
+        sprintf(def, "label='p50 (ms)' group='%s' precision=3", group);
+        TwAddVarRO(bar, id, TW_TYPE_FLOAT, &v.p50, def);
+        sprintf(id, "%s-p99", group);
+        sprintf(def, "label='p99 (ms)' group='%s' precision=3", group);
+        TwAddVarRO(bar, id, TW_TYPE_FLOAT, &v.p99, def);
+        sprintf(def, "%s/%s group='producers' label='%s' opened='false'", TwGetBarName(bar), group, writer->getProducerName(i).c_str());
+        TwDefine(def);
+    }
+    if (writer->getCacheCount() > 0) {
+        sprintf(def, "%s/caches label='Caches' opened='false'", TwGetBarName(bar));
+        TwDefine(def);
+    }
+    if (writer->getProducerCount() > 0) {
+        sprintf(def, "%s/producers label='Producers' opened='false'", TwGetBarName(bar));
+        TwDefine(def);
+    }
+}
+
+void TweakTileStats::swap(ptr<TweakTileStats> o)
+{
+    TweakBarHandler::swap(o);
+    std::swap(scene, o->scene);
+    std::swap(writer, o->writer);
+}
+
+/**
+ * The resource for a TweakTileStats. The optional "frames" attribute gives
+ * the number of frames between two samples (60 by default), and the optional
+ * "file" and "format" ("json" or "csv") attributes specify where and how the
+ * statistics must be written.
+ */
+class TweakTileStatsResource : public ResourceTemplate<55, TweakTileStats>
+{
+public:
+    TweakTileStatsResource(ptr<ResourceManager> manager, const string &name, ptr<ResourceDescriptor> desc, const TiXmlElement *e = NULL) :
+        ResourceTemplate<55, TweakTileStats> (manager, name, desc)
+    {
+        e = e == NULL ? desc->descriptor : e;
+        checkParameters(desc, e, "name,scene,active,frames,file,format,");
+
+        ptr<SceneNode> scene = manager->loadResource(getParameter(desc, e, "scene")).cast<SceneNode>();
+        bool active = true;
+        if (e->Attribute("active") != NULL) {
+            active = strcmp(e->Attribute("active"), "true") == 0;
+        }
+        int frames = 60;
+        if (e->Attribute("frames") != NULL) {
+            getIntParameter(desc, e, "frames", &frames);
+        }
+        TileStatsWriter::Format format = TileStatsWriter::JSON;
+        if (e->Attribute("format") != NULL && strcmp(e->Attribute("format"), "csv") == 0) {
+            format = TileStatsWriter::CSV;
+        }
+        const char *file = e->Attribute("file");
+
+        init(scene, new TileStatsWriter(file, format, frames), active);
+    }
+};
+
+extern const char tweakTileStats[] = "tweakTileStats";
+
+static ResourceFactory::Type<tweakTileStats, TweakTileStatsResource> TweakTileStatsType;
+
+}
@@ -0,0 +1,164 @@
+/*
+ * Proland: a procedural landscape rendering library.
+ * Website : http://proland.inrialpes.fr/
+ * Copyright (c) 2008-2015 INRIA - LJK (CNRS - Grenoble University)
+ * All rights reserved.
+ * Redistribution and use in source and binary forms, with or without 
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice, 
+ * this list of conditions and the following disclaimer.
+ * 
+ * 2. Redistributions in binary form must reproduce the above copyright notice, 
+ * this list of conditions and the following disclaimer in the documentation 
+ * and/or other materials provided with the distribution.
+ * 
+ * 3. Neither the name of the copyright holder nor the names of its contributors 
+ * may be used to endorse or promote products derived from this software without 
+ * specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND 
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED 
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. 
+ * IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, 
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, 
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, 
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF 
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE 
+ * OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED 
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+/*
+ * Proland is distributed under the Berkeley Software Distribution 3 Licence. 
+ * For any assistance, feedback and enquiries about training programs, you can check out the 
+ * contact page on our website : 
+ * http://proland.inrialpes.fr/
+ */
+/*
+ * Main authors: Eric Bruneton, Antoine Begault, Guillaume Piolat.
+ */
+
+#ifndef _PROLAND_TWEAKTILESTATS_H_
+#define _PROLAND_TWEAKTILESTATS_H_
+
+#include <vector>
+
+#include "ork/scenegraph/SceneNode.h"
+#include "proland/producer/TileStatsWriter.h"
+#include "proland/ui/twbar/TweakBarHandler.h"
+
+using namespace ork;
+
+namespace proland
+{
+
+/**
+ * A TweakBarHandler to display the statistics of the tile caches and tile
+ * producers of a scene graph (hit rates, evictions, prefetches, lock wait
+ * times, tile creation times, etc). The statistics are collected every N
+ * frames with a TileStatsWriter, which can also write them to a file.
+ * @ingroup twbar
+ * @authors Eric Bruneton, Antoine Begault
+ */
+PROLAND_API class TweakTileStats : public TweakBarHandler
+{
+public:
+    /**
+     * Creates a new TweakTileStats.
+     *
+     * @param scene the root of the scene graph whose caches and producers
+     *      must be monitored.
+     * @param writer the TileStatsWriter used to collect the statistics.
+     * @param active true if this TweakBarHandler must be initialy active.
+     */
+    TweakTileStats(ptr<SceneNode> scene, ptr<TileStatsWriter> writer, bool active);
+
+    /**
+     * Deletes this TweakTileStats.
+     */
+    virtual ~TweakTileStats();
+
+    virtual void redisplay(double t, double dt, bool &needUpdate);
+
+    virtual void updateBar(TwBar *bar);
+
+protected:
+    /**
+     * Creates an uninitialized TweakTileStats.
+     */
+    TweakTileStats();
+
+    /**
+     * Initializes this TweakTileStats.
+     * See #TweakTileStats.
+     */
+    virtual void init(ptr<SceneNode> scene, ptr<TileStatsWriter> writer, bool active);
+
+    void swap(ptr<TweakTileStats> o);
+
+private:
+    /**
+     * The values displayed for a TileCache, per frame.
+     */
+    struct CacheValues
+    {
+        float hitRate;
+
+        float misses;
+
+        float evictions;
+
+        float prefetchHits;
+
+        float wastedPrefetches;
+
+        float lockWaitTime;
+    };
+
+    /**
+     * The values displayed for a TileProducer, per frame.
+     */
+    struct ProducerValues
+    {
+        float tiles;
+
+        float averageTime;
+
+        float p50;
+
+        float p99;
+    };
+
+    /**
+     * The root of the scene graph whose caches and producers are monitored.
+     */
+    ptr<SceneNode> scene;
+
+    /**
+     * The TileStatsWriter used to collect the statistics.
+     */
+    ptr<TileStatsWriter> writer;
+
+    /**
+     * The values displayed for each cache of #writer. The tweak bar
+     * variables point directly to these values.
+     */
+    std::vector<CacheValues> cacheValues;
+
+    /**
+     * The values displayed for each %producer of #writer. The tweak bar
+     * variables point directly to these values.
+     */
+    std::vector<ProducerValues> producerValues;
+
+    /**
+     * Updates #cacheValues and #producerValues from the last sample of
+     * #writer.
+     */
+    void updateValues();
+};
+
+}
+
+#endif
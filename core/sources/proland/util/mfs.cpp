@@ -391,6 +391,9 @@ int mfs_write (mfs_file *fd, void *clnt_buf, int size)
         if (fd->buf_off + size > fd->buf_size)
         {
             extend_mem_file (fd, fd->buf_off + size);
+            /* A seek past the end leaves a hole, read back as zeros */
+            if (fd->buf_off > fd->buf_size)
+                memset (fd->buf + fd->buf_size, 0, fd->buf_off - fd->buf_size);
             fd->buf_size = (fd->buf_off + size);
         }
 
@@ -327,6 +327,11 @@ void EditOrthoCPUProducer::reset()
     invalidateTiles();
 }
 
+bool EditOrthoCPUProducer::save()
+{
+    return saveTiles(modifiedTiles);
+}
+
 int *EditOrthoCPUProducer::getDeltaColor(int level, int n, int tx, int ty, int x, int y)
 {
     x += tx * tSize;
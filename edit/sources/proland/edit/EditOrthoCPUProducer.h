@@ -91,6 +91,17 @@ public:
      */
     void reset();
 
+    /**
+     * Saves the tiles modified since the last call to #reset in the overlay
+     * of the tiles file (see OrthoCPUProducer#saveTiles). The cost of this
+     * method is proportional to the number of modified tiles, not to the
+     * size of the file. The modified tiles are kept, so that they can be
+     * edited and saved again.
+     *
+     * @return false if the tiles cannot be saved.
+     */
+    bool save();
+
 protected:
     /**
      * Creates an uninitialized EditOrthoCPUProducer.
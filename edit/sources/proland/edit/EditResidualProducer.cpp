@@ -60,10 +60,10 @@ EditResidualProducer::EditResidualProducer(ptr<TileCache> cache, const char *nam
 
 EditResidualProducer::EditResidualProducer() : ResidualProducer()
 {
-    map<TileCache::Tile::Id, float*>::iterator i = modifiedTiles.begin();
-    while (i != modifiedTiles.end()) {
-        delete[] i->second;
-        i++;
+    TileCache::Tile::Key key;
+    TileHashMap<float*>::Iterator i = modifiedTiles.getEntries();
+    while (i.hasNext()) {
+        delete[] i.next(key);
     }
 }
 
@@ -170,20 +170,20 @@ void EditResidualProducer::updateResiduals()
         int level = id.first;
         int tx = id.second.first;
         int ty = id.second.second;
-        TileCache::Tile::Id key = TileCache::Tile::getId(level, tx, ty);
+        TileCache::Tile::Key key = TileCache::Tile::getKey(level, tx, ty);
 
         // finds the modified residual tile, creates it if necessary
         float *modifiedTile = NULL;
-        map<TileCache::Tile::Id, float*>::iterator k = modifiedTiles.find(key);
-        if (k == modifiedTiles.end()) {
+        float **k = modifiedTiles.find(key);
+        if (k == NULL) {
             CPUTileStorage<float>::CPUSlot *slot = new CPUTileStorage<float>::CPUSlot(getCache()->getStorage().get(), tWidth * tWidth);
             doCreateTile(level, tx, ty, slot);
-            modifiedTiles.insert(make_pair(key, slot->data));
+            modifiedTiles.insert(key, slot->data);
             modifiedTile = slot->data;
             slot->data = NULL;
             delete slot;
         } else {
-            modifiedTile = k->second;
+            modifiedTile = *k;
         }
 
         int offset = 2 * tWidth + 2;
@@ -287,15 +287,27 @@ void EditResidualProducer::updateResiduals()
 
 void EditResidualProducer::reset()
 {
-    map<TileCache::Tile::Id, float*>::iterator i = modifiedTiles.begin();
-    while (i != modifiedTiles.end()) {
-        delete[] i->second;
-        i++;
+    TileCache::Tile::Key key;
+    TileHashMap<float*>::Iterator i = modifiedTiles.getEntries();
+    while (i.hasNext()) {
+        delete[] i.next(key);
     }
     modifiedTiles.clear();
     invalidateTiles();
 }
 
+bool EditResidualProducer::save()
+{
+    map<TileCache::Tile::Id, float*> tiles;
+    TileCache::Tile::Key key;
+    TileHashMap<float*>::Iterator i = modifiedTiles.getEntries();
+    while (i.hasNext()) {
+        float *tile = i.next(key);
+        tiles.insert(make_pair(TileCache::Tile::getId(key), tile));
+    }
+    return saveTiles(tiles);
+}
+
 float EditResidualProducer::getDeltaElevation(int level, int w, int n, int tx, int ty, int x, int y)
 {
     x += tx * w;
@@ -332,10 +344,9 @@ float EditResidualProducer::getDeltaElevation(int level, int w, int n, int tx, i
 
 bool EditResidualProducer::doCreateTile(int level, int tx, int ty, TileStorage::Slot *data)
 {
-    TileCache::Tile::Id id = TileCache::Tile::getId(level, tx, ty);
-    map<TileCache::Tile::Id, float*>::iterator it = modifiedTiles.find(id);
-    if (it != modifiedTiles.end()) {
-        float *src = it->second;
+    float **it = modifiedTiles.find(TileCache::Tile::getKey(level, tx, ty));
+    if (it != NULL) {
+        float *src = *it;
         float *dst = dynamic_cast<CPUTileStorage<float>::CPUSlot*>(data)->data;
         int tileWidth = getCache()->getStorage()->getTileSize();
         for (int i = 0; i < tileWidth * tileWidth; ++i) {
@@ -43,6 +43,7 @@
 #define _PROLAND_EDIT_RESIDUAL_PRODUCER_H_
 
 #include "proland/dem/ResidualProducer.h"
+#include "proland/producer/TileHashMap.h"
 
 namespace proland
 {
@@ -89,6 +90,17 @@ public:
      */
     void reset();
 
+    /**
+     * Saves the residual tiles modified since the last call to #reset in the
+     * overlay of the residual tiles file (see ResidualProducer#saveTiles).
+     * The cost of this method is proportional to the number of modified
+     * tiles, not to the size of the file. The modified tiles are kept, so
+     * that they can be edited and saved again.
+     *
+     * @return false if the tiles cannot be saved.
+     */
+    bool save();
+
 protected:
     /**
      * Creates an uninitialized EditResidualProducer.
@@ -129,9 +141,10 @@ private:
     float *curDeltaElevation;
 
     /**
-     * The residual tiles that have been modified.
+     * The residual tiles that have been modified. Maps tile keys (see
+     * TileCache::Tile#getKey) to residual tiles.
      */
-    std::map<TileCache::Tile::Id, float*> modifiedTiles;
+    TileHashMap<float*> modifiedTiles;
 
     /**
      * The elevation deltas from which to recompute the residual tiles.
@@ -212,8 +212,8 @@ void PlantsProducer::produceTiles()
     total = 0;
     plantBounds.clear();
     plantBox = box3d();
-    putTiles(&usedTiles, terrain->root);
-    getTiles(&usedTiles, terrain->root);
+    putTiles(&usedTiles, terrain->root.get());
+    getTiles(&usedTiles, terrain->root.get());
 }
 
 ptr<MeshBuffers> PlantsProducer::getPlantsMesh()
@@ -358,7 +358,7 @@ bool PlantsProducer::mustAmplifyTile(double ox, double oy, double l)
         seg2f(p4, p1).segmentDistSq(c) < d;
 }
 
-void PlantsProducer::putTiles(Tree **t, ptr<TerrainQuad> q)
+void PlantsProducer::putTiles(Tree **t, TerrainQuad *q)
 {
     assert(q->level <= plants->getMaxLevel());
     if (*t == NULL) {
@@ -403,12 +403,12 @@ void PlantsProducer::putTiles(Tree **t, ptr<TerrainQuad> q)
         }
     } else if (q->level < plants->getMaxLevel()) {
         for (int i = 0; i < 4; ++i) {
-            putTiles(&((*t)->children[i]), q->children[i]);
+            putTiles(&((*t)->children[i]), q->children[i].get());
         }
     }
 }
 
-void PlantsProducer::getTiles(Tree **t, ptr<TerrainQuad> q)
+void PlantsProducer::getTiles(Tree **t, TerrainQuad *q)
 {
     assert(q->level <= plants->getMaxLevel());
     if (*t == NULL) {
@@ -490,12 +490,12 @@ void PlantsProducer::getTiles(Tree **t, ptr<TerrainQuad> q)
 
     if (q->children[0] != NULL && q->level < plants->getMaxLevel()) {
         for (int i = 0; i < 4; ++i) {
-            getTiles(&((*t)->children[i]), q->children[i]);
+            getTiles(&((*t)->children[i]), q->children[i].get());
         }
     }
 }
 
-void PlantsProducer::updateTerrainHeights(ptr<TerrainQuad> q)
+void PlantsProducer::updateTerrainHeights(TerrainQuad *q)
 {
     double xmin = q->ox - localCameraPos.x;
     double xmax = q->ox - localCameraPos.x + q->l;
@@ -270,11 +270,11 @@ private:
 
     bool mustAmplifyTile(double ox, double oy, double l);
 
-    void putTiles(Tree **t, ptr<TerrainQuad> q);
+    void putTiles(Tree **t, TerrainQuad *q);
 
-    void getTiles(Tree **t, ptr<TerrainQuad> q);
+    void getTiles(Tree **t, TerrainQuad *q);
 
-    void updateTerrainHeights(ptr<TerrainQuad> q);
+    void updateTerrainHeights(TerrainQuad *q);
 };
 
 }
@@ -90,7 +90,7 @@ Graph *GraphProducer::LazyGraphFactory::newGraph(int nodeCacheSize, int curveCac
 
 GraphProducer::GraphCache::GraphCache(GraphPtr root, string graphName, ptr<ResourceManager> manager, bool loadSubgraphs) : Object("GraphCache")
 {
-    graphs.insert(make_pair(TileCache::Tile::getId(0, 0, 0), root));
+    graphs.insert(TileCache::Tile::getKey(0, 0, 0), root);
     this->manager = manager;
     this->graphName = graphName;
     this->loadSubgraphs = loadSubgraphs;
@@ -103,7 +103,7 @@ GraphProducer::GraphCache::~GraphCache()
 
 void GraphProducer::GraphCache::add(TileCache::Tile::Id id, GraphPtr graph)
 {
-    graphs.insert(make_pair(id, graph));
+    graphs.insert(TileCache::Tile::getKey(id.first, id.second.first, id.second.second), graph);
     // finding the correct file name
     char fileName[100];
     sprintf(fileName, "%s.graph", graphName.c_str());
@@ -134,8 +134,10 @@ void GraphProducer::GraphCache::add(TileCache::Tile::Id id, GraphPtr graph)
 
 GraphPtr GraphProducer::GraphCache::getTile(TileCache::Tile::Id tileId)
 {
-    if (graphs.find(tileId) != graphs.end()) {
-        return graphs[tileId];
+    TileCache::Tile::Key key = TileCache::Tile::getKey(tileId.first, tileId.second.first, tileId.second.second);
+    GraphPtr *g = graphs.find(key);
+    if (g != NULL) {
+        return *g;
     }
     GraphPtr tmp = NULL;
     char fileName[100];
@@ -149,10 +151,10 @@ GraphPtr GraphProducer::GraphCache::getTile(TileCache::Tile::Id tileId)
         }
         sprintf(fileName, "%s/%s_%02d_%02d_%02d.graph", graphName.c_str(), graphBase.c_str(), tileId.first, tileId.second.first, tileId.second.second);
         string filePath = manager->getLoader()->findResource(fileName);
-        tmp = graphs.find(TileCache::Tile::getId(0, 0, 0))->second->createChild();
+        tmp = (*graphs.find(TileCache::Tile::getKey(0, 0, 0)))->createChild();
         tmp->setParent(getTile(TileCache::Tile::getId(0, 0, 0)).get());
         tmp->load(filePath, loadSubgraphs);
-        graphs.insert(make_pair(tileId, tmp));
+        graphs.insert(key, tmp);
 
     } catch(exception) { // In case the manager doesn't find the file, the tile will be computed from the root graph.
         if (Logger::DEBUG_LOGGER != NULL) {
@@ -43,6 +43,7 @@
 #define _PROLAND_GRAPH_PRODUCER_H_
 
 #include "ork/resource/ResourceTemplate.h"
+#include "proland/producer/TileHashMap.h"
 #include "proland/producer/TileProducer.h"
 #include "proland/graph/LazyGraph.h"
 #include "proland/graph/BasicGraph.h"
@@ -173,9 +174,9 @@ public:
         ptr<ResourceManager> manager;
 
         /**
-         * Maps Tile Ids with Graphs.
+         * Maps Tile keys (see TileCache::Tile#getKey) with Graphs.
          */
-        map<TileCache::Tile::Id, GraphPtr> graphs;
+        TileHashMap<GraphPtr> graphs;
     };
 
     /**
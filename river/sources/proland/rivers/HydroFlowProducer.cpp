@@ -212,8 +212,7 @@ vec3d HydroFlowProducer::getTileCoords(int level, int tx, int ty)
 
 void HydroFlowProducer::addUsedTiles(int level, int tx, int ty, TileProducer *producer, set<TileCache::Tile*> tiles)
 {
-    TileCache::Tile::Id id = TileCache::Tile::getId(level, tx, ty);
-    usedTiles.insert(make_pair(id, make_pair(producer, tiles)));
+    usedTiles.insert(TileCache::Tile::getKey(level, tx, ty), make_pair(producer, tiles));
 }
 
 ptr<Task> HydroFlowProducer::startCreateTile(int level, int tx, int ty, unsigned int deadline, ptr<Task> task, ptr<TaskGraph> owner)
@@ -229,10 +229,11 @@ private:
 
     /**
      * The tiles currently in use. These tiles cannot be evicted from the cache
-     * and from the TileStorage, until they become unused. Maps tile identifiers
-     * to used tiles and to the TileProducer that produces those tiles.
+     * and from the TileStorage, until they become unused. Maps tile keys (see
+     * TileCache::Tile#getKey) to used tiles and to the TileProducer that
+     * produces those tiles.
      */
-    map<TileCache::Tile::Id, pair<TileProducer *, set<TileCache::Tile*> > > usedTiles;
+    TileHashMap< pair<TileProducer *, set<TileCache::Tile*> > > usedTiles;
 
     /**
      * Minimum level to start creating tiles.
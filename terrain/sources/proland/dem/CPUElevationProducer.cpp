@@ -41,11 +41,13 @@
 
 #include "proland/dem/CPUElevationProducer.h"
 
+#include <algorithm>
 #include <sstream>
 
 #include "ork/core/Logger.h"
 #include "ork/resource/ResourceTemplate.h"
 #include "ork/taskgraph/TaskGraph.h"
+#include "proland/math/upsample.h"
 #include "proland/producer/CPUTileStorage.h"
 
 using namespace std;
@@ -90,15 +92,15 @@ int CPUElevationProducer::getBorder()
     return 2;
 }
 
-bool CPUElevationProducer::prefetchTile(int level, int tx, int ty)
+bool CPUElevationProducer::prefetchTile(int level, int tx, int ty, unsigned int deadline)
 {
-    bool b = TileProducer::prefetchTile(level, tx, ty);
+    bool b = TileProducer::prefetchTile(level, tx, ty, deadline);
     if (!b) {
         int tileSize = getCache()->getStorage()->getTileSize() - 5;
         int residualTileSize = residualTiles->getCache()->getStorage()->getTileSize() - 5;
         int mod = residualTileSize / tileSize;
         if (residualTiles->hasTile(level, tx / mod, ty / mod)) {
-            residualTiles->prefetchTile(level, tx / mod, ty / mod);
+            residualTiles->prefetchTile(level, tx / mod, ty / mod, deadline);
         }
     }
     return b;
@@ -140,6 +142,106 @@ float CPUElevationProducer::getHeight(ptr<TileProducer> producer, int level, flo
     return tile[sx + sy * tileWidth];
 }
 
+int CPUElevationProducer::getHeights(ptr<TileProducer> producer, int level, int n, const vec2f *points,
+    float *heights, vec3f *normals, int *levels)
+{
+    float rootSize = producer->getRootQuadSize();
+    float s = rootSize / 2.0f;
+    int nTiles = 1 << level;
+    int tileWidth = producer->getCache()->getStorage()->getTileSize();
+    int tileSize = tileWidth - 5;
+
+    // sorts the points by tile, using the tile index at 'level' as key
+    vector< pair<long long, int> > order;
+    order.reserve(n);
+    for (int i = 0; i < n; ++i) {
+        float x = points[i].x;
+        float y = points[i].y;
+        heights[i] = 0.0f;
+        if (normals != NULL) {
+            normals[i] = vec3f(0.0f, 0.0f, 1.0f);
+        }
+        if (levels != NULL) {
+            levels[i] = -1;
+        }
+        if (x <= -s || x >= s || y <= -s || y >= s) {
+            continue;
+        }
+        long long tx = min((long long) floor((x + s) / rootSize * nTiles), (long long) nTiles - 1);
+        long long ty = min((long long) floor((y + s) / rootSize * nTiles), (long long) nTiles - 1);
+        order.push_back(make_pair(tx + (ty << 32), i));
+    }
+    sort(order.begin(), order.end());
+
+    int found = 0;
+    unsigned int first = 0;
+    while (first < order.size()) {
+        long long key = order[first].first;
+        unsigned int last = first + 1;
+        while (last < order.size() && order[last].first == key) {
+            ++last;
+        }
+        int tx = int(key & 0xFFFFFFFF);
+        int ty = int(key >> 32);
+
+        // finds the finest ready tile containing this group of points, and
+        // acquires it so that it cannot be evicted while it is read
+        TileCache::Tile *t = NULL;
+        int l = level;
+        while (l >= 0) {
+            t = producer->getReadyTile(l, tx >> (level - l), ty >> (level - l), true);
+            if (t != NULL) {
+                break;
+            }
+            --l;
+        }
+        if (t == NULL) {
+            if (Logger::INFO_LOGGER != NULL) {
+                Logger::INFO_LOGGER->logf("DEM", "Missing CPUElevation tile [%d:%d:%d] and ancestors", level, tx, ty);
+            }
+            first = last;
+            continue;
+        }
+        CPUTileStorage<float>::CPUSlot *slot = dynamic_cast<CPUTileStorage<float>::CPUSlot*>(t->getData());
+        assert(slot != NULL);
+        const float *tile = slot->data;
+
+        // bilinear interpolation between the samples of the tile; the
+        // sample (i,j) is at (i-2,j-2)*cellSize from the tile's lower left corner
+        float levelTileSize = rootSize / (1 << l);
+        float cellSize = levelTileSize / tileSize;
+        float ox = (tx >> (level - l)) * levelTileSize - s;
+        float oy = (ty >> (level - l)) * levelTileSize - s;
+        for (unsigned int k = first; k < last; ++k) {
+            int i = order[k].second;
+            float fx = 2.0f + (points[i].x - ox) / cellSize;
+            float fy = 2.0f + (points[i].y - oy) / cellSize;
+            int sx = max(2, min(tileSize + 1, (int) floor(fx)));
+            int sy = max(2, min(tileSize + 1, (int) floor(fy)));
+            float u = fx - sx;
+            float v = fy - sy;
+            const float *p = tile + sx + sy * tileWidth;
+            float z00 = p[0];
+            float z10 = p[1];
+            float z01 = p[tileWidth];
+            float z11 = p[tileWidth + 1];
+            heights[i] = (z00 * (1.0f - u) + z10 * u) * (1.0f - v) + (z01 * (1.0f - u) + z11 * u) * v;
+            if (normals != NULL) {
+                float dzdx = ((z10 - z00) * (1.0f - v) + (z11 - z01) * v) / cellSize;
+                float dzdy = ((z01 - z00) * (1.0f - u) + (z11 - z10) * u) / cellSize;
+                normals[i] = vec3f(-dzdx, -dzdy, 1.0f).normalize();
+            }
+            if (levels != NULL) {
+                levels[i] = l;
+            }
+        }
+        producer->putTile(t);
+        found += last - first;
+        first = last;
+    }
+    return found;
+}
+
 ptr<Task> CPUElevationProducer::startCreateTile(int level, int tx, int ty, unsigned int deadline, ptr<Task> task, ptr<TaskGraph> owner)
 {
     ptr<TaskGraph> result = owner == NULL ? createTaskGraph(task) : owner;
@@ -208,53 +310,20 @@ bool CPUElevationProducer::doCreateTile(int level, int tx, int ty, TileStorage::
     int px = 1 + (tx % 2) * tileSize / 2; //select the xy coord in the parent tile
     int py = 1 + (ty % 2) * tileSize / 2;
 
-    float *parentTile = NULL;
+    float *result = cpuData->data;
     if (level > 0) {
-        parentTile = parentCpuData->data;
+        upsample(parentCpuData->data, tileWidth, px, py, tileWidth, result);
+    } else {
+        for (int i = 0; i < tileWidth * tileWidth; ++i) {
+            result[i] = 0.0f;
+        }
     }
 
-    for (int j = 0; j < tileWidth; ++j) {
-        for (int i = 0; i < tileWidth; ++i) {
-            float z;
-            float r = 0.0f;
-
-            if (level == 0) {
-                z = 0.0f;
-            } else {
-                if (j % 2 == 0) {
-                    if (i % 2 == 0) {
-                        z = parentTile[i / 2 + px + (j / 2 + py) * tileWidth];
-                    } else {
-                        float z0 = parentTile[i / 2 + px - 1 + (j / 2 + py) * tileWidth];
-                        float z1 = parentTile[i / 2 + px + (j / 2 + py) * tileWidth];
-                        float z2 = parentTile[i / 2 + px + 1 + (j / 2 + py) * tileWidth];
-                        float z3 = parentTile[i / 2 + px + 2 + (j / 2 + py) * tileWidth];
-                        z = ((z1 + z2) * 9 - (z0 + z3)) / 16;
-                    }
-                } else {
-                    if (i % 2 == 0) {
-                        float z0 = parentTile[i / 2  + px + (j / 2 - 1 + py) * tileWidth];
-                        float z1 = parentTile[i / 2 + px + (j / 2 + py) * tileWidth];
-                        float z2 = parentTile[i / 2 + px + (j / 2 + 1 + py) * tileWidth];
-                        float z3 = parentTile[i / 2 + px + (j / 2 + 2 + py) * tileWidth];
-                        z = ((z1 + z2) * 9 - (z0 + z3)) / 16;
-                    } else {
-                        int di, dj;
-                        z = 0;
-                        for (dj = -1; dj <= 2; ++dj) {
-                            float f = dj == -1 || dj == 2 ? -1/16.0f : 9/16.0f;
-                            for (di = -1; di <= 2; ++di) {
-                                float g = di == -1 || di == 2 ? -1/16.0f : 9/16.0f;
-                                z += f * g * parentTile[i / 2 + di + px + (j / 2 + dj + py) * tileWidth];
-                            }
-                        }
-                    }
-                }
-            }
-            if (hasResidual) {
-                r = cpuTile->data[(int)(i + rx + (j + ry) * residualTileWidth)];
+    if (hasResidual) {
+        for (int j = 0; j < tileWidth; ++j) {
+            for (int i = 0; i < tileWidth; ++i) {
+                result[i + j * tileWidth] += cpuTile->data[i + rx + (j + ry) * residualTileWidth];
             }
-            cpuData->data[i + j * tileWidth] = z + r;
         }
     }
 
@@ -42,6 +42,8 @@
 #ifndef _PROLAND_ELEVATION_PRODUCER_H_
 #define _PROLAND_ELEVATION_PRODUCER_H_
 
+#include "ork/math/vec2.h"
+#include "ork/math/vec3.h"
 #include "proland/producer/TileProducer.h"
 
 namespace proland
@@ -78,7 +80,7 @@ public:
 
     virtual int getBorder();
 
-    virtual bool prefetchTile(int level, int tx, int ty);
+    virtual bool prefetchTile(int level, int tx, int ty, unsigned int deadline = 1u << 31u);
 
     /**
      * Returns the %terrain altitude at a given point, at a given level.
@@ -92,6 +94,34 @@ public:
      */
     static float getHeight(ptr<TileProducer> producer, int level, float x, float y);
 
+    /**
+     * Returns the %terrain altitudes, and optionally the %terrain normals, at
+     * several points. The altitudes are bilinearly interpolated between the
+     * tile samples. For each point, the tile at the given level is used if it
+     * is in cache (used or not) and ready. Otherwise the finest ancestor of
+     * this tile that is in cache and ready is used. Each tile is acquired
+     * while it is read (see TileProducer#getReadyTile), so that it cannot be
+     * evicted in the meantime. The points are grouped by tile, so that the
+     * tile lookups are done only once per tile, and not once per point.
+     * Points outside the %terrain, or without any tile in cache, get a zero
+     * altitude and a vertical normal.
+     *
+     * @param producer a CPUElevationProducer or an equivalent (i.e. a %
+     *      producer using an underlying CPUTileStorage of float type).
+     * @param level the level at which we want to get the altitudes.
+     * @param n the number of points.
+     * @param points the physical x,y coordinates of the points (in meters
+     *      from the %terrain center).
+     * @param[out] heights the altitudes at these points (n values).
+     * @param[out] normals the %terrain normals at these points (n values), or
+     *      NULL if the normals are not needed.
+     * @param[out] levels the level of the tile actually used for each point
+     *      (n values, or -1 if no tile was found), or NULL if not needed.
+     * @return the number of points for which a tile was found.
+     */
+    static int getHeights(ptr<TileProducer> producer, int level, int n, const vec2f *points,
+        float *heights, vec3f *normals = NULL, int *levels = NULL);
+
 protected:
     /**
      * Creates an uninitialized CPUElevationProducer.
@@ -573,8 +573,9 @@ public:
         ResourceTemplate<40, ElevationProducer>(manager, name, desc)
     {
         e = e == NULL ? desc->descriptor : e;
-        checkParameters(desc, e, "name,cache,residuals,face,upsampleProg,blendProg,gridSize,noise,flip,");
+        checkParameters(desc, e, "name,cache,residuals,face,upsampleProg,blendProg,gridSize,noise,flip,diskCache,");
         init(manager, this, name, desc, e);
+        initDiskCache(name, e);
     }
 
     virtual bool prepareUpdate()
@@ -357,7 +357,7 @@ public:
         ptr<Program> normalsProg;
         int gridSize = 24;
         bool deform = false;
-        checkParameters(desc, e, "name,cache,elevations,normalProg,gridSize,deform,");
+        checkParameters(desc, e, "name,cache,elevations,normalProg,gridSize,deform,diskCache,");
         cache = manager->loadResource(getParameter(desc, e, "cache")).cast<TileCache>();
         elevations = manager->loadResource(getParameter(desc, e, "elevations")).cast<TileProducer>();
         string normals = "normalShader;";
@@ -383,6 +383,7 @@ public:
         normalTexture = manager->loadResource(normalTex.str()).cast<Texture2D>();
 
         init(cache, elevations, normalTexture, normalsProg, gridSize, deform);
+        initDiskCache(name, e);
     }
 
     virtual bool prepareUpdate()
@@ -48,10 +48,13 @@
 
 #include "ork/core/Logger.h"
 #include "ork/resource/ResourceTemplate.h"
+#include "proland/math/upsample.h"
 #include "proland/producer/CPUTileStorage.h"
+#include "proland/producer/TileDiskCache.h"
 #include "proland/util/mfs.h"
 
 #include <pthread.h>
+#include <cmath>
 #include <cstring>
 
 using namespace std;
@@ -60,8 +63,6 @@ using namespace ork;
 namespace proland
 {
 
-//#define SINGLE_FILE
-
 #define MAX_TILE_SIZE 256
 
 void *ResidualProducer::key = NULL;
@@ -71,23 +72,27 @@ void residualDelete(void* data)
     delete[] (unsigned char*) data;
 }
 
-ResidualProducer::ResidualProducer(ptr<TileCache> cache, const char *name, int deltaLevel, float zscale) :
+ResidualProducer::ResidualProducer(ptr<TileCache> cache, const char *name, int deltaLevel, float zscale,
+        TileFile::Mode reader) :
     TileProducer("ResidualProducer", "CreateResidualTile")
 {
-    init(cache, name, deltaLevel, zscale);
+    init(cache, name, deltaLevel, zscale, reader);
 }
 
 ResidualProducer::ResidualProducer() : TileProducer("ResidualProducer", "CreateResidualTile")
 {
 }
 
-void ResidualProducer::init(ptr<TileCache> cache, const char *name, int deltaLevel, float zscale)
+void ResidualProducer::init(ptr<TileCache> cache, const char *name, int deltaLevel, float zscale,
+        TileFile::Mode reader)
 {
     TileProducer::init(cache, false);
     this->name = name;
+    this->deltaTile = NULL;
+    mutex = new pthread_mutex_t;
+    pthread_mutex_init((pthread_mutex_t*) mutex, NULL);
 
     if (strlen(name) == 0) {
-        this->tileFile = NULL;
         this->minLevel = 0;
         this->maxLevel = 32;
         this->rootLevel = 0;
@@ -95,22 +100,36 @@ void ResidualProducer::init(ptr<TileCache> cache, const char *name, int deltaLev
         this->rootTx = 0;
         this->rootTy = 0;
         this->scale = 1.0;
+        this->codec = TileCodec::TIFF;
     } else {
-        fopen(&tileFile, name, "rb");
-        if (tileFile == NULL) {
+        codec = TileCodec::TIFF;
+        FILE *file;
+        fopen(&file, name, "rb");
+        if (file == NULL) {
             if (Logger::ERROR_LOGGER != NULL) {
                 Logger::ERROR_LOGGER->log("DEM", "Cannot open file '" + string(name) + "'");
             }
             maxLevel = -1;
             scale = 1.0;
         } else {
-            fread(&minLevel, sizeof(int), 1, tileFile);
-            fread(&maxLevel, sizeof(int), 1, tileFile);
-            fread(&tileSize, sizeof(int), 1, tileFile);
-            fread(&rootLevel, sizeof(int), 1, tileFile);
-            fread(&rootTx, sizeof(int), 1, tileFile);
-            fread(&rootTy, sizeof(int), 1, tileFile);
-            fread(&scale, sizeof(float), 1, tileFile);
+            // files whose tiles are not stored as TIFF files start with a
+            // magic number followed by the codec used for the tiles
+            fread(&minLevel, sizeof(int), 1, file);
+            if (minLevel == TileCodec::MAGIC) {
+                int c;
+                fread(&c, sizeof(int), 1, file);
+                fread(&minLevel, sizeof(int), 1, file);
+                codec = TileCodec::Codec(c);
+                if (!TileCodec::isAvailable(codec) && Logger::ERROR_LOGGER != NULL) {
+                    Logger::ERROR_LOGGER->log("DEM", "Unsupported tile codec '" + string(TileCodec::getName(codec)) + "' in file '" + string(name) + "'");
+                }
+            }
+            fread(&maxLevel, sizeof(int), 1, file);
+            fread(&tileSize, sizeof(int), 1, file);
+            fread(&rootLevel, sizeof(int), 1, file);
+            fread(&rootTx, sizeof(int), 1, file);
+            fread(&rootTy, sizeof(int), 1, file);
+            fread(&scale, sizeof(float), 1, file);
         }
 
         this->deltaLevel = rootLevel == 0 ? deltaLevel : 0;
@@ -118,13 +137,15 @@ void ResidualProducer::init(ptr<TileCache> cache, const char *name, int deltaLev
 
         int ntiles = minLevel + ((1 << (max(maxLevel - minLevel, 0) * 2 + 2)) - 1) / 3;
         header = sizeof(float) + sizeof(int) * (6 + ntiles * 2);
+        if (codec != TileCodec::TIFF) {
+            header += 2 * sizeof(int);
+        }
         offsets = new unsigned int[ntiles * 2];
-        if (tileFile != NULL) {
-            fread(offsets, sizeof(unsigned int) * ntiles * 2, 1, tileFile);
-#ifndef SINGLE_FILE
-            fclose(tileFile);
-            tileFile = NULL;
-#endif
+        if (file != NULL) {
+            fread(offsets, sizeof(unsigned int) * ntiles * 2, 1, file);
+            fclose(file);
+            tileFile = new TileFile(name, reader);
+            overlay = new TileOverlay(name);
         }
 
         if (key == NULL) {
@@ -134,22 +155,15 @@ void ResidualProducer::init(ptr<TileCache> cache, const char *name, int deltaLev
 
         assert(tileSize + 5 < MAX_TILE_SIZE);
         assert(deltaLevel <= minLevel);
-
-#ifdef SINGLE_FILE
-        mutex = new pthread_mutex_t;
-        pthread_mutex_init((pthread_mutex_t*) mutex, NULL);
-#endif
     }
 }
 
 ResidualProducer::~ResidualProducer()
 {
-#ifdef SINGLE_FILE
-    fclose(tileFile);
+    delete[] offsets;
+    delete[] deltaTile;
     pthread_mutex_destroy((pthread_mutex_t*) mutex);
     delete (pthread_mutex_t*) mutex;
-#endif
-    delete[] offsets;
 }
 
 int ResidualProducer::getBorder()
@@ -157,6 +171,16 @@ int ResidualProducer::getBorder()
     return 2;
 }
 
+unsigned long long ResidualProducer::getSourceKey()
+{
+    unsigned long long h = TileDiskCache::getFileKey(name);
+    h = TileDiskCache::fnvMix(h, TileDiskCache::getFileKey(name + ".overlay.index"));
+    for (unsigned int i = 0; i < producers.size(); ++i) {
+        h = TileDiskCache::fnvMix(h, producers[i]->getSourceKey());
+    }
+    return h;
+}
+
 int ResidualProducer::getMinLevel()
 {
     return minLevel;
@@ -188,6 +212,25 @@ bool ResidualProducer::hasTile(int level, int tx, int ty)
     return false;
 }
 
+ptr<Task> ResidualProducer::startCreateTile(int level, int tx, int ty, unsigned int deadline, ptr<Task> task, ptr<TaskGraph> owner)
+{
+    int l = level + deltaLevel - rootLevel;
+    if (tileFile != NULL && l >= 0 && l <= maxLevel && (tx >> l) == rootTx && (ty >> l) == rootTy) {
+        int first = getTileId(l, tx - (rootTx << l), ty - (rootTy << l));
+        int last = first;
+        if (deltaLevel > 0 && l == deltaLevel) {
+            // see doCreateTile
+            pthread_mutex_lock((pthread_mutex_t*) mutex);
+            if (deltaTile == NULL) {
+                first = getTileId(0, 0, 0);
+            }
+            pthread_mutex_unlock((pthread_mutex_t*) mutex);
+        }
+        tileFile->willNeed(header + offsets[2 * first], offsets[2 * last + 1] - offsets[2 * first]);
+    }
+    return TileProducer::startCreateTile(level, tx, ty, deadline, task, owner);
+}
+
 bool ResidualProducer::doCreateTile(int level, int tx, int ty, TileStorage::Slot *data)
 {
     int l = level + deltaLevel - rootLevel;
@@ -223,20 +266,23 @@ bool ResidualProducer::doCreateTile(int level, int tx, int ty, TileStorage::Slot
 
         unsigned char *tsData = (unsigned char*) pthread_getspecific(*((pthread_key_t*) key));
         if (tsData == NULL) {
-            tsData = new unsigned char[MAX_TILE_SIZE * MAX_TILE_SIZE * 4];
+            tsData = new unsigned char[MAX_TILE_SIZE * MAX_TILE_SIZE * (4 + sizeof(float))];
             pthread_setspecific(*((pthread_key_t*) key), tsData);
         }
         unsigned char *compressedData = tsData;
         unsigned char *uncompressedData = tsData + MAX_TILE_SIZE * MAX_TILE_SIZE * 2;
+        float *tmp = (float*) (tsData + MAX_TILE_SIZE * MAX_TILE_SIZE * 4);
 
         if (deltaLevel > 0 && level == deltaLevel) {
-            float *tmp = new float[(tileSize + 5) * (tileSize + 5)];
-            readTile(0, 0, 0, compressedData, uncompressedData, NULL, cpuData->data);
-            for (int i = 1; i <= deltaLevel; ++i) {
-                upsample(i, 0, 0, cpuData->data, tmp);
-                readTile(i, 0, 0, compressedData, uncompressedData, tmp, cpuData->data);
+            // the levels 0 to deltaLevel-1 are synthesized only once, so
+            // that the root tile then costs one upsample and one decode
+            pthread_mutex_lock((pthread_mutex_t*) mutex);
+            if (deltaTile == NULL) {
+                createDeltaTile(compressedData, uncompressedData, tmp);
             }
-            delete[] tmp;
+            upsample(deltaLevel, 0, 0, deltaTile, tmp);
+            pthread_mutex_unlock((pthread_mutex_t*) mutex);
+            readTile(deltaLevel, 0, 0, compressedData, uncompressedData, tmp, cpuData->data);
         } else {
             readTile(level, tx, ty, compressedData, uncompressedData, NULL, cpuData->data);
         }
@@ -258,10 +304,12 @@ void ResidualProducer::swap(ptr<ResidualProducer> p)
     std::swap(maxLevel, p->maxLevel);
     std::swap(scale, p->scale);
     std::swap(header, p->header);
+    std::swap(codec, p->codec);
     std::swap(offsets, p->offsets);
-    std::swap(mutex, p->mutex);
     std::swap(tileFile, p->tileFile);
+    std::swap(overlay, p->overlay);
     std::swap(producers, p->producers);
+    std::swap(deltaTile, p->deltaTile);
 }
 
 int ResidualProducer::getTileSize(int level)
@@ -301,55 +349,67 @@ void ResidualProducer::readTile(int level, int tx, int ty,
         }
     } else {
         int tileid = getTileId(level, tx, ty);
-        int fsize = offsets[2 * tileid + 1] - offsets[2 * tileid];
-        assert(fsize < (tileSize + 5) * (tileSize + 5) * 2);
-
-#ifdef SINGLE_FILE
-        pthread_mutex_lock((pthread_mutex_t*) mutex);
-        fseek64(tileFile, header + offsets[2 * tileid], SEEK_SET);
-        fread(compressedData, fsize, 1, tileFile);
-        pthread_mutex_unlock((pthread_mutex_t*) mutex);
-#else
-        FILE *file;
-        fopen(&file, name.c_str(), "rb");
-        fseek64(file, header + offsets[2 * tileid], SEEK_SET);
-        fread(compressedData, fsize, 1, file);
-        fclose(file);
-#endif
-        /*ifstream fs(name.c_str(), ios::binary);
-        fs.seekg(header + offsets[2 * tileid], ios::beg);
-        fs.read((char*) compressedData, fsize);
-        fs.close();*/
-
-        // TODO compare perfs FILE vs ifstream vs mmap
-
-        mfs_file fd;
-        mfs_open(compressedData, fsize, (char *)"r", &fd);
-        TIFF* tf = TIFFClientOpen("name", "r", &fd,
-            (TIFFReadWriteProc) mfs_read, (TIFFReadWriteProc) mfs_write, (TIFFSeekProc) mfs_lseek,
-            (TIFFCloseProc) mfs_close, (TIFFSizeProc) mfs_size, (TIFFMapFileProc) mfs_map,
-            (TIFFUnmapFileProc) mfs_unmap);
-        TIFFReadEncodedStrip(tf, 0, uncompressedData, (tsize_t) -1);
-        TIFFClose(tf);
-
-        if (tile != NULL) {
-            for (int j = 0; j < tilesize; ++j) {
-                for (int i = 0; i < tilesize; ++i) {
-                    int off = 2 * (i + j * tilesize);
-                    int toff = i + j * (tileSize + 5);
-                    short z = short(uncompressedData[off + 1]) << 8 | short(uncompressedData[off]);
-                    result[toff] = tile[toff] + z * scale;
-                }
+        int fsize;
+        void *handle = NULL;
+        const unsigned char *src;
+        if (overlay->read(tileid, compressedData, MAX_TILE_SIZE * MAX_TILE_SIZE * 2, fsize)) {
+            src = compressedData;
+        } else {
+            fsize = offsets[2 * tileid + 1] - offsets[2 * tileid];
+            assert(fsize < (tileSize + 5) * (tileSize + 5) * 2);
+            // the compressed data is decoded directly from the memory mapped
+            // file when possible (otherwise it is read in compressedData)
+            src = tileFile->read(header + offsets[2 * tileid], fsize, compressedData, handle);
+        }
+        if (src != NULL && codec != TileCodec::TIFF) {
+            if (!TileCodec::decompress(codec, src, fsize, uncompressedData, tilesize * tilesize * 2)) {
+                memset(uncompressedData, 0, tilesize * tilesize * 2);
             }
+        } else if (src != NULL) {
+            mfs_file fd;
+            mfs_open((void*) src, fsize, (char *)"r", &fd);
+            TIFF* tf = TIFFClientOpen("name", "r", &fd,
+                (TIFFReadWriteProc) mfs_read, (TIFFReadWriteProc) mfs_write, (TIFFSeekProc) mfs_lseek,
+                (TIFFCloseProc) mfs_close, (TIFFSizeProc) mfs_size, (TIFFMapFileProc) mfs_map,
+                (TIFFUnmapFileProc) mfs_unmap);
+            TIFFReadEncodedStrip(tf, 0, uncompressedData, (tsize_t) -1);
+            TIFFClose(tf);
         } else {
-            for (int j = 0; j < tilesize; ++j) {
-                for (int i = 0; i < tilesize; ++i) {
-                    int off = 2 * (i + j * tilesize);
-                    short z = short(uncompressedData[off + 1]) << 8 | short(uncompressedData[off]);
-                    result[i + j * (tileSize + 5)] = z * scale;
+            memset(uncompressedData, 0, tilesize * tilesize * 2);
+        }
+        tileFile->release(handle);
+
+        // the children of this tile will probably be needed soon
+        if (level < maxLevel) {
+            int ntiles = minLevel + ((1 << (max(maxLevel - minLevel, 0) * 2 + 2)) - 1) / 3;
+            if (level + 1 <= minLevel) {
+                // there is a single tile per level up to minLevel
+                int child = getTileId(level + 1, 0, 0);
+                tileFile->willNeed(header + offsets[2 * child], offsets[2 * child + 1] - offsets[2 * child]);
+            } else {
+                for (int j = 0; j < 2; ++j) {
+                    int first = min(getTileId(level + 1, 2 * tx, 2 * ty + j), ntiles - 1);
+                    int last = min(getTileId(level + 1, 2 * tx + 1, 2 * ty + j), ntiles - 1);
+                    tileFile->willNeed(header + offsets[2 * first], offsets[2 * last + 1] - offsets[2 * first]);
                 }
             }
         }
+
+        for (int j = 0; j < tilesize; ++j) {
+            int toff = j * (tileSize + 5);
+            TileCodec::decodeShorts(uncompressedData + 2 * j * tilesize, tilesize, scale,
+                tile == NULL ? NULL : tile + toff, result + toff);
+        }
+    }
+}
+
+void ResidualProducer::createDeltaTile(unsigned char *compressedData, unsigned char *uncompressedData, float *tmp)
+{
+    deltaTile = new float[(tileSize + 5) * (tileSize + 5)];
+    readTile(0, 0, 0, compressedData, uncompressedData, NULL, deltaTile);
+    for (int i = 1; i < deltaLevel; ++i) {
+        upsample(i, 0, 0, deltaTile, tmp);
+        readTile(i, 0, 0, compressedData, uncompressedData, tmp, deltaTile);
     }
 }
 
@@ -359,42 +419,77 @@ void ResidualProducer::upsample(int level, int tx, int ty, float *parentTile, fl
     int tilesize = getTileSize(level);
     int px = 1 + (tx % 2) * tilesize / 2;
     int py = 1 + (ty % 2) * tilesize / 2;
-    for (int j = 0; j <= tilesize + 4; ++j) {
-        for (int i = 0; i <= tilesize + 4; ++i) {
-            float z;
-            if (j%2 == 0) {
-                if (i%2 == 0) {
-                    z = parentTile[i/2+px + (j/2+py)*n];
-                } else {
-                    float z0 = parentTile[i/2+px-1 + (j/2+py)*n];
-                    float z1 = parentTile[i/2+px + (j/2+py)*n];
-                    float z2 = parentTile[i/2+px+1 + (j/2+py)*n];
-                    float z3 = parentTile[i/2+px+2 + (j/2+py)*n];
-                    z = ((z1+z2)*9-(z0+z3))/16;
-                }
-            } else {
-                if (i%2 == 0) {
-                    float z0 = parentTile[i/2+px + (j/2-1+py)*n];
-                    float z1 = parentTile[i/2+px + (j/2+py)*n];
-                    float z2 = parentTile[i/2+px + (j/2+1+py)*n];
-                    float z3 = parentTile[i/2+px + (j/2+2+py)*n];
-                    z = ((z1+z2)*9-(z0+z3))/16;
-                } else {
-                    int di, dj;
-                    z = 0.0;
-                    for (dj = -1; dj <= 2; ++dj) {
-                        float f = dj == -1 || dj == 2 ? -1/16.0f : 9/16.0f;
-                        for (di = -1; di <= 2; ++di) {
-                            float g = di == -1 || di == 2 ? -1/16.0f : 9/16.0f;
-                            z += f*g*parentTile[i/2+di+px + (j/2+dj+py)*n];
-                        }
-                    }
-                }
+    proland::upsample(parentTile, n, px, py, tilesize + 5, result);
+}
+
+bool ResidualProducer::saveTiles(const map<TileCache::Tile::Id, float*> &tiles)
+{
+    if (overlay == NULL) {
+        if (Logger::ERROR_LOGGER != NULL) {
+            Logger::ERROR_LOGGER->log("DEM", "Cannot save residual tiles without file");
+        }
+        return false;
+    }
+
+    int n = tileSize + 5;
+    unsigned char *tsData = new unsigned char[MAX_TILE_SIZE * MAX_TILE_SIZE * (4 + sizeof(float))];
+    unsigned char *tile = tsData + MAX_TILE_SIZE * MAX_TILE_SIZE * 2;
+    float *tmp = (float*) (tsData + MAX_TILE_SIZE * MAX_TILE_SIZE * 4);
+    map< int, vector<unsigned char> > data;
+    bool ok = true;
+
+    map<TileCache::Tile::Id, float*>::const_iterator i = tiles.begin();
+    for (; ok && i != tiles.end(); ++i) {
+        int level = i->first.first + deltaLevel - rootLevel;
+        int tx = i->first.second.first;
+        int ty = i->first.second.second;
+        if (level < 0 || level > maxLevel || (tx >> level) != rootTx || (ty >> level) != rootTy) {
+            continue;
+        }
+        tx = tx - (rootTx << level);
+        ty = ty - (rootTy << level);
+
+        // the root tile is stored as a residual from the tile synthesized
+        // from the levels 0 to deltaLevel-1 (see doCreateTile)
+        const float *parent = NULL;
+        if (deltaLevel > 0 && level == deltaLevel) {
+            pthread_mutex_lock((pthread_mutex_t*) mutex);
+            if (deltaTile == NULL) {
+                createDeltaTile(tsData, tile, tmp);
             }
-            int off = i + j * n;
-            result[off] = z;
+            upsample(deltaLevel, 0, 0, deltaTile, tmp);
+            pthread_mutex_unlock((pthread_mutex_t*) mutex);
+            parent = tmp;
+        }
+
+        // quantizes the residuals as in HeightMipmap::encodeTile
+        int tilesize = getTileSize(level) + 5;
+        for (int y = 0; y < tilesize; ++y) {
+            for (int x = 0; x < tilesize; ++x) {
+                float r = i->second[x + y * n] - (parent == NULL ? 0.0f : parent[x + y * n]);
+                int z = max(-32768, min(int(roundf(r / scale)), 32767));
+                int off = x + y * tilesize;
+                tile[2 * off] = z & 0xFF;
+                tile[2 * off + 1] = (z >> 8) & 0xFF;
+            }
+        }
+
+        vector<unsigned char> &result = data[getTileId(level, tx, ty)];
+        if (codec != TileCodec::TIFF) {
+            ok = TileCodec::compress(codec, tile, tilesize * tilesize * 2, result);
+        } else {
+            ok = TileCodec::compressTiff(tile, tilesize, 2, 0, result);
         }
     }
+    delete[] tsData;
+
+    if (!ok) {
+        if (Logger::ERROR_LOGGER != NULL) {
+            Logger::ERROR_LOGGER->log("DEM", "Cannot encode residual tiles of '" + name + "'");
+        }
+        return false;
+    }
+    return overlay->write(data);
 }
 
 void ResidualProducer::init(ptr<ResourceManager> manager, Resource *r, const string &name, ptr<ResourceDescriptor> desc, const TiXmlElement *e)
@@ -404,6 +499,7 @@ void ResidualProducer::init(ptr<ResourceManager> manager, Resource *r, const str
     string file;
     int deltaLevel = 0;
     float zscale = 1.0;
+    TileFile::Mode reader = TileFile::MMAP;
     cache = manager->loadResource(r->getParameter(desc, e, "cache")).cast<TileCache>();
     if (e->Attribute("file") != NULL) {
         file = r->getParameter(desc, e, "file");
@@ -415,7 +511,13 @@ void ResidualProducer::init(ptr<ResourceManager> manager, Resource *r, const str
     if (e->Attribute("delta") != NULL) {
         r->getIntParameter(desc, e, "delta", &deltaLevel);
     }
-    init(cache, file.c_str(), deltaLevel, zscale);
+    if (e->Attribute("reader") != NULL && !TileFile::getMode(e->Attribute("reader"), reader)) {
+        if (Logger::ERROR_LOGGER != NULL) {
+            Resource::log(Logger::ERROR_LOGGER, desc, e, "Invalid reader (must be mmap, pread or uring)");
+        }
+        throw exception();
+    }
+    init(cache, file.c_str(), deltaLevel, zscale, reader);
     const TiXmlNode *n = e->FirstChild();
     while (n != NULL) {
         const TiXmlElement *f = n->ToElement();
@@ -440,7 +542,7 @@ public:
         ResourceTemplate<2, ResidualProducer>(manager, name, desc)
     {
         e = e == NULL ? desc->descriptor : e;
-        checkParameters(desc, e, "name,cache,file,delta,scale,");
+        checkParameters(desc, e, "name,cache,file,delta,scale,reader,");
         init(manager, this, name, desc, e);
     }
 };
@@ -45,6 +45,9 @@
 #include <string>
 
 #include "ork/resource/Resource.h"
+#include "proland/producer/TileCodec.h"
+#include "proland/producer/TileFile.h"
+#include "proland/producer/TileOverlay.h"
 #include "proland/producer/TileProducer.h"
 
 using namespace ork;
@@ -73,8 +76,10 @@ public:
      *      the root level in this %producer. Must be less than or equal to
      *      #getMinLevel().
      * @param zscale a vertical scaling factor to be applied to all elevations.
+     * @param reader how the file containing the tiles must be read.
      */
-    ResidualProducer(ptr<TileCache> cache, const char *name, int deltaLevel = 0, float zscale = 1.0);
+    ResidualProducer(ptr<TileCache> cache, const char *name, int deltaLevel = 0, float zscale = 1.0,
+        TileFile::Mode reader = TileFile::MMAP);
 
     /**
      * Deletes this ResidualProducer.
@@ -98,6 +103,12 @@ public:
 
     virtual bool hasTile(int level, int tx, int ty);
 
+    /**
+     * Returns a key computed from the residual tiles file, its overlay, and
+     * the files of the subproducers (see TileDiskCache#getFileKey).
+     */
+    virtual unsigned long long getSourceKey();
+
 protected:
     /**
      * Creates an uninitialized ResidualProducer.
@@ -109,7 +120,8 @@ protected:
      *
      * See #ResidualProducer.
      */
-    void init(ptr<TileCache> cache, const char *name, int deltaLevel = 0, float zscale = 1.0);
+    void init(ptr<TileCache> cache, const char *name, int deltaLevel = 0, float zscale = 1.0,
+        TileFile::Mode reader = TileFile::MMAP);
 
     /**
      * Initializes this ResidualProducer from a Resource.
@@ -135,6 +147,13 @@ protected:
      */
     int getDeltaLevel();
 
+    /**
+     * Announces the tiles needed to produce the given tile to the TileFile,
+     * so that they can be read asynchronously, together with the other tiles
+     * requested during the same frame.
+     */
+    virtual ptr<Task> startCreateTile(int level, int tx, int ty, unsigned int deadline, ptr<Task> task, ptr<TaskGraph> owner);
+
     virtual bool doCreateTile(int level, int tx, int ty, TileStorage::Slot *data);
 
     virtual void swap(ptr<ResidualProducer> p);
@@ -152,6 +171,19 @@ protected:
      */
     void upsample(int level, int tx, int ty, float *parentTile, float *result);
 
+    /**
+     * Saves the given tiles in the overlay of the residual tiles file (see
+     * TileOverlay). Only these tiles are encoded, with the codec of this file,
+     * and written to disk. They then replace the corresponding stored tiles,
+     * for this %producer and for any %producer subsequently created with
+     * the same file. The tiles of the subproducers are ignored.
+     *
+     * @param tiles the tiles to save, in the format produced by
+     *      #doCreateTile, indexed by their coordinates in this %producer.
+     * @return false if the tiles cannot be saved.
+     */
+    bool saveTiles(const std::map<TileCache::Tile::Id, float*> &tiles);
+
 private:
     /**
      * The name of the file containing the residual tiles to load.
@@ -218,6 +250,11 @@ private:
      */
     unsigned int header;
 
+    /**
+     * The codec used to compress the tiles stored on disk.
+     */
+    TileCodec::Codec codec;
+
     /**
      * The offsets of each tile on disk, relatively to #offset, for each
      * tile id (see #getTileId).
@@ -225,14 +262,14 @@ private:
     unsigned int* offsets;
 
     /**
-     * A mutex used to serializes accesses to the file storing the tiles.
+     * The file storing the residual tiles on disk.
      */
-    void *mutex;
+    ptr<TileFile> tileFile;
 
     /**
-     * The file storing the residual tiles on disk.
+     * The overlay of #tileFile, containing the tiles saved with #saveTiles.
      */
-    FILE *tileFile;
+    ptr<TileOverlay> overlay;
 
     /**
      * The "subproducers" providing more details in some regions.
@@ -240,6 +277,19 @@ private:
      */
     std::vector< ptr<ResidualProducer> > producers;
 
+    /**
+     * The residual tile of level #deltaLevel - 1 synthesized from the stored
+     * tiles of levels 0 to #deltaLevel - 1, or NULL if it has not been computed
+     * yet. It avoids decoding and upsampling all these levels each time the
+     * root tile must be produced (see #doCreateTile).
+     */
+    float *deltaTile;
+
+    /**
+     * A mutex to serialize the computation and the accesses to #deltaTile.
+     */
+    void *mutex;
+
     /**
      * A key to store thread specific buffers used to produce the tiles.
      */
@@ -265,6 +315,15 @@ private:
      */
     int getTileId(int level, int tx, int ty);
 
+    /**
+     * Computes #deltaTile. The mutex must be locked.
+     *
+     * @param compressedData a buffer to store compressed tile data.
+     * @param uncompressedData a buffer to store uncompressed tile data.
+     * @param tmp a buffer to store an upsampled tile.
+     */
+    void createDeltaTile(unsigned char *compressedData, unsigned char *uncompressedData, float *tmp);
+
     /**
      * Reads compressed tile data on disk, uncompress it and scale it with
      * #scale.
@@ -0,0 +1,655 @@
+/*
+ * Proland: a procedural landscape rendering library.
+ * Website : http://proland.inrialpes.fr/
+ * Copyright (c) 2008-2015 INRIA - LJK (CNRS - Grenoble University)
+ * All rights reserved.
+ * Redistribution and use in source and binary forms, with or without 
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice, 
+ * this list of conditions and the following disclaimer.
+ * 
+ * 2. Redistributions in binary form must reproduce the above copyright notice, 
+ * this list of conditions and the following disclaimer in the documentation 
+ * and/or other materials provided with the distribution.
+ * 
+ * 3. Neither the name of the copyright holder nor the names of its contributors 
+ * may be used to endorse or promote products derived from this software without 
+ * specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND 
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED 
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. 
+ * IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, 
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, 
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, 
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF 
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE 
+ * OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED 
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+/*
+ * Proland is distributed under the Berkeley Software Distribution 3 Licence. 
+ * For any assistance, feedback and enquiries about training programs, you can check out the 
+ * contact page on our website : 
+ * http://proland.inrialpes.fr/
+ */
+/*
+ * Main authors: Eric Bruneton, Antoine Begault, Guillaume Piolat.
+ */
+
+#include "proland/dem/TerrainRayCaster.h"
+
+#include <algorithm>
+#include <pthread.h>
+
+#include "ork/core/Logger.h"
+#include "ork/taskgraph/TaskGraph.h"
+#include "proland/producer/CPUTileStorage.h"
+#include "proland/terrain/CylindricalDeformation.h"
+#include "proland/terrain/SphericalDeformation.h"
+
+using namespace std;
+using namespace ork;
+
+namespace proland
+{
+
+/**
+ * The minimum distance of the intersections with the segments tested by
+ * TerrainRayCaster#isVisible, relatively to the segment lengths.
+ */
+static const double SEGMENT_EPSILON = 1e-6;
+
+struct TerrainRayCaster::Query
+{
+    vec3d origin;
+
+    vec3d dir;
+
+    double tmin;
+
+    double tmax;
+
+    bool anyHit;
+
+    bool found;
+
+    vec3d normal;
+
+    int level;
+};
+
+struct TerrainRayCaster::MinMaxTile
+{
+    /**
+     * The completion date of the creation task of the tile, when this
+     * pyramid was computed.
+     */
+    unsigned int date;
+
+    /**
+     * The number of queries using this pyramid.
+     */
+    int users;
+
+    /**
+     * True if this pyramid has been removed from TerrainRayCaster#minMaxTiles,
+     * and must be deleted when it is no longer used.
+     */
+    bool removed;
+
+    /**
+     * The number of blocks per row and per column at each pyramid level.
+     * The blocks at level k contain 2^k x 2^k cells (less on the borders).
+     */
+    vector<int> sizes;
+
+    /**
+     * The offset of the blocks of each level in #zmin and #zmax.
+     */
+    vector<int> offsets;
+
+    /**
+     * The minimum altitude of each block.
+     */
+    vector<float> zmin;
+
+    /**
+     * The maximum altitude of each block.
+     */
+    vector<float> zmax;
+
+    MinMaxTile(const float *tile, int tileSize, int tileWidth, unsigned int date) :
+        date(date), users(0), removed(false)
+    {
+        int total = 0;
+        for (int n = tileSize; ; n = (n + 1) / 2) {
+            sizes.push_back(n);
+            offsets.push_back(total);
+            total += n * n;
+            if (n == 1) {
+                break;
+            }
+        }
+        zmin.resize(total);
+        zmax.resize(total);
+        // the cell (i,j) is between the samples (i+2,j+2) and (i+3,j+3)
+        for (int j = 0; j < tileSize; ++j) {
+            for (int i = 0; i < tileSize; ++i) {
+                const float *z = tile + (i + 2) + (j + 2) * tileWidth;
+                int b = getBlock(0, i, j);
+                zmin[b] = min(min(z[0], z[1]), min(z[tileWidth], z[tileWidth + 1]));
+                zmax[b] = max(max(z[0], z[1]), max(z[tileWidth], z[tileWidth + 1]));
+            }
+        }
+        for (int k = 1; k < (int) sizes.size(); ++k) {
+            int n = sizes[k - 1];
+            for (int bj = 0; bj < sizes[k]; ++bj) {
+                for (int bi = 0; bi < sizes[k]; ++bi) {
+                    int b = getBlock(k, bi, bj);
+                    zmin[b] = INFINITY;
+                    zmax[b] = -INFINITY;
+                    for (int c = 0; c < 4; ++c) {
+                        int ci = 2 * bi + (c & 1);
+                        int cj = 2 * bj + (c >> 1);
+                        if (ci < n && cj < n) {
+                            int s = getBlock(k - 1, ci, cj);
+                            zmin[b] = min(zmin[b], zmin[s]);
+                            zmax[b] = max(zmax[b], zmax[s]);
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+    /**
+     * Returns the index in #zmin and #zmax of the block (bi,bj) of level k.
+     */
+    inline int getBlock(int k, int bi, int bj) const
+    {
+        return offsets[k] + bi + bj * sizes[k];
+    }
+};
+
+class TerrainRayCaster::QueryTask : public Task
+{
+public:
+    const TerrainRayCaster *owner;
+
+    Query *queries;
+
+    int n;
+
+    QueryTask(const TerrainRayCaster *owner, Query *queries, int n) :
+        Task("TerrainRayCasterTask", false, 0), owner(owner), queries(queries), n(n)
+    {
+    }
+
+    virtual ~QueryTask()
+    {
+    }
+
+    virtual bool run()
+    {
+        for (int i = 0; i < n; ++i) {
+            owner->process(queries[i]);
+        }
+        return true;
+    }
+};
+
+/**
+ * Clips the parametric range [t0,t1] of a ray to a slab [mn,mx] along one
+ * axis. Returns false if the clipped range is empty.
+ */
+static inline bool clipSlab(double o, double d, double mn, double mx, double &t0, double &t1)
+{
+    if (d == 0.0) {
+        return o >= mn && o <= mx;
+    }
+    double a = (mn - o) / d;
+    double b = (mx - o) / d;
+    if (a > b) {
+        std::swap(a, b);
+    }
+    t0 = max(t0, a);
+    t1 = min(t1, b);
+    return t0 <= t1;
+}
+
+/**
+ * Clips the parametric range [t0,t1] of a ray to a box. Returns false if the
+ * clipped range is empty.
+ */
+static inline bool clipBox(const box3d &b, const vec3d &o, const vec3d &d, double &t0, double &t1)
+{
+    return clipSlab(o.x, d.x, b.xmin, b.xmax, t0, t1) &&
+        clipSlab(o.y, d.y, b.ymin, b.ymax, t0, t1) &&
+        clipSlab(o.z, d.z, b.zmin, b.zmax, t0, t1);
+}
+
+/**
+ * Sorts at most four (entry distance, index) pairs by increasing distance.
+ */
+static inline void sortEntries(pair<double, int> *entries, int n)
+{
+    for (int i = 1; i < n; ++i) {
+        pair<double, int> e = entries[i];
+        int j = i;
+        while (j > 0 && entries[j - 1].first > e.first) {
+            entries[j] = entries[j - 1];
+            --j;
+        }
+        entries[j] = e;
+    }
+}
+
+TerrainRayCaster::TerrainRayCaster(ptr<TerrainNode> terrain, ptr<TileProducer> elevations) :
+    Object("TerrainRayCaster"), terrain(terrain), elevations(elevations), radius(0.0), cylindrical(false)
+{
+    ptr<SphericalDeformation> s = terrain->deform.cast<SphericalDeformation>();
+    ptr<CylindricalDeformation> c = terrain->deform.cast<CylindricalDeformation>();
+    if (s != NULL) {
+        radius = s->R;
+    } else if (c != NULL) {
+        radius = c->R;
+        cylindrical = true;
+    }
+    mutex = new pthread_mutex_t;
+    pthread_mutex_init((pthread_mutex_t*) mutex, NULL);
+}
+
+TerrainRayCaster::~TerrainRayCaster()
+{
+    map<TileCache::Tile::Id, MinMaxTile*>::iterator i = minMaxTiles.begin();
+    while (i != minMaxTiles.end()) {
+        delete i->second;
+        ++i;
+    }
+    pthread_mutex_destroy((pthread_mutex_t*) mutex);
+    delete (pthread_mutex_t*) mutex;
+}
+
+ptr<TerrainNode> TerrainRayCaster::getTerrain()
+{
+    return terrain;
+}
+
+ptr<TileProducer> TerrainRayCaster::getElevations()
+{
+    return elevations;
+}
+
+bool TerrainRayCaster::intersect(const Ray &ray, Hit &hit) const
+{
+    Query query;
+    query.origin = ray.origin;
+    query.dir = ray.direction;
+    query.tmin = 0.0;
+    query.tmax = ray.maxDistance;
+    query.anyHit = false;
+    process(query);
+    hit.hit = query.found;
+    hit.distance = query.found ? query.tmax : 0.0;
+    hit.position = query.origin + query.dir * hit.distance;
+    hit.normal = query.normal;
+    hit.level = query.level;
+    return query.found;
+}
+
+bool TerrainRayCaster::isVisible(const vec3d &p, const vec3d &q) const
+{
+    Query query;
+    query.origin = p;
+    query.dir = q - p;
+    query.tmin = SEGMENT_EPSILON;
+    query.tmax = 1.0 - SEGMENT_EPSILON;
+    query.anyHit = true;
+    process(query);
+    return !query.found;
+}
+
+int TerrainRayCaster::intersect(int n, const Ray *rays, Hit *hits, ptr<Scheduler> scheduler, int batchSize) const
+{
+    vector<Query> queries(n);
+    for (int i = 0; i < n; ++i) {
+        queries[i].origin = rays[i].origin;
+        queries[i].dir = rays[i].direction;
+        queries[i].tmin = 0.0;
+        queries[i].tmax = rays[i].maxDistance;
+        queries[i].anyHit = false;
+    }
+    if (scheduler == NULL || n <= batchSize) {
+        for (int i = 0; i < n; ++i) {
+            process(queries[i]);
+        }
+    } else {
+        ptr<TaskGraph> graph = new TaskGraph();
+        for (int i = 0; i < n; i += batchSize) {
+            graph->addTask(new QueryTask(this, &queries[i], min(batchSize, n - i)));
+        }
+        scheduler->run(graph);
+    }
+    int found = 0;
+    for (int i = 0; i < n; ++i) {
+        const Query &q = queries[i];
+        hits[i].hit = q.found;
+        hits[i].distance = q.found ? q.tmax : 0.0;
+        hits[i].position = q.origin + q.dir * hits[i].distance;
+        hits[i].normal = q.normal;
+        hits[i].level = q.level;
+        found += q.found ? 1 : 0;
+    }
+    return found;
+}
+
+int TerrainRayCaster::isVisible(int n, const vec3d *p, const vec3d *q, bool *visible, ptr<Scheduler> scheduler, int batchSize) const
+{
+    vector<Query> queries(n);
+    for (int i = 0; i < n; ++i) {
+        queries[i].origin = p[i];
+        queries[i].dir = q[i] - p[i];
+        queries[i].tmin = SEGMENT_EPSILON;
+        queries[i].tmax = 1.0 - SEGMENT_EPSILON;
+        queries[i].anyHit = true;
+    }
+    if (scheduler == NULL || n <= batchSize) {
+        for (int i = 0; i < n; ++i) {
+            process(queries[i]);
+        }
+    } else {
+        ptr<TaskGraph> graph = new TaskGraph();
+        for (int i = 0; i < n; i += batchSize) {
+            graph->addTask(new QueryTask(this, &queries[i], min(batchSize, n - i)));
+        }
+        scheduler->run(graph);
+    }
+    int count = 0;
+    for (int i = 0; i < n; ++i) {
+        visible[i] = !queries[i].found;
+        count += visible[i] ? 1 : 0;
+    }
+    return count;
+}
+
+box3d TerrainRayCaster::getDeformedBounds(double x0, double y0, double x1, double y1, double zmin, double zmax) const
+{
+    if (radius == 0.0) {
+        return box3d(x0, x1, y0, y1, zmin, zmax);
+    }
+    // bounds of a 3x3 grid of deformed points at zmin and zmax; any point of
+    // the box is at most at half a grid cell diagonal from a grid point (in
+    // local space), and the local to deformed mapping at a given altitude is
+    // k-Lipschitz, so enlarging the bounds by k times this distance gives
+    // conservative bounds (see SphericalDeformation and CylindricalDeformation)
+    const Deformation *d = terrain->deform.get();
+    vec3d p = d->localToDeformed(vec3d(x0, y0, zmin));
+    box3d b(p.x, p.x, p.y, p.y, p.z, p.z);
+    for (int j = 0; j < 3; ++j) {
+        double y = y0 + (y1 - y0) * j * 0.5;
+        for (int i = 0; i < 3; ++i) {
+            double x = x0 + (x1 - x0) * i * 0.5;
+            b = b.enlarge(d->localToDeformed(vec3d(x, y, zmin)));
+            b = b.enlarge(d->localToDeformed(vec3d(x, y, zmax)));
+        }
+    }
+    double k = cylindrical ? max(1.0, (radius - zmin) / radius) : (radius + zmax) / radius;
+    double hx = (x1 - x0) * 0.25;
+    double hy = (y1 - y0) * 0.25;
+    double e = k * sqrt(hx * hx + hy * hy);
+    return box3d(b.xmin - e, b.xmax + e, b.ymin - e, b.ymax + e, b.zmin - e, b.zmax + e);
+}
+
+void TerrainRayCaster::process(Query &query) const
+{
+    query.found = false;
+    query.normal = vec3d(0.0, 0.0, 1.0);
+    query.level = -1;
+    const TerrainQuad *root = terrain->root.get();
+    double t0 = query.tmin;
+    double t1 = query.tmax;
+    box3d b = getDeformedBounds(root->ox, root->oy, root->ox + root->l, root->oy + root->l, root->zmin, root->zmax);
+    if (t0 <= t1 && clipBox(b, query.origin, query.dir, t0, t1)) {
+        intersectQuad(root, query);
+    }
+}
+
+void TerrainRayCaster::intersectQuad(const TerrainQuad *q, Query &query) const
+{
+    if (!q->isLeaf()) {
+        // visits the children intersected by the ray, front to back
+        pair<double, int> entries[4];
+        int n = 0;
+        for (int i = 0; i < 4; ++i) {
+            const TerrainQuad *c = q->children[i].get();
+            double t0 = query.tmin;
+            double t1 = query.tmax;
+            box3d b = getDeformedBounds(c->ox, c->oy, c->ox + c->l, c->oy + c->l, c->zmin, c->zmax);
+            if (clipBox(b, query.origin, query.dir, t0, t1)) {
+                entries[n++] = make_pair(t0, i);
+            }
+        }
+        sortEntries(entries, n);
+        for (int i = 0; i < n; ++i) {
+            if (entries[i].first > query.tmax || (query.anyHit && query.found)) {
+                break;
+            }
+            intersectQuad(q->children[entries[i].second].get(), query);
+        }
+        return;
+    }
+
+    // finds and acquires the finest ready elevation tile containing this
+    // leaf quad, so that it cannot be evicted while it is used
+    TileCache::Tile *t = NULL;
+    int l = q->level;
+    while (l >= 0) {
+        t = elevations->getReadyTile(l, q->tx >> (q->level - l), q->ty >> (q->level - l), true);
+        if (t != NULL) {
+            break;
+        }
+        --l;
+    }
+    if (t == NULL) {
+        if (Logger::INFO_LOGGER != NULL) {
+            Logger::INFO_LOGGER->logf("DEM", "Missing CPUElevation tile [%d:%d:%d] and ancestors", q->level, q->tx, q->ty);
+        }
+        return;
+    }
+    CPUTileStorage<float>::CPUSlot *slot = dynamic_cast<CPUTileStorage<float>::CPUSlot*>(t->getData());
+    assert(slot != NULL);
+
+    // the cells of this tile covered by the quad (all the cells if l == q->level)
+    int tileSize = elevations->getCache()->getStorage()->getTileSize() - 5;
+    int d = q->level - l;
+    int mask = (1 << d) - 1;
+    double n = double(1 << d);
+    double cellSize = q->l * n / tileSize;
+    double ox = q->ox - (q->tx & mask) * q->l;
+    double oy = q->oy - (q->ty & mask) * q->l;
+    int i0 = max(0, (int) floor((q->tx & mask) * tileSize / n));
+    int j0 = max(0, (int) floor((q->ty & mask) * tileSize / n));
+    int i1 = min(tileSize, (int) ceil(((q->tx & mask) + 1) * tileSize / n));
+    int j1 = min(tileSize, (int) ceil(((q->ty & mask) + 1) * tileSize / n));
+    MinMaxTile *m = getMinMaxTile(t, slot->data);
+    intersectCells(slot->data, m, l, ox, oy, cellSize, int(m->sizes.size()) - 1, 0, 0, i0, j0, i1, j1, query);
+    putMinMaxTile(m);
+    elevations->putTile(t);
+}
+
+TerrainRayCaster::MinMaxTile *TerrainRayCaster::getMinMaxTile(TileCache::Tile *t, const float *tile) const
+{
+    TileCache::Tile::Id id = t->getId();
+    unsigned int date = t->task->getCompletionDate();
+    pthread_mutex_lock((pthread_mutex_t*) mutex);
+    map<TileCache::Tile::Id, MinMaxTile*>::iterator i = minMaxTiles.find(id);
+    if (i != minMaxTiles.end() && i->second->date == date) {
+        MinMaxTile *m = i->second;
+        m->users += 1;
+        pthread_mutex_unlock((pthread_mutex_t*) mutex);
+        return m;
+    }
+    pthread_mutex_unlock((pthread_mutex_t*) mutex);
+
+    // computes the pyramid without holding the lock, so that the other
+    // queries are not blocked meanwhile
+    int tileWidth = elevations->getCache()->getStorage()->getTileSize();
+    MinMaxTile *m = new MinMaxTile(tile, tileWidth - 5, tileWidth, date);
+
+    pthread_mutex_lock((pthread_mutex_t*) mutex);
+    i = minMaxTiles.find(id);
+    if (i != minMaxTiles.end()) {
+        if (i->second->date == date) {
+            // the pyramid was computed by another thread in the meantime
+            delete m;
+            m = i->second;
+            m->users += 1;
+            pthread_mutex_unlock((pthread_mutex_t*) mutex);
+            return m;
+        }
+        // the tile was recreated since its pyramid was computed
+        if (i->second->users == 0) {
+            delete i->second;
+        } else {
+            i->second->removed = true;
+        }
+        minMaxTiles.erase(i);
+    }
+    m->users = 1;
+    minMaxTiles.insert(make_pair(id, m));
+
+    // removes the unused pyramids of the tiles that are no longer in cache;
+    // this is only done when there are twice as many pyramids as tiles in
+    // cache, so that its cost is amortized over many new pyramids
+    if ((int) minMaxTiles.size() > 2 * elevations->getCache()->getStorage()->getCapacity()) {
+        i = minMaxTiles.begin();
+        while (i != minMaxTiles.end()) {
+            const TileCache::Tile::Id &c = i->first;
+            if (i->second->users == 0 && elevations->findTile(c.first, c.second.first, c.second.second, true) == NULL) {
+                delete i->second;
+                minMaxTiles.erase(i++);
+            } else {
+                ++i;
+            }
+        }
+    }
+    pthread_mutex_unlock((pthread_mutex_t*) mutex);
+    return m;
+}
+
+void TerrainRayCaster::putMinMaxTile(MinMaxTile *m) const
+{
+    pthread_mutex_lock((pthread_mutex_t*) mutex);
+    m->users -= 1;
+    if (m->removed && m->users == 0) {
+        delete m;
+    }
+    pthread_mutex_unlock((pthread_mutex_t*) mutex);
+}
+
+void TerrainRayCaster::intersectCells(const float *tile, const MinMaxTile *m, int level, double ox, double oy, double cellSize,
+    int k, int bi, int bj, int i0, int j0, int i1, int j1, Query &query) const
+{
+    if (k == 0) {
+        intersectCell(tile, level, ox, oy, cellSize, bi, bj, query);
+        return;
+    }
+
+    // visits the (at most) four sub blocks of this block that contain cells
+    // in [i0,i1[x[j0,j1[ and that are intersected by the ray, front to back
+    // (the altitude bounds of the sub blocks that are only partially in this
+    // range are conservative)
+    int n = m->sizes[k - 1];
+    int s = 1 << (k - 1);
+    pair<double, int> entries[4];
+    int count = 0;
+    for (int c = 0; c < 4; ++c) {
+        int ci = 2 * bi + (c & 1);
+        int cj = 2 * bj + (c >> 1);
+        if (ci >= n || cj >= n) {
+            continue;
+        }
+        int ci0 = max(ci * s, i0);
+        int cj0 = max(cj * s, j0);
+        int ci1 = min((ci + 1) * s, i1);
+        int cj1 = min((cj + 1) * s, j1);
+        if (ci0 >= ci1 || cj0 >= cj1) {
+            continue;
+        }
+        int b = m->getBlock(k - 1, ci, cj);
+        double t0 = query.tmin;
+        double t1 = query.tmax;
+        box3d box = getDeformedBounds(ox + ci0 * cellSize, oy + cj0 * cellSize,
+            ox + ci1 * cellSize, oy + cj1 * cellSize, m->zmin[b], m->zmax[b]);
+        if (clipBox(box, query.origin, query.dir, t0, t1)) {
+            entries[count++] = make_pair(t0, c);
+        }
+    }
+    sortEntries(entries, count);
+    for (int i = 0; i < count; ++i) {
+        if (entries[i].first > query.tmax || (query.anyHit && query.found)) {
+            break;
+        }
+        int c = entries[i].second;
+        intersectCells(tile, m, level, ox, oy, cellSize, k - 1, 2 * bi + (c & 1), 2 * bj + (c >> 1), i0, j0, i1, j1, query);
+    }
+}
+
+/**
+ * Intersects a ray with a triangle. Returns the distance of the
+ * intersection along the ray, or -1 if there is no intersection.
+ */
+static inline double intersectTriangle(const vec3d &o, const vec3d &d, const vec3d &p0, const vec3d &e1, const vec3d &e2)
+{
+    vec3d p = d.crossProduct(e2);
+    double det = e1.dotproduct(p);
+    if (det == 0.0) {
+        return -1.0;
+    }
+    double invDet = 1.0 / det;
+    vec3d s = o - p0;
+    double u = s.dotproduct(p) * invDet;
+    if (u < 0.0 || u > 1.0) {
+        return -1.0;
+    }
+    vec3d q = s.crossProduct(e1);
+    double v = d.dotproduct(q) * invDet;
+    if (v < 0.0 || u + v > 1.0) {
+        return -1.0;
+    }
+    return e2.dotproduct(q) * invDet;
+}
+
+void TerrainRayCaster::intersectCell(const float *tile, int level, double ox, double oy, double cellSize,
+    int i, int j, Query &query) const
+{
+    int tileWidth = elevations->getCache()->getStorage()->getTileSize();
+    const float *z = tile + (i + 2) + (j + 2) * tileWidth;
+    double x0 = ox + i * cellSize;
+    double y0 = oy + j * cellSize;
+    double x1 = x0 + cellSize;
+    double y1 = y0 + cellSize;
+    const Deformation *d = terrain->deform.get();
+    vec3d p00 = d->localToDeformed(vec3d(x0, y0, z[0]));
+    vec3d p10 = d->localToDeformed(vec3d(x1, y0, z[1]));
+    vec3d p01 = d->localToDeformed(vec3d(x0, y1, z[tileWidth]));
+    vec3d p11 = d->localToDeformed(vec3d(x1, y1, z[tileWidth + 1]));
+
+    // the cell is split in two triangles along its (0,0)-(1,1) diagonal
+    vec3d e[3] = { p10 - p00, p11 - p00, p01 - p00 };
+    for (int k = 0; k < 2; ++k) {
+        double t = intersectTriangle(query.origin, query.dir, p00, e[k], e[k + 1]);
+        if (t >= query.tmin && t <= query.tmax) {
+            vec3d n = e[k].crossProduct(e[k + 1]).normalize();
+            query.tmax = t;
+            query.normal = n.dotproduct(query.dir) > 0.0 ? -n : n;
+            query.level = level;
+            query.found = true;
+        }
+    }
+}
+
+}
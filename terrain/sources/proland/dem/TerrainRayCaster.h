@@ -0,0 +1,318 @@
+/*
+ * Proland: a procedural landscape rendering library.
+ * Website : http://proland.inrialpes.fr/
+ * Copyright (c) 2008-2015 INRIA - LJK (CNRS - Grenoble University)
+ * All rights reserved.
+ * Redistribution and use in source and binary forms, with or without 
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice, 
+ * this list of conditions and the following disclaimer.
+ * 
+ * 2. Redistributions in binary form must reproduce the above copyright notice, 
+ * this list of conditions and the following disclaimer in the documentation 
+ * and/or other materials provided with the distribution.
+ * 
+ * 3. Neither the name of the copyright holder nor the names of its contributors 
+ * may be used to endorse or promote products derived from this software without 
+ * specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND 
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED 
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. 
+ * IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, 
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, 
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, 
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF 
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE 
+ * OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED 
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+/*
+ * Proland is distributed under the Berkeley Software Distribution 3 Licence. 
+ * For any assistance, feedback and enquiries about training programs, you can check out the 
+ * contact page on our website : 
+ * http://proland.inrialpes.fr/
+ */
+/*
+ * Main authors: Eric Bruneton, Antoine Begault, Guillaume Piolat.
+ */
+
+#ifndef _PROLAND_TERRAIN_RAY_CASTER_H_
+#define _PROLAND_TERRAIN_RAY_CASTER_H_
+
+#include <map>
+
+#include "ork/math/box3.h"
+#include "ork/math/vec3.h"
+#include "ork/taskgraph/Scheduler.h"
+#include "proland/producer/TileProducer.h"
+#include "proland/terrain/TerrainNode.h"
+
+namespace proland
+{
+
+/**
+ * Intersects rays and segments with a %terrain on CPU. The %terrain surface
+ * is the one defined by the tiles of a CPUElevationProducer (or of an
+ * equivalent producer using a CPUTileStorage of float type), triangulated
+ * with two triangles per tile cell, and deformed with the %terrain
+ * deformation. The intersections are found with a hierarchical min/max
+ * traversal: the TerrainQuad quadtree of the %terrain is first traversed
+ * front to back, using the TerrainQuad#zmin and TerrainQuad#zmax bounds,
+ * down to its leaves. The finest elevation tile that is in cache and ready
+ * is then used for each leaf quad, and is itself traversed with a min/max
+ * pyramid of its cells. This pyramid is computed once per tile, when the
+ * tile is first used, and is kept until the tile is evicted from the cache.
+ *
+ * Flat (i.e. Deformation), SphericalDeformation and CylindricalDeformation
+ * terrains are supported. All the coordinates are in the %terrain
+ * <i>deformed</i> space (see TerrainNode#deform). Queries can be made from
+ * any thread, and batched queries can be parallelised with a Scheduler,
+ * but the %terrain quadtree must not be updated at the same time (i.e. the
+ * queries must not overlap a TerrainNode#update). The elevation tiles are
+ * acquired with TileProducer#getReadyTile during their use, and released
+ * with TileProducer#putTile, so that they cannot be evicted from the cache
+ * during a query.
+ * @ingroup dem
+ * @authors Eric Bruneton, Antoine Begault, Guillaume Piolat
+ */
+PROLAND_API class TerrainRayCaster : public Object
+{
+public:
+    /**
+     * A ray or segment query.
+     */
+    struct Ray
+    {
+        /**
+         * The ray origin, in the %terrain deformed space.
+         */
+        vec3d origin;
+
+        /**
+         * The ray direction, in the %terrain deformed space. Need not be
+         * normalized.
+         */
+        vec3d direction;
+
+        /**
+         * The maximum distance along the ray, in units of the direction
+         * length (i.e. 1 for a segment from origin to origin + direction).
+         */
+        double maxDistance;
+    };
+
+    /**
+     * The result of a ray query.
+     */
+    struct Hit
+    {
+        /**
+         * True if the ray intersects the %terrain.
+         */
+        bool hit;
+
+        /**
+         * The distance to the intersection along the ray, in units of the
+         * ray direction length.
+         */
+        double distance;
+
+        /**
+         * The intersection point, in the %terrain deformed space.
+         */
+        vec3d position;
+
+        /**
+         * The unit normal of the intersected triangle, in the %terrain
+         * deformed space, oriented towards the ray origin.
+         */
+        vec3d normal;
+
+        /**
+         * The level of the elevation tile used for the intersection.
+         */
+        int level;
+    };
+
+    /**
+     * Creates a new TerrainRayCaster.
+     *
+     * @param terrain the %terrain to intersect. Its quadtree is used to skip
+     *      the regions that cannot be intersected. Its quad bounds must
+     *      enclose the elevations produced by elevations (which is the case
+     *      if they are computed from the same residuals, with a TileSamplerZ).
+     * @param elevations a CPUElevationProducer, or an equivalent (i.e. a
+     *      %producer using an underlying CPUTileStorage of float type), for
+     *      the same %terrain.
+     */
+    TerrainRayCaster(ptr<TerrainNode> terrain, ptr<TileProducer> elevations);
+
+    /**
+     * Deletes this TerrainRayCaster.
+     */
+    virtual ~TerrainRayCaster();
+
+    /**
+     * Returns the %terrain to intersect.
+     */
+    ptr<TerrainNode> getTerrain();
+
+    /**
+     * Returns the %producer of the elevation tiles.
+     */
+    ptr<TileProducer> getElevations();
+
+    /**
+     * Finds the first intersection of a ray with the %terrain.
+     *
+     * @param ray the ray to intersect with the %terrain.
+     * @param[out] hit the first intersection, if any.
+     * @return true if the ray intersects the %terrain.
+     */
+    bool intersect(const Ray &ray, Hit &hit) const;
+
+    /**
+     * Returns true if the segment between two points does not intersect the
+     * %terrain. This is faster than #intersect, because the traversal stops
+     * at the first intersection found, which is not necessarily the nearest.
+     * The two end points themselves are excluded from the test, so that
+     * points lying on the %terrain surface can be tested.
+     *
+     * @param p a point, in the %terrain deformed space.
+     * @param q another point, in the %terrain deformed space.
+     */
+    bool isVisible(const vec3d &p, const vec3d &q) const;
+
+    /**
+     * Finds the first intersection of several rays with the %terrain.
+     *
+     * @param n the number of rays.
+     * @param rays the rays to intersect with the %terrain (n values).
+     * @param[out] hits the first intersection of each ray (n values).
+     * @param scheduler the scheduler used to process the rays in parallel,
+     *      by batches of batchSize rays, or NULL to process them in the
+     *      current thread.
+     * @param batchSize the number of rays per task.
+     * @return the number of rays that intersect the %terrain.
+     */
+    int intersect(int n, const Ray *rays, Hit *hits, ptr<Scheduler> scheduler = NULL, int batchSize = 256) const;
+
+    /**
+     * Tests the visibility between several pairs of points.
+     *
+     * @param n the number of pairs of points.
+     * @param p the first point of each pair (n values).
+     * @param q the second point of each pair (n values).
+     * @param[out] visible true for each pair whose segment does not
+     *      intersect the %terrain (n values).
+     * @param scheduler the scheduler used to process the pairs in parallel,
+     *      by batches of batchSize pairs, or NULL to process them in the
+     *      current thread.
+     * @param batchSize the number of pairs per task.
+     * @return the number of visible pairs.
+     */
+    int isVisible(int n, const vec3d *p, const vec3d *q, bool *visible, ptr<Scheduler> scheduler = NULL, int batchSize = 256) const;
+
+private:
+    /**
+     * A ray being traversed.
+     */
+    struct Query;
+
+    /**
+     * A task to process a batch of queries.
+     */
+    class QueryTask;
+
+    /**
+     * The min/max pyramid of the cells of an elevation tile.
+     */
+    struct MinMaxTile;
+
+    /**
+     * The %terrain to intersect.
+     */
+    ptr<TerrainNode> terrain;
+
+    /**
+     * The %producer of the elevation tiles.
+     */
+    ptr<TileProducer> elevations;
+
+    /**
+     * The radius of the %terrain deformation, or 0 for a flat %terrain.
+     */
+    double radius;
+
+    /**
+     * True if the %terrain deformation is a CylindricalDeformation.
+     */
+    bool cylindrical;
+
+    /**
+     * The min/max pyramids of the elevation tiles, indexed by tile
+     * coordinates. Contains at most one pyramid per tile in cache, plus
+     * the pyramids of the tiles evicted since the last cleanup.
+     */
+    mutable std::map<TileCache::Tile::Id, MinMaxTile*> minMaxTiles;
+
+    /**
+     * A mutex to serialize parallel accesses to #minMaxTiles.
+     */
+    void *mutex;
+
+    /**
+     * Returns the min/max pyramid of the given elevation tile, computing it
+     * if necessary. The returned pyramid must be released with
+     * #putMinMaxTile.
+     *
+     * @param t an elevation tile, acquired with TileProducer#getReadyTile.
+     * @param tile the elevation samples of this tile.
+     */
+    MinMaxTile *getMinMaxTile(TileCache::Tile *t, const float *tile) const;
+
+    /**
+     * Releases a pyramid returned by #getMinMaxTile.
+     */
+    void putMinMaxTile(MinMaxTile *m) const;
+
+    /**
+     * Returns a box in deformed space that contains the deformed points of
+     * the given box in local space.
+     */
+    box3d getDeformedBounds(double x0, double y0, double x1, double y1, double zmin, double zmax) const;
+
+    /**
+     * Traverses the given quad and its sub quads, front to back.
+     */
+    void intersectQuad(const TerrainQuad *q, Query &query) const;
+
+    /**
+     * Traverses the cells [i0,i1[x[j0,j1[ of an elevation tile that are in
+     * the given block of its min/max pyramid, front to back.
+     *
+     * @param k the level of the block in the pyramid (0 for a single cell).
+     * @param bi the x coordinate of the block at this level.
+     * @param bj the y coordinate of the block at this level.
+     */
+    void intersectCells(const float *tile, const MinMaxTile *m, int level, double ox, double oy, double cellSize,
+        int k, int bi, int bj, int i0, int j0, int i1, int j1, Query &query) const;
+
+    /**
+     * Intersects a cell of an elevation tile.
+     */
+    void intersectCell(const float *tile, int level, double ox, double oy, double cellSize,
+        int i, int j, Query &query) const;
+
+    /**
+     * Processes a query.
+     */
+    void process(Query &query) const;
+};
+
+}
+
+#endif
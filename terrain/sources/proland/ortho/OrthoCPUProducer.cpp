@@ -51,9 +51,11 @@
 #include "ork/core/Logger.h"
 #include "ork/resource/ResourceTemplate.h"
 #include "proland/producer/CPUTileStorage.h"
+#include "proland/producer/TileDiskCache.h"
 #include "proland/util/mfs.h"
 
 #include <pthread.h>
+#include <cstring>
 
 using namespace std;
 using namespace ork;
@@ -61,8 +63,6 @@ using namespace ork;
 namespace proland
 {
 
-//#define SINGLE_FILE
-
 #define MAX_TILE_SIZE 512
 
 void *OrthoCPUProducer::key = NULL;
@@ -72,13 +72,13 @@ void orthoCPUDelete(void* data)
     delete[] (unsigned char*) data;
 }
 
-OrthoCPUProducer::OrthoCPUProducer(ptr<TileCache> cache, const char *name) :
-    TileProducer("OrthoCPUProducer", "CreateOrthoCPUTile")
+OrthoCPUProducer::OrthoCPUProducer(ptr<TileCache> cache, const char *name, TileFile::Mode reader) :
+    TileProducer("OrthoCPUProducer", "CreateOrthoCPUTile"), reader(reader)
 {
     init(cache, name);
 }
 
-OrthoCPUProducer::OrthoCPUProducer() : TileProducer("OrthoCPUProducer", "CreateOrthoCPUTile")
+OrthoCPUProducer::OrthoCPUProducer() : TileProducer("OrthoCPUProducer", "CreateOrthoCPUTile"), reader(TileFile::MMAP)
 {
 }
 
@@ -91,9 +91,12 @@ void OrthoCPUProducer::init(ptr<TileCache> cache, const char *name)
         tileSize = 0;
         dxt = 0;
         border = 2;
+        codec = TileCodec::TIFF;
     } else {
-        fopen(&tileFile, name, "rb");
-        if (tileFile == NULL) {
+        codec = TileCodec::TIFF;
+        FILE *file;
+        fopen(&file, name, "rb");
+        if (file == NULL) {
             if (Logger::ERROR_LOGGER != NULL) {
                 Logger::ERROR_LOGGER->log("ORTHO", "Cannot open file '" + string(name) + "'");
             }
@@ -103,26 +106,29 @@ void OrthoCPUProducer::init(ptr<TileCache> cache, const char *name)
             int tx;
             int ty;
             int flags;
-            fread(&maxLevel, sizeof(int), 1, tileFile);
-            fread(&tileSize, sizeof(int), 1, tileFile);
-            fread(&channels, sizeof(int), 1, tileFile);
-            fread(&root, sizeof(int), 1, tileFile);
-            fread(&tx, sizeof(int), 1, tileFile);
-            fread(&ty, sizeof(int), 1, tileFile);
-            fread(&flags, sizeof(int), 1, tileFile);
+            fread(&maxLevel, sizeof(int), 1, file);
+            fread(&tileSize, sizeof(int), 1, file);
+            fread(&channels, sizeof(int), 1, file);
+            fread(&root, sizeof(int), 1, file);
+            fread(&tx, sizeof(int), 1, file);
+            fread(&ty, sizeof(int), 1, file);
+            fread(&flags, sizeof(int), 1, file);
             dxt = (flags & 1) != 0;
             border = (flags & 2) != 0 ? 0 : 2;
+            codec = TileCodec::Codec((flags >> 2) & 7);
+            if (!TileCodec::isAvailable(codec) && Logger::ERROR_LOGGER != NULL) {
+                Logger::ERROR_LOGGER->log("ORTHO", "Unsupported tile codec '" + string(TileCodec::getName(codec)) + "' in file '" + string(name) + "'");
+            }
         }
 
         int ntiles = ((1 << (maxLevel * 2 + 2)) - 1) / 3;
         header = 7 * sizeof(int) + 2 * ntiles * sizeof(long long);
         offsets = new long long[2 * ntiles];
-        if (tileFile != NULL) {
-            fread(offsets, sizeof(long long) * ntiles * 2, 1, tileFile);
-    #ifndef SINGLE_FILE
-            fclose(tileFile);
-            tileFile = NULL;
-    #endif
+        if (file != NULL) {
+            fread(offsets, sizeof(long long) * ntiles * 2, 1, file);
+            fclose(file);
+            tileFile = new TileFile(name, reader);
+            overlay = new TileOverlay(name);
         }
 
         if (key == NULL) {
@@ -131,21 +137,11 @@ void OrthoCPUProducer::init(ptr<TileCache> cache, const char *name)
         }
 
         assert(tileSize + 2*border < MAX_TILE_SIZE);
-
-    #ifdef SINGLE_FILE
-        mutex = new pthread_mutex_t;
-        pthread_mutex_init((pthread_mutex_t*) mutex, NULL);
-    #endif
     }
 }
 
 OrthoCPUProducer::~OrthoCPUProducer()
 {
-#ifdef SINGLE_FILE
-    fclose(tileFile);
-    pthread_mutex_destroy((pthread_mutex_t*) mutex);
-    delete (pthread_mutex_t*) mutex;
-#endif
     delete[] offsets;
 }
 
@@ -156,7 +152,17 @@ int OrthoCPUProducer::getBorder()
 
 bool OrthoCPUProducer::hasTile(int level, int tx, int ty)
 {
-    return level <= maxLevel;
+    if (level <= maxLevel) {
+        return true;
+    }
+    // saved tiles can be deeper than the stored ones (see saveTiles)
+    return overlay != NULL && level < 16 && overlay->hasTile(getTileId(level, tx, ty));
+}
+
+unsigned long long OrthoCPUProducer::getSourceKey()
+{
+    unsigned long long h = TileDiskCache::getFileKey(name);
+    return TileDiskCache::fnvMix(h, TileDiskCache::getFileKey(name + ".overlay.index"));
 }
 
 bool OrthoCPUProducer::isCompressed()
@@ -164,6 +170,15 @@ bool OrthoCPUProducer::isCompressed()
     return dxt;
 }
 
+ptr<Task> OrthoCPUProducer::startCreateTile(int level, int tx, int ty, unsigned int deadline, ptr<Task> task, ptr<TaskGraph> owner)
+{
+    if (tileFile != NULL && level <= maxLevel) {
+        int tileid = getTileId(level, tx, ty);
+        tileFile->willNeed(header + offsets[2 * tileid], int(offsets[2 * tileid + 1] - offsets[2 * tileid]));
+    }
+    return TileProducer::startCreateTile(level, tx, ty, deadline, task, owner);
+}
+
 bool OrthoCPUProducer::doCreateTile(int level, int tx, int ty, TileStorage::Slot *data)
 {
     if (Logger::DEBUG_LOGGER != NULL) {
@@ -184,7 +199,6 @@ bool OrthoCPUProducer::doCreateTile(int level, int tx, int ty, TileStorage::Slot
     } else {
         assert(dynamic_cast<CPUTileStorage<unsigned char>*>(cpuData->getOwner())->getChannels() == channels);
         assert(cpuData->getOwner()->getTileSize() == tileSize + 2*border);
-        assert(level <= maxLevel);
 
         unsigned char *compressedData = (unsigned char*) pthread_getspecific(*((pthread_key_t*) key));
         if (compressedData == NULL) {
@@ -192,54 +206,52 @@ bool OrthoCPUProducer::doCreateTile(int level, int tx, int ty, TileStorage::Slot
             pthread_setspecific(*((pthread_key_t*) key), compressedData);
         }
 
-        int fsize = (int) (offsets[2 * tileid + 1] - offsets[2 * tileid]);
-        assert(fsize < (tileSize + 2*border) * (tileSize + 2*border) * channels * 2);
-
+        // the data is decoded directly from the memory mapped file when
+        // possible (otherwise it is read in cpuData->data or compressedData)
+        void *handle = NULL;
+        int fsize;
         if (dxt) {
-    #ifdef SINGLE_FILE
-            pthread_mutex_lock((pthread_mutex_t*) mutex);
-            fseek64(tileFile, header + offsets[2 * tileid], SEEK_SET);
-            fread(cpuData->data, fsize, 1, tileFile);
-            pthread_mutex_unlock((pthread_mutex_t*) mutex);
-    #else
-            FILE *file;
-            fopen(&file, name.c_str(), "rb");
-            fseek64(file, header + offsets[2 * tileid], SEEK_SET);
-            fread(cpuData->data, fsize, 1, file);
-            fclose(file);
-            /*ifstream fs(name.c_str(), ios::binary);
-            fs.seekg(header + offsets[2 * tileid], ios::beg);
-            fs.read((char*) cpuData->data, fsize);
-            fs.close();*/
-    #endif
+            assert(level <= maxLevel);
+            fsize = (int) (offsets[2 * tileid + 1] - offsets[2 * tileid]);
+            const unsigned char *src = tileFile->read(header + offsets[2 * tileid], fsize, cpuData->data, handle);
+            if (src != NULL && src != cpuData->data) {
+                memcpy(cpuData->data, src, fsize);
+            }
             cpuData->size = fsize;
         } else {
-            unsigned char* srcData = compressedData;
-    #ifdef SINGLE_FILE
-            pthread_mutex_lock((pthread_mutex_t*) mutex);
-            fseek64(tileFile, header + offsets[2 * tileid], SEEK_SET);
-            fread(compressedData, fsize, 1, tileFile);
-            pthread_mutex_unlock((pthread_mutex_t*) mutex);
-    #else
-            FILE *file;
-            fopen(&file, name.c_str(), "rb");
-            fseek64(file, header + offsets[2 * tileid], SEEK_SET);
-            fread(compressedData, fsize, 1, file);
-            fclose(file);
-            /*ifstream fs(name.c_str(), ios::binary);
-            fs.seekg(header + offsets[2 * tileid], ios::beg);
-            fs.read((char*) src, fsize);
-            fs.close();*/
-    #endif
-
-            mfs_file fd;
-            mfs_open(srcData, fsize, (char *)"r", &fd);
-            TIFF* tf = TIFFClientOpen("name", "r", &fd,
-                (TIFFReadWriteProc) mfs_read, (TIFFReadWriteProc) mfs_write, (TIFFSeekProc) mfs_lseek,
-                (TIFFCloseProc) mfs_close, (TIFFSizeProc) mfs_size, (TIFFMapFileProc) mfs_map,
-                (TIFFUnmapFileProc) mfs_unmap);
-            TIFFReadEncodedStrip(tf, 0, cpuData->data, (tsize_t) -1);
-            TIFFClose(tf);
+            // the tiles saved in the overlay replace the stored ones
+            const unsigned char *src = compressedData;
+            if (!overlay->read(tileid, compressedData, MAX_TILE_SIZE * MAX_TILE_SIZE * 4 * 2, fsize)) {
+                assert(level <= maxLevel);
+                fsize = (int) (offsets[2 * tileid + 1] - offsets[2 * tileid]);
+                assert(fsize < (tileSize + 2*border) * (tileSize + 2*border) * channels * 2);
+                src = tileFile->read(header + offsets[2 * tileid], fsize, compressedData, handle);
+            }
+            if (src != NULL && codec != TileCodec::TIFF) {
+                int size = (tileSize + 2*border) * (tileSize + 2*border) * channels;
+                if (!TileCodec::decompress(codec, src, fsize, cpuData->data, size)) {
+                    memset(cpuData->data, 0, size);
+                }
+            } else if (src != NULL) {
+                mfs_file fd;
+                mfs_open((void*) src, fsize, (char *)"r", &fd);
+                TIFF* tf = TIFFClientOpen("name", "r", &fd,
+                    (TIFFReadWriteProc) mfs_read, (TIFFReadWriteProc) mfs_write, (TIFFSeekProc) mfs_lseek,
+                    (TIFFCloseProc) mfs_close, (TIFFSizeProc) mfs_size, (TIFFMapFileProc) mfs_map,
+                    (TIFFUnmapFileProc) mfs_unmap);
+                TIFFReadEncodedStrip(tf, 0, cpuData->data, (tsize_t) -1);
+                TIFFClose(tf);
+            }
+        }
+        tileFile->release(handle);
+
+        // the children of this tile will probably be needed soon
+        if (level < maxLevel) {
+            for (int j = 0; j < 2; ++j) {
+                int first = getTileId(level + 1, 2 * tx, 2 * ty + j);
+                int last = getTileId(level + 1, 2 * tx + 1, 2 * ty + j);
+                tileFile->willNeed(header + offsets[2 * first], int(offsets[2 * last + 1] - offsets[2 * first]));
+            }
         }
     }
 
@@ -254,9 +266,11 @@ void OrthoCPUProducer::swap(ptr<OrthoCPUProducer> p)
     std::swap(tileSize, p->tileSize);
     std::swap(maxLevel, p->maxLevel);
     std::swap(dxt, p->dxt);
+    std::swap(codec, p->codec);
     std::swap(offsets, p->offsets);
-    std::swap(mutex, p->mutex);
+    std::swap(reader, p->reader);
     std::swap(tileFile, p->tileFile);
+    std::swap(overlay, p->overlay);
 }
 
 int OrthoCPUProducer::getTileId(int level, int tx, int ty)
@@ -264,6 +278,45 @@ int OrthoCPUProducer::getTileId(int level, int tx, int ty)
     return tx + ty * (1 << level) + ((1 << (2 * level)) - 1) / 3;
 }
 
+bool OrthoCPUProducer::saveTiles(const map<TileCache::Tile::Id, unsigned char*> &tiles)
+{
+    if (overlay == NULL || dxt) {
+        if (Logger::ERROR_LOGGER != NULL) {
+            Logger::ERROR_LOGGER->log("ORTHO", "Cannot save tiles without file or in DXT format");
+        }
+        return false;
+    }
+
+    int size = (tileSize + 2*border) * (tileSize + 2*border) * channels;
+    map< int, vector<unsigned char> > data;
+    bool ok = true;
+
+    map<TileCache::Tile::Id, unsigned char*>::const_iterator i = tiles.begin();
+    for (; ok && i != tiles.end(); ++i) {
+        int level = i->first.first;
+        int tx = i->first.second.first;
+        int ty = i->first.second.second;
+        if (level >= 16) {
+            ok = false;
+            continue;
+        }
+        vector<unsigned char> &result = data[getTileId(level, tx, ty)];
+        if (codec != TileCodec::TIFF) {
+            ok = TileCodec::compress(codec, i->second, size, result);
+        } else {
+            ok = TileCodec::compressTiff(i->second, tileSize + 2*border, channels, 0, result);
+        }
+    }
+
+    if (!ok) {
+        if (Logger::ERROR_LOGGER != NULL) {
+            Logger::ERROR_LOGGER->log("ORTHO", "Cannot encode tiles of '" + name + "'");
+        }
+        return false;
+    }
+    return overlay->write(data);
+}
+
 class OrthoCPUProducerResource : public ResourceTemplate<2, OrthoCPUProducer>
 {
 public:
@@ -273,13 +326,20 @@ public:
         e = e == NULL ? desc->descriptor : e;
         ptr<TileCache> cache;
         string file;
-        checkParameters(desc, e, "name,cache,file,");
+        checkParameters(desc, e, "name,cache,file,reader,diskCache,");
         cache = manager->loadResource(getParameter(desc, e, "cache")).cast<TileCache>();
         if (e->Attribute("file") != NULL) {
             file = getParameter(desc, e, "file");
             file = manager->getLoader()->findResource(file);
         }
+        if (e->Attribute("reader") != NULL && !TileFile::getMode(e->Attribute("reader"), reader)) {
+            if (Logger::ERROR_LOGGER != NULL) {
+                log(Logger::ERROR_LOGGER, desc, e, "Invalid reader (must be mmap, pread or uring)");
+            }
+            throw exception();
+        }
         init(cache, file.c_str());
+        initDiskCache(name, e);
     }
 };
 
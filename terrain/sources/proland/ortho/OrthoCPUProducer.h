@@ -44,6 +44,9 @@
 
 #include <string>
 
+#include "proland/producer/TileCodec.h"
+#include "proland/producer/TileFile.h"
+#include "proland/producer/TileOverlay.h"
 #include "proland/producer/TileProducer.h"
 
 namespace proland
@@ -72,8 +75,9 @@ public:
      *      of tiles in this storage size must be equal to the size of the
      *      tiles stored on disk, borders included.
      * @param name the name of the file containing the tiles to load.
+     * @param reader how the file containing the tiles must be read.
      */
-    OrthoCPUProducer(ptr<TileCache> cache, const char *name);
+    OrthoCPUProducer(ptr<TileCache> cache, const char *name, TileFile::Mode reader = TileFile::MMAP);
 
     /**
      * Deletes this OrthoCPUProducer.
@@ -84,6 +88,12 @@ public:
 
     virtual bool hasTile(int level, int tx, int ty);
 
+    /**
+     * Returns a key computed from the tiles file and its overlay (see
+     * TileDiskCache#getFileKey).
+     */
+    virtual unsigned long long getSourceKey();
+
     /**
      * Returns true if the produced tiles are compressed in DXT format.
      */
@@ -106,10 +116,36 @@ protected:
      */
     virtual void init(ptr<TileCache> cache, const char *name);
 
+    /**
+     * Announces the given tile to the TileFile, so that it can be read
+     * asynchronously, together with the other tiles requested during the
+     * same frame.
+     */
+    virtual ptr<Task> startCreateTile(int level, int tx, int ty, unsigned int deadline, ptr<Task> task, ptr<TaskGraph> owner);
+
     virtual bool doCreateTile(int level, int tx, int ty, TileStorage::Slot *data);
 
     virtual void swap(ptr<OrthoCPUProducer> p);
 
+    /**
+     * Saves the given tiles in the overlay of the tiles file (see
+     * TileOverlay). Only these tiles are encoded, with the codec of this file,
+     * and written to disk. They then replace the corresponding stored tiles,
+     * for this %producer and for any %producer subsequently created with the
+     * same file. Tiles can be saved at levels deeper than the maximum level
+     * of the file. Files in DXT format are not supported.
+     *
+     * @param tiles the tiles to save, in the format produced by
+     *      #doCreateTile, indexed by their coordinates.
+     * @return false if the tiles cannot be saved.
+     */
+    bool saveTiles(const std::map<TileCache::Tile::Id, unsigned char*> &tiles);
+
+    /**
+     * How the file storing the tiles must be read. Used in #init.
+     */
+    TileFile::Mode reader;
+
 private:
     /**
      * The name of the file containing the residual tiles to load.
@@ -143,6 +179,12 @@ private:
      */
     bool dxt;
 
+    /**
+     * The codec used to compress the tiles stored on disk, if not in DXT
+     * format.
+     */
+    TileCodec::Codec codec;
+
     /**
      * Offset of the first stored tile on disk. The offsets indicated in
      * the tile offsets array #offsets are relative to this offset.
@@ -156,14 +198,14 @@ private:
     long long* offsets;
 
     /**
-     * A mutex used to serializes accesses to the file storing the tiles.
+     * The file storing the tiles on disk.
      */
-    void *mutex;
+    ptr<TileFile> tileFile;
 
     /**
-     * The file storing the tiles on disk.
+     * The overlay of #tileFile, containing the tiles saved with #saveTiles.
      */
-    FILE *tileFile;
+    ptr<TileOverlay> overlay;
 
     /**
      * A key to store thread specific buffers used to produce the tiles.
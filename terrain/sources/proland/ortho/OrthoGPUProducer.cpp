@@ -209,9 +209,9 @@ bool OrthoGPUProducer::hasTile(int level, int tx, int ty)
     }
 }
 
-bool OrthoGPUProducer::prefetchTile(int level, int tx, int ty)
+bool OrthoGPUProducer::prefetchTile(int level, int tx, int ty, unsigned int deadline)
 {
-    bool b = TileProducer::prefetchTile(level, tx, ty);
+    bool b = TileProducer::prefetchTile(level, tx, ty, deadline);
     if (!b) {
         if (orthoTiles != NULL) {
             if (hasLayers() && !orthoTiles->hasTile(level, tx, ty)) {
@@ -223,9 +223,9 @@ bool OrthoGPUProducer::prefetchTile(int level, int tx, int ty)
                     x /= 2;
                     y /= 2;
                 }
-                coarseGpuTiles->prefetchTile(l, x, y);
+                coarseGpuTiles->prefetchTile(l, x, y, deadline);
             } else {
-                orthoTiles->prefetchTile(level, tx, ty);
+                orthoTiles->prefetchTile(level, tx, ty, deadline);
             }
         }
     }
@@ -443,7 +443,7 @@ public:
         int maxLevel = -1;
         ptr<Texture2D> compressedTexture;
         ptr<Texture2D> uncompressedTexture;
-        checkParameters(desc, e, "name,cache,backgroundCache,ortho,maxLevel,");
+        checkParameters(desc, e, "name,cache,backgroundCache,ortho,maxLevel,diskCache,");
         cache = manager->loadResource(getParameter(desc, e, "cache")).cast<TileCache>();
         if (e->Attribute("backgroundCache") != NULL) {
             backgroundCache = manager->loadResource(getParameter(desc, e, "backgroundCache")).cast<TileCache>();
@@ -498,6 +498,7 @@ public:
         assert(ortho != NULL || hasLayers);
 
         init(cache, backgroundCache, ortho, maxLevel, compressedTexture, uncompressedTexture);
+        initDiskCache(name, e);
     }
 };
 
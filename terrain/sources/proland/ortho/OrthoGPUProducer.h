@@ -108,7 +108,7 @@ public:
 
     virtual bool hasTile(int level, int tx, int ty);
 
-    virtual bool prefetchTile(int level, int tx, int ty);
+    virtual bool prefetchTile(int level, int tx, int ty, unsigned int deadline = 1u << 31u);
 
 protected:
     /**
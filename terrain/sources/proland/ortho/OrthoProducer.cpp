@@ -250,12 +250,12 @@ void *OrthoProducer::getContext() const
     return orthoTexture.get();
 }
 
-bool OrthoProducer::prefetchTile(int level, int tx, int ty)
+bool OrthoProducer::prefetchTile(int level, int tx, int ty, unsigned int deadline)
 {
-    bool b = TileProducer::prefetchTile(level, tx, ty);
+    bool b = TileProducer::prefetchTile(level, tx, ty, deadline);
     if (!b) {
         if (residualTiles != NULL && residualTiles->hasTile(level, tx, ty)) {
-            residualTiles->prefetchTile(level, tx, ty);
+            residualTiles->prefetchTile(level, tx, ty, deadline);
         }
     }
     return b;
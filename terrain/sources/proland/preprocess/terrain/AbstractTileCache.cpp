@@ -47,6 +47,12 @@ namespace proland
 unsigned char* AbstractTileCache::getTile(int tx, int ty)
 {
     int key = Tile(tx, ty).key(width / tileSize + 1);
+    int thread = getPreprocessThreadIndex();
+    if (tileSets[thread] == NULL) {
+        tileSets[thread] = new TileSet();
+    }
+    Cache &tileCache = tileSets[thread]->tileCache;
+    list<Tile*> &tileCacheOrder = tileSets[thread]->tileCacheOrder;
     Cache::iterator i = tileCache.find(key);
     if (i == tileCache.end()) {
         unsigned char *data = readTile(tx, ty);
@@ -131,13 +137,18 @@ vec4f AbstractTileCache::getTileColor(int x, int y)
 
 void AbstractTileCache::reset(int width, int height, int tileSize)
 {
-    list<Tile*>::iterator i = tileCacheOrder.begin();
-    while (i != tileCacheOrder.end()) {
-        delete *i;
-        ++i;
+    for (int t = 0; t < MAX_PREPROCESS_THREADS; ++t) {
+        if (tileSets[t] == NULL) {
+            continue;
+        }
+        list<Tile*>::iterator i = tileSets[t]->tileCacheOrder.begin();
+        while (i != tileSets[t]->tileCacheOrder.end()) {
+            delete *i;
+            ++i;
+        }
+        tileSets[t]->tileCache.clear();
+        tileSets[t]->tileCacheOrder.clear();
     }
-    tileCache.clear();
-    tileCacheOrder.clear();
     this->width = width;
     this->height = height;
     this->tileSize = tileSize;
@@ -46,6 +46,7 @@
 #include <map>
 #include <list>
 #include "ork/math/vec4.h"
+#include "proland/preprocess/terrain/Util.h"
 
 using namespace std;
 using namespace ork;
@@ -82,11 +83,17 @@ public:
 	AbstractTileCache(int width, int height, int tileSize, int channels, int capacity = 20) :
         width(width), height(height), tileSize(tileSize), channels(channels), capacity(capacity)
 	{
+	    for (int i = 0; i < MAX_PREPROCESS_THREADS; ++i) {
+	        tileSets[i] = NULL;
+	    }
 	}
 
 	virtual ~AbstractTileCache()
 	{
 	    reset(0, 0, 0);
+	    for (int i = 0; i < MAX_PREPROCESS_THREADS; ++i) {
+	        delete tileSets[i];
+	    }
 	}
 
     int getWidth()
@@ -133,9 +140,16 @@ private:
 
 	typedef map<int, list<Tile*>::iterator> Cache;
 
-	Cache tileCache;
+    // the tiles cached by one thread; each preprocessing thread has its
+    // own tiles, so that getTile can be called from several threads
+    struct TileSet
+    {
+        Cache tileCache;
+
+        list<Tile*> tileCacheOrder;
+    };
 
-	list<Tile*> tileCacheOrder;
+    TileSet *tileSets[MAX_PREPROCESS_THREADS];
 };
 
 }
@@ -43,6 +43,7 @@
 
 #include "ork/math/mat3.h"
 #include "ork/core/Object.h"
+#include "proland/math/upsample.h"
 #include "proland/preprocess/terrain/ColorMipmap.h"
 #include "proland/util/mfs.h"
 
@@ -93,7 +94,14 @@ DemTileCache::DemTileCache(const string &name, int capacity) :
     FloatTileCache(capacity)
 {
     fopen(&tileFile, name.c_str(), "rb");
+    codec = TileCodec::TIFF;
     fread(&minLevel, sizeof(int), 1, tileFile);
+    if (minLevel == TileCodec::MAGIC) {
+        int c;
+        fread(&c, sizeof(int), 1, tileFile);
+        fread(&minLevel, sizeof(int), 1, tileFile);
+        codec = TileCodec::Codec(c);
+    }
     fread(&maxLevel, sizeof(int), 1, tileFile);
     fread(&tileSize, sizeof(int), 1, tileFile);
     fread(&rootLevel, sizeof(int), 1, tileFile);
@@ -103,6 +111,9 @@ DemTileCache::DemTileCache(const string &name, int capacity) :
 
     int ntiles = minLevel + ((1 << (max(maxLevel - minLevel, 0) * 2 + 2)) - 1) / 3;
     header = sizeof(float) + sizeof(int) * (6 + ntiles * 2);
+    if (codec != TileCodec::TIFF) {
+        header += 2 * sizeof(int);
+    }
     offsets = new unsigned int[ntiles * 2];
     fread(offsets, sizeof(unsigned int) * ntiles * 2, 1, tileFile);
 
@@ -138,22 +149,25 @@ float* DemTileCache::readTile(int level, int tx, int ty)
     fseek64(tileFile, header + offsets[2 * tileid], SEEK_SET);
     fread(compressedData, fsize, 1, tileFile);
 
-    mfs_file fd;
-    mfs_open(compressedData, fsize, (char*)"r", &fd);
-    TIFF* tf = TIFFClientOpen("name", "r", &fd,
-        (TIFFReadWriteProc) mfs_read, (TIFFReadWriteProc) mfs_write, (TIFFSeekProc) mfs_lseek,
-        (TIFFCloseProc) mfs_close, (TIFFSizeProc) mfs_size, (TIFFMapFileProc) mfs_map,
-        (TIFFUnmapFileProc) mfs_unmap);
-    TIFFReadEncodedStrip(tf, 0, uncompressedData, (tsize_t) -1);
-    TIFFClose(tf);
+    if (codec != TileCodec::TIFF) {
+        if (!TileCodec::decompress(codec, compressedData, fsize, uncompressedData, tilesize * tilesize * 2)) {
+            fprintf(stderr, "Cannot decompress tile %d %d %d\n", level, tx, ty);
+            throw exception();
+        }
+    } else {
+        mfs_file fd;
+        mfs_open(compressedData, fsize, (char*)"r", &fd);
+        TIFF* tf = TIFFClientOpen("name", "r", &fd,
+            (TIFFReadWriteProc) mfs_read, (TIFFReadWriteProc) mfs_write, (TIFFSeekProc) mfs_lseek,
+            (TIFFCloseProc) mfs_close, (TIFFSizeProc) mfs_size, (TIFFMapFileProc) mfs_map,
+            (TIFFUnmapFileProc) mfs_unmap);
+        TIFFReadEncodedStrip(tf, 0, uncompressedData, (tsize_t) -1);
+        TIFFClose(tf);
+    }
 
     float *result = new float[(tileSize + 5) * (tileSize + 5)];
     for (int j = 0; j < tilesize; ++j) {
-        for (int i = 0; i < tilesize; ++i) {
-            int off = 2 * (i + j * tilesize);
-            short z = short(uncompressedData[off + 1]) << 8 | short(uncompressedData[off]);
-            result[i + j * (tileSize + 5)] = z * scale;
-        }
+        TileCodec::decodeShorts(uncompressedData + 2 * j * tilesize, tilesize, scale, NULL, result + j * (tileSize + 5));
     }
 
     return result;
@@ -199,40 +213,11 @@ float* ElevationTileCache::readTile(int level, int tx, int ty)
         int px = 1 + (tx % 2) * tileSize / 2;
         int py = 1 + (ty % 2) * tileSize / 2;
         const int n = r->tileSize + 5;
+        upsample(parentTile, n, px, py, tileSize + 5, result);
         for (int j = 0; j <= tileSize + 4; ++j) {
             for (int i = 0; i <= tileSize + 4; ++i) {
-                float z;
-                if (j%2 == 0) {
-                    if (i%2 == 0) {
-                        z = parentTile[i/2+px + (j/2+py)*n];
-                    } else {
-                        float z0 = parentTile[i/2+px-1 + (j/2+py)*n];
-                        float z1 = parentTile[i/2+px + (j/2+py)*n];
-                        float z2 = parentTile[i/2+px+1 + (j/2+py)*n];
-                        float z3 = parentTile[i/2+px+2 + (j/2+py)*n];
-                        z = ((z1+z2)*9-(z0+z3))/16;
-                    }
-                } else {
-                    if (i%2 == 0) {
-                        float z0 = parentTile[i/2+px + (j/2-1+py)*n];
-                        float z1 = parentTile[i/2+px + (j/2+py)*n];
-                        float z2 = parentTile[i/2+px + (j/2+1+py)*n];
-                        float z3 = parentTile[i/2+px + (j/2+2+py)*n];
-                        z = ((z1+z2)*9-(z0+z3))/16;
-                    } else {
-                        int di, dj;
-                        z = 0.0;
-                        for (dj = -1; dj <= 2; ++dj) {
-                            float f = dj == -1 || dj == 2 ? -1/16.0 : 9/16.0;
-                            for (di = -1; di <= 2; ++di) {
-                                float g = di == -1 || di == 2 ? -1/16.0 : 9/16.0;
-                                z += f*g*parentTile[i/2+di+px + (j/2+dj+py)*n];
-                            }
-                        }
-                    }
-                }
                 int off = i + j * n;
-                result[off] = z + residuals[off];
+                result[off] += residuals[off];
             }
         }
     }
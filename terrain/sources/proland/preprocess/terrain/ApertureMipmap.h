@@ -47,6 +47,7 @@
 #include <map>
 
 #include "ork/math/vec3.h"
+#include "proland/producer/TileCodec.h"
 #include "proland/preprocess/terrain/Util.h"
 
 using namespace std;
@@ -136,6 +137,8 @@ public:
 
     unsigned int header;
 
+    TileCodec::Codec codec;
+
     unsigned int* offsets;
 
     unsigned char *compressedData;
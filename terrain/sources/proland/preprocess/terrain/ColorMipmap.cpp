@@ -42,6 +42,7 @@
 #include "proland/preprocess/terrain/ColorMipmap.h"
 
 #include <cstdlib>
+#include <vector>
 
 #include "ork/core/Object.h"
 #include "proland/preprocess/terrain/Util.h"
@@ -64,6 +65,7 @@ ColorMipmap::ColorMipmap(ColorFunction *colorf, int baseLevelSize, int tileSize,
     tile = new unsigned char[(tileSize + 2*border) * (tileSize + 2*border) * channels];
     rgbaTile = new unsigned char[(tileSize + 2*border) * (tileSize + 2*border) * 4];
     dxtTile = new unsigned char[(tileSize + 2*border) * (tileSize + 2*border) * 4];
+    codec = TileCodec::TIFF;
     left = NULL;
     right = NULL;
     bottom = NULL;
@@ -106,15 +108,17 @@ void ColorMipmap::computeMipmap()
     }
 }
 
-void ColorMipmap::generate(int rootLevel, int rootTx, int rootTy, bool dxt, bool jpg, int jpg_quality, const string &file)
+void ColorMipmap::generate(int rootLevel, int rootTx, int rootTy, bool dxt, bool jpg, int jpg_quality, const string &file, TileCodec::Codec codec)
 {
     this->dxt = dxt;
     this->jpg = jpg;
     this->jpg_quality = jpg_quality;
+    this->codec = dxt ? TileCodec::TIFF : codec;
     int flags = dxt ? 1 : 0;
     if (border == 0) {
 		flags += 2;
 	}
+    flags += this->codec << 2;
     int fchannels = dxt ? max(3, channels) : channels;
 
     if (flog(file.c_str())) {
@@ -169,6 +173,8 @@ void ColorMipmap::generateResiduals(bool jpg, int jpg_quality, const string &inp
         compressedInputTile = new unsigned char[tileWidth * tileWidth * 8];
         inputTile = new unsigned char[tileWidth * tileWidth * 4];
 
+        // codec of the input tiles (residual tiles are always stored as TIFF files)
+        codec = TileCodec::Codec((flags >> 2) & 7);
         oJpg = jpg;
         oJpg_quality = jpg_quality;
         int oflags = dxt ? 1 : 0;
@@ -278,6 +284,34 @@ unsigned char* ColorMipmap::readTile(int tx, int ty)
     return data;
 }
 
+struct ColorMipmap::GroupTask
+{
+    ColorMipmap *owner;
+
+    int level;
+
+    vector<int> groups;
+
+    vector<string> files;
+
+    GroupTask(ColorMipmap *owner, int level) :
+        owner(owner), level(level)
+    {
+    }
+
+    void add(int dx, int dy, const char *file)
+    {
+        groups.push_back(dx);
+        groups.push_back(dy);
+        files.push_back(file);
+    }
+
+    int size()
+    {
+        return int(files.size());
+    }
+};
+
 void ColorMipmap::buildBaseLevelTiles()
 {
     char buf[256];
@@ -286,25 +320,19 @@ void ColorMipmap::buildBaseLevelTiles()
 
     printf("Build mipmap level %d...\n", maxLevel);
 
+    GroupTask task(this, maxLevel);
     for (int dy = 0; dy < nTiles / nTilesPerFile; ++dy) {
-		for (int dx = 0; dx < nTiles / nTilesPerFile; ++dx) {
-	   	    sprintf(buf, "%s/%.2d-%.4d-%.4d.tiff", cache.c_str(), maxLevel, dx, dy);
-	   	    if (flog(buf)) {
-                TIFF* f = TIFFOpen(buf, "wb");
-                for (int ny = 0; ny < nTilesPerFile; ++ny) {
-                    for (int nx = 0; nx < nTilesPerFile; ++nx) {
-                        int tx = nx + dx * nTilesPerFile;
-                        int ty = ny + dy * nTilesPerFile;
-                        buildBaseLevelTile(tx, ty, f);
-                    }
-                }
-                TIFFClose(f);
-	   	    }
-		}
-	}
+        for (int dx = 0; dx < nTiles / nTilesPerFile; ++dx) {
+            sprintf(buf, "%s/%.2d-%.4d-%.4d.tiff", cache.c_str(), maxLevel, dx, dy);
+            if (flog(buf)) {
+                task.add(dx, dy, buf);
+            }
+        }
+    }
+    parallelFor(task.size(), buildGroup, &task);
 }
 
-void ColorMipmap::buildBaseLevelTile(int tx, int ty, TIFF *f)
+void ColorMipmap::buildBaseLevelTile(int tx, int ty, unsigned char *tile, TIFF *f)
 {
 	int off = 0;
 	for (int j = -border; j < tileSize + border; ++j) {
@@ -350,70 +378,107 @@ void ColorMipmap::buildMipmapLevel(int level)
     currentLevel = level + 1;
     reset(tileSize << currentLevel, tileSize << currentLevel, tileSize);
 
+    GroupTask task(this, level);
     for (int dy = 0; dy < nTiles / nTilesPerFile; ++dy) {
         for (int dx = 0; dx < nTiles / nTilesPerFile; ++dx) {
             sprintf(buf, "%s/%.2d-%.4d-%.4d.tiff", cache.c_str(), level, dx, dy);
             if (flog(buf)) {
-                TIFF* f = TIFFOpen(buf, "wb");
-                for (int ny = 0; ny < nTilesPerFile; ++ny) {
-                    for (int nx = 0; nx < nTilesPerFile; ++nx) {
-                        int tx = nx + dx * nTilesPerFile;
-                        int ty = ny + dy * nTilesPerFile;
-
-                        int off = 0;
-                        for (int j = -border; j < tileSize + border; ++j) {
-                            for (int i = -border; i < tileSize + border; ++i) {
-                                int ix = 2 * (tx * tileSize + i);
-                                int iy = 2 * (ty * tileSize + j);
-
-                                vec4f c1 = getTileColor(ix, iy);
-                                vec4f c2 = getTileColor(ix+1, iy);
-                                vec4f c3 = getTileColor(ix, iy+1);
-                                vec4f c4 = getTileColor(ix+1, iy+1);
-
-                                tile[off++] = int(roundf(l2r((r2l(c1.x)+r2l(c2.x)+r2l(c3.x)+r2l(c4.x))/4.0)));
-                                if (channels > 1) {
-                                    tile[off++] = int(roundf(l2r((r2l(c1.y)+r2l(c2.y)+r2l(c3.y)+r2l(c4.y))/4.0)));
-                                }
-                                if (channels > 2) {
-                                    tile[off++] = int(roundf(l2r((r2l(c1.z)+r2l(c2.z)+r2l(c3.z)+r2l(c4.z))/4.0)));
-                                }
-                                if (channels > 3) {
-                                    float w1 = max(2.0 * c1.w - 255.0, 0.0);
-                                    float n1 = max(255.0 - 2.0 * c1.w, 0.0);
-                                    float w2 = max(2.0 * c2.w - 255.0, 0.0);
-                                    float n2 = max(255.0 - 2.0 * c2.w, 0.0);
-                                    float w3 = max(2.0 * c3.w - 255.0, 0.0);
-                                    float n3 = max(255.0 - 2.0 * c3.w, 0.0);
-                                    float w4 = max(2.0 * c4.w - 255.0, 0.0);
-                                    float n4 = max(255.0 - 2.0 * c4.w, 0.0);
-                                    int w = int(roundf((w1 + w2 + w3 + w4) / 4));
-                                    int n = int(roundf((n1 + n2 + n3 + n4) / 4));
-                                    tile[off++] = 127 + w / 2 - n / 2;
-                                }
-                            }
-                        }
-
-                        TIFFSetField(f, TIFFTAG_IMAGEWIDTH, tileSize + 2*border);
-                        TIFFSetField(f, TIFFTAG_IMAGELENGTH, tileSize + 2*border);
-                        TIFFSetField(f, TIFFTAG_SAMPLESPERPIXEL, channels);
-                        TIFFSetField(f, TIFFTAG_BITSPERSAMPLE, 8);
-                        TIFFSetField(f, TIFFTAG_COMPRESSION, COMPRESSION_DEFLATE);
-                        TIFFSetField(f, TIFFTAG_ORIENTATION, ORIENTATION_BOTLEFT);
-                        TIFFSetField(f, TIFFTAG_PLANARCONFIG, PLANARCONFIG_CONTIG);
-                        if (channels == 1) {
-                            TIFFSetField(f, TIFFTAG_PHOTOMETRIC, PHOTOMETRIC_MINISBLACK);
-                        } else {
-                            TIFFSetField(f, TIFFTAG_PHOTOMETRIC, PHOTOMETRIC_RGB);
-                        }
-                        TIFFWriteEncodedStrip(f, 0, tile, (tileSize + 2*border) * (tileSize + 2*border) * channels);
-                        TIFFWriteDirectory(f);
-                    }
+                task.add(dx, dy, buf);
+            }
+        }
+    }
+    parallelFor(task.size(), buildGroup, &task);
+}
+
+void ColorMipmap::buildMipmapTile(int tx, int ty, unsigned char *tile, TIFF *f)
+{
+    int off = 0;
+    for (int j = -border; j < tileSize + border; ++j) {
+        for (int i = -border; i < tileSize + border; ++i) {
+            int ix = 2 * (tx * tileSize + i);
+            int iy = 2 * (ty * tileSize + j);
+
+            vec4f c1 = getTileColor(ix, iy);
+            vec4f c2 = getTileColor(ix+1, iy);
+            vec4f c3 = getTileColor(ix, iy+1);
+            vec4f c4 = getTileColor(ix+1, iy+1);
+
+            tile[off++] = int(roundf(l2r((r2l(c1.x)+r2l(c2.x)+r2l(c3.x)+r2l(c4.x))/4.0)));
+            if (channels > 1) {
+                tile[off++] = int(roundf(l2r((r2l(c1.y)+r2l(c2.y)+r2l(c3.y)+r2l(c4.y))/4.0)));
+            }
+            if (channels > 2) {
+                tile[off++] = int(roundf(l2r((r2l(c1.z)+r2l(c2.z)+r2l(c3.z)+r2l(c4.z))/4.0)));
+            }
+            if (channels > 3) {
+                float w1 = max(2.0 * c1.w - 255.0, 0.0);
+                float n1 = max(255.0 - 2.0 * c1.w, 0.0);
+                float w2 = max(2.0 * c2.w - 255.0, 0.0);
+                float n2 = max(255.0 - 2.0 * c2.w, 0.0);
+                float w3 = max(2.0 * c3.w - 255.0, 0.0);
+                float n3 = max(255.0 - 2.0 * c3.w, 0.0);
+                float w4 = max(2.0 * c4.w - 255.0, 0.0);
+                float n4 = max(255.0 - 2.0 * c4.w, 0.0);
+                int w = int(roundf((w1 + w2 + w3 + w4) / 4));
+                int n = int(roundf((n1 + n2 + n3 + n4) / 4));
+                tile[off++] = 127 + w / 2 - n / 2;
+            }
+        }
+    }
+
+    TIFFSetField(f, TIFFTAG_IMAGEWIDTH, tileSize + 2*border);
+    TIFFSetField(f, TIFFTAG_IMAGELENGTH, tileSize + 2*border);
+    TIFFSetField(f, TIFFTAG_SAMPLESPERPIXEL, channels);
+    TIFFSetField(f, TIFFTAG_BITSPERSAMPLE, 8);
+    TIFFSetField(f, TIFFTAG_COMPRESSION, COMPRESSION_DEFLATE);
+    TIFFSetField(f, TIFFTAG_ORIENTATION, ORIENTATION_BOTLEFT);
+    TIFFSetField(f, TIFFTAG_PLANARCONFIG, PLANARCONFIG_CONTIG);
+    if (channels == 1) {
+        TIFFSetField(f, TIFFTAG_PHOTOMETRIC, PHOTOMETRIC_MINISBLACK);
+    } else {
+        TIFFSetField(f, TIFFTAG_PHOTOMETRIC, PHOTOMETRIC_RGB);
+    }
+    TIFFWriteEncodedStrip(f, 0, tile, (tileSize + 2*border) * (tileSize + 2*border) * channels);
+    TIFFWriteDirectory(f);
+}
+
+void ColorMipmap::buildGroup(int i, void *data)
+{
+    GroupTask *task = (GroupTask*) data;
+    ColorMipmap *owner = task->owner;
+    int nTiles = 1 << task->level;
+    int nTilesPerFile = min(nTiles, 16);
+    int dx = task->groups[2 * i];
+    int dy = task->groups[2 * i + 1];
+    int tileWidth = owner->tileSize + 2 * owner->border;
+    unsigned char *tile = new unsigned char[tileWidth * tileWidth * owner->channels];
+
+    // see HeightMipmap::buildGroup
+    string tmp = task->files[i] + ".tmp";
+    TIFF* f = TIFFOpen(tmp.c_str(), "wb");
+    for (int ny = 0; ny < nTilesPerFile; ++ny) {
+        for (int nx = 0; nx < nTilesPerFile; ++nx) {
+            int tx = nx + dx * nTilesPerFile;
+            int ty = ny + dy * nTilesPerFile;
+            if (task->level == owner->maxLevel) {
+                if (nx + 1 < nTilesPerFile || ny + 1 < nTilesPerFile) {
+                    // the source data of the next tile is loaded while this one is built
+                    int ntx = (nx + 1) % nTilesPerFile + dx * nTilesPerFile;
+                    int nty = ny + (nx + 1) / nTilesPerFile + dy * nTilesPerFile;
+                    int ts = owner->tileSize;
+                    int b = owner->border;
+                    owner->colorf->prefetch(ntx * ts - b, nty * ts - b, (ntx + 1) * ts + b - 1, (nty + 1) * ts + b - 1);
                 }
-                TIFFClose(f);
+                owner->buildBaseLevelTile(tx, ty, tile, f);
+            } else {
+                owner->buildMipmapTile(tx, ty, tile, f);
             }
         }
     }
+    TIFFClose(f);
+    rename(tmp.c_str(), task->files[i].c_str());
+
+    delete[] tile;
 }
 
 void ColorMipmap::produceRawTile(int level, int tx, int ty)
@@ -666,36 +731,24 @@ void ColorMipmap::produceTile(int level, int tx, int ty, long long *offset, long
                 CompressImageDXT1(rgbaTile, dxtTile, tileSize + 2*border, tileSize + 2*border, size);
                 fwrite(dxtTile, size, 1, f);
             }
-        } else {
-            mfs_file fd;
-            mfs_open(NULL, 0, (char*)"w", &fd);
-            TIFF* tf = TIFFClientOpen("", (char*)"w", &fd,
-                (TIFFReadWriteProc) mfs_read, (TIFFReadWriteProc) mfs_write, (TIFFSeekProc) mfs_lseek,
-                (TIFFCloseProc) mfs_close, (TIFFSizeProc) mfs_size, (TIFFMapFileProc) mfs_map,
-                (TIFFUnmapFileProc) mfs_unmap);
-            TIFFSetField(tf, TIFFTAG_IMAGEWIDTH, tileSize + 2*border);
-            TIFFSetField(tf, TIFFTAG_IMAGELENGTH, tileSize + 2*border);
-            if (jpg && (tx > 0 && ty > 0 && tx < (1 << level) - 1 && ty < (1 << level) - 1)) {
-                TIFFSetField(tf, TIFFTAG_COMPRESSION, COMPRESSION_JPEG);
-                TIFFSetField(tf, TIFFTAG_JPEGQUALITY, jpg_quality);
-            } else {
-                TIFFSetField(tf, TIFFTAG_COMPRESSION, COMPRESSION_DEFLATE);
+        } else if (codec != TileCodec::TIFF) {
+            vector<unsigned char> data;
+            if (!TileCodec::compress(codec, tile, (tileSize + 2*border) * (tileSize + 2*border) * channels, data)) {
+                fprintf(stderr, "Cannot compress tile %d %d %d\n", level, tx, ty);
+                throw exception();
             }
-            TIFFSetField(tf, TIFFTAG_ORIENTATION, ORIENTATION_BOTLEFT);
-            TIFFSetField(tf, TIFFTAG_PLANARCONFIG, PLANARCONFIG_CONTIG);
-            if (channels == 1) {
-                TIFFSetField(tf, TIFFTAG_PHOTOMETRIC, PHOTOMETRIC_MINISBLACK);
-            } else {
-                TIFFSetField(tf, TIFFTAG_PHOTOMETRIC, PHOTOMETRIC_RGB);
+            fwrite(&data[0], data.size(), 1, f);
+            size = data.size();
+        } else {
+            // the border tiles are never JPEG compressed
+            bool jpgTile = jpg && (tx > 0 && ty > 0 && tx < (1 << level) - 1 && ty < (1 << level) - 1);
+            vector<unsigned char> data;
+            if (!TileCodec::compressTiff(tile, tileSize + 2*border, channels, jpgTile ? jpg_quality : 0, data)) {
+                fprintf(stderr, "Cannot compress tile %d %d %d\n", level, tx, ty);
+                throw exception();
             }
-            TIFFSetField(tf, TIFFTAG_SAMPLESPERPIXEL, channels);
-            TIFFSetField(tf, TIFFTAG_BITSPERSAMPLE, 8);
-            TIFFWriteEncodedStrip(tf, 0, tile, (tileSize + 2*border) * (tileSize + 2*border) * channels);
-            TIFFClose(tf);
-
-            fwrite(fd.buf, fd.buf_size, 1, f);
-            free(fd.buf);
-            size = fd.buf_size;
+            fwrite(&data[0], data.size(), 1, f);
+            size = data.size();
         }
         offsets[2 * tileid] = *offset;
         *offset += size;
@@ -729,6 +782,14 @@ void ColorMipmap::readInputTile(int level, int tx, int ty)
     fseek64(in, iheader + ioffsets[2 * tileid], SEEK_SET);
     fread(compressedInputTile, fsize, 1, in);
 
+    if (codec != TileCodec::TIFF) {
+        if (!TileCodec::decompress(codec, compressedInputTile, fsize, inputTile, tileWidth * tileWidth * channels)) {
+            fprintf(stderr, "Cannot decompress tile %d %d %d\n", level, tx, ty);
+            throw exception();
+        }
+        return;
+    }
+
     mfs_file fd;
     mfs_open(compressedInputTile, fsize, (char *)"r", &fd);
     TIFF* tf = TIFFClientOpen("name", "r", &fd,
@@ -838,36 +899,17 @@ void ColorMipmap::convertTile(int level, int tx, int ty, unsigned char *parent,
     } else {
         int size;
 
-        mfs_file fd;
-        mfs_open(NULL, 0, (char*)"w", &fd);
-        TIFF* tf = TIFFClientOpen("", "w", &fd,
-            (TIFFReadWriteProc) mfs_read, (TIFFReadWriteProc) mfs_write, (TIFFSeekProc) mfs_lseek,
-            (TIFFCloseProc) mfs_close, (TIFFSizeProc) mfs_size, (TIFFMapFileProc) mfs_map,
-            (TIFFUnmapFileProc) mfs_unmap);
-        TIFFSetField(tf, TIFFTAG_IMAGEWIDTH, tileWidth);
-        TIFFSetField(tf, TIFFTAG_IMAGELENGTH, tileWidth);
-        if (oJpg) {
-            TIFFSetField(tf, TIFFTAG_COMPRESSION, COMPRESSION_JPEG);
-            TIFFSetField(tf, TIFFTAG_JPEGQUALITY, oJpg_quality);
-        } else {
-            TIFFSetField(tf, TIFFTAG_COMPRESSION, COMPRESSION_DEFLATE);
-        }
-        TIFFSetField(tf, TIFFTAG_ORIENTATION, ORIENTATION_BOTLEFT);
-        TIFFSetField(tf, TIFFTAG_PLANARCONFIG, PLANARCONFIG_CONTIG);
-        if (channels == 1) {
-            TIFFSetField(tf, TIFFTAG_PHOTOMETRIC, PHOTOMETRIC_MINISBLACK);
-        } else {
-            TIFFSetField(tf, TIFFTAG_PHOTOMETRIC, PHOTOMETRIC_RGB);
+        vector<unsigned char> data;
+        if (!TileCodec::compressTiff(tile, tileWidth, channels, oJpg ? oJpg_quality : 0, data)) {
+            fprintf(stderr, "Cannot compress tile %d %d %d\n", level, tx, ty);
+            throw exception();
         }
-        TIFFSetField(tf, TIFFTAG_SAMPLESPERPIXEL, channels);
-        TIFFSetField(tf, TIFFTAG_BITSPERSAMPLE, 8);
-        TIFFWriteEncodedStrip(tf, 0, tile, tileWidth * tileWidth * channels);
-        TIFFClose(tf);
 
         if (oJpg) {
             // uncompress back into 'tile'
-            mfs_open(fd.buf, fd.buf_size, (char *) "r", &fd);
-            tf = TIFFClientOpen("name", "r", &fd,
+            mfs_file fd;
+            mfs_open(&data[0], data.size(), (char *) "r", &fd);
+            TIFF* tf = TIFFClientOpen("name", "r", &fd,
                 (TIFFReadWriteProc) mfs_read, (TIFFReadWriteProc) mfs_write, (TIFFSeekProc) mfs_lseek,
                 (TIFFCloseProc) mfs_close, (TIFFSizeProc) mfs_size, (TIFFMapFileProc) mfs_map,
                 (TIFFUnmapFileProc) mfs_unmap);
@@ -875,9 +917,8 @@ void ColorMipmap::convertTile(int level, int tx, int ty, unsigned char *parent,
             TIFFClose(tf);
         }
 
-        fwrite(fd.buf, fd.buf_size, 1, f);
-        free(fd.buf);
-        size = fd.buf_size;
+        fwrite(&data[0], data.size(), 1, f);
+        size = data.size();
 
         offsets[2 * tileid] = *offset;
         *offset += size;
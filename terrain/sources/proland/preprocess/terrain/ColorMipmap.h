@@ -47,6 +47,7 @@
 
 #include "tiffio.h"
 
+#include "proland/producer/TileCodec.h"
 #include "proland/preprocess/terrain/AbstractTileCache.h"
 
 using namespace std;
@@ -61,6 +62,11 @@ public:
     {
     public:
         virtual vec4f getColor(int x, int y) = 0;
+
+        // hints that the [x0,x1]x[y0,y1] region will soon be read
+        virtual void prefetch(int x0, int y0, int x1, int y1)
+        {
+        }
     };
 
     ColorMipmap *left;
@@ -82,7 +88,7 @@ public:
 
     void computeMipmap();
 
-    void generate(int rootLevel, int rootTx, int rootTy, bool dxt, bool jpg, int jpg_quality, const string &file);
+    void generate(int rootLevel, int rootTx, int rootTy, bool dxt, bool jpg, int jpg_quality, const string &file, TileCodec::Codec codec = TileCodec::TIFF);
 
     void generateResiduals(bool jpg, int jpg_quality, const string &in, const string &out);
 
@@ -125,6 +131,8 @@ protected:
 
     int jpg_quality;
 
+    TileCodec::Codec codec;
+
     FILE *in;
 
     int iheader;
@@ -141,12 +149,18 @@ protected:
 
     unsigned char *inputTile;
 
+    struct GroupTask;
+
     void buildBaseLevelTiles();
 
-    void buildBaseLevelTile(int tx, int ty, TIFF *f);
+    void buildBaseLevelTile(int tx, int ty, unsigned char *tile, TIFF *f);
 
     virtual void buildMipmapLevel(int level);
 
+    void buildMipmapTile(int tx, int ty, unsigned char *tile, TIFF *f);
+
+    static void buildGroup(int i, void *data);
+
     void produceRawTile(int level, int tx, int ty);
 
     virtual void produceTile(int level, int tx, int ty);
@@ -42,10 +42,14 @@
 #include "proland/preprocess/terrain/HeightMipmap.h"
 
 #include <cstdlib>
+#include <cstring>
 
 #include "ork/core/Object.h"
+#include "proland/math/upsample.h"
 #include "proland/preprocess/terrain/Util.h"
-#include "proland/util/mfs.h"
+
+// the version of the intermediate files format, hashed with their inputs
+#define MANIFEST_VERSION 1
 
 namespace proland
 {
@@ -65,17 +69,18 @@ HeightMipmap::HeightMipmap(HeightFunction *height, int topLevelSize, int baseLev
         maxLevel += 1;
         size /= 2;
     }
-    tile = new unsigned char[(tileSize + 5) * (tileSize + 5) * 2];
     constantTile = -1;
+    codec = TileCodec::TIFF;
     left = NULL;
     right = NULL;
     bottom = NULL;
     top = NULL;
+    manifest = new Manifest(cache + "/manifest.txt");
 }
 
 HeightMipmap::~HeightMipmap()
 {
-    delete[] tile;
+    delete manifest;
 }
 
 void HeightMipmap::setCube(HeightMipmap *hm1, HeightMipmap *hm2, HeightMipmap *hm3, HeightMipmap *hm4, HeightMipmap *hm5, HeightMipmap *hm6)
@@ -110,17 +115,90 @@ bool HeightMipmap::compute2()
     }
 }
 
-void HeightMipmap::generate(int rootLevel, int rootTx, int rootTy, float scale, const string &file)
+struct HeightMipmap::GroupTask
+{
+    enum Stage { BASE_LEVEL, MIPMAP_LEVEL, RESIDUALS };
+
+    HeightMipmap *owner;
+
+    Stage stage;
+
+    int level;
+
+    vector<int> groups;
+
+    vector<string> files;
+
+    vector<float> maxR;
+
+    vector<float> maxErr;
+
+    vector<unsigned long long> hashes;
+
+    float *rootTile;
+
+    GroupTask(HeightMipmap *owner, Stage stage, int level) :
+        owner(owner), stage(stage), level(level), rootTile(NULL)
+    {
+    }
+
+    void add(int dx, int dy, const string &file, unsigned long long hash)
+    {
+        groups.push_back(dx);
+        groups.push_back(dy);
+        files.push_back(file);
+        maxR.push_back(0.0f);
+        maxErr.push_back(0.0f);
+        hashes.push_back(hash);
+    }
+
+    int size()
+    {
+        return int(files.size());
+    }
+};
+
+struct HeightMipmap::EncodeTask
+{
+    HeightMipmap *owner;
+
+    const int *tiles;
+
+    vector<unsigned char> *data;
+
+    bool *isConstant;
+};
+
+void HeightMipmap::generate(int rootLevel, int rootTx, int rootTy, float scale, const string &file, TileCodec::Codec codec)
 {
+    this->codec = codec;
     for (int level = 1; level <= maxLevel; ++level) {
         buildResiduals(level);
     }
 
-    if (flog(file.c_str())) {
+    int params[] = { MANIFEST_VERSION, rootLevel, rootTx, rootTy, codec };
+    unsigned long long hash = hashBytes(params, sizeof(params));
+    hash = hashBytes(&scale, sizeof(float), hash);
+    hash = hashGroups("", 0, -1, -1, 1, 1, hash);
+    for (int level = 1; level <= maxLevel; ++level) {
+        hash = hashLevel("residual-", level, hash);
+    }
+
+    if (!isUpToDate(file, file, hash)) {
+        printf("GENERATING %s\n", file.c_str());
+        string tmp = file + ".tmp";
         FILE *f;
-        fopen(&f, file.c_str(), "wb");
+        fopen(&f, tmp.c_str(), "wb");
         int nTiles = minLevel + ((1 << (max(maxLevel - minLevel, 0) * 2 + 2)) - 1) / 3;
         unsigned int *offsets = new unsigned int[nTiles * 2];
+        int header = 0;
+        if (codec != TileCodec::TIFF) {
+            int magic = TileCodec::MAGIC;
+            int c = codec;
+            fwrite(&magic, sizeof(int), 1, f);
+            fwrite(&c, sizeof(int), 1, f);
+            header = 2 * sizeof(int);
+        }
         fwrite(&minLevel, sizeof(int), 1, f);
         fwrite(&maxLevel, sizeof(int), 1, f);
         fwrite(&tileSize, sizeof(int), 1, f);
@@ -129,19 +207,26 @@ void HeightMipmap::generate(int rootLevel, int rootTx, int rootTy, float scale,
         fwrite(&rootTy, sizeof(int), 1, f);
         fwrite(&scale, sizeof(float), 1, f);
         fwrite(offsets, sizeof(int) * nTiles * 2, 1, f);
-        unsigned int offset = 0;
+        vector<int> tiles;
         for (int l = 0; l < minLevel; ++l) {
-            produceTile(l, 0, 0, &offset, offsets, f);
+            tiles.push_back(l);
+            tiles.push_back(0);
+            tiles.push_back(0);
         }
         for (int l = minLevel; l <= maxLevel; ++l) {
-            produceTilesLebeguesOrder(l - minLevel, 0, 0, 0, &offset, offsets, f);
+            getTilesLebeguesOrder(l - minLevel, 0, 0, 0, tiles);
         }
-        fseek(f, sizeof(int) * 6 + sizeof(float), SEEK_SET);
+        unsigned int offset = 0;
+        produceTiles(tiles, &offset, offsets, f);
+        fseek(f, header + sizeof(int) * 6 + sizeof(float), SEEK_SET);
         fwrite(offsets, sizeof(int) * nTiles * 2, 1, f);
         delete[] offsets;
         fclose(f);
+        rename(tmp.c_str(), file.c_str());
+        manifest->put(file, hash, hash);
     }
 }
+
 unsigned char* HeightMipmap::readTile(int tx, int ty)
 {
     char buf[256];
@@ -162,31 +247,38 @@ unsigned char* HeightMipmap::readTile(int tx, int ty)
 
 void HeightMipmap::buildBaseLevelTiles()
 {
-    char buf[256];
     int nTiles = baseLevelSize / tileSize;
     int nTilesPerFile = min(nTiles, 16);
 
     printf("Build mipmap level %d...\n", maxLevel);
 
+    // the base level tiles are skipped if the key of their source did not
+    // change. Otherwise, or if this key is unknown, they are computed to get
+    // their content hash, but they are only written (and their ancestors
+    // recomputed) if this hash changed (see buildGroup)
+    unsigned long long key = height->getSourceKey();
+    int params[] = { MANIFEST_VERSION, tileSize, baseLevelSize };
+    GroupTask task(this, GroupTask::BASE_LEVEL, maxLevel);
     for (int dy = 0; dy < nTiles / nTilesPerFile; ++dy) {
-		for (int dx = 0; dx < nTiles / nTilesPerFile; ++dx) {
-	   	    sprintf(buf, "%s/%.2d-%.4d-%.4d.tiff", cache.c_str(), maxLevel, dx, dy);
-	   	    if (flog(buf)) {
-                TIFF* f = TIFFOpen(buf, "wb");
-                for (int ny = 0; ny < nTilesPerFile; ++ny) {
-                    for (int nx = 0; nx < nTilesPerFile; ++nx) {
-                        int tx = nx + dx * nTilesPerFile;
-                        int ty = ny + dy * nTilesPerFile;
-                        buildBaseLevelTile(tx, ty, f);
-                    }
+        for (int dx = 0; dx < nTiles / nTilesPerFile; ++dx) {
+            string name = getGroupName("", maxLevel, dx, dy);
+            string file = cache + "/" + name;
+            unsigned long long hash = 0;
+            if (key != 0) {
+                hash = hashBytes(params, sizeof(params), key);
+                hash = hashBytes(&dx, sizeof(int), hash);
+                hash = hashBytes(&dy, sizeof(int), hash);
+                if (isUpToDate(file, name, hash)) {
+                    continue;
                 }
-                TIFFClose(f);
-	   	    }
-		}
-	}
+            }
+            task.add(dx, dy, file, hash);
+        }
+    }
+    parallelFor(task.size(), buildGroup, &task);
 }
 
-void HeightMipmap::buildBaseLevelTile(int tx, int ty, TIFF *f)
+void HeightMipmap::buildBaseLevelTile(int tx, int ty, unsigned char *tile, TIFF *f)
 {
 	int off = 0;
 	for (int j = -2; j <= tileSize + 2; ++j) {
@@ -221,119 +313,306 @@ void HeightMipmap::buildMipmapLevel(int level)
     currentLevel = level + 1;
     reset(baseLevelSize >> (maxLevel - currentLevel), baseLevelSize >> (maxLevel - currentLevel), min(topLevelSize << currentLevel, tileSize));
 
+    int currentTileSize = min(topLevelSize << level, tileSize);
+    int childTileSize = min(topLevelSize << currentLevel, tileSize);
+    int params[] = { MANIFEST_VERSION, tileSize, topLevelSize, baseLevelSize };
+
+    GroupTask task(this, GroupTask::MIPMAP_LEVEL, level);
     for (int dy = 0; dy < nTiles / nTilesPerFile; ++dy) {
         for (int dx = 0; dx < nTiles / nTilesPerFile; ++dx) {
-            sprintf(buf, "%s/%.2d-%.4d-%.4d.tiff", cache.c_str(), level, dx, dy);
-            if (flog(buf)) {
-                TIFF* f = TIFFOpen(buf, "wb");
-                for (int ny = 0; ny < nTilesPerFile; ++ny) {
-                    for (int nx = 0; nx < nTilesPerFile; ++nx) {
-                        int tx = nx + dx * nTilesPerFile;
-                        int ty = ny + dy * nTilesPerFile;
-
-                        int off = 0;
-                        int currentTileSize = min(topLevelSize << level, tileSize);
-                        for (int j = -2; j <= currentTileSize + 2; ++j) {
-                            for (int i = -2; i <= currentTileSize + 2; ++i) {
-                                int ix = 2 * (tx * currentTileSize + i);
-                                int iy = 2 * (ty * currentTileSize + j);
-                                /*float h1 = getTileHeight(ix, iy);
-                                float h2 = getTileHeight(ix+1, iy);
-                                float h3 = getTileHeight(ix, iy+1);
-                                float h4 = getTileHeight(ix+1, iy+1);
-                                short sh = (short) ((h1 + h2 + h3 + h4) / 4);*/
-                                short sh = (short) (getTileHeight(ix, iy));
-                                tile[off++] = sh & 0xFF;
-                                tile[off++] = sh >> 8;
-                            }
-                        }
-
-                        TIFFSetField(f, TIFFTAG_IMAGEWIDTH, currentTileSize + 5);
-                        TIFFSetField(f, TIFFTAG_IMAGELENGTH, currentTileSize + 5);
-                        TIFFSetField(f, TIFFTAG_SAMPLESPERPIXEL, 1);
-                        TIFFSetField(f, TIFFTAG_BITSPERSAMPLE, 16);
-                        TIFFSetField(f, TIFFTAG_COMPRESSION, COMPRESSION_DEFLATE);
-                        TIFFSetField(f, TIFFTAG_ORIENTATION, ORIENTATION_BOTLEFT);
-                        TIFFSetField(f, TIFFTAG_PLANARCONFIG, PLANARCONFIG_CONTIG);
-                        TIFFSetField(f, TIFFTAG_PHOTOMETRIC, PHOTOMETRIC_MINISBLACK);
-                        TIFFWriteEncodedStrip(f, 0, tile, (currentTileSize + 5) * (currentTileSize + 5) * 2);
-                        TIFFWriteDirectory(f);
-                    }
-                }
-                TIFFClose(f);
+            // the tiles of this group read the [2*x0-4,2*x1+4] pixels of
+            // the next level, where [x0,x1] is the group pixels range
+            int x0 = 2 * dx * nTilesPerFile * currentTileSize - 4;
+            int y0 = 2 * dy * nTilesPerFile * currentTileSize - 4;
+            int x1 = 2 * (dx + 1) * nTilesPerFile * currentTileSize + 4;
+            int y1 = 2 * (dy + 1) * nTilesPerFile * currentTileSize + 4;
+            unsigned long long hash = hashBytes(params, sizeof(params));
+            hash = hashGroups("", currentLevel, x0 / childTileSize - 1, y0 / childTileSize - 1,
+                x1 / childTileSize + 1, y1 / childTileSize + 1, hash);
+            string name = getGroupName("", level, dx, dy);
+            sprintf(buf, "%s/%s", cache.c_str(), name.c_str());
+            if (!isUpToDate(buf, name, hash)) {
+                printf("GENERATING %s\n", buf);
+                task.add(dx, dy, buf, hash);
             }
         }
     }
+    parallelFor(task.size(), buildGroup, &task);
+}
+
+void HeightMipmap::buildMipmapTile(int level, int tx, int ty, unsigned char *tile, TIFF *f)
+{
+    int off = 0;
+    int currentTileSize = min(topLevelSize << level, tileSize);
+    for (int j = -2; j <= currentTileSize + 2; ++j) {
+        for (int i = -2; i <= currentTileSize + 2; ++i) {
+            int ix = 2 * (tx * currentTileSize + i);
+            int iy = 2 * (ty * currentTileSize + j);
+            /*float h1 = getTileHeight(ix, iy);
+            float h2 = getTileHeight(ix+1, iy);
+            float h3 = getTileHeight(ix, iy+1);
+            float h4 = getTileHeight(ix+1, iy+1);
+            short sh = (short) ((h1 + h2 + h3 + h4) / 4);*/
+            short sh = (short) (getTileHeight(ix, iy));
+            tile[off++] = sh & 0xFF;
+            tile[off++] = sh >> 8;
+        }
+    }
+
+    TIFFSetField(f, TIFFTAG_IMAGEWIDTH, currentTileSize + 5);
+    TIFFSetField(f, TIFFTAG_IMAGELENGTH, currentTileSize + 5);
+    TIFFSetField(f, TIFFTAG_SAMPLESPERPIXEL, 1);
+    TIFFSetField(f, TIFFTAG_BITSPERSAMPLE, 16);
+    TIFFSetField(f, TIFFTAG_COMPRESSION, COMPRESSION_DEFLATE);
+    TIFFSetField(f, TIFFTAG_ORIENTATION, ORIENTATION_BOTLEFT);
+    TIFFSetField(f, TIFFTAG_PLANARCONFIG, PLANARCONFIG_CONTIG);
+    TIFFSetField(f, TIFFTAG_PHOTOMETRIC, PHOTOMETRIC_MINISBLACK);
+    TIFFWriteEncodedStrip(f, 0, tile, (currentTileSize + 5) * (currentTileSize + 5) * 2);
+    TIFFWriteDirectory(f);
 }
 
 void HeightMipmap::buildResiduals(int level)
 {
     int nTiles = max(1, (baseLevelSize / this->tileSize) >> (maxLevel - level));
     int nTilesPerFile = min(nTiles, 16);
-    int tileSize = min(topLevelSize << level, this->tileSize);
 
     printf("Build residuals level %d...\n", level);
 
     currentLevel = level;
     reset(baseLevelSize >> (maxLevel - currentLevel), baseLevelSize >> (maxLevel - currentLevel), min(topLevelSize << currentLevel, this->tileSize));
 
-    float *parentTile = new float[(this->tileSize + 5) * (this->tileSize + 5)];
-    float *currentTile = new float[(this->tileSize + 5) * (this->tileSize + 5)];
-    float *residualTile = new float[(this->tileSize + 5) * (this->tileSize + 5)];
-    unsigned char *encodedResidual = new unsigned char[(this->tileSize + 5) * (this->tileSize + 5) * 2];
+    int params[] = { MANIFEST_VERSION, tileSize, topLevelSize, baseLevelSize };
 
-    float maxRR = 0.0;
-    float maxEE = 0.0;
+    GroupTask task(this, GroupTask::RESIDUALS, level);
     for (int dy = 0; dy < nTiles / nTilesPerFile; ++dy) {
         for (int dx = 0; dx < nTiles / nTilesPerFile; ++dx) {
-            char buf[256];
-            sprintf(buf, "%s/residual-%.2d-%.4d-%.4d.tiff", cache.c_str(), level, dx, dy);
-
-            if (flog(buf)) {
-                TIFF* f = TIFFOpen(buf, "wb");
-                for (int ny = 0; ny < nTilesPerFile; ++ny) {
-                    for (int nx = 0; nx < nTilesPerFile; ++nx) {
-                        int tx = nx + dx * nTilesPerFile;
-                        int ty = ny + dy * nTilesPerFile;
-                        float maxR, meanR, maxErr;
-
-                        getApproxTile(level - 1, tx / 2, ty / 2, parentTile);
-                        getTile(level, tx, ty, currentTile);
-                        computeResidual(parentTile, currentTile, level, tx, ty, residualTile, maxR, meanR);
-                        encodeResidual(level, residualTile, encodedResidual);
-                        computeApproxTile(parentTile, residualTile, level, tx, ty, currentTile, maxErr);
-                        if (level < maxLevel) {
-                            saveApproxTile(level, tx, ty, currentTile);
-                        }
-
-                        TIFFSetField(f, TIFFTAG_IMAGEWIDTH, tileSize + 5);
-                        TIFFSetField(f, TIFFTAG_IMAGELENGTH, tileSize + 5);
-                        TIFFSetField(f, TIFFTAG_COMPRESSION, COMPRESSION_DEFLATE);
-                        TIFFSetField(f, TIFFTAG_ORIENTATION, ORIENTATION_BOTLEFT);
-                        TIFFSetField(f, TIFFTAG_PLANARCONFIG, PLANARCONFIG_CONTIG);
-                        TIFFSetField(f, TIFFTAG_PHOTOMETRIC, PHOTOMETRIC_MINISBLACK);
-                        /*TIFFSetField(f, TIFFTAG_SAMPLESPERPIXEL, 1);
-                        TIFFSetField(f, TIFFTAG_BITSPERSAMPLE, 16);*/
-                        TIFFSetField(f, TIFFTAG_SAMPLESPERPIXEL, 2);
-                        TIFFSetField(f, TIFFTAG_BITSPERSAMPLE, 8);
-                        TIFFWriteEncodedStrip(f, 0, encodedResidual, (tileSize + 5) * (tileSize + 5) * 2);
-                        TIFFWriteDirectory(f);
-
-                        maxRR = max(maxR, maxRR);
-                        maxEE = max(maxErr, maxEE);
+            // a residual tile depends on the tile at this level, with its
+            // borders, and on the approximate parent tile, computed by the
+            // residuals of the previous level (or from the level 0 tile)
+            int tx0 = dx * nTilesPerFile;
+            int ty0 = dy * nTilesPerFile;
+            int tx1 = tx0 + nTilesPerFile - 1;
+            int ty1 = ty0 + nTilesPerFile - 1;
+            unsigned long long hash = hashBytes(params, sizeof(params));
+            hash = hashBytes(&scale, sizeof(float), hash);
+            hash = hashGroups("", level, tx0 - 1, ty0 - 1, tx1 + 1, ty1 + 1, hash);
+            if (level == 1) {
+                hash = hashGroups("", 0, -1, -1, 1, 1, hash);
+            } else {
+                for (int ty = ty0 / 2; ty <= ty1 / 2; ++ty) {
+                    for (int tx = tx0 / 2; tx <= tx1 / 2; ++tx) {
+                        char raw[256];
+                        sprintf(raw, "%.2d-%.4d-%.4d.raw", level - 1, tx, ty);
+                        hash = hashContent(raw, hash);
                     }
                 }
+            }
+            char buf[256];
+            string name = getGroupName("residual-", level, dx, dy);
+            sprintf(buf, "%s/%s", cache.c_str(), name.c_str());
+            bool upToDate = isUpToDate(buf, name, hash);
+            // the approximate tiles are needed by the next level
+            for (int ty = ty0; upToDate && level < maxLevel && ty <= ty1; ++ty) {
+                for (int tx = tx0; upToDate && tx <= tx1; ++tx) {
+                    char raw[256];
+                    sprintf(raw, "%s/%.2d-%.4d-%.4d.raw", cache.c_str(), level, tx, ty);
+                    upToDate = fexists(raw);
+                }
+            }
+            if (!upToDate) {
+                printf("GENERATING %s\n", buf);
+                task.add(dx, dy, buf, hash);
+            }
+        }
+    }
+    if (task.size() == 0) {
+        return;
+    }
+    if (level == 1) {
+        // the level 0 tile is computed from the level 0 mipmap, which
+        // requires a reset of the cache; it is therefore computed here,
+        // once, instead of in each task
+        task.rootTile = new float[(this->tileSize + 5) * (this->tileSize + 5)];
+        getApproxTile(0, 0, 0, task.rootTile);
+    }
+    parallelFor(task.size(), buildGroup, &task);
+
+    float maxRR = 0.0;
+    float maxEE = 0.0;
+    for (int i = 0; i < task.size(); ++i) {
+        maxRR = max(task.maxR[i], maxRR);
+        maxEE = max(task.maxErr[i], maxEE);
+    }
+    printf("%f max residual, %f max err\n", maxRR, maxEE);
+
+    if (task.rootTile != NULL) {
+        delete[] task.rootTile;
+    }
+}
 
-                TIFFClose(f);
-                printf("%f max residual, %f max err\n", maxRR, maxEE);
+void HeightMipmap::buildResidualTile(int level, int tx, int ty, const float *rootTile, float *buffers, unsigned char *encodedResidual, TIFF *f, float &maxRR, float &maxEE)
+{
+    int tileSize = min(topLevelSize << level, this->tileSize);
+    int n = (this->tileSize + 5) * (this->tileSize + 5);
+    float *parentTile = buffers;
+    float *currentTile = buffers + n;
+    float *residualTile = buffers + 2 * n;
+    float *upsampledTile = buffers + 3 * n;
+    float maxR, meanR, maxErr;
+
+    if (rootTile != NULL) {
+        memcpy(parentTile, rootTile, n * sizeof(float));
+    } else {
+        getApproxTile(level - 1, tx / 2, ty / 2, parentTile);
+    }
+    getTile(level, tx, ty, currentTile);
+    computeResidual(parentTile, currentTile, level, tx, ty, upsampledTile, residualTile, maxR, meanR);
+    encodeResidual(level, residualTile, encodedResidual);
+    computeApproxTile(parentTile, residualTile, level, tx, ty, upsampledTile, currentTile, maxErr);
+    if (level < maxLevel) {
+        saveApproxTile(level, tx, ty, currentTile);
+    }
+
+    TIFFSetField(f, TIFFTAG_IMAGEWIDTH, tileSize + 5);
+    TIFFSetField(f, TIFFTAG_IMAGELENGTH, tileSize + 5);
+    TIFFSetField(f, TIFFTAG_COMPRESSION, COMPRESSION_DEFLATE);
+    TIFFSetField(f, TIFFTAG_ORIENTATION, ORIENTATION_BOTLEFT);
+    TIFFSetField(f, TIFFTAG_PLANARCONFIG, PLANARCONFIG_CONTIG);
+    TIFFSetField(f, TIFFTAG_PHOTOMETRIC, PHOTOMETRIC_MINISBLACK);
+    /*TIFFSetField(f, TIFFTAG_SAMPLESPERPIXEL, 1);
+    TIFFSetField(f, TIFFTAG_BITSPERSAMPLE, 16);*/
+    TIFFSetField(f, TIFFTAG_SAMPLESPERPIXEL, 2);
+    TIFFSetField(f, TIFFTAG_BITSPERSAMPLE, 8);
+    TIFFWriteEncodedStrip(f, 0, encodedResidual, (tileSize + 5) * (tileSize + 5) * 2);
+    TIFFWriteDirectory(f);
+
+    maxRR = max(maxR, maxRR);
+    maxEE = max(maxErr, maxEE);
+}
+
+void HeightMipmap::buildGroup(int i, void *data)
+{
+    GroupTask *task = (GroupTask*) data;
+    HeightMipmap *owner = task->owner;
+    int level = task->level;
+    int nTiles = max(1, (owner->baseLevelSize / owner->tileSize) >> (owner->maxLevel - level));
+    int nTilesPerFile = min(nTiles, 16);
+    int dx = task->groups[2 * i];
+    int dy = task->groups[2 * i + 1];
+    int n = (owner->tileSize + 5) * (owner->tileSize + 5);
+    unsigned char *tile = new unsigned char[n * 2];
+    float *buffers = task->stage == GroupTask::RESIDUALS ? new float[4 * n] : NULL;
+
+    // each group is written in a temporary file, renamed when complete,
+    // so that an interrupted run never leaves a partial file (see flog)
+    string tmp = task->files[i] + ".tmp";
+    TIFF* f = TIFFOpen(tmp.c_str(), "wb");
+    int params[] = { MANIFEST_VERSION, owner->tileSize, owner->baseLevelSize };
+    unsigned long long content = hashBytes(params, sizeof(params));
+    for (int ny = 0; ny < nTilesPerFile; ++ny) {
+        for (int nx = 0; nx < nTilesPerFile; ++nx) {
+            int tx = nx + dx * nTilesPerFile;
+            int ty = ny + dy * nTilesPerFile;
+            switch (task->stage) {
+            case GroupTask::BASE_LEVEL:
+                if (nx + 1 < nTilesPerFile || ny + 1 < nTilesPerFile) {
+                    // the source data of the next tile is loaded while this one is built
+                    int ntx = (nx + 1) % nTilesPerFile + dx * nTilesPerFile;
+                    int nty = ny + (nx + 1) / nTilesPerFile + dy * nTilesPerFile;
+                    int ts = owner->tileSize;
+                    owner->height->prefetch(ntx * ts - 2, nty * ts - 2, (ntx + 1) * ts + 2, (nty + 1) * ts + 2);
+                }
+                owner->buildBaseLevelTile(tx, ty, tile, f);
+                break;
+            case GroupTask::MIPMAP_LEVEL:
+                owner->buildMipmapTile(level, tx, ty, tile, f);
+                break;
+            case GroupTask::RESIDUALS:
+                owner->buildResidualTile(level, tx, ty, task->rootTile, buffers, tile, f, task->maxR[i], task->maxErr[i]);
+                break;
+            }
+            content = hashBytes(tile, n * 2, content);
+        }
+    }
+    TIFFClose(f);
+
+    // the hash of the base level tiles is the key of their source, or 0 if
+    // it is unknown: they are compared with their previous content instead
+    string name = task->files[i].substr(owner->cache.size() + 1);
+    unsigned long long hash = task->hashes[i];
+    unsigned long long h;
+    unsigned long long previous;
+    if (task->stage == GroupTask::BASE_LEVEL && owner->manifest->get(name, h, previous) &&
+        previous == content && fexists(task->files[i]))
+    {
+        // the existing file, and the files computed from it, are still valid
+        remove(tmp.c_str());
+        owner->manifest->put(name, hash, content);
+    } else {
+        if (task->stage == GroupTask::BASE_LEVEL) {
+            printf("GENERATING %s\n", task->files[i].c_str());
+        }
+        rename(tmp.c_str(), task->files[i].c_str());
+        owner->manifest->put(name, hash, content);
+    }
+
+    delete[] tile;
+    if (buffers != NULL) {
+        delete[] buffers;
+    }
+}
+
+string HeightMipmap::getGroupName(const char *prefix, int level, int dx, int dy)
+{
+    char buf[256];
+    sprintf(buf, "%s%.2d-%.4d-%.4d.tiff", prefix, level, dx, dy);
+    return buf;
+}
+
+unsigned long long HeightMipmap::hashGroups(const char *prefix, int level, int tx0, int ty0, int tx1, int ty1, unsigned long long hash)
+{
+    int nTiles = max(1, (baseLevelSize / tileSize) >> (maxLevel - level));
+    int nTilesPerFile = min(nTiles, 16);
+    if (tx0 < 0 || ty0 < 0 || tx1 >= nTiles || ty1 >= nTiles) {
+        // the borders of these tiles come from the neighbor faces, if any
+        HeightMipmap *neighbors[4] = { left, right, bottom, top };
+        for (int i = 0; i < 4; ++i) {
+            if (neighbors[i] != NULL) {
+                hash = neighbors[i]->hashLevel(prefix, level, hash);
             }
         }
     }
+    int dx0 = max(tx0, 0) / nTilesPerFile;
+    int dy0 = max(ty0, 0) / nTilesPerFile;
+    int dx1 = min(tx1, nTiles - 1) / nTilesPerFile;
+    int dy1 = min(ty1, nTiles - 1) / nTilesPerFile;
+    for (int dy = dy0; dy <= dy1; ++dy) {
+        for (int dx = dx0; dx <= dx1; ++dx) {
+            hash = hashContent(getGroupName(prefix, level, dx, dy), hash);
+        }
+    }
+    return hash;
+}
 
-    delete[] parentTile;
-    delete[] currentTile;
-    delete[] residualTile;
-    delete[] encodedResidual;
+unsigned long long HeightMipmap::hashLevel(const char *prefix, int level, unsigned long long hash)
+{
+    int nTiles = max(1, (baseLevelSize / tileSize) >> (maxLevel - level));
+    return hashGroups(prefix, level, 0, 0, nTiles - 1, nTiles - 1, hash);
+}
+
+unsigned long long HeightMipmap::hashContent(const string &name, unsigned long long hash)
+{
+    unsigned long long h = 0;
+    unsigned long long content = 0;
+    manifest->get(name, h, content);
+    return hashBytes(&content, sizeof(content), hash);
+}
+
+bool HeightMipmap::isUpToDate(const string &file, const string &name, unsigned long long hash)
+{
+    unsigned long long h;
+    unsigned long long content;
+    return manifest->get(name, h, content) && h == hash && fexists(file);
 }
 
 void rotation(int r, int n, int x, int y, int &xp, int &yp);
@@ -458,9 +737,12 @@ void HeightMipmap::saveApproxTile(int level, int tx, int ty, float *tile)
     fopen(&f, buf, "wb");
     fwrite(tile, (tileSize + 5) * (tileSize + 5) * sizeof(float), 1, f);
     fclose(f);
+    // used to find the residual tiles of the next level to recompute
+    unsigned long long hash = hashBytes(tile, (tileSize + 5) * (tileSize + 5) * sizeof(float));
+    manifest->put(buf + cache.size() + 1, hash, hash);
 }
 
-void HeightMipmap::computeResidual(float *parentTile, float *tile, int level, int tx, int ty, float *residual, float &maxR, float &meanR)
+void HeightMipmap::computeResidual(float *parentTile, float *tile, int level, int tx, int ty, float *upsampledTile, float *residual, float &maxR, float &meanR)
 {
     maxR = 0.0;
     meanR = 0.0;
@@ -468,39 +750,11 @@ void HeightMipmap::computeResidual(float *parentTile, float *tile, int level, in
     int px = 1 + (tx % 2) * tileSize / 2;
     int py = 1 + (ty % 2) * tileSize / 2;
     const int n = this->tileSize + 5;
+    proland::upsample(parentTile, n, px, py, tileSize + 5, upsampledTile);
     for (int j = 0; j <= tileSize + 4; ++j) {
         for (int i = 0; i <= tileSize + 4; ++i) {
-            float z;
-            if (j%2 == 0) {
-                if (i%2 == 0) {
-                    z = parentTile[i/2+px + (j/2+py)*n];
-                } else {
-                    float z0 = parentTile[i/2+px-1 + (j/2+py)*n];
-                    float z1 = parentTile[i/2+px + (j/2+py)*n];
-                    float z2 = parentTile[i/2+px+1 + (j/2+py)*n];
-                    float z3 = parentTile[i/2+px+2 + (j/2+py)*n];
-                    z = ((z1+z2)*9-(z0+z3))/16;
-                }
-            } else {
-                if (i%2 == 0) {
-                    float z0 = parentTile[i/2+px + (j/2-1+py)*n];
-                    float z1 = parentTile[i/2+px + (j/2+py)*n];
-                    float z2 = parentTile[i/2+px + (j/2+1+py)*n];
-                    float z3 = parentTile[i/2+px + (j/2+2+py)*n];
-                    z = ((z1+z2)*9-(z0+z3))/16;
-                } else {
-                    int di, dj;
-                    z = 0;
-                    for (dj = -1; dj <= 2; ++dj) {
-                        float f = dj == -1 || dj == 2 ? -1/16.0 : 9/16.0;
-                        for (di = -1; di <= 2; ++di) {
-                            float g = di == -1 || di == 2 ? -1/16.0 : 9/16.0;
-                            z += f*g*parentTile[i/2+di+px + (j/2+dj+py)*n];
-                        }
-                    }
-                }
-            }
             int off = i + j * n;
+            float z = upsampledTile[off];
             float diff = tile[off] - z;
             residual[off] = diff;
             maxR = max(diff < 0.0 ? -diff : diff, maxR);
@@ -525,46 +779,18 @@ void HeightMipmap::encodeResidual(int level, float *residual, unsigned char *enc
     }
 }
 
-void HeightMipmap::computeApproxTile(float *parentTile, float *residual, int level, int tx, int ty, float *tile, float &maxErr)
+void HeightMipmap::computeApproxTile(float *parentTile, float *residual, int level, int tx, int ty, float *upsampledTile, float *tile, float &maxErr)
 {
     maxErr = 0.0;
     int tileSize = min(topLevelSize << level, this->tileSize);
     int px = 1 + (tx % 2) * tileSize / 2;
     int py = 1 + (ty % 2) * tileSize / 2;
     const int n = this->tileSize + 5;
+    proland::upsample(parentTile, n, px, py, tileSize + 5, upsampledTile);
     for (int j = 0; j <= tileSize + 4; ++j) {
         for (int i = 0; i <= tileSize + 4; ++i) {
-            float z;
-            if (j%2 == 0) {
-                if (i%2 == 0) {
-                    z = parentTile[i/2+px + (j/2+py)*n];
-                } else {
-                    float z0 = parentTile[i/2+px-1 + (j/2+py)*n];
-                    float z1 = parentTile[i/2+px + (j/2+py)*n];
-                    float z2 = parentTile[i/2+px+1 + (j/2+py)*n];
-                    float z3 = parentTile[i/2+px+2 + (j/2+py)*n];
-                    z = ((z1+z2)*9-(z0+z3))/16;
-                }
-            } else {
-                if (i%2 == 0) {
-                    float z0 = parentTile[i/2+px + (j/2-1+py)*n];
-                    float z1 = parentTile[i/2+px + (j/2+py)*n];
-                    float z2 = parentTile[i/2+px + (j/2+1+py)*n];
-                    float z3 = parentTile[i/2+px + (j/2+2+py)*n];
-                    z = ((z1+z2)*9-(z0+z3))/16;
-                } else {
-                    int di, dj;
-                    z = 0.0;
-                    for (dj = -1; dj <= 2; ++dj) {
-                        float f = dj == -1 || dj == 2 ? -1/16.0 : 9/16.0;
-                        for (di = -1; di <= 2; ++di) {
-                            float g = di == -1 || di == 2 ? -1/16.0 : 9/16.0;
-                            z += f*g*parentTile[i/2+di+px + (j/2+dj+py)*n];
-                        }
-                    }
-                }
-            }
             int off = i + j * n;
+            float z = upsampledTile[off];
             float err = tile[off] - (z + residual[off]);
             maxErr = max(err < 0.0 ? -err : err, maxErr);
             tile[off] = z + residual[off];
@@ -572,7 +798,7 @@ void HeightMipmap::computeApproxTile(float *parentTile, float *residual, int lev
     }
 }
 
-void HeightMipmap::produceTile(int level, int tx, int ty, unsigned int *offset, unsigned int *offsets, FILE *f)
+void HeightMipmap::encodeTile(int level, int tx, int ty, unsigned char *tile, vector<unsigned char> &data, bool &isConstant)
 {
     int nTiles = max(1, (baseLevelSize / this->tileSize) >> (maxLevel - level));
     int nTilesPerFile = min(nTiles, 16);
@@ -604,15 +830,7 @@ void HeightMipmap::produceTile(int level, int tx, int ty, unsigned int *offset,
         TIFFClose(f);
     }
 
-    int tileid;
-	if (level < minLevel) {
-	    tileid = level;
-	} else {
-        int l = max(level - minLevel, 0);
-	    tileid = minLevel + tx + ty * (1 << l) + ((1 << (2 * l)) - 1) / 3;
-	}
-
-    bool isConstant = true;
+    isConstant = true;
     for (int i = 0; i < (tileSize + 5) * (tileSize + 5) * 2; ++i) {
         if (tile[i] != 0) {
             isConstant = false;
@@ -620,51 +838,112 @@ void HeightMipmap::produceTile(int level, int tx, int ty, unsigned int *offset,
         }
     }
 
-    if (isConstant && constantTile != -1) {
-        offsets[2 * tileid] = offsets[2 * constantTile];
-        offsets[2 * tileid + 1] = offsets[2 * constantTile + 1];
+    // constant tiles are only compressed if they are written (see produceTiles)
+    if (!isConstant) {
+        compressTile(tileSize, tile, data);
+    }
+}
+
+void HeightMipmap::compressTile(int tileSize, const unsigned char *tile, vector<unsigned char> &data)
+{
+    bool ok;
+    if (codec != TileCodec::TIFF) {
+        ok = TileCodec::compress(codec, tile, (tileSize + 5) * (tileSize + 5) * 2, data);
     } else {
-        mfs_file fd;
-        mfs_open(NULL, 0, (char*)"w", &fd);
-        TIFF* tf = TIFFClientOpen("", "w", &fd,
-            (TIFFReadWriteProc) mfs_read, (TIFFReadWriteProc) mfs_write, (TIFFSeekProc) mfs_lseek,
-            (TIFFCloseProc) mfs_close, (TIFFSizeProc) mfs_size, (TIFFMapFileProc) mfs_map,
-            (TIFFUnmapFileProc) mfs_unmap);
-        TIFFSetField(tf, TIFFTAG_IMAGEWIDTH, tileSize + 5);
-        TIFFSetField(tf, TIFFTAG_IMAGELENGTH, tileSize + 5);
-        TIFFSetField(tf, TIFFTAG_COMPRESSION, COMPRESSION_DEFLATE);
-        TIFFSetField(tf, TIFFTAG_ORIENTATION, ORIENTATION_BOTLEFT);
-        TIFFSetField(tf, TIFFTAG_PLANARCONFIG, PLANARCONFIG_CONTIG);
-        TIFFSetField(tf, TIFFTAG_PHOTOMETRIC, PHOTOMETRIC_MINISBLACK);
-        /*TIFFSetField(tf, TIFFTAG_SAMPLESPERPIXEL, 1);
-        TIFFSetField(tf, TIFFTAG_BITSPERSAMPLE, 16);*/
-        TIFFSetField(tf, TIFFTAG_SAMPLESPERPIXEL, 2);
-        TIFFSetField(tf, TIFFTAG_BITSPERSAMPLE, 8);
-        TIFFWriteEncodedStrip(tf, 0, tile, (tileSize + 5) * (tileSize + 5) * 2);
-        TIFFClose(tf);
+        ok = TileCodec::compressTiff(tile, tileSize + 5, 2, 0, data);
+    }
+    // an empty result signals the error to produceTiles
+    if (!ok) {
+        data.clear();
+    }
+}
 
-        fwrite(fd.buf, fd.buf_size, 1, f);
-        free(fd.buf);
+void HeightMipmap::encodeTiles(int i, void *data)
+{
+    EncodeTask *task = (EncodeTask*) data;
+    HeightMipmap *owner = task->owner;
+    const int *t = task->tiles + 3 * i;
+    unsigned char *tile = new unsigned char[(owner->tileSize + 5) * (owner->tileSize + 5) * 2];
+    owner->encodeTile(t[0], t[1], t[2], tile, task->data[i], task->isConstant[i]);
+    delete[] tile;
+}
 
-        offsets[2 * tileid] = *offset;
-        *offset += fd.buf_size;
-        offsets[2 * tileid + 1] = *offset;
-    }
+void HeightMipmap::produceTiles(const vector<int> &tiles, unsigned int *offset, unsigned int *offsets, FILE *f)
+{
+    // the tiles are encoded in parallel by windows of at most 'window'
+    // tiles, whose size is bounded by the memory budget, and each window
+    // is then written sequentially, in order, so that the generated file
+    // does not depend on the number of threads
+    int n = int(tiles.size()) / 3;
+    int tileBytes = (tileSize + 5) * (tileSize + 5) * 2;
+    int window = int(min((long long) n, max((long long) getPreprocessThreads(), getPreprocessMemoryBudget() / tileBytes)));
+    vector<unsigned char> *data = new vector<unsigned char>[window];
+    bool *isConstant = new bool[window];
+
+    for (int first = 0; first < n; first += window) {
+        int count = min(window, n - first);
+        EncodeTask task;
+        task.owner = this;
+        task.tiles = &tiles[3 * first];
+        task.data = data;
+        task.isConstant = isConstant;
+        parallelFor(count, encodeTiles, &task);
+
+        for (int i = 0; i < count; ++i) {
+            int level = tiles[3 * (first + i)];
+            int tx = tiles[3 * (first + i) + 1];
+            int ty = tiles[3 * (first + i) + 2];
+
+            int tileid;
+            if (level < minLevel) {
+                tileid = level;
+            } else {
+                int l = max(level - minLevel, 0);
+                tileid = minLevel + tx + ty * (1 << l) + ((1 << (2 * l)) - 1) / 3;
+            }
 
-    if (isConstant && constantTile == -1) {
-        constantTile = tileid;
+            if (isConstant[i] && constantTile != -1) {
+                offsets[2 * tileid] = offsets[2 * constantTile];
+                offsets[2 * tileid + 1] = offsets[2 * constantTile + 1];
+            } else {
+                if (isConstant[i]) {
+                    int size = min(topLevelSize << level, tileSize);
+                    vector<unsigned char> zero((size + 5) * (size + 5) * 2, 0);
+                    compressTile(size, &zero[0], data[i]);
+                }
+                if (data[i].empty()) {
+                    fprintf(stderr, "Cannot compress tile %d %d %d\n", level, tx, ty);
+                    throw exception();
+                }
+                fwrite(&data[i][0], data[i].size(), 1, f);
+
+                offsets[2 * tileid] = *offset;
+                *offset += data[i].size();
+                offsets[2 * tileid + 1] = *offset;
+            }
+
+            if (isConstant[i] && constantTile == -1) {
+                constantTile = tileid;
+            }
+            data[i].clear();
+        }
     }
+
+    delete[] data;
+    delete[] isConstant;
 }
 
-void HeightMipmap::produceTilesLebeguesOrder(int l, int level, int tx, int ty, unsigned int *offset, unsigned int *offsets, FILE *f)
+void HeightMipmap::getTilesLebeguesOrder(int l, int level, int tx, int ty, vector<int> &tiles)
 {
     if (level < l) {
-        produceTilesLebeguesOrder(l, level+1, 2*tx, 2*ty, offset, offsets, f);
-        produceTilesLebeguesOrder(l, level+1, 2*tx+1, 2*ty, offset, offsets, f);
-        produceTilesLebeguesOrder(l, level+1, 2*tx, 2*ty+1, offset, offsets, f);
-        produceTilesLebeguesOrder(l, level+1, 2*tx+1, 2*ty+1, offset, offsets, f);
+        getTilesLebeguesOrder(l, level+1, 2*tx, 2*ty, tiles);
+        getTilesLebeguesOrder(l, level+1, 2*tx+1, 2*ty, tiles);
+        getTilesLebeguesOrder(l, level+1, 2*tx, 2*ty+1, tiles);
+        getTilesLebeguesOrder(l, level+1, 2*tx+1, 2*ty+1, tiles);
     } else {
-        produceTile(minLevel + level, tx, ty, offset, offsets, f);
+        tiles.push_back(minLevel + level);
+        tiles.push_back(tx);
+        tiles.push_back(ty);
     }
 }
 
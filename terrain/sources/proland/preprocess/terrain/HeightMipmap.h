@@ -44,10 +44,13 @@
 
 #include <string>
 #include <cmath>
+#include <vector>
 
 #include "tiffio.h"
 
+#include "proland/producer/TileCodec.h"
 #include "proland/preprocess/terrain/AbstractTileCache.h"
+#include "proland/preprocess/terrain/Manifest.h"
 
 namespace proland
 {
@@ -59,6 +62,17 @@ public:
     {
     public:
         virtual float getHeight(int x, int y) = 0;
+
+        // hints that the [x0,x1]x[y0,y1] region will soon be read
+        virtual void prefetch(int x0, int y0, int x1, int y1)
+        {
+        }
+
+        // a key that changes when the heights change, or 0 if unknown
+        virtual unsigned long long getSourceKey()
+        {
+            return 0;
+        }
     };
 
     HeightMipmap *left;
@@ -80,7 +94,7 @@ public:
 
     bool compute2();
 
-    void generate(int rootLevel, int rootTx, int rootTy, float scale, const string &file);
+    void generate(int rootLevel, int rootTx, int rootTy, float scale, const string &file, TileCodec::Codec codec = TileCodec::TIFF);
 
     virtual float getTileHeight(int x, int y);
 
@@ -104,39 +118,67 @@ private:
 
     string cache;
 
+    Manifest *manifest;
+
     int minLevel;
 
     int maxLevel;
 
     int currentMipLevel;
 
-    unsigned char *tile;
-
     int currentLevel;
 
     int constantTile;
 
+    TileCodec::Codec codec;
+
+    struct GroupTask;
+
+    struct EncodeTask;
+
     void buildBaseLevelTiles();
 
-    void buildBaseLevelTile(int tx, int ty, TIFF *f);
+    void buildBaseLevelTile(int tx, int ty, unsigned char *tile, TIFF *f);
 
     void buildMipmapLevel(int level);
 
+    void buildMipmapTile(int level, int tx, int ty, unsigned char *tile, TIFF *f);
+
     void buildResiduals(int level);
 
+    void buildResidualTile(int level, int tx, int ty, const float *rootTile, float *buffers, unsigned char *encodedResidual, TIFF *f, float &maxRR, float &maxEE);
+
+    static void buildGroup(int i, void *data);
+
+    string getGroupName(const char *prefix, int level, int dx, int dy);
+
+    unsigned long long hashGroups(const char *prefix, int level, int tx0, int ty0, int tx1, int ty1, unsigned long long hash);
+
+    unsigned long long hashLevel(const char *prefix, int level, unsigned long long hash);
+
+    unsigned long long hashContent(const string &name, unsigned long long hash);
+
+    bool isUpToDate(const string &file, const string &name, unsigned long long hash);
+
     void getApproxTile(int level, int tx, int ty, float *tile);
 
     void saveApproxTile(int level, int tx, int ty, float *tile);
 
-    void computeResidual(float *parentTile, float *tile, int level, int tx, int ty, float *residual, float &maxR, float &meanR);
+    void computeResidual(float *parentTile, float *tile, int level, int tx, int ty, float *upsampledTile, float *residual, float &maxR, float &meanR);
 
     void encodeResidual(int level, float *residual, unsigned char *encoded);
 
-    void computeApproxTile(float *parentTile, float *residual, int level, int tx, int ty, float *tile, float &maxErr);
+    void computeApproxTile(float *parentTile, float *residual, int level, int tx, int ty, float *upsampledTile, float *tile, float &maxErr);
+
+    void encodeTile(int level, int tx, int ty, unsigned char *tile, vector<unsigned char> &data, bool &isConstant);
+
+    void compressTile(int tileSize, const unsigned char *tile, vector<unsigned char> &data);
+
+    static void encodeTiles(int i, void *data);
 
-    void produceTile(int level, int tx, int ty, unsigned int *offset, unsigned int *offsets, FILE *f);
+    void produceTiles(const vector<int> &tiles, unsigned int *offset, unsigned int *offsets, FILE *f);
 
-    void produceTilesLebeguesOrder(int l, int level, int tx, int ty, unsigned int *offset, unsigned int *offsets, FILE *f);
+    void getTilesLebeguesOrder(int l, int level, int tx, int ty, vector<int> &tiles);
 };
 
 }
@@ -0,0 +1,131 @@
+/*
+ * Proland: a procedural landscape rendering library.
+ * Website : http://proland.inrialpes.fr/
+ * Copyright (c) 2008-2015 INRIA - LJK (CNRS - Grenoble University)
+ * All rights reserved.
+ * Redistribution and use in source and binary forms, with or without 
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice, 
+ * this list of conditions and the following disclaimer.
+ * 
+ * 2. Redistributions in binary form must reproduce the above copyright notice, 
+ * this list of conditions and the following disclaimer in the documentation 
+ * and/or other materials provided with the distribution.
+ * 
+ * 3. Neither the name of the copyright holder nor the names of its contributors 
+ * may be used to endorse or promote products derived from this software without 
+ * specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND 
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED 
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. 
+ * IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, 
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, 
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, 
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF 
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE 
+ * OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED 
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+/*
+ * Proland is distributed under the Berkeley Software Distribution 3 Licence. 
+ * For any assistance, feedback and enquiries about training programs, you can check out the 
+ * contact page on our website : 
+ * http://proland.inrialpes.fr/
+ */
+/*
+ * Main authors: Eric Bruneton, Antoine Begault, Guillaume Piolat.
+ */
+
+#include "proland/preprocess/terrain/Manifest.h"
+
+#include <string.h>
+#include <pthread.h>
+
+#include "ork/core/Object.h"
+#include "proland/producer/TileDiskCache.h"
+
+namespace proland
+{
+
+Manifest::Manifest(const string &file)
+{
+    // the manifest is an append only log, in which the last hash of a
+    // file wins; it is compacted here, and reopened in append mode
+    FILE *f;
+    fopen(&f, file.c_str(), "r");
+    if (f != NULL) {
+        char line[512];
+        while (fgets(line, 512, f) != NULL) {
+            unsigned long long hash;
+            unsigned long long content;
+            char name[512];
+            // lines truncated by an interrupted run are ignored
+            if (strchr(line, '\n') != NULL && sscanf(line, "%llx %llx %511s", &hash, &content, name) == 3) {
+                hashes[name] = make_pair(hash, content);
+            }
+        }
+        fclose(f);
+    }
+    string tmp = file + ".tmp";
+    fopen(&f, tmp.c_str(), "w");
+    if (f != NULL) {
+        map< string, pair<unsigned long long, unsigned long long> >::iterator i = hashes.begin();
+        while (i != hashes.end()) {
+            fprintf(f, "%016llx %016llx %s\n", i->second.first, i->second.second, i->first.c_str());
+            ++i;
+        }
+        fclose(f);
+        rename(tmp.c_str(), file.c_str());
+    }
+    fopen(&log, file.c_str(), "a");
+    mutex = new pthread_mutex_t;
+    pthread_mutex_init((pthread_mutex_t*) mutex, NULL);
+}
+
+Manifest::~Manifest()
+{
+    if (log != NULL) {
+        fclose(log);
+    }
+    pthread_mutex_destroy((pthread_mutex_t*) mutex);
+    delete (pthread_mutex_t*) mutex;
+}
+
+bool Manifest::get(const string &name, unsigned long long &hash, unsigned long long &content)
+{
+    pthread_mutex_lock((pthread_mutex_t*) mutex);
+    map< string, pair<unsigned long long, unsigned long long> >::iterator i = hashes.find(name);
+    bool found = i != hashes.end();
+    if (found) {
+        hash = i->second.first;
+        content = i->second.second;
+    }
+    pthread_mutex_unlock((pthread_mutex_t*) mutex);
+    return found;
+}
+
+void Manifest::put(const string &name, unsigned long long hash, unsigned long long content)
+{
+    pthread_mutex_lock((pthread_mutex_t*) mutex);
+    hashes[name] = make_pair(hash, content);
+    if (log != NULL) {
+        fprintf(log, "%016llx %016llx %s\n", hash, content, name.c_str());
+        fflush(log);
+    }
+    pthread_mutex_unlock((pthread_mutex_t*) mutex);
+}
+
+unsigned long long hashBytes(const void *data, size_t size, unsigned long long hash)
+{
+    // 64 bits FNV-1a
+    const unsigned char *p = (const unsigned char*) data;
+    for (size_t i = 0; i < size; ++i) {
+        hash = TileDiskCache::fnvMix(hash, p[i]);
+    }
+    return hash;
+}
+
+}
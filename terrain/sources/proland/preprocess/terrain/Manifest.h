@@ -0,0 +1,87 @@
+/*
+ * Proland: a procedural landscape rendering library.
+ * Website : http://proland.inrialpes.fr/
+ * Copyright (c) 2008-2015 INRIA - LJK (CNRS - Grenoble University)
+ * All rights reserved.
+ * Redistribution and use in source and binary forms, with or without 
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice, 
+ * this list of conditions and the following disclaimer.
+ * 
+ * 2. Redistributions in binary form must reproduce the above copyright notice, 
+ * this list of conditions and the following disclaimer in the documentation 
+ * and/or other materials provided with the distribution.
+ * 
+ * 3. Neither the name of the copyright holder nor the names of its contributors 
+ * may be used to endorse or promote products derived from this software without 
+ * specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND 
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED 
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. 
+ * IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, 
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, 
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, 
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF 
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE 
+ * OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED 
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+/*
+ * Proland is distributed under the Berkeley Software Distribution 3 Licence. 
+ * For any assistance, feedback and enquiries about training programs, you can check out the 
+ * contact page on our website : 
+ * http://proland.inrialpes.fr/
+ */
+/*
+ * Main authors: Eric Bruneton, Antoine Begault, Guillaume Piolat.
+ */
+
+#ifndef _PROLAND_MANIFEST_
+#define _PROLAND_MANIFEST_
+
+#include <string>
+#include <map>
+#include <stdio.h>
+
+using namespace std;
+
+namespace proland
+{
+
+/**
+ * The hashes of the intermediate files of a preprocessing folder. Each
+ * file has an input hash, which identifies the inputs and parameters used
+ * to build it, and a content hash. A new preprocessing run can reuse the
+ * files whose input hash did not change, and the files computed from them
+ * if their content hash did not change either. The hashes are appended to
+ * a file as soon as they are recorded, so that an interrupted run can be
+ * resumed from the last completed file.
+ * This class can be used from several threads.
+ */
+class Manifest
+{
+public:
+    Manifest(const string &file);
+
+    ~Manifest();
+
+    bool get(const string &name, unsigned long long &hash, unsigned long long &content);
+
+    void put(const string &name, unsigned long long hash, unsigned long long content);
+
+private:
+    map< string, pair<unsigned long long, unsigned long long> > hashes;
+
+    FILE *log;
+
+    void *mutex;
+};
+
+unsigned long long hashBytes(const void *data, size_t size, unsigned long long hash = 14695981039346656037ULL);
+
+}
+
+#endif
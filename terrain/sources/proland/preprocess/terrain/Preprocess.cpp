@@ -45,12 +45,21 @@
 #include <sys/stat.h>
 
 #include <errno.h>
+#include <pthread.h>
+#include <string.h>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
 
 #include "ork/core/Object.h"
 #include "proland/preprocess/terrain/ApertureMipmap.h"
 #include "proland/preprocess/terrain/ColorMipmap.h"
 #include "proland/preprocess/terrain/HeightMipmap.h"
 #include "proland/preprocess/terrain/Util.h"
+#include "proland/producer/TileDiskCache.h"
 
 #define RGB_JPEG_QUALITY 90
 
@@ -69,16 +78,74 @@ InputMap::Tile::~Tile()
     }
 }
 
-InputMap::InputMap(int width, int height, int channels, int tileSize, int capacity) :
-    width(width), height(height), channels(channels), tileSize(tileSize), capacity(capacity)
+#define MAX_CACHE_SHARDS 16
+
+InputMap::InputMap(int width, int height, int channels, int tileSize, int cache) :
+    width(width), height(height), channels(channels), tileSize(tileSize),
+    prefetchThread(NULL), prefetchStop(false)
 {
     assert(tileSize > 0);
     assert(width % tileSize == 0);
     assert(height % tileSize == 0);
+    long long tileBytes = (long long) tileSize * tileSize * channels * sizeof(float);
+    createCache(cache * tileBytes);
+    loadMutex = new pthread_mutex_t;
+    pthread_mutex_init((pthread_mutex_t*) loadMutex, NULL);
+    loadCondition = new pthread_cond_t;
+    pthread_cond_init((pthread_cond_t*) loadCondition, NULL);
+    prefetchMutex = new pthread_mutex_t;
+    pthread_mutex_init((pthread_mutex_t*) prefetchMutex, NULL);
+    prefetchCondition = new pthread_cond_t;
+    pthread_cond_init((pthread_cond_t*) prefetchCondition, NULL);
 }
 
 InputMap::~InputMap()
 {
+    stopPrefetch();
+    deleteCache();
+    pthread_mutex_destroy((pthread_mutex_t*) loadMutex);
+    delete (pthread_mutex_t*) loadMutex;
+    pthread_cond_destroy((pthread_cond_t*) loadCondition);
+    delete (pthread_cond_t*) loadCondition;
+    pthread_mutex_destroy((pthread_mutex_t*) prefetchMutex);
+    delete (pthread_mutex_t*) prefetchMutex;
+    pthread_cond_destroy((pthread_cond_t*) prefetchCondition);
+    delete (pthread_cond_t*) prefetchCondition;
+}
+
+void InputMap::setCacheSize(long long cacheSize)
+{
+    deleteCache();
+    createCache(cacheSize);
+}
+
+void InputMap::createCache(long long cacheSize)
+{
+    // uses at most one shard per 4 tiles, so that each shard keeps a
+    // meaningful LRU order, even with large tiles
+    long long tileBytes = (long long) tileSize * tileSize * channels * sizeof(float);
+    shardCount = (int) max(1LL, min((long long) MAX_CACHE_SHARDS, cacheSize / (4 * tileBytes)));
+    capacity = cacheSize / shardCount;
+    shards = new CacheShard[shardCount];
+    for (int i = 0; i < shardCount; ++i) {
+        shards[i].mutex = new pthread_mutex_t;
+        pthread_mutex_init((pthread_mutex_t*) shards[i].mutex, NULL);
+        shards[i].size = 0;
+    }
+}
+
+void InputMap::deleteCache()
+{
+    for (int i = 0; i < shardCount; ++i) {
+        list<Tile*>::iterator j = shards[i].tileCacheOrder.begin();
+        while (j != shards[i].tileCacheOrder.end()) {
+            delete *j;
+            ++j;
+        }
+        pthread_mutex_destroy((pthread_mutex_t*) shards[i].mutex);
+        delete (pthread_mutex_t*) shards[i].mutex;
+    }
+    delete[] shards;
 }
 
 float* InputMap::getValues(int x, int y)
@@ -103,55 +170,90 @@ float* InputMap::getValues(int x, int y)
     return v;
 }
 
-float* InputMap::getTile(int tx, int ty)
+InputMap::CacheShard *InputMap::getShard(int tx, int ty)
 {
-    pair<int, int> key = make_pair(tx, ty);
-    Cache::iterator i = tileCache.find(key);
-    if (i == tileCache.end()) {
-        float *data = getValues(tx * tileSize, ty * tileSize);
-
-        list<Tile*>::iterator li;
-        if ((int) tileCache.size() == 20) {
-            // evict least recently used tile if cache is full
-            li = tileCacheOrder.begin();
-            Tile *t = *li;
-            tileCache.erase(make_pair(t->tx, t->ty));
-            tileCacheOrder.erase(li);
-            delete t;
-        }
+    unsigned int h = ((unsigned int) tx * 73856093u) ^ ((unsigned int) ty * 19349663u);
+    return shards + h % shardCount;
+}
 
-        // create tile, put it at the end of tileCacheOrder, and update the map
-        Tile *t = new Tile(tx, ty, data);
-        li = tileCacheOrder.insert(tileCacheOrder.end(), t);
-        tileCache[key] = li;
-        assert(tileCache.find(key) != tileCache.end());
-        return data;
-    } else {
+bool InputMap::getCached(int tx, int ty, int off, vec4f &value)
+{
+    CacheShard *s = getShard(tx, ty);
+    pthread_mutex_lock((pthread_mutex_t*) s->mutex);
+    Cache::iterator i = s->tileCache.find(make_pair(tx, ty));
+    bool found = i != s->tileCache.end();
+    if (found) {
         list<Tile*>::iterator li = i->second;
-        list<Tile*>::iterator lj = li;
         Tile *t = *li;
         assert(t->tx == tx && t->ty == ty);
-        // put t at the end of tileCacheOrder, and update the map accordingly
-        lj++;
-        if (lj != tileCacheOrder.end()) {
-            tileCacheOrder.erase(li);
-            li = tileCacheOrder.insert(tileCacheOrder.end(), t);
-            tileCache[key] = li;
-        }
-        return t->data;
+        // put t at the end of tileCacheOrder (splice keeps li valid)
+        s->tileCacheOrder.splice(s->tileCacheOrder.end(), s->tileCacheOrder, li);
+        // the value must be read before the lock is released, since
+        // another thread can then evict the tile
+        value = getPixel(t->data, off);
     }
+    pthread_mutex_unlock((pthread_mutex_t*) s->mutex);
+    return found;
 }
 
-vec4f InputMap::get(int x, int y)
+bool InputMap::isCached(int tx, int ty)
+{
+    CacheShard *s = getShard(tx, ty);
+    pthread_mutex_lock((pthread_mutex_t*) s->mutex);
+    bool found = s->tileCache.find(make_pair(tx, ty)) != s->tileCache.end();
+    pthread_mutex_unlock((pthread_mutex_t*) s->mutex);
+    return found;
+}
+
+void InputMap::putTile(int tx, int ty, float *data)
+{
+    long long tileBytes = (long long) tileSize * tileSize * channels * sizeof(float);
+    CacheShard *s = getShard(tx, ty);
+    pthread_mutex_lock((pthread_mutex_t*) s->mutex);
+    // evict least recently used tiles if the shard is full
+    while (!s->tileCacheOrder.empty() && s->size + tileBytes > capacity) {
+        Tile *t = s->tileCacheOrder.front();
+        s->tileCache.erase(make_pair(t->tx, t->ty));
+        s->tileCacheOrder.pop_front();
+        s->size -= tileBytes;
+        delete t;
+    }
+    // create tile, put it at the end of tileCacheOrder, and update the map
+    Tile *t = new Tile(tx, ty, data);
+    s->tileCache[make_pair(tx, ty)] = s->tileCacheOrder.insert(s->tileCacheOrder.end(), t);
+    s->size += tileBytes;
+    pthread_mutex_unlock((pthread_mutex_t*) s->mutex);
+}
+
+bool InputMap::loadTile(int tx, int ty, int off, vec4f &value)
+{
+    pair<int, int> key = make_pair(tx, ty);
+    pthread_mutex_lock((pthread_mutex_t*) loadMutex);
+    // waits if the tile is being loaded by another thread; the other
+    // tiles can be loaded in parallel
+    while (loadingTiles.find(key) != loadingTiles.end()) {
+        pthread_cond_wait((pthread_cond_t*) loadCondition, (pthread_mutex_t*) loadMutex);
+    }
+    if (isCached(tx, ty)) {
+        pthread_mutex_unlock((pthread_mutex_t*) loadMutex);
+        return false;
+    }
+    loadingTiles.insert(key);
+    pthread_mutex_unlock((pthread_mutex_t*) loadMutex);
+
+    float *data = getValues(tx * tileSize, ty * tileSize);
+    value = getPixel(data, off);
+    putTile(tx, ty, data);
+
+    pthread_mutex_lock((pthread_mutex_t*) loadMutex);
+    loadingTiles.erase(key);
+    pthread_cond_broadcast((pthread_cond_t*) loadCondition);
+    pthread_mutex_unlock((pthread_mutex_t*) loadMutex);
+    return true;
+}
+
+vec4f InputMap::getPixel(float *data, int off)
 {
-    x = max(min(x, width - 1), 0);
-    y = max(min(y, height - 1), 0);
-    int tx = x / tileSize;
-    int ty = y / tileSize;
-    x = x % tileSize;
-    y = y % tileSize;
-    int off = (x + y * tileSize) * channels;
-    float *data = getTile(tx, ty);
     vec4f c;
     c.x = data[off];
     if (channels > 1) {
@@ -166,6 +268,260 @@ vec4f InputMap::get(int x, int y)
     return c;
 }
 
+vec4f InputMap::get(int x, int y)
+{
+    x = max(min(x, width - 1), 0);
+    y = max(min(y, height - 1), 0);
+    if (capacity == 0) {
+        return getValue(x, y);
+    }
+    int tx = x / tileSize;
+    int ty = y / tileSize;
+    x = x % tileSize;
+    y = y % tileSize;
+    int off = (x + y * tileSize) * channels;
+    vec4f c;
+    // if the tile was loaded by another thread, it may have been evicted
+    // before this thread reads it from the cache, hence the loop
+    while (!getCached(tx, ty, off, c)) {
+        if (loadTile(tx, ty, off, c)) {
+            break;
+        }
+    }
+    return c;
+}
+
+void InputMap::prefetch(int x0, int y0, int x1, int y1)
+{
+    if (capacity == 0) {
+        return;
+    }
+    int tx0 = max(x0, 0) / tileSize;
+    int ty0 = max(y0, 0) / tileSize;
+    int tx1 = min(x1, width - 1) / tileSize;
+    int ty1 = min(y1, height - 1) / tileSize;
+    // prefetching more than half the cache would evict the tiles in use
+    long long tileBytes = (long long) tileSize * tileSize * channels * sizeof(float);
+    int maxPending = (int) max(1LL, capacity * shardCount / (2 * tileBytes));
+
+    pthread_mutex_lock((pthread_mutex_t*) prefetchMutex);
+    for (int ty = ty0; ty <= ty1; ++ty) {
+        for (int tx = tx0; tx <= tx1; ++tx) {
+            pair<int, int> key = make_pair(tx, ty);
+            if (prefetchPending.find(key) == prefetchPending.end() && !isCached(tx, ty)) {
+                prefetchQueue.push_back(key);
+                prefetchPending.insert(key);
+            }
+        }
+    }
+    // drops the oldest requests, which are the least likely to be useful
+    while ((int) prefetchQueue.size() > maxPending) {
+        prefetchPending.erase(prefetchQueue.front());
+        prefetchQueue.pop_front();
+    }
+    if (!prefetchQueue.empty()) {
+        if (prefetchThread == NULL) {
+            prefetchStop = false;
+            pthread_t *t = new pthread_t;
+            if (pthread_create(t, NULL, prefetchTiles, this) == 0) {
+                prefetchThread = t;
+            } else {
+                delete t;
+                prefetchQueue.clear();
+                prefetchPending.clear();
+            }
+        }
+        pthread_cond_signal((pthread_cond_t*) prefetchCondition);
+    }
+    pthread_mutex_unlock((pthread_mutex_t*) prefetchMutex);
+}
+
+void InputMap::stopPrefetch()
+{
+    pthread_mutex_lock((pthread_mutex_t*) prefetchMutex);
+    pthread_t *t = (pthread_t*) prefetchThread;
+    prefetchThread = NULL;
+    prefetchStop = true;
+    prefetchQueue.clear();
+    prefetchPending.clear();
+    pthread_cond_broadcast((pthread_cond_t*) prefetchCondition);
+    pthread_mutex_unlock((pthread_mutex_t*) prefetchMutex);
+    if (t != NULL) {
+        pthread_join(*t, NULL);
+        delete t;
+    }
+}
+
+unsigned long long InputMap::getSourceKey()
+{
+    return 0;
+}
+
+void *InputMap::prefetchTiles(void *arg)
+{
+    InputMap *map = (InputMap*) arg;
+    pthread_mutex_lock((pthread_mutex_t*) map->prefetchMutex);
+    while (true) {
+        while (map->prefetchQueue.empty() && !map->prefetchStop) {
+            pthread_cond_wait((pthread_cond_t*) map->prefetchCondition, (pthread_mutex_t*) map->prefetchMutex);
+        }
+        if (map->prefetchStop) {
+            break;
+        }
+        pair<int, int> key = map->prefetchQueue.front();
+        map->prefetchQueue.pop_front();
+        map->prefetchPending.erase(key);
+        pthread_mutex_unlock((pthread_mutex_t*) map->prefetchMutex);
+
+        vec4f unused;
+        map->loadTile(key.first, key.second, 0, unused);
+
+        pthread_mutex_lock((pthread_mutex_t*) map->prefetchMutex);
+    }
+    pthread_mutex_unlock((pthread_mutex_t*) map->prefetchMutex);
+    return NULL;
+}
+
+static const int FORMAT_SIZES[] = { 1, 2, 2, 4 };
+
+MappedInputMap::MappedInputMap(const string &file, int width, int height, int channels, int tileSize,
+        Format format, float scale, long long offset) :
+    InputMap(width, height, channels, tileSize, 0), format(format), scale(scale),
+    data(NULL), dataSize(0), pixels(NULL), fd(-1)
+{
+    pixelSize = channels * FORMAT_SIZES[format];
+    long long size = offset + (long long) width * height * pixelSize;
+    int params[] = { width, height, channels, format };
+    sourceKey = TileDiskCache::getFileKey(file);
+    sourceKey = hashBytes(params, sizeof(params), sourceKey);
+    sourceKey = hashBytes(&scale, sizeof(float), sourceKey);
+    sourceKey = hashBytes(&offset, sizeof(long long), sourceKey);
+#ifndef _WIN32
+    fd = open(file.c_str(), O_RDONLY);
+    struct stat s;
+    if (fd >= 0 && fstat(fd, &s) == 0 && s.st_size >= size) {
+        void *p = mmap(NULL, size_t(size), PROT_READ, MAP_SHARED, fd, 0);
+        if (p != MAP_FAILED) {
+            data = (unsigned char*) p;
+            dataSize = size;
+        }
+    }
+    if (data == NULL && fd >= 0) {
+        close(fd);
+        fd = -1;
+    }
+#else
+    FILE *f;
+    fopen(&f, file.c_str(), "rb");
+    if (f != NULL) {
+        data = new unsigned char[size_t(size)];
+        if (fread(data, size_t(size), 1, f) == 1) {
+            dataSize = size;
+        } else {
+            delete[] data;
+            data = NULL;
+        }
+        fclose(f);
+    }
+#endif
+    if (data == NULL) {
+        fprintf(stderr, "Cannot map raw file %s\n", file.c_str());
+        throw exception();
+    }
+    pixels = data + offset;
+}
+
+MappedInputMap::~MappedInputMap()
+{
+#ifndef _WIN32
+    munmap(data, size_t(dataSize));
+    close(fd);
+#else
+    delete[] data;
+#endif
+}
+
+static inline float readComponent(MappedInputMap::Format format, const unsigned char *p)
+{
+    // memcpy, because the file offset may not be aligned
+    switch (format) {
+    case MappedInputMap::UNSIGNED_BYTE:
+        return *p;
+    case MappedInputMap::SHORT: {
+        short v;
+        memcpy(&v, p, sizeof(short));
+        return v;
+    }
+    case MappedInputMap::UNSIGNED_SHORT: {
+        unsigned short v;
+        memcpy(&v, p, sizeof(unsigned short));
+        return v;
+    }
+    default: {
+        float v;
+        memcpy(&v, p, sizeof(float));
+        return v;
+    }
+    }
+}
+
+vec4f MappedInputMap::getValue(int x, int y)
+{
+    const unsigned char *p = pixels + ((long long) y * width + x) * pixelSize;
+    int componentSize = FORMAT_SIZES[format];
+    float v[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+    for (int c = 0; c < channels; ++c) {
+        v[c] = readComponent(format, p + c * componentSize) * scale;
+    }
+    return vec4f(v[0], v[1], v[2], v[3]);
+}
+
+float* MappedInputMap::getValues(int x, int y)
+{
+    int componentSize = FORMAT_SIZES[format];
+    float *v = new float[tileSize * tileSize * channels];
+    float *dst = v;
+    for (int j = 0; j < tileSize; ++j) {
+        const unsigned char *p = pixels + ((long long) (y + j) * width + x) * pixelSize;
+        for (int i = 0; i < tileSize * channels; ++i) {
+            *(dst++) = readComponent(format, p) * scale;
+            p += componentSize;
+        }
+    }
+    return v;
+}
+
+void MappedInputMap::prefetch(int x0, int y0, int x1, int y1)
+{
+#ifndef _WIN32
+    x0 = max(x0, 0);
+    y0 = max(y0, 0);
+    x1 = min(x1, width - 1);
+    y1 = min(y1, height - 1);
+    if (x0 > x1 || y0 > y1) {
+        return;
+    }
+    long long page = sysconf(_SC_PAGESIZE);
+    long long base = pixels - data;
+    long long rowSize = (long long) width * pixelSize;
+    long long spanSize = (long long) (x1 - x0 + 1) * pixelSize;
+    // advises each row separately if the region is narrow, to avoid
+    // reading the whole rows
+    int n = 2 * spanSize < rowSize ? y1 - y0 + 1 : 1;
+    long long size = n == 1 ? (y1 - y0) * rowSize + spanSize : spanSize;
+    for (int j = 0; j < n; ++j) {
+        long long start = base + (y0 + j) * rowSize + (long long) x0 * pixelSize;
+        long long alignedStart = (start / page) * page;
+        madvise(data + alignedStart, size_t(start + size - alignedStart), MADV_WILLNEED);
+    }
+#endif
+}
+
+unsigned long long MappedInputMap::getSourceKey()
+{
+    return sourceKey;
+}
+
 typedef void (*projectionFunction)(int x, int y, int w, double &sx, double &sy, double &sz);
 
 void projection1(int x, int y, int w, double &sx, double &sy, double &sz) // north pole
@@ -348,6 +704,31 @@ void projection6h(int x, int y, int w, double &sx, double &sy, double &sz) // so
     sz = -1.0 / l;
 }
 
+// hints the source tiles used by the given region of a cube face. They are
+// found by sampling the region, since its longitudes can wrap around.
+void prefetchSpherical(InputMap *src, projectionFunction projection, int dstSize, int x0, int y0, int x1, int y1)
+{
+    const int N = 8;
+    set< pair<int, int> > tiles;
+    for (int j = 0; j <= N; ++j) {
+        for (int i = 0; i <= N; ++i) {
+            double sx, sy, sz;
+            projection(x0 + (x1 - x0) * i / N, y0 + (y1 - y0) * j / N, dstSize, sx, sy, sz);
+            double lon = (atan2(sy, sx) + M_PI) / M_PI * (src->width / 2);
+            double lat = acos(sz) / M_PI * src->height;
+            int ilon = ((int) floor(lon) + src->width) % src->width;
+            int ilat = max(min((int) floor(lat), src->height - 1), 0);
+            tiles.insert(make_pair(ilon / src->tileSize, ilat / src->tileSize));
+        }
+    }
+    int ts = src->tileSize;
+    set< pair<int, int> >::iterator t = tiles.begin();
+    while (t != tiles.end()) {
+        src->prefetch(t->first * ts, t->second * ts, (t->first + 1) * ts - 1, (t->second + 1) * ts - 1);
+        ++t;
+    }
+}
+
 class PlaneHeightFunction : public HeightMipmap::HeightFunction
 {
 public:
@@ -360,11 +741,23 @@ public:
     {
     }
 
+    virtual unsigned long long getSourceKey()
+    {
+        unsigned long long key = src->getSourceKey();
+        return key == 0 ? 0 : hashBytes(&dstSize, sizeof(int), key);
+    }
+
     virtual float getHeight(int x, int y)
     {
         return getHeight(double(x) / dstSize * src->width, double(y) / dstSize * src->height);
     }
 
+    virtual void prefetch(int x0, int y0, int x1, int y1)
+    {
+        src->prefetch(int(floor(double(x0) / dstSize * src->width)), int(floor(double(y0) / dstSize * src->height)),
+            int(floor(double(x1) / dstSize * src->width)) + 1, int(floor(double(y1) / dstSize * src->height)) + 1);
+    }
+
 	float getHeight(double x, double y)
 	{
 		int ix = (int) floor(x);
@@ -398,6 +791,12 @@ public:
         return getColor(double(x) / dstSize * src->width, double(y) / dstSize * src->height);
     }
 
+    virtual void prefetch(int x0, int y0, int x1, int y1)
+    {
+        src->prefetch(int(floor(double(x0) / dstSize * src->width)), int(floor(double(y0) / dstSize * src->height)),
+            int(floor(double(x1) / dstSize * src->width)) + 1, int(floor(double(y1) / dstSize * src->height)) + 1);
+    }
+
 	vec4f getColor(double x, double y)
 	{
 		int ix = (int) floor(x);
@@ -433,6 +832,14 @@ public:
     {
     }
 
+    virtual unsigned long long getSourceKey()
+    {
+        // the projection is not part of the key, since each cube face has
+        // its own temporary folder, and thus its own manifest
+        unsigned long long key = src->getSourceKey();
+        return key == 0 ? 0 : hashBytes(&dstSize, sizeof(int), key);
+    }
+
     virtual float getHeight(int x, int y)
     {
         double sx, sy, sz;
@@ -442,6 +849,11 @@ public:
         return getHeight(lon, lat);
     }
 
+    virtual void prefetch(int x0, int y0, int x1, int y1)
+    {
+        prefetchSpherical(src, projection, dstSize, x0, y0, x1, y1);
+    }
+
 	float getHeight(double lon, double lat)
 	{
 		lon = lon / M_PI * (src->width / 2);
@@ -483,6 +895,11 @@ public:
         return getColor(lon, lat);
     }
 
+    virtual void prefetch(int x0, int y0, int x1, int y1)
+    {
+        prefetchSpherical(src, projection, dstSize, x0, y0, x1, y1);
+    }
+
 	vec4f getColor(double lon, double lat)
 	{
 		lon = lon / M_PI * (src->width / 2);
@@ -530,12 +947,11 @@ void createDir(const string &dir)
 }
 
 void preprocessDem(InputMap *src, int dstMinTileSize, int dstTileSize, int dstMaxLevel,
-        const string &dstFolder, const string &tmpFolder, float residualScale)
+        const string &dstFolder, const string &tmpFolder, float residualScale, TileCodec::Codec codec)
 {
     assert(dstTileSize % dstMinTileSize == 0);
-    if (fexists(dstFolder + "/DEM.dat")) {
-        return;
-    }
+    // the existing intermediate and output files are reused if they are
+    // up to date (see HeightMipmap)
     createDir(tmpFolder);
     createDir(dstFolder);
     int dstSize = dstTileSize << dstMaxLevel;
@@ -547,18 +963,16 @@ void preprocessDem(InputMap *src, int dstMinTileSize, int dstTileSize, int dstMa
             break;
         }
     }
-    hm->generate(0, 0, 0, residualScale, dstFolder + "/DEM.dat");
+    src->stopPrefetch();
+    hm->generate(0, 0, 0, residualScale, dstFolder + "/DEM.dat", codec);
 }
 
 void preprocessSphericalDem(InputMap *src, int dstMinTileSize, int dstTileSize, int dstMaxLevel,
-        const string &dstFolder, const string &tmpFolder, float residualScale)
+        const string &dstFolder, const string &tmpFolder, float residualScale, TileCodec::Codec codec)
 {
     assert(dstTileSize % dstMinTileSize == 0);
-    if (fexists(dstFolder + "/DEM1.dat") && fexists(dstFolder + "/DEM2.dat") && fexists(dstFolder + "/DEM3.dat") &&
-        fexists(dstFolder + "/DEM4.dat") && fexists(dstFolder + "/DEM5.dat") && fexists(dstFolder + "/DEM6.dat"))
-    {
-        return;
-    }
+    // the existing intermediate and output files are reused if they are
+    // up to date (see HeightMipmap)
     createDir(tmpFolder + "1");
     createDir(tmpFolder + "2");
     createDir(tmpFolder + "3");
@@ -596,12 +1010,13 @@ void preprocessSphericalDem(InputMap *src, int dstMinTileSize, int dstTileSize,
             break;
         }
     }
-    hm1->generate(0, 0, 0, residualScale, dstFolder + "/DEM1.dat");
-    hm2->generate(0, 0, 0, residualScale, dstFolder + "/DEM2.dat");
-    hm3->generate(0, 0, 0, residualScale, dstFolder + "/DEM3.dat");
-    hm4->generate(0, 0, 0, residualScale, dstFolder + "/DEM4.dat");
-    hm5->generate(0, 0, 0, residualScale, dstFolder + "/DEM5.dat");
-    hm6->generate(0, 0, 0, residualScale, dstFolder + "/DEM6.dat");
+    src->stopPrefetch();
+    hm1->generate(0, 0, 0, residualScale, dstFolder + "/DEM1.dat", codec);
+    hm2->generate(0, 0, 0, residualScale, dstFolder + "/DEM2.dat", codec);
+    hm3->generate(0, 0, 0, residualScale, dstFolder + "/DEM3.dat", codec);
+    hm4->generate(0, 0, 0, residualScale, dstFolder + "/DEM4.dat", codec);
+    hm5->generate(0, 0, 0, residualScale, dstFolder + "/DEM5.dat", codec);
+    hm6->generate(0, 0, 0, residualScale, dstFolder + "/DEM6.dat", codec);
 }
 
 void preprocessSphericalAperture(const string &srcFolder, int minLevel, int maxLevel, int samples,
@@ -660,7 +1075,8 @@ void preprocessSphericalAperture(const string &srcFolder, int minLevel, int maxL
 }
 
 void preprocessOrtho(InputMap *src, int dstTileSize, int dstChannels, int dstMaxLevel,
-        const string &dstFolder, const string &tmpFolder, float (*rgbToLinear)(float), float (*linearToRgb)(float))
+        const string &dstFolder, const string &tmpFolder, float (*rgbToLinear)(float), float (*linearToRgb)(float),
+        TileCodec::Codec codec)
 {
     if (fexists(dstFolder + "/RGB.dat") && fexists(dstFolder + "/dxt/RGB.dat") && fexists(dstFolder + "/residuals/RGB.dat")) {
         return;
@@ -674,14 +1090,16 @@ void preprocessOrtho(InputMap *src, int dstTileSize, int dstChannels, int dstMax
     ColorMipmap *cm = new ColorMipmap(cf, dstSize, dstTileSize, 2, dstChannels,
         rgbToLinear == NULL ? id : rgbToLinear, linearToRgb == NULL ? id : linearToRgb, tmpFolder);
     cm->compute();
-    cm->generate(0, 0, 0, false, true, RGB_JPEG_QUALITY, dstFolder + "/RGB.dat");
+    src->stopPrefetch();
+    cm->generate(0, 0, 0, false, true, RGB_JPEG_QUALITY, dstFolder + "/RGB.dat", codec);
     cm->generate(0, 0, 0, true, true, RGB_JPEG_QUALITY, dstFolder + "/dxt/RGB.dat");
     cm->generateResiduals(true, RGB_JPEG_QUALITY, dstFolder + "/RGB.dat", tmpFolder + "/residuals/RGB.dat");
     cm->reorderResiduals(tmpFolder + "/RGB.dat", dstFolder + "/residuals/RGB.dat");
 }
 
 void preprocessSphericalOrtho(InputMap *src, int dstTileSize, int dstChannels, int dstMaxLevel,
-        const string &dstFolder, const string &tmpFolder, float (*rgbToLinear)(float), float (*linearToRgb)(float))
+        const string &dstFolder, const string &tmpFolder, float (*rgbToLinear)(float), float (*linearToRgb)(float),
+        TileCodec::Codec codec)
 {
     if (fexists(dstFolder + "/RGB1.dat") && fexists(dstFolder + "/dxt/RGB1.dat") && fexists(dstFolder + "/residuals/RGB1.dat") &&
         fexists(dstFolder + "/RGB2.dat") && fexists(dstFolder + "/dxt/RGB2.dat") && fexists(dstFolder + "/residuals/RGB2.dat") &&
@@ -727,12 +1145,13 @@ void preprocessSphericalOrtho(InputMap *src, int dstTileSize, int dstChannels, i
     cm4->compute();
     cm5->compute();
     cm6->compute();
-    cm1->generate(0, 0, 0, false, true, RGB_JPEG_QUALITY, dstFolder + "/RGB1.dat");
-    cm2->generate(0, 0, 0, false, true, RGB_JPEG_QUALITY, dstFolder + "/RGB2.dat");
-    cm3->generate(0, 0, 0, false, true, RGB_JPEG_QUALITY, dstFolder + "/RGB3.dat");
-    cm4->generate(0, 0, 0, false, true, RGB_JPEG_QUALITY, dstFolder + "/RGB4.dat");
-    cm5->generate(0, 0, 0, false, true, RGB_JPEG_QUALITY, dstFolder + "/RGB5.dat");
-    cm6->generate(0, 0, 0, false, true, RGB_JPEG_QUALITY, dstFolder + "/RGB6.dat");
+    src->stopPrefetch();
+    cm1->generate(0, 0, 0, false, true, RGB_JPEG_QUALITY, dstFolder + "/RGB1.dat", codec);
+    cm2->generate(0, 0, 0, false, true, RGB_JPEG_QUALITY, dstFolder + "/RGB2.dat", codec);
+    cm3->generate(0, 0, 0, false, true, RGB_JPEG_QUALITY, dstFolder + "/RGB3.dat", codec);
+    cm4->generate(0, 0, 0, false, true, RGB_JPEG_QUALITY, dstFolder + "/RGB4.dat", codec);
+    cm5->generate(0, 0, 0, false, true, RGB_JPEG_QUALITY, dstFolder + "/RGB5.dat", codec);
+    cm6->generate(0, 0, 0, false, true, RGB_JPEG_QUALITY, dstFolder + "/RGB6.dat", codec);
     cm1->generate(0, 0, 0, true, true, RGB_JPEG_QUALITY, dstFolder + "/dxt/RGB1.dat");
     cm2->generate(0, 0, 0, true, true, RGB_JPEG_QUALITY, dstFolder + "/dxt/RGB2.dat");
     cm3->generate(0, 0, 0, true, true, RGB_JPEG_QUALITY, dstFolder + "/dxt/RGB3.dat");
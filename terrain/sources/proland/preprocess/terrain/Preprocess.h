@@ -45,8 +45,10 @@
 #include <string>
 #include <map>
 #include <list>
+#include <set>
 
 #include "ork/math/vec4.h"
+#include "proland/producer/TileCodec.h"
 
 using namespace std;
 using namespace ork;
@@ -64,7 +66,9 @@ namespace proland
  * An abstract raster data map. A map is a 2D array of pixels, whose
  * values can come from anywhere (this depends on how you implement
  * the #getValue method). A map can be read pixel by pixel, or tile
- * by tile. The tiles are cached for better efficiency.
+ * by tile. The tiles are cached for better efficiency, in a cache
+ * limited by its size in bytes. This cache can be used from several
+ * threads at the same time.
  *
  * @ingroup preprocess
  * @author Eric Bruneton
@@ -101,14 +105,27 @@ public:
      * @param channels the number of components per pixel of this map.
      * @param tileSize the tile size to use when reading this map by tile.
      *      The width and height must be multiples of this size.
-     * @param cache how much tiles can be cached at the same time.
+     * @param cache how much tiles can be cached at the same time. If this
+     *      number is 0, #get calls #getValue directly, which must then be
+     *      thread safe. See also #setCacheSize.
      */
     InputMap(int width, int height, int channels, int tileSize, int cache = 20);
 
     /**
      * Deletes this input map.
      */
-    ~InputMap();
+    virtual ~InputMap();
+
+    /**
+     * Sets the maximum size in bytes of the cached tiles. This replaces the
+     * tile count given in the constructor, and must be called before any
+     * pixel is read.
+     *
+     * @param cacheSize the maximum size in bytes of the cached tiles. If
+     *      this size is 0, #get calls #getValue directly, which must then be
+     *      thread safe.
+     */
+    void setCacheSize(long long cacheSize);
 
     /**
      * Returns the value of the given pixel. You can implement this
@@ -138,7 +155,10 @@ public:
      * Returns the value of the given pixel. This method uses a cache
      * for better efficiency: it reads the tile containing the given pixel,
      * if it is not already in cache, puts it in cache, and returns the
-     * requested pixel from this tile.
+     * requested pixel from this tile. This method can be called from
+     * several threads. #getValues can then be called from several threads
+     * at the same time, but never twice at the same time for the same
+     * tile.
      *
      * @param x the x coordinate of the pixel to be read.
      * @param y the y coordinate of the pixel to be read.
@@ -146,6 +166,36 @@ public:
      */
     vec4f get(int x, int y);
 
+    /**
+     * Hints that the given region will soon be read with #get. The default
+     * implementation loads the missing tiles of this region into the cache
+     * with a background thread, up to half the cache size. Does nothing if
+     * the cache is disabled.
+     *
+     * @param x0 the minimum x coordinate of the region (inclusive).
+     * @param y0 the minimum y coordinate of the region (inclusive).
+     * @param x1 the maximum x coordinate of the region (inclusive).
+     * @param y1 the maximum y coordinate of the region (inclusive).
+     */
+    virtual void prefetch(int x0, int y0, int x1, int y1);
+
+    /**
+     * Cancels the pending prefetch requests and waits for the background
+     * prefetch thread to stop. This method must be called before the
+     * destructor of a subclass, if #prefetch has been used directly (the
+     * preprocess functions below call it before they return).
+     */
+    void stopPrefetch();
+
+    /**
+     * Returns a key identifying the content of this map, or 0 if it is
+     * unknown. If it is not 0, this key must change when the content of
+     * this map changes. It is used to skip the base level tiles of a mipmap
+     * whose source did not change (see HeightMipmap). The default
+     * implementation returns 0.
+     */
+    virtual unsigned long long getSourceKey();
+
 private:
     struct Tile
     {
@@ -160,18 +210,196 @@ private:
 
 	typedef map<pair<int, int>, list<Tile*>::iterator> Cache;
 
-    int capacity;
+    /**
+     * A part of the tile cache, with its own lock and LRU order. Tiles are
+     * distributed into several shards so that threads reading different
+     * tiles do not wait for each other.
+     */
+    struct CacheShard
+    {
+        void *mutex;
 
-	Cache tileCache;
+        Cache tileCache;
+
+        list<Tile*> tileCacheOrder;
+
+        long long size;
+    };
 
-	list<Tile*> tileCacheOrder;
+    /**
+     * The maximum size in bytes of the tiles in each shard.
+     */
+    long long capacity;
+
+    int shardCount;
+
+    CacheShard *shards;
+
+    /**
+     * The tiles currently loaded with #getValues, by any thread.
+     */
+    set< pair<int, int> > loadingTiles;
+
+    /**
+     * A mutex to serialize accesses to #loadingTiles.
+     */
+    void *loadMutex;
+
+    /**
+     * A condition signaled when a tile is removed from #loadingTiles.
+     */
+    void *loadCondition;
+
+    /**
+     * The tiles to be loaded by the prefetch thread, in request order.
+     */
+    list< pair<int, int> > prefetchQueue;
+
+    set< pair<int, int> > prefetchPending;
+
+    void *prefetchMutex;
+
+    void *prefetchCondition;
+
+    void *prefetchThread;
+
+    bool prefetchStop;
+
+    void createCache(long long cacheSize);
+
+    void deleteCache();
+
+    CacheShard *getShard(int tx, int ty);
+
+    bool getCached(int tx, int ty, int off, vec4f &value);
+
+    bool isCached(int tx, int ty);
+
+    void putTile(int tx, int ty, float *data);
+
+    /**
+     * Loads the given tile with #getValues and puts it in cache, unless it
+     * is already in cache. If another thread is loading this tile, waits
+     * until it is loaded.
+     *
+     * @param off the offset of a pixel in the tile.
+     * @param[out] value the value of this pixel, if the tile was loaded by
+     *      this thread.
+     * @return true if the tile was loaded by this thread. Otherwise it must
+     *      be read from the cache, where it may have been evicted already.
+     */
+    bool loadTile(int tx, int ty, int off, vec4f &value);
 
-	float* getTile(int tx, int ty);
+    vec4f getPixel(float *data, int off);
+
+    static void *prefetchTiles(void *arg);
+};
+
+/**
+ * An InputMap whose pixels are read directly from a raw raster file,
+ * mapped in memory. The pixels are stored row by row, starting with the
+ * y=0 row, with all the components of a pixel stored contiguously, in the
+ * native byte order. This map does not use the tile cache of InputMap:
+ * the operating system pages the file in and out as needed, and #prefetch
+ * asks it to read the given region ahead of use.
+ *
+ * @ingroup preprocess
+ * @author Eric Bruneton
+ */
+PROLAND_API class MappedInputMap : public InputMap
+{
+public:
+    /**
+     * The possible formats of the pixel components.
+     */
+    enum Format {
+        UNSIGNED_BYTE, ///< 8 bits unsigned integers
+        SHORT, ///< 16 bits signed integers
+        UNSIGNED_SHORT, ///< 16 bits unsigned integers
+        FLOAT ///< 32 bits floats
+    };
+
+    /**
+     * Creates a new map from a raw raster file.
+     *
+     * @param file the raw raster file.
+     * @param width the width of this map.
+     * @param height the height of this map.
+     * @param channels the number of components per pixel of this map.
+     * @param tileSize the tile size to use when reading this map by tile.
+     * @param format the format of the pixel components in the file.
+     * @param scale the scale factor to apply to the pixel components.
+     * @param offset the offset of the first pixel in the file, in bytes.
+     */
+    MappedInputMap(const string &file, int width, int height, int channels, int tileSize,
+        Format format, float scale = 1.0f, long long offset = 0);
+
+    /**
+     * Deletes this input map.
+     */
+    virtual ~MappedInputMap();
+
+    virtual vec4f getValue(int x, int y);
+
+    virtual float* getValues(int tx, int ty);
+
+    virtual void prefetch(int x0, int y0, int x1, int y1);
+
+    virtual unsigned long long getSourceKey();
+
+private:
+    Format format;
+
+    float scale;
+
+    int pixelSize;
+
+    /**
+     * The mapped file content, or the file content read in memory if
+     * mmap is not available.
+     */
+    unsigned char *data;
+
+    long long dataSize;
+
+    /**
+     * The first pixel in #data.
+     */
+    unsigned char *pixels;
+
+    int fd;
+
+    /**
+     * A key computed from the file name, size and modification time, and
+     * from the parameters of this map.
+     */
+    unsigned long long sourceKey;
 };
 
+/**
+ * Sets the number of threads used by the preprocess functions below. The
+ * intermediate files of each mipmap level are computed in parallel, and the
+ * tiles of the generated elevation files are compressed in parallel. The
+ * generated files do not depend on the number of threads.
+ * @ingroup preprocess
+ *
+ * @param threads the number of threads to use, or 0 to use one thread per
+ *     processor core (the default). 1 gives the serial behavior.
+ * @param memoryBudget the maximum size, in MB, of the compressed tiles kept
+ *     in memory before they are written in order to a generated file.
+ */
+PROLAND_API void setPreprocessThreads(int threads, int memoryBudget = 256);
+
 /**
  * Preprocess an elevation map into a file that can be used with a
- * proland::ResidualProducer.
+ * proland::ResidualProducer. The intermediate files saved in tmpFolder are
+ * recorded, with a hash of their inputs, in a manifest.txt file, as well as
+ * the generated file. A new call only recomputes the intermediate files
+ * whose inputs changed (e.g. after a modification of some parts of the
+ * source map), and the generated file if one of them changed. An
+ * interrupted call resumes from the last completed intermediate file. The
+ * base level of the source map is sampled again at each call, unless its
+ * InputMap#getSourceKey is not 0 and did not change.
  * @ingroup preprocess
  * @author Eric Bruneton
  *
@@ -193,13 +421,16 @@ private:
  *     A small value gives better precision, but can lead to overflows. If you get
  *     overflows during the precomputations (i.e. if the maximum residual, indicated
  *     in the standard ouput is larger than 65535), retry with a larger value.
+ * @param codec the codec to use to compress the tiles of the generated file.
+ *     TileCodec::TIFF produces files that can be read by all Proland versions.
  */
 PROLAND_API void preprocessDem(InputMap *src, int dstMinTileSize, int dstTileSize, int dstMaxLevel,
-        const string &dstFolder, const string &tmpFolder, float residualScale);
+        const string &dstFolder, const string &tmpFolder, float residualScale, TileCodec::Codec codec = TileCodec::TIFF);
 
 /**
  * Preprocess a spherical elevation map into six files that can be used with six
- * proland::ResidualProducer to form a planet.
+ * proland::ResidualProducer to form a planet. Like #preprocessDem, this
+ * function only recomputes the intermediate files whose inputs changed.
  * @ingroup preprocess
  * @author Eric Bruneton
  *
@@ -225,9 +456,11 @@ PROLAND_API void preprocessDem(InputMap *src, int dstMinTileSize, int dstTileSiz
  *     A small value gives better precision, but can lead to overflows. If you get
  *     overflows during the precomputations (i.e. if the maximum residual, indicated
  *     in the standard ouput is larger than 65535), retry with a larger value.
+ * @param codec the codec to use to compress the tiles of the generated file.
+ *     TileCodec::TIFF produces files that can be read by all Proland versions.
  */
 PROLAND_API void preprocessSphericalDem(InputMap *src, int dstMinTileSize, int dstTileSize, int dstMaxLevel,
-        const string &dstFolder, const string &tmpFolder, float residualScale);
+        const string &dstFolder, const string &tmpFolder, float residualScale, TileCodec::Codec codec = TileCodec::TIFF);
 
 /**
  * Preprocess a spherical elevation map into six files that can be used with six
@@ -281,9 +514,13 @@ PROLAND_API void preprocessSphericalAperture(const string &srcFolder, int minLev
  *     function. A NULL value indicates the identity function.
  * @param linearToRgb an optional transformation, which must be the inverse of
  *     'rgbToLinear'. A NULL value indicates the identity function.
+ * @param codec the codec to use to compress the tiles of the generated non
+ *     DXT file. TileCodec::TIFF produces files that can be read by all Proland
+ *     versions, and is the only one that uses JPEG compression.
  */
 PROLAND_API void preprocessOrtho(InputMap *src, int dstTileSize, int dstChannels, int dstMaxLevel,
-        const string &dstFolder, const string &tmpFolder, float (*rgbToLinear)(float) = NULL, float (*linearToRgb)(float) = NULL);
+        const string &dstFolder, const string &tmpFolder, float (*rgbToLinear)(float) = NULL, float (*linearToRgb)(float) = NULL,
+        TileCodec::Codec codec = TileCodec::TIFF);
 
 /**
  * Preprocess a spherical map into files that can be used with a
@@ -306,9 +543,13 @@ PROLAND_API void preprocessOrtho(InputMap *src, int dstTileSize, int dstChannels
  *     function. A NULL value indicates the identity function.
  * @param linearToRgb an optional transformation, which must be the inverse of
  *     'rgbToLinear'. A NULL value indicates the identity function.
+ * @param codec the codec to use to compress the tiles of the generated non
+ *     DXT file. TileCodec::TIFF produces files that can be read by all Proland
+ *     versions, and is the only one that uses JPEG compression.
  */
 PROLAND_API void preprocessSphericalOrtho(InputMap *src, int dstTileSize, int dstChannels, int dstMaxLevel,
-        const string &dstFolder, const string &tmpFolder, float (*rgbToLinear)(float) = NULL, float (*linearToRgb)(float) = NULL);
+        const string &dstFolder, const string &tmpFolder, float (*rgbToLinear)(float) = NULL, float (*linearToRgb)(float) = NULL,
+        TileCodec::Codec codec = TileCodec::TIFF);
 
 }
 
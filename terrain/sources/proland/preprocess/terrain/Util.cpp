@@ -41,11 +41,13 @@
 
 #include "proland/preprocess/terrain/Util.h"
 
+#include <algorithm>
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
 #include <assert.h>
 #include <fcntl.h>
+#include <pthread.h>
 
 // Lars F: addition, since they use close() below
 #include <unistd.h>
@@ -103,6 +105,116 @@ bool flog(const string &name)
     }
 }
 
+static int preprocessThreads = 0;
+
+static long long preprocessMemoryBudget = 256;
+
+void setPreprocessThreads(int threads, int memoryBudget)
+{
+    preprocessThreads = max(0, min(threads, MAX_PREPROCESS_THREADS));
+    preprocessMemoryBudget = max(memoryBudget, 1);
+}
+
+int getPreprocessThreads()
+{
+    if (preprocessThreads == 0) {
+        long n = sysconf(_SC_NPROCESSORS_ONLN);
+        preprocessThreads = n > 0 ? min(int(n), MAX_PREPROCESS_THREADS) : 1;
+    }
+    return preprocessThreads;
+}
+
+long long getPreprocessMemoryBudget()
+{
+    return preprocessMemoryBudget * 1024 * 1024;
+}
+
+static pthread_key_t threadIndexKey;
+
+static pthread_once_t threadIndexOnce = PTHREAD_ONCE_INIT;
+
+static void createThreadIndexKey()
+{
+    pthread_key_create(&threadIndexKey, NULL);
+}
+
+int getPreprocessThreadIndex()
+{
+    pthread_once(&threadIndexOnce, createThreadIndexKey);
+    return int((size_t) pthread_getspecific(threadIndexKey));
+}
+
+struct ParallelFor
+{
+    void (*f)(int i, void *data);
+
+    void *data;
+
+    int n;
+
+    int next;
+
+    pthread_mutex_t mutex;
+};
+
+struct ParallelForThread
+{
+    ParallelFor *p;
+
+    int index;
+};
+
+static void *parallelForThread(void *arg)
+{
+    ParallelForThread *t = (ParallelForThread*) arg;
+    ParallelFor *p = t->p;
+    pthread_setspecific(threadIndexKey, (void*) (size_t) t->index);
+    while (true) {
+        pthread_mutex_lock(&p->mutex);
+        int i = p->next++;
+        pthread_mutex_unlock(&p->mutex);
+        if (i >= p->n) {
+            break;
+        }
+        p->f(i, p->data);
+    }
+    return NULL;
+}
+
+void parallelFor(int n, void (*f)(int i, void *data), void *data)
+{
+    pthread_once(&threadIndexOnce, createThreadIndexKey);
+    int threads = min(getPreprocessThreads(), n);
+    if (threads <= 1) {
+        for (int i = 0; i < n; ++i) {
+            f(i, data);
+        }
+        return;
+    }
+    // the calling thread is the worker 0, the other workers are created
+    // here and take the next index in the work queue when they are idle
+    ParallelFor p;
+    p.f = f;
+    p.data = data;
+    p.n = n;
+    p.next = 0;
+    pthread_mutex_init(&p.mutex, NULL);
+    ParallelForThread t[MAX_PREPROCESS_THREADS];
+    pthread_t ids[MAX_PREPROCESS_THREADS];
+    for (int i = 0; i < threads; ++i) {
+        t[i].p = &p;
+        t[i].index = i;
+    }
+    for (int i = 1; i < threads; ++i) {
+        pthread_create(&ids[i], NULL, parallelForThread, &t[i]);
+    }
+    parallelForThread(&t[0]);
+    for (int i = 1; i < threads; ++i) {
+        pthread_join(ids[i], NULL);
+    }
+    pthread_mutex_destroy(&p.mutex);
+}
+
 byte *globalOutData;
 
 word ColorTo565( const byte *color ) {
@@ -59,6 +59,16 @@ bool fexists(const string &name);
 
 bool flog(const string &name);
 
+#define MAX_PREPROCESS_THREADS 64
+
+int getPreprocessThreads();
+
+long long getPreprocessMemoryBudget();
+
+int getPreprocessThreadIndex();
+
+void parallelFor(int n, void (*f)(int i, void *data), void *data);
+
 void CompressImageDXT1( const byte *inBuf, byte *outBuf, int width, int height, int &outputBytes );
 
 void CompressImageDXT5( const byte *inBuf, byte *outBuf, int width, int height, int &outputBytes );